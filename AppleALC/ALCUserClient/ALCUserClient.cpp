@@ -19,6 +19,62 @@ const IOExternalMethodDispatch ALCUserClient::sMethods[kNumberOfMethods] = {
 		0,																				// Num of struct input values
 		1,																				// Num of scalar output values
 		0																				// Num of struct output values
+	},
+	{ //kMethodExecuteVerbEx
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodExecuteVerbEx),	// Method pointer
+		4,																				// Num of scalar input values
+		0,																				// Num of struct input values
+		3,																				// Num of scalar output values
+		0																				// Num of struct output values
+	},
+	{ //kMethodExecuteVerbAsync
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodExecuteVerbAsync),	// Method pointer
+		4,																				// Num of scalar input values
+		0,																				// Num of struct input values
+		0,																				// Num of scalar output values
+		0																				// Num of struct output values
+	},
+	{ //kMethodExecuteVerbs
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodExecuteVerbs),	// Method pointer
+		0,																				// Num of scalar input values
+		kIOUCVariableStructureSize,														// Size of struct input
+		1,																				// Num of scalar output values
+		kIOUCVariableStructureSize														// Size of struct output
+	},
+	{ //kMethodWatchEvents
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodWatchEvents),	// Method pointer
+		0,																				// Num of scalar input values
+		0,																				// Num of struct input values
+		0,																				// Num of scalar output values
+		0																				// Num of struct output values
+	},
+	{ //kMethodReadTrace
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodReadTrace),	// Method pointer
+		1,																				// Num of scalar input values
+		0,																				// Num of struct input values
+		0,																				// Num of scalar output values
+		kIOUCVariableStructureSize														// Size of struct output
+	},
+	{ //kMethodReadPatchReport
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodReadPatchReport),	// Method pointer
+		0,																				// Num of scalar input values
+		0,																				// Num of struct input values
+		1,																				// Num of scalar output values
+		kIOUCVariableStructureSize														// Size of struct output
+	},
+	{ //kMethodUploadResource
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodUploadResource),	// Method pointer
+		4,																				// Num of scalar input values
+		kIOUCVariableStructureSize,														// Size of struct input
+		0,																				// Num of scalar output values
+		0																				// Num of struct output values
+	},
+	{ //kMethodReadLog
+		reinterpret_cast<IOExternalMethodAction>(&ALCUserClient::methodReadLog),		// Method pointer
+		1,																				// Num of scalar input values
+		0,																				// Num of struct input values
+		0,																				// Num of scalar output values
+		kIOUCVariableStructureSize														// Size of struct output
 	}
 };
 
@@ -29,7 +85,7 @@ IOReturn ALCUserClient::externalMethod(uint32_t selector, IOExternalMethodArgume
 	dispatch = const_cast<IOExternalMethodDispatch*>(&sMethods[selector]);
 	
 	target = mProvider;
-	reference = NULL;
+	reference = this;
 	
 	return super::externalMethod(selector, arguments, dispatch, target, reference);
 }
@@ -43,6 +99,7 @@ bool ALCUserClient::initWithTask(task_t owningTask, void* securityToken, UInt32
 	
 	mTask = owningTask;
 	mProvider = NULL;
+	mAdministrator = clientHasPrivilege(securityToken, kIOClientPrivilegeAdministrator) == kIOReturnSuccess;
 	
 	return true;
 }
@@ -55,17 +112,41 @@ bool ALCUserClient::start(IOService* provider) {
 
 	if (success)
 		success = super::start(provider);
+
+	auto sharedAlc = AlcEnabler::getShared();
+	if (success && sharedAlc)
+		sharedAlc->publishEntitlementStats();
 	
 	return success;
 }
 
 IOReturn ALCUserClient::clientClose() {
+	if (mProvider) {
+		mProvider->cancelHdaCommands(this);
+		mProvider->unwatchEvents(this);
+	}
+
 	if (!isInactive())
 		terminate();
 	
 	return kIOReturnSuccess;
 }
 
+IOReturn ALCUserClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory) {
+	if (type != kALCMemoryEventQueue || !mProvider)
+		return kIOReturnUnsupported;
+
+	auto queue = mProvider->getEventQueue();
+	if (!queue)
+		return kIOReturnNotReady;
+
+	// The caller consumes one reference.
+	queue->retain();
+	*options = kIOMapReadOnly;
+	*memory = queue;
+	return kIOReturnSuccess;
+}
+
 IOReturn ALCUserClient::methodExecuteVerb(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
 	uint16_t nid, verb, params;
 	
@@ -76,3 +157,160 @@ IOReturn ALCUserClient::methodExecuteVerb(ALCUserClientProvider* target, void* r
 	args->scalarOutput[0] = target->sendHdaCommand(nid, verb, params);
 	return kIOReturnSuccess;
 }
+
+IOReturn ALCUserClient::methodExecuteVerbEx(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	uint16_t nid, verb, params;
+	uint32_t flags, response, retries;
+	
+	nid 	= static_cast<uint16_t>(args->scalarInput[0]);
+	verb 	= static_cast<uint16_t>(args->scalarInput[1]);
+	params 	= static_cast<uint16_t>(args->scalarInput[2]);
+	flags 	= static_cast<uint32_t>(args->scalarInput[3]);
+	
+	auto status = target->executeHdaCommand(nid, verb, params, !(flags & kVerbFlagNoWait), response, retries);
+	args->scalarOutput[0] = response;
+	args->scalarOutput[1] = static_cast<uint32_t>(status);
+	args->scalarOutput[2] = retries;
+	return kIOReturnSuccess;
+}
+
+IOReturn ALCUserClient::methodExecuteVerbAsync(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	if (!args->asyncWakePort || !args->asyncReference)
+		return kIOReturnBadArgument;
+
+	uint16_t nid, verb, params;
+	uint32_t flags;
+
+	nid 	= static_cast<uint16_t>(args->scalarInput[0]);
+	verb 	= static_cast<uint16_t>(args->scalarInput[1]);
+	params 	= static_cast<uint16_t>(args->scalarInput[2]);
+	flags 	= static_cast<uint32_t>(args->scalarInput[3]);
+
+	return target->submitHdaCommand(static_cast<ALCUserClient *>(ref), args->asyncReference, nid, verb, params, !(flags & kVerbFlagNoWait));
+}
+
+IOReturn ALCUserClient::methodExecuteVerbs(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	auto num = args->structureInputSize / sizeof(ALCVerbCommand);
+	if (num == 0 || num > kMaxTransactionVerbs || args->structureInputSize % sizeof(ALCVerbCommand) != 0 ||
+		args->structureOutputSize < num * sizeof(ALCVerbResult))
+		return kIOReturnBadArgument;
+
+	auto commands = static_cast<const ALCVerbCommand *>(args->structureInput);
+	auto results = static_cast<ALCVerbResult *>(args->structureOutput);
+	args->scalarOutput[0] = static_cast<uint32_t>(target->executeHdaCommands(commands, results, num));
+	args->structureOutputSize = static_cast<uint32_t>(num * sizeof(ALCVerbResult));
+	return kIOReturnSuccess;
+}
+
+IOReturn ALCUserClient::methodWatchEvents(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	if (!args->asyncWakePort || !args->asyncReference)
+		return kIOReturnBadArgument;
+
+	return target->watchEvents(static_cast<ALCUserClient *>(ref), args->asyncReference);
+}
+
+IOReturn ALCUserClient::methodReadTrace(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	// The dump exceeds the inline structure limit, so it normally comes as a memory descriptor.
+	auto descriptor = args->structureOutputDescriptor;
+	auto size = descriptor ? descriptor->getLength() : args->structureOutputSize;
+	if (size < sizeof(ALCTraceDump))
+		return kIOReturnBadArgument;
+
+	auto dump = static_cast<ALCTraceDump *>(IOMalloc(sizeof(ALCTraceDump)));
+	if (!dump)
+		return kIOReturnNoMemory;
+
+	auto status = target->readVerbTrace(static_cast<uint32_t>(args->scalarInput[0]), *dump);
+	if (status == kIOReturnSuccess)
+		status = writeStructureOutput(args, dump, sizeof(ALCTraceDump));
+
+	IOFree(dump, sizeof(ALCTraceDump));
+	return status;
+}
+
+IOReturn ALCUserClient::methodReadPatchReport(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	// Callers pass any number of records and learn the total from the scalar output.
+	// No more records than the kext keeps are ever filled, which bounds the allocation.
+	auto descriptor = args->structureOutputDescriptor;
+	auto size = descriptor ? descriptor->getLength() : args->structureOutputSize;
+	size_t num = size / sizeof(ALCPatchRecord);
+	if (num > AlcEnabler::MaxPatchRecords)
+		num = AlcEnabler::MaxPatchRecords;
+
+	ALCPatchRecord *records = nullptr;
+	auto allocSize = num * sizeof(ALCPatchRecord);
+	if (num > 0) {
+		records = static_cast<ALCPatchRecord *>(IOMalloc(allocSize));
+		if (!records)
+			return kIOReturnNoMemory;
+	}
+
+	size_t total = 0;
+	auto status = target->readPatchReport(records, num, total);
+	if (status == kIOReturnSuccess) {
+		args->scalarOutput[0] = total;
+		if (num > total)
+			num = total;
+		if (num > 0)
+			status = writeStructureOutput(args, records, num * sizeof(ALCPatchRecord));
+		else if (!descriptor)
+			args->structureOutputSize = 0;
+	}
+
+	if (records)
+		IOFree(records, allocSize);
+	return status;
+}
+
+IOReturn ALCUserClient::methodUploadResource(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	// Replacing codec resources affects every audio client, so only administrators may do it.
+	if (!static_cast<ALCUserClient *>(ref)->mAdministrator)
+		return kIOReturnNotPermitted;
+
+	uint32_t type, layout, unpackedSize, flags;
+
+	type 			= static_cast<uint32_t>(args->scalarInput[0]);
+	layout 			= static_cast<uint32_t>(args->scalarInput[1]);
+	unpackedSize 	= static_cast<uint32_t>(args->scalarInput[2]);
+	flags 			= static_cast<uint32_t>(args->scalarInput[3]);
+
+	// Files exceeding the inline structure limit come as a memory descriptor.
+	auto descriptor = args->structureInputDescriptor;
+	auto size = descriptor ? descriptor->getLength() : args->structureInputSize;
+	return target->uploadResource(type, layout, unpackedSize, flags, descriptor, args->structureInput, size);
+}
+
+IOReturn ALCUserClient::methodReadLog(ALCUserClientProvider* target, void* ref, IOExternalMethodArguments* args) {
+	auto descriptor = args->structureOutputDescriptor;
+	auto size = descriptor ? descriptor->getLength() : args->structureOutputSize;
+	if (size < sizeof(ALCLogDump))
+		return kIOReturnBadArgument;
+
+	auto dump = static_cast<ALCLogDump *>(IOMalloc(sizeof(ALCLogDump)));
+	if (!dump)
+		return kIOReturnNoMemory;
+
+	auto status = target->readBinaryLog(static_cast<uint32_t>(args->scalarInput[0]), *dump);
+	if (status == kIOReturnSuccess)
+		status = writeStructureOutput(args, dump, sizeof(ALCLogDump));
+
+	IOFree(dump, sizeof(ALCLogDump));
+	return status;
+}
+
+IOReturn ALCUserClient::writeStructureOutput(IOExternalMethodArguments* args, const void* data, size_t size) {
+	auto descriptor = args->structureOutputDescriptor;
+	if (descriptor) {
+		auto status = descriptor->prepare();
+		if (status != kIOReturnSuccess)
+			return status;
+		if (descriptor->writeBytes(0, data, size) != size)
+			status = kIOReturnVMError;
+		descriptor->complete();
+		return status;
+	}
+
+	memcpy(args->structureOutput, data, size);
+	args->structureOutputSize = static_cast<uint32_t>(size);
+	return kIOReturnSuccess;
+}
@@ -21,6 +21,7 @@ class EXPORT ALCUserClient : public IOUserClient {
 
 	ALCUserClientProvider* mProvider { nullptr };
 	task_t mTask {nullptr};
+	bool mAdministrator {false};
 	static const IOExternalMethodDispatch sMethods[kNumberOfMethods];
 	
 public:
@@ -33,10 +34,39 @@ public:
 	virtual IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments* arguments,
 									IOExternalMethodDispatch* dispatch, OSObject* target,
 									void* reference) override;
+	virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options,
+										 IOMemoryDescriptor** memory) override;
 	
 protected:
 	static IOReturn methodExecuteVerb(ALCUserClientProvider* target, void* ref,
 									  IOExternalMethodArguments* args);
+	static IOReturn methodExecuteVerbEx(ALCUserClientProvider* target, void* ref,
+										IOExternalMethodArguments* args);
+	static IOReturn methodExecuteVerbAsync(ALCUserClientProvider* target, void* ref,
+										   IOExternalMethodArguments* args);
+	static IOReturn methodExecuteVerbs(ALCUserClientProvider* target, void* ref,
+									   IOExternalMethodArguments* args);
+	static IOReturn methodWatchEvents(ALCUserClientProvider* target, void* ref,
+									  IOExternalMethodArguments* args);
+	static IOReturn methodReadTrace(ALCUserClientProvider* target, void* ref,
+									IOExternalMethodArguments* args);
+	static IOReturn methodReadPatchReport(ALCUserClientProvider* target, void* ref,
+										  IOExternalMethodArguments* args);
+	static IOReturn methodUploadResource(ALCUserClientProvider* target, void* ref,
+										 IOExternalMethodArguments* args);
+	static IOReturn methodReadLog(ALCUserClientProvider* target, void* ref,
+								  IOExternalMethodArguments* args);
+
+	/**
+	 *  Copy a variable size structure output to the caller
+	 *
+	 *  @param args Method arguments
+	 *  @param data Output data
+	 *  @param size Output data size, must fit the caller buffer
+	 *
+	 *  @return kIOReturnSuccess on success
+	 */
+	static IOReturn writeStructureOutput(IOExternalMethodArguments* args, const void* data, size_t size);
 };
 
 #endif /* ALCUserClient_hpp */
@@ -8,6 +8,7 @@
 
 #include "ALCUserClientProvider.hpp"
 #include <Headers/kern_iokit.hpp>
+#include <Headers/kern_time.hpp>
 
 OSDefineMetaClassAndStructors(ALCUserClientProvider, IOService);
 
@@ -28,12 +29,21 @@ IOService *ALCUserClientProvider::probe(IOService *provider, SInt32 *score) {
 
 	uint32_t enableHdaVerbs = 0;
 	WIOKit::getOSDataValue(hdefDevice, "alc-verbs", enableHdaVerbs);
-	PE_parse_boot_argn("alcverbs", &enableHdaVerbs, sizeof(enableHdaVerbs));
+	auto sharedAlc = AlcEnabler::getShared();
+	if (sharedAlc && sharedAlc->getBootConfig().hasVerbs)
+		enableHdaVerbs = sharedAlc->getBootConfig().verbs;
 	DBGLOG("client", "device %s to send custom verbs", enableHdaVerbs != 0 ? "allows" : "disallows");
 	if (enableHdaVerbs == 0) {
 		return nullptr;
 	}
 
+	uint32_t interval = EventMonitor::DefaultInterval;
+	WIOKit::getOSDataValue(hdefDevice, "alc-event-poll", interval);
+	if (sharedAlc && sharedAlc->getBootConfig().hasEventPoll)
+		interval = sharedAlc->getBootConfig().eventPoll;
+	eventPollInterval = EventMonitor::clampInterval(interval);
+	DBGLOG("client", "polling jack sense and GPIO events every %u ms", eventPollInterval);
+
 	return this;
 }
 
@@ -41,6 +51,37 @@ bool ALCUserClientProvider::start(IOService* provider) {
 	if (!super::start(provider))
 		return false;
 
+	verbLock = IOLockAlloc();
+	verbQueueLock = IOLockAlloc();
+	verbQueueCall = thread_call_allocate(processVerbQueue, this);
+	if (!verbLock || !verbQueueLock || !verbQueueCall) {
+		SYSLOG("client", "failed to allocate verb work queue");
+		super::stop(provider);
+		return false;
+	}
+
+	eventLock = IOLockAlloc();
+	eventCall = thread_call_allocate(processEvents, this);
+	eventBuffer = IOBufferMemoryDescriptor::withOptions(kIOMemoryKernelUserShared | kIODirectionInOut, sizeof(ALCEventQueue), page_size);
+	if (!eventLock || !eventCall || !eventBuffer) {
+		SYSLOG("client", "failed to allocate event queue");
+		super::stop(provider);
+		return false;
+	}
+
+	eventQueue = static_cast<ALCEventQueue *>(eventBuffer->getBytesNoCopy());
+	memset(eventQueue, 0, sizeof(ALCEventQueue));
+	eventQueue->version = kALCEventQueueVersion;
+	eventQueue->capacity = kALCEventQueueCapacity;
+
+	// Verb tracing is optional, keep working without it. Only a registered ring is kept.
+	auto sharedAlc = AlcEnabler::getShared();
+	verbTrace = sharedAlc ? new VerbTrace : nullptr;
+	if (verbTrace && !sharedAlc->registerVerbTrace(hdaCodecDevice, verbTrace)) {
+		delete verbTrace;
+		verbTrace = nullptr;
+	}
+
 	// We are ready for verbs
 	DBGLOG("client", "ALCUserClient is ready for hda-verbs");
 	setProperty("ReadyForALCVerbs", kOSBooleanTrue);
@@ -53,30 +94,381 @@ bool ALCUserClientProvider::start(IOService* provider) {
 }
 
 void ALCUserClientProvider::stop(IOService* provider) {
+	readyForVerbs = false;
+	cancelHdaCommands(nullptr);
+	unwatchEvents(nullptr);
+
+	auto sharedAlc = AlcEnabler::getShared();
+	if (verbTrace && sharedAlc)
+		sharedAlc->unregisterVerbTrace(hdaCodecDevice);
+
+	// A pending monitor run holds a reference to us, drop it if we managed to cancel it.
+	if (eventCall && thread_call_cancel(eventCall)) {
+		IOLockLock(eventLock);
+		eventMonitorActive = false;
+		IOLockUnlock(eventLock);
+		release();
+	}
+
 	super::stop(provider);
 }
 
-uint64_t ALCUserClientProvider::sendHdaCommand(uint16_t nid, uint16_t verb, uint16_t param) {
+void ALCUserClientProvider::free() {
+	// The queue and event handlers hold a reference to us, so they cannot be running here.
+	if (eventCall) {
+		thread_call_free(eventCall);
+		eventCall = nullptr;
+	}
+	if (eventLock) {
+		IOLockFree(eventLock);
+		eventLock = nullptr;
+	}
+	if (eventBuffer) {
+		eventBuffer->release();
+		eventBuffer = nullptr;
+		eventQueue = nullptr;
+	}
+	if (verbTrace) {
+		delete verbTrace;
+		verbTrace = nullptr;
+	}
+	if (verbQueueCall) {
+		thread_call_free(verbQueueCall);
+		verbQueueCall = nullptr;
+	}
+	if (verbQueueLock) {
+		IOLockFree(verbQueueLock);
+		verbQueueLock = nullptr;
+	}
+	if (verbLock) {
+		IOLockFree(verbLock);
+		verbLock = nullptr;
+	}
+	super::free();
+}
+
+bool ALCUserClientProvider::verbsAvailable() {
 	if (!readyForVerbs) {
 		DBGLOG("client", "provider not ready to accept hda-verb commands");
-		return kIOReturnError;
+		return false;
 	}
 	
 	auto sharedAlc = AlcEnabler::getShared();
 	
 	if (!sharedAlc) {
 		DBGLOG("client", "unable to get shared AlcEnabler instance");
-		return kIOReturnError;
+		return false;
 	}
 
 	if (!sharedAlc->orgIOHDACodecDevice_executeVerb) {
 		DBGLOG("client", "unable to get verb support");
-		return kIOReturnError;
+		return false;
 	}
+
+	return true;
+}
+
+uint64_t ALCUserClientProvider::sendHdaCommand(uint16_t nid, uint16_t verb, uint16_t param) {
+	if (!verbsAvailable())
+		return kIOReturnError;
 	
 	unsigned ret = 0;
-	sharedAlc->IOHDACodecDevice_executeVerb(reinterpret_cast<void*>(hdaCodecDevice), nid, verb, param, &ret, true);
-	DBGLOG("client", "send HDA command nid=0x%X, verb=0x%X, param=0x%X, result=0x%08x", nid, verb, param, ret);
+	IOLockLock(verbLock);
+	AlcEnabler::getShared()->executeVerb(reinterpret_cast<void*>(hdaCodecDevice), nid, verb, param, &ret, true);
+	IOLockUnlock(verbLock);
+	ALCLOG("client", "send HDA command nid=0x%X, verb=0x%X, param=0x%X, result=0x%08x", nid, verb, param, ret);
 	
 	return ret;
 }
+
+IOReturn ALCUserClientProvider::executeHdaCommand(uint16_t nid, uint16_t verb, uint16_t param, bool wait, uint32_t &response, uint32_t &retries) {
+	response = 0;
+	retries = 0;
+
+	if (!verbsAvailable())
+		return kIOReturnNotReady;
+
+	IOLockLock(verbLock);
+	auto status = executeHdaCommandLocked(nid, verb, param, wait, response, retries);
+	IOLockUnlock(verbLock);
+	return status;
+}
+
+IOReturn ALCUserClientProvider::executeHdaCommandLocked(uint16_t nid, uint16_t verb, uint16_t param, bool wait, uint32_t &response, uint32_t &retries) {
+	unsigned ret = 0;
+	auto status = AlcEnabler::getShared()->executeVerb(reinterpret_cast<void*>(hdaCodecDevice), nid, verb, param, &ret, wait, &retries);
+	ALCLOG("client", "send HDA command nid=0x%X, verb=0x%X, param=0x%X, wait=%d, result=0x%08x, status=%08X, retries=%u",
+		   nid, verb, param, wait, ret, status, retries);
+
+	response = ret;
+	return status;
+}
+
+IOReturn ALCUserClientProvider::executeHdaCommands(const ALCVerbCommand *commands, ALCVerbResult *results, size_t num) {
+	if (!verbsAvailable())
+		return kIOReturnNotReady;
+
+	IOLockLock(verbLock);
+	auto status = VerbTransaction::run(commands, results, num, [this](uint16_t nid, uint16_t verb, uint16_t param, bool wait, uint32_t &response) {
+		uint32_t retries = 0;
+		return executeHdaCommandLocked(nid, verb, param, wait, response, retries);
+	});
+	IOLockUnlock(verbLock);
+
+	ALCLOG("client", "executed %lu verb transaction with status %08X", num, status);
+	return status;
+}
+
+IOReturn ALCUserClientProvider::submitHdaCommand(IOService *client, OSAsyncReference64 reference, uint16_t nid, uint16_t verb, uint16_t param, bool wait) {
+	if (!verbsAvailable())
+		return kIOReturnNotReady;
+
+	VerbRequest request {client, {}, nid, verb, param, wait};
+	memcpy(request.reference, reference, sizeof(OSAsyncReference64));
+
+	IOLockLock(verbQueueLock);
+	if (!verbQueue.push(request)) {
+		IOLockUnlock(verbQueueLock);
+		ALCLOG("client", "verb queue is full, rejecting nid=0x%X, verb=0x%X", nid, verb);
+		return kIOReturnNoResources;
+	}
+	client->retain();
+
+	// Hold a reference for the handler, it is dropped once the queue drains.
+	bool schedule = !verbQueueActive;
+	if (schedule) {
+		verbQueueActive = true;
+		retain();
+	}
+	IOLockUnlock(verbQueueLock);
+
+	if (schedule)
+		thread_call_enter(verbQueueCall);
+
+	return kIOReturnSuccess;
+}
+
+void ALCUserClientProvider::cancelHdaCommands(IOService *client) {
+	if (!verbQueueLock)
+		return;
+
+	// Completions are posted outside of the lock, so take the requests one by one.
+	while (true) {
+		VerbRequest request;
+		IOLockLock(verbQueueLock);
+		bool found = verbQueue.take(request, [client](const VerbRequest &curr) {
+			return !client || curr.client == client;
+		});
+		IOLockUnlock(verbQueueLock);
+
+		if (!found)
+			break;
+
+		ALCLOG("client", "cancelling queued verb nid=0x%X, verb=0x%X", request.nid, request.verb);
+		completeVerbRequest(request, kIOReturnAborted, 0, 0);
+	}
+}
+
+void ALCUserClientProvider::completeVerbRequest(VerbRequest &request, IOReturn status, uint32_t response, uint32_t retries) {
+	io_user_reference_t args[] {response, retries};
+	IOUserClient::sendAsyncResult64(request.reference, status, args, arrsize(args));
+	request.client->release();
+	request.client = nullptr;
+}
+
+void ALCUserClientProvider::processVerbQueue(thread_call_param_t provider, thread_call_param_t) {
+	auto that = static_cast<ALCUserClientProvider *>(provider);
+
+	while (true) {
+		VerbRequest request;
+		IOLockLock(that->verbQueueLock);
+		if (!that->verbQueue.pop(request)) {
+			that->verbQueueActive = false;
+			IOLockUnlock(that->verbQueueLock);
+			break;
+		}
+		IOLockUnlock(that->verbQueueLock);
+
+		uint32_t response = 0, retries = 0;
+		auto status = that->executeHdaCommand(request.nid, request.verb, request.param, request.wait, response, retries);
+		completeVerbRequest(request, status, response, retries);
+	}
+
+	that->release();
+}
+
+IOReturn ALCUserClientProvider::watchEvents(IOService *client, OSAsyncReference64 reference) {
+	if (!verbsAvailable())
+		return kIOReturnNotReady;
+
+	IOLockLock(eventLock);
+	size_t index = 0;
+	while (index < eventWatcherCount && eventWatchers[index].client != client)
+		index++;
+
+	if (index == MaxEventWatchers) {
+		IOLockUnlock(eventLock);
+		DBGLOG("client", "too many event watchers");
+		return kIOReturnNoResources;
+	}
+
+	if (index == eventWatcherCount)
+		eventWatcherCount++;
+	eventWatchers[index].client = client;
+	memcpy(eventWatchers[index].reference, reference, sizeof(OSAsyncReference64));
+
+	// Let the new watcher know the current state of every event source.
+	eventResync = true;
+
+	// Hold a reference for the monitor, it is dropped once the last watcher leaves.
+	bool schedule = !eventMonitorActive;
+	if (schedule) {
+		eventMonitorActive = true;
+		retain();
+	}
+	IOLockUnlock(eventLock);
+
+	if (schedule)
+		thread_call_enter(eventCall);
+
+	return kIOReturnSuccess;
+}
+
+void ALCUserClientProvider::unwatchEvents(IOService *client) {
+	if (!eventLock)
+		return;
+
+	IOLockLock(eventLock);
+	size_t i = 0;
+	while (i < eventWatcherCount) {
+		if (client && eventWatchers[i].client != client) {
+			i++;
+			continue;
+		}
+		eventWatchers[i] = eventWatchers[--eventWatcherCount];
+		eventWatchers[eventWatcherCount].client = nullptr;
+	}
+	IOLockUnlock(eventLock);
+}
+
+IOReturn ALCUserClientProvider::eventExec(void *provider, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+	uint32_t retries = 0;
+	return static_cast<ALCUserClientProvider *>(provider)->executeHdaCommand(nid, verb, param, false, *response, retries);
+}
+
+void ALCUserClientProvider::processEvents(thread_call_param_t provider, thread_call_param_t) {
+	auto that = static_cast<ALCUserClientProvider *>(provider);
+
+	auto &monitor = that->eventMonitor;
+	if (!monitor.isDiscovered())
+		monitor.discover(eventExec, that);
+
+	IOLockLock(that->eventLock);
+	bool all = that->eventResync && monitor.isDiscovered();
+	if (all)
+		that->eventResync = false;
+	IOLockUnlock(that->eventLock);
+
+	bool published = monitor.isDiscovered() && monitor.poll(eventExec, that, that->eventQueue, all);
+
+	IOLockLock(that->eventLock);
+	if (published) {
+		io_user_reference_t args[] {that->eventQueue->head};
+		for (size_t i = 0; i < that->eventWatcherCount; i++)
+			IOUserClient::sendAsyncResult64(that->eventWatchers[i].reference, kIOReturnSuccess, args, arrsize(args));
+	}
+	bool active = that->eventWatcherCount > 0 && that->readyForVerbs;
+	that->eventMonitorActive = active;
+	IOLockUnlock(that->eventLock);
+
+	if (active) {
+		uint64_t deadline = 0;
+		clock_interval_to_deadline(that->eventPollInterval, kMillisecondScale, &deadline);
+		thread_call_enter_delayed(that->eventCall, deadline);
+	} else {
+		that->release();
+	}
+}
+
+IOReturn ALCUserClientProvider::readVerbTrace(uint32_t flags, ALCTraceDump &dump) {
+	auto sharedAlc = AlcEnabler::getShared();
+	if (!verbTrace || !sharedAlc)
+		return kIOReturnNotReady;
+
+	if (flags & kTraceFlagEnable)
+		sharedAlc->setVerbTraceEnabled(true);
+	if (flags & kTraceFlagDisable)
+		sharedAlc->setVerbTraceEnabled(false);
+
+	verbTrace->read(dump);
+	dump.enabled = sharedAlc->isVerbTraceEnabled();
+
+	if (flags & kTraceFlagReset)
+		verbTrace->reset();
+
+	DBGLOG("client", "read verb trace up to %llu, flags %X", dump.head, flags);
+	return kIOReturnSuccess;
+}
+
+IOReturn ALCUserClientProvider::readBinaryLog(uint32_t flags, ALCLogDump &dump) {
+	// Only debug builds booted with -alcbinlog record the log.
+	auto log = BinaryLog::active;
+	if (!log)
+		return kIOReturnNotReady;
+
+	log->read(dump);
+	if (flags & kLogFlagReset)
+		log->reset();
+
+	DBGLOG("client", "read binary log up to %llu, flags %X", dump.head, flags);
+	return kIOReturnSuccess;
+}
+
+IOReturn ALCUserClientProvider::readPatchReport(ALCPatchRecord *records, size_t num, size_t &total) {
+	auto sharedAlc = AlcEnabler::getShared();
+	if (!sharedAlc)
+		return kIOReturnNotReady;
+
+	total = sharedAlc->copyPatchReport(records, num);
+	sharedAlc->publishEntitlementStats();
+	DBGLOG("client", "read %lu of %lu patch records", num < total ? num : total, total);
+	return kIOReturnSuccess;
+}
+
+IOReturn ALCUserClientProvider::uploadResource(uint32_t type, uint32_t layout, uint32_t unpackedSize, uint32_t flags,
+											   IOMemoryDescriptor *descriptor, const void *input, size_t size) {
+	auto sharedAlc = AlcEnabler::getShared();
+	if (!sharedAlc)
+		return kIOReturnNotReady;
+
+	uint8_t *data = nullptr;
+	if (!(flags & kResourceFlagRemove)) {
+		if (size == 0 || size > kALCResourceMaxSize)
+			return kIOReturnBadArgument;
+
+		data = Buffer::create<uint8_t>(size);
+		if (!data)
+			return kIOReturnNoMemory;
+
+		IOReturn status = kIOReturnSuccess;
+		if (descriptor) {
+			status = descriptor->prepare();
+			if (status == kIOReturnSuccess) {
+				if (descriptor->readBytes(0, data, size) != size)
+					status = kIOReturnVMError;
+				descriptor->complete();
+			}
+		} else {
+			memcpy(data, input, size);
+		}
+
+		if (status != kIOReturnSuccess) {
+			Buffer::deleter(data);
+			return status;
+		}
+	}
+
+	auto status = sharedAlc->uploadResource(hdaCodecDevice, type, layout, data, static_cast<uint32_t>(size), unpackedSize, flags);
+	DBGLOG("client", "resource upload of %lu bytes returned %X", size, status);
+	return status;
+}
@@ -13,8 +13,14 @@
 
 #include<IOKit/IOService.h>
 #include <IOKit/IOUserClient.h>
+#include <IOKit/IOLib.h>
+#include <IOKit/IOLocks.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 
 #include "kern_alc.hpp"
+#include "kern_events.hpp"
+#include "kern_verbqueue.hpp"
+#include "UserKernelShared.h"
 
 class EXPORT ALCUserClientProvider : public IOService {
 	using super = IOService;
@@ -23,10 +29,122 @@ class EXPORT ALCUserClientProvider : public IOService {
 	IOService* 	hdaCodecDevice { nullptr };
 	bool		readyForVerbs	{ false	};
 
+	/**
+	 *  Check that verbs can be sent to the codec
+	 */
+	bool verbsAvailable();
+
+	/**
+	 *  Codec access lock serialising verbs from all user-clients, so that multi-verb
+	 *  sequences like SET_COEF_INDEX/GET_PROC_COEF are never interleaved
+	 */
+	IOLock*		verbLock		{ nullptr };
+
+	/**
+	 *  Execute a single verb, verbLock must be held
+	 */
+	IOReturn executeHdaCommandLocked(uint16_t nid, uint16_t verb, uint16_t param, bool wait, uint32_t &response, uint32_t &retries);
+
+	/**
+	 *  Asynchronous verb request waiting in the codec work queue
+	 */
+	struct VerbRequest {
+		IOService *client;
+		OSAsyncReference64 reference;
+		uint16_t nid;
+		uint16_t verb;
+		uint16_t param;
+		bool wait;
+	};
+
+	/**
+	 *  Maximum number of asynchronous verbs queued for a single codec
+	 */
+	static constexpr size_t MaxQueuedVerbs = 64;
+
+	/**
+	 *  Codec work queue of pending asynchronous verbs protected by verbQueueLock
+	 */
+	VerbQueue<VerbRequest, MaxQueuedVerbs> verbQueue;
+	bool		verbQueueActive	{ false };
+	IOLock*		verbQueueLock	{ nullptr };
+	thread_call_t verbQueueCall	{ nullptr };
+
+	/**
+	 *  Work queue handler executing pending verbs and posting completions
+	 *
+	 *  @param provider ALCUserClientProvider instance
+	 */
+	static void processVerbQueue(thread_call_param_t provider, thread_call_param_t);
+
+	/**
+	 *  Post a completion for an asynchronous verb request and drop its client reference
+	 */
+	static void completeVerbRequest(VerbRequest &request, IOReturn status, uint32_t response, uint32_t retries);
+
+	/**
+	 *  Maximum number of event watchers
+	 */
+	static constexpr size_t MaxEventWatchers = 8;
+
+	/**
+	 *  User-client waiting for event queue notifications
+	 */
+	struct EventWatcher {
+		IOService *client;
+		OSAsyncReference64 reference;
+	};
+
+	/**
+	 *  Event queue shared with user-clients, only written by processEvents
+	 */
+	IOBufferMemoryDescriptor *eventBuffer { nullptr };
+	ALCEventQueue *eventQueue { nullptr };
+
+	/**
+	 *  Jack sense and GPIO monitor, only used by processEvents
+	 */
+	EventMonitor eventMonitor;
+
+	/**
+	 *  Polling interval in milliseconds from alc-event-poll or alceventpoll boot-arg
+	 */
+	uint32_t	eventPollInterval	{ EventMonitor::DefaultInterval };
+
+	/**
+	 *  Event watchers and monitor state protected by eventLock
+	 */
+	EventWatcher eventWatchers[MaxEventWatchers] {};
+	size_t		eventWatcherCount	{ 0 };
+	bool		eventResync			{ false };
+	bool		eventMonitorActive	{ false };
+	IOLock*		eventLock			{ nullptr };
+	thread_call_t eventCall			{ nullptr };
+
+	/**
+	 *  EventMonitor executor sending verbs to the codec
+	 *
+	 *  @param provider ALCUserClientProvider instance
+	 */
+	static IOReturn eventExec(void *provider, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response);
+
+	/**
+	 *  Event monitor handler polling the codec while there are watchers
+	 *
+	 *  @param provider ALCUserClientProvider instance
+	 */
+	static void processEvents(thread_call_param_t provider, thread_call_param_t);
+
+	/**
+	 *  Codec verb trace ring registered in AlcEnabler
+	 */
+	VerbTrace*	verbTrace		{ nullptr };
+
 public:
 	virtual IOService* probe(IOService *provider, SInt32 *score) override;
 	virtual bool start(IOService* provider) override;
 	virtual void stop(IOService* provider) override;
+	virtual void free() override;
 	
 	/**
 	 *  Called by user-client to set the codec verbs
@@ -38,6 +156,128 @@ public:
 	 *  @return kIOReturnSuccess on successful execution
 	 */
 	virtual uint64_t sendHdaCommand(uint16_t nid, uint16_t verb, uint16_t param);
+
+	/**
+	 *  Called by user-client to set the codec verbs with explicit retry control
+	 *
+	 *  @param nid      Node ID
+	 *  @param verb     The hda-verb command to send (as defined in hdaverb.h)
+	 *  @param param    The parameters for the verb
+	 *  @param wait     Retry SET_STREAM_FORMAT within the bounded retry policy
+	 *  @param response The output of the command
+	 *  @param retries  Number of performed retries
+	 *
+	 *  @return kIOReturnSuccess on successful execution
+	 */
+	IOReturn executeHdaCommand(uint16_t nid, uint16_t verb, uint16_t param, bool wait, uint32_t &response, uint32_t &retries);
+
+	/**
+	 *  Called by user-client to execute a sequence of verbs atomically.
+	 *  No other verb from this provider is sent to the codec until the sequence completes,
+	 *  and the remaining verbs are aborted after the first failure.
+	 *
+	 *  @param commands Verbs to execute
+	 *  @param results  Responses and statuses for every verb
+	 *  @param num      Number of verbs
+	 *
+	 *  @return kIOReturnSuccess if all verbs were executed successfully
+	 */
+	IOReturn executeHdaCommands(const ALCVerbCommand *commands, ALCVerbResult *results, size_t num);
+
+	/**
+	 *  Called by user-client to queue a codec verb for asynchronous execution.
+	 *  Completion is posted to the reference with the response and retry count as arguments.
+	 *
+	 *  @param client    Submitting user-client, retained until completion
+	 *  @param reference Async reference to post the completion to
+	 *  @param nid       Node ID
+	 *  @param verb      The hda-verb command to send (as defined in hdaverb.h)
+	 *  @param param     The parameters for the verb
+	 *  @param wait      Retry SET_STREAM_FORMAT within the bounded retry policy
+	 *
+	 *  @return kIOReturnSuccess if the verb was queued
+	 */
+	IOReturn submitHdaCommand(IOService *client, OSAsyncReference64 reference, uint16_t nid, uint16_t verb, uint16_t param, bool wait);
+
+	/**
+	 *  Abort all queued verbs submitted by a user-client
+	 *
+	 *  @param client Closing user-client
+	 */
+	void cancelHdaCommands(IOService *client);
+
+	/**
+	 *  Get the event queue memory for mapping into a user-client task
+	 *
+	 *  @return read-only event queue descriptor (not retained)
+	 */
+	IOMemoryDescriptor *getEventQueue() { return eventBuffer; }
+
+	/**
+	 *  Called by user-client to get notified about published jack sense and GPIO events.
+	 *  The current state of all event sources is published once the watcher is added.
+	 *
+	 *  @param client    Watching user-client
+	 *  @param reference Async reference to post notifications to
+	 *
+	 *  @return kIOReturnSuccess if the watcher was added
+	 */
+	IOReturn watchEvents(IOService *client, OSAsyncReference64 reference);
+
+	/**
+	 *  Stop sending event notifications to a user-client
+	 *
+	 *  @param client Closing user-client, nullptr for all
+	 */
+	void unwatchEvents(IOService *client);
+
+	/**
+	 *  Called by user-client to read the codec verb trace
+	 *
+	 *  @param flags kMethodReadTrace flags
+	 *  @param dump  Trace snapshot
+	 *
+	 *  @return kIOReturnSuccess if the trace was read
+	 */
+	IOReturn readVerbTrace(uint32_t flags, ALCTraceDump &dump);
+
+	/**
+	 *  Called by user-client to read the binary debug log
+	 *
+	 *  @param flags kMethodReadLog flags
+	 *  @param dump  Log snapshot
+	 *
+	 *  @return kIOReturnSuccess if the log was read
+	 */
+	IOReturn readBinaryLog(uint32_t flags, ALCLogDump &dump);
+
+	/**
+	 *  Called by user-client to read the boot patch report
+	 *
+	 *  @param records Report records
+	 *  @param num     Maximum number of records
+	 *  @param total   Number of recorded patches, may exceed num
+	 *
+	 *  @return kIOReturnSuccess if the report was read
+	 */
+	IOReturn readPatchReport(ALCPatchRecord *records, size_t num, size_t &total);
+
+	/**
+	 *  Called by user-client to replace the layout or platform file of the codec until reboot.
+	 *  The file is copied once from the descriptor or the inline input into a kext-owned buffer.
+	 *
+	 *  @param type         kALCResourceLayout or kALCResourcePlatform
+	 *  @param layout       layout id, 0 for the current one
+	 *  @param unpackedSize uncompressed file size
+	 *  @param flags        kMethodUploadResource flags
+	 *  @param descriptor   compressed file descriptor or nullptr
+	 *  @param input        inline compressed file when there is no descriptor
+	 *  @param size         compressed file size
+	 *
+	 *  @return kIOReturnSuccess if the file was stored or removed
+	 */
+	IOReturn uploadResource(uint32_t type, uint32_t layout, uint32_t unpackedSize, uint32_t flags,
+							IOMemoryDescriptor *descriptor, const void *input, size_t size);
 };
 
 #endif /* ALCUserClientProvider_hpp */
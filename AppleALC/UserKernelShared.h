@@ -9,10 +9,268 @@
 #ifndef UserKernelShared_h
 #define UserKernelShared_h
 
+#include <stdint.h>
+
 enum {
 	kMethodExecuteVerb,
+	kMethodExecuteVerbEx,
+	kMethodExecuteVerbAsync,
+	kMethodExecuteVerbs,
+	kMethodWatchEvents,
+	kMethodReadTrace,
+	kMethodReadPatchReport,
+	kMethodUploadResource,
+	kMethodReadLog,
 	
 	kNumberOfMethods // Must be last
 };
 
+/**
+ *  kMethodExecuteVerbEx and kMethodExecuteVerbAsync flags
+ */
+enum {
+	kVerbFlagNoWait = 1 << 0 // Do not retry failing SET_STREAM_FORMAT
+};
+
+/**
+ *  kMethodExecuteVerbAsync completion arguments
+ */
+enum {
+	kVerbAsyncResponse,
+	kVerbAsyncRetries,
+
+	kVerbAsyncArgCount
+};
+
+/**
+ *  kMethodExecuteVerbs transaction entry
+ */
+typedef struct {
+	uint16_t nid;
+	uint16_t verb;
+	uint16_t param;
+	uint16_t flags;
+} ALCVerbCommand;
+
+/**
+ *  kMethodExecuteVerbs transaction result entry
+ */
+typedef struct {
+	uint32_t response;
+	uint32_t status;
+} ALCVerbResult;
+
+/**
+ *  Maximum number of verbs in a single kMethodExecuteVerbs transaction
+ */
+#define kMaxTransactionVerbs 64
+
+/**
+ *  clientMemoryForType memory types
+ */
+enum {
+	kALCMemoryEventQueue // Read-only ALCEventQueue
+};
+
+/**
+ *  kMethodWatchEvents notification arguments
+ */
+enum {
+	kEventAsyncHead, // Sequence number of the last published event
+
+	kEventAsyncArgCount
+};
+
+/**
+ *  Event types
+ */
+enum {
+	kALCEventPinSense = 1, // value is GET_PIN_SENSE response
+	kALCEventGpio     = 2  // value is GET_GPIO_DATA response
+};
+
+/**
+ *  Event queue entry. The sequence is cleared while the entry is written,
+ *  and readers must check it is unchanged after copying the entry.
+ */
+typedef struct {
+	uint64_t sequence;
+	uint64_t timestamp; // Nanoseconds since boot
+	uint16_t nid;
+	uint16_t type;
+	uint32_t value;
+} ALCEvent;
+
+#define kALCEventQueueVersion  1
+#define kALCEventQueueCapacity 256
+
+/**
+ *  Event queue shared with user space. The event with sequence N (starting from 1)
+ *  is stored at events[(N - 1) % capacity], head is the last published sequence.
+ */
+typedef struct {
+	uint32_t version;
+	uint32_t capacity;
+	uint64_t head;
+	ALCEvent events[kALCEventQueueCapacity];
+} ALCEventQueue;
+
+/**
+ *  kMethodReadTrace flags
+ */
+enum {
+	kTraceFlagEnable  = 1 << 0, // Start tracing verbs of all codecs
+	kTraceFlagDisable = 1 << 1, // Stop tracing verbs of all codecs
+	kTraceFlagReset   = 1 << 2  // Drop entries and histograms once they are read
+};
+
+/**
+ *  Verb classes with separate latency histograms
+ */
+enum {
+	kALCTraceClassParameter,    // GET_PARAMETERS
+	kALCTraceClassGet,          // Other GET verbs
+	kALCTraceClassSet,          // SET verbs
+	kALCTraceClassCoefficient,  // Processing coefficient verbs
+	kALCTraceClassStreamFormat, // SET_STREAM_FORMAT and GET_STREAM_FORMAT
+
+	kALCTraceClassCount
+};
+
+/**
+ *  Histogram bucket 0 counts verbs faster than 1 us, bucket N counts verbs
+ *  taking [2^(N-1), 2^N) us, and the last bucket also counts all slower verbs.
+ */
+#define kALCTraceBuckets 24
+
+typedef struct {
+	uint64_t count;
+	uint64_t totalTime; // Nanoseconds
+	uint64_t maxTime;   // Nanoseconds
+	uint64_t buckets[kALCTraceBuckets];
+} ALCTraceHistogram;
+
+/**
+ *  Traced codec verb, sequence is 0 for empty entries and entries overwritten while reading
+ */
+typedef struct {
+	uint64_t sequence;
+	uint64_t timestamp; // Nanoseconds since boot when the verb was sent
+	uint32_t duration;  // Nanoseconds
+	uint32_t response;
+	uint32_t status;
+	uint16_t nid;
+	uint16_t verb;
+	uint16_t param;
+	uint16_t reserved[3];
+} ALCTraceEntry;
+
+#define kALCTraceVersion  1
+#define kALCTraceCapacity 512
+
+/**
+ *  kMethodReadTrace output. The entry with sequence N (starting from 1)
+ *  is stored at entries[(N - 1) % capacity], head is the last recorded sequence.
+ */
+typedef struct {
+	uint32_t version;
+	uint32_t capacity;
+	uint64_t head;
+	uint32_t enabled;
+	uint32_t reserved;
+	ALCTraceHistogram histograms[kALCTraceClassCount];
+	ALCTraceEntry entries[kALCTraceCapacity];
+} ALCTraceDump;
+
+#define kALCPatchNameLength   64
+#define kALCPatchFoundUnknown 0xFFFFFFFF
+
+/**
+ *  kMethodReadPatchReport entry, one for every lookup patch applied during boot
+ */
+typedef struct {
+	char source[kALCPatchNameLength]; // Resource file and patch index
+	char kext[kALCPatchNameLength];   // Patched kext identifier
+	uint32_t count;                   // Expected replacements, 0 for all
+	uint32_t found;                   // Matches in the kext, kALCPatchFoundUnknown without -alcpatchstats
+	uint32_t status;                  // KernelPatcher error, 0 on success
+	uint32_t reserved;
+	uint64_t duration;                // Nanoseconds
+	uint64_t scanned;                 // Bytes scanned for matches, 0 without -alcpatchstats
+} ALCPatchRecord;
+
+/**
+ *  kMethodUploadResource resource types
+ */
+enum {
+	kALCResourceLayout,   // layoutN.xml replacement
+	kALCResourcePlatform  // PlatformsN.xml replacement
+};
+
+/**
+ *  kMethodUploadResource flags
+ */
+enum {
+	kResourceFlagReload = 1 << 0, // Queue a restart of AppleHDA of the codec to load the resource
+	kResourceFlagRemove = 1 << 1  // Drop the uploaded resource and use the built-in one
+};
+
+/**
+ *  Largest zlib compressed and uncompressed resource accepted by kMethodUploadResource
+ */
+#define kALCResourceMaxSize         (512 * 1024)
+#define kALCResourceMaxUnpackedSize (4 * 1024 * 1024)
+
+/**
+ *  kMethodReadLog flags
+ */
+enum {
+	kLogFlagReset = 1 << 0 // Drop records once they are read
+};
+
+#define kALCLogVersion      1
+#define kALCLogCapacity     1024
+#define kALCLogFormats      256
+#define kALCLogArgs         8
+#define kALCLogModuleLength 16
+#define kALCLogFormatLength 240
+
+/**
+ *  Binary log record, sequence is 0 for empty records and records overwritten while reading.
+ *  Integer and pointer arguments are widened to 64 bits, string arguments are stored inline
+ *  starting at the slots marked in strings, truncated to the remaining slots.
+ */
+typedef struct {
+	uint64_t sequence;
+	uint64_t timestamp; // Nanoseconds since boot
+	uint16_t format;    // Format index plus one
+	uint8_t count;      // Used argument slots
+	uint8_t strings;    // Bit N is set when slot N starts an inline string
+	uint32_t reserved;
+	uint64_t args[kALCLogArgs];
+} ALCLogRecord;
+
+/**
+ *  Format string of a log call site
+ */
+typedef struct {
+	char module[kALCLogModuleLength];
+	char format[kALCLogFormatLength];
+} ALCLogFormat;
+
+/**
+ *  kMethodReadLog output. The record with sequence N (starting from 1)
+ *  is stored at records[(N - 1) % capacity], head is the last recorded sequence.
+ */
+typedef struct {
+	uint32_t version;
+	uint32_t capacity;
+	uint64_t head;
+	uint64_t dropped;     // Records of call sites left without a format slot
+	uint32_t formatCount;
+	uint32_t reserved;
+	ALCLogFormat formats[kALCLogFormats];
+	ALCLogRecord records[kALCLogCapacity];
+} ALCLogDump;
+
 #endif /* UserKernelShared_h */
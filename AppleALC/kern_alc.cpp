@@ -6,10 +6,14 @@
 //
 
 #include <Headers/kern_api.hpp>
+#include <Headers/kern_compression.hpp>
 #include <Headers/kern_devinfo.hpp>
+#include <Headers/kern_file.hpp>
+#include <Headers/kern_time.hpp>
 #include <Headers/plugin_start.hpp>
 #include <IOKit/IOService.h>
 #include <IOKit/pci/IOPCIDevice.h>
+#include <libkern/OSByteOrder.h>
 #include <mach/vm_map.h>
 
 #include "kern_alc.hpp"
@@ -17,6 +21,53 @@
 
 static AlcEnabler alcEnabler;
 
+/**
+ *  Resource pack locations when no alcpack boot-arg is given. Injected kexts have no bundle
+ *  on disk, so their pack is looked up in a location of its own.
+ */
+static const char *DefaultPackPaths[] {
+#ifdef HAVE_ANALOG_AUDIO
+	"/Library/Extensions/AppleALC.kext/Contents/Resources/AppleALC.alcpack",
+#else
+	"/Library/Extensions/AppleALCU.kext/Contents/Resources/AppleALC.alcpack",
+#endif
+	"/Library/Application Support/Acidanthera/AppleALC.alcpack"
+};
+
+/**
+ *  Check whether the root filesystem is mounted, files missing by then are not going to appear
+ */
+static bool rootMounted() {
+	auto ctx = vfs_context_create(nullptr);
+	if (!ctx)
+		return false;
+	vnode_t vnode = nullptr;
+	bool mounted = vnode_lookup("/", 0, &vnode, ctx) == 0;
+	if (mounted)
+		vnode_put(vnode);
+	vfs_context_rele(ctx);
+	return mounted;
+}
+
+/**
+ *  Report dictionary helpers ignoring allocation failures
+ */
+static void setReportNumber(OSDictionary *dict, const char *key, uint64_t value) {
+	auto number = OSNumber::withNumber(value, 64);
+	if (number) {
+		dict->setObject(key, number);
+		number->release();
+	}
+}
+
+static void setReportString(OSDictionary *dict, const char *key, const char *value) {
+	auto string = OSString::withCString(value ? value : "");
+	if (string) {
+		dict->setObject(key, string);
+		string->release();
+	}
+}
+
 // Only used in apple-driven callbacks
 AlcEnabler* AlcEnabler::callbackAlc = nullptr;
 
@@ -31,6 +82,34 @@ void AlcEnabler::createShared() {
 }
 
 void AlcEnabler::init() {
+	// Boot-args cannot change after boot, parse them only once for every stage.
+	config.verbTrace = checkKernelArgument("-alctrace");
+	config.patchStats = checkKernelArgument("-alcpatchstats");
+	config.wakeLegacy = checkKernelArgument("-alcwakelegacy");
+	config.dhost = checkKernelArgument("-alcdhost");
+	config.binaryLog = checkKernelArgument("-alcbinlog");
+	config.hasLayoutId = PE_parse_boot_argn("alcid", &config.layoutId, sizeof(config.layoutId));
+	config.hasVerbs = PE_parse_boot_argn("alcverbs", &config.verbs, sizeof(config.verbs));
+	config.hasDelay = PE_parse_boot_argn("alcdelay", &config.delay, sizeof(config.delay));
+	config.hasTcsel = PE_parse_boot_argn("alctcsel", &config.tcsel, sizeof(config.tcsel));
+	config.hasEventPoll = PE_parse_boot_argn("alceventpoll", &config.eventPoll, sizeof(config.eventPoll));
+	config.noPack = checkKernelArgument("-alcnopack");
+	PE_parse_boot_argn("alcpack", config.packPath, sizeof(config.packPath));
+#ifdef HAVE_ANALOG_AUDIO
+	config.codecWait = CodecDiscoveryTimeout;
+	PE_parse_boot_argn("alccodecwait", &config.codecWait, sizeof(config.codecWait));
+#endif
+
+	verbTraceEnabled = config.verbTrace;
+	patchStats = config.patchStats;
+
+#ifdef DEBUG
+	// Debug logging on hot paths is recorded in binary form instead of being formatted.
+	if (config.binaryLog) {
+		BinaryLog::active = new BinaryLog;
+		SYSLOG_COND(!BinaryLog::active, "alc", "failed to allocate binary log");
+	}
+#endif
 
 	lilu.onPatcherLoadForce(
 	[](void *user, KernelPatcher &pathcer) {
@@ -38,6 +117,16 @@ void AlcEnabler::init() {
 	}, this);
 
 #ifdef HAVE_ANALOG_AUDIO
+	wakeReplay = !config.wakeLegacy;
+
+	// Detection state lives in fixed arrays, the lock is the only thing to allocate.
+	codecLock = IOLockAlloc();
+	SYSLOG_COND(!codecLock, "alc", "failed to allocate codec discovery lock");
+	overrideLock = IOLockAlloc();
+	SYSLOG_COND(!overrideLock, "alc", "failed to allocate resource override lock");
+	reloadCall = thread_call_allocate(processReloads, this);
+	SYSLOG_COND(!reloadCall, "alc", "failed to allocate codec driver reload call");
+
 	if (getKernelVersion() < KernelVersion::Mojave)
 		ADDPR(kextList)[KextIdAppleGFXHDA].switchOff();
 #else
@@ -53,7 +142,7 @@ void AlcEnabler::init() {
 	if (getKernelVersion() >= KernelVersion::Sierra) {
 		// Unlock custom audio engines by disabling Apple private entitlement verification
 		// Recent macOS versions (e.g. 10.13.6) support legacy_hda_tools_support=1 boot argument, which works similarly.
-		if (checkKernelArgument("-alcdhost")) {
+		if (config.dhost) {
 			if (getKernelVersion() >= KernelVersion::HighSierra)
 				SYSLOG("alc", "consider replacing -alcdhost with legacy_hda_tools_support=1 boot-arg!");
 			lilu.onEntitlementRequestForce([](void *user, task_t task, const char *entitlement, OSObject *&original) {
@@ -64,14 +153,115 @@ void AlcEnabler::init() {
 }
 
 void AlcEnabler::deinit() {
+	if (config.devInfo) {
+		DeviceInfo::deleter(config.devInfo);
+		config.devInfo = nullptr;
+	}
 	controllers.deinit();
+	if (BinaryLog::active) {
+		auto log = BinaryLog::active;
+		BinaryLog::active = nullptr;
+		delete log;
+	}
+	if (packData) {
+		Buffer::deleter(packData);
+		packData = nullptr;
+	}
 #ifdef HAVE_ANALOG_AUDIO
 	codecs.deinit();
+	if (codecLock) {
+		IOLockFree(codecLock);
+		codecLock = nullptr;
+	}
+	if (reloadCall) {
+		thread_call_cancel_wait(reloadCall);
+		thread_call_free(reloadCall);
+		reloadCall = nullptr;
+	}
+	if (overrideLock) {
+		const uint8_t *released = nullptr;
+		while (resourceOverrides.size() > 0) {
+			auto &item = resourceOverrides[0];
+			if (!resourceOverrides.remove(item.type, item.codec, item.layout, released))
+				break;
+			Buffer::deleter(const_cast<uint8_t *>(released));
+		}
+		IOLockFree(overrideLock);
+		overrideLock = nullptr;
+	}
 #endif
 }
 
+void AlcEnabler::snapshotDevices() {
+	config.devInfo = DeviceInfo::create();
+	if (!config.devInfo)
+		return;
+
+	// Device properties are only looked up when the boot-args do not override them.
+	auto devInfo = config.devInfo;
+	DeviceRequests requests;
+	auto hasProperty = [](IORegistryEntry *entry, const char *name) { return entry->getProperty(name) != nullptr; };
+	requests.check(devInfo->audioBuiltinAnalog, config.hasVerbs, config.hasDelay, hasProperty);
+	for (size_t gpu = 0; gpu < devInfo->videoExternal.size(); gpu++)
+		requests.check(devInfo->videoExternal[gpu].audio, config.hasVerbs, config.hasDelay, hasProperty);
+	config.verbsRequested = requests.verbs;
+	config.delayRequested = requests.delay;
+
+#ifdef HAVE_ANALOG_AUDIO
+	// DeviceInfo only reports one analog controller, workstations may have more of them.
+	// Other HDA functions may be capture cards or GPUs we do not know, so only the ones
+	// given a layout are taken over.
+	WIOKit::findEntryByPrefix("/AppleACPIPlatformExpert", "PCI", gIOServicePlane, [](void *user, IORegistryEntry *root) {
+		auto &config = static_cast<AlcEnabler *>(user)->config;
+		auto devInfo = config.devInfo;
+		auto iterator = IORegistryIterator::iterateOver(root, gIOServicePlane, kIORegistryIterateRecursively);
+		if (!iterator)
+			return false;
+
+		IORegistryEntry *entry;
+		while ((entry = OSDynamicCast(IORegistryEntry, iterator->getNextObject())) != nullptr) {
+			uint32_t code = 0;
+			if (!WIOKit::getOSDataValue(entry, "class-code", code) ||
+				(code & WIOKit::ClassCode::PCISubclassMask) != WIOKit::ClassCode::HDADevice)
+				continue;
+
+			bool known = entry == devInfo->audioBuiltinAnalog || entry == devInfo->audioBuiltinDigital;
+			for (size_t gpu = 0; !known && gpu < devInfo->videoExternal.size(); gpu++)
+				known = entry == devInfo->videoExternal[gpu].audio;
+			for (size_t i = 0; !known && i < config.extraAnalogNum; i++)
+				known = entry == config.extraAnalog[i];
+			if (known)
+				continue;
+
+			if (!entry->getProperty("alc-layout-id") && !entry->getProperty("layout-id")) {
+				DBGLOG("alc", "skipping HDA device %s without alc-layout-id or layout-id", safeString(entry->getName()));
+				continue;
+			}
+
+			if (config.extraAnalogNum == BootConfig::MaxExtraAnalog) {
+				SYSLOG("alc", "too many analog controllers, ignoring %s", safeString(entry->getName()));
+				continue;
+			}
+
+			DBGLOG("alc", "found extra analog controller %s", safeString(entry->getName()));
+			config.extraAnalog[config.extraAnalogNum++] = entry;
+		}
+
+		iterator->release();
+		// Continue with the next PCI root.
+		return false;
+	}, false, this);
+#endif
+
+	DBGLOG("alc", "snapshot has %lu external gpus, %lu extra analog controllers, verbs %d delay %d", devInfo->videoExternal.size(),
+		   config.extraAnalogNum, config.hdaVerbsEnabled(), config.alcDelayEnabled());
+}
+
 void AlcEnabler::updateProperties() {
-	auto devInfo = DeviceInfo::create();
+	BootTimings::Scope stage(timings, "updateProperties");
+
+	snapshotDevices();
+	auto devInfo = config.devInfo;
 	if (devInfo) {
 		// Assume that IGPU with connections means built-in digital audio.
 		bool hasBuiltinDigitalAudio = !devInfo->reportedFramebufferIsConnectorLess && devInfo->videoBuiltin;
@@ -111,8 +301,8 @@ void AlcEnabler::updateProperties() {
 		if (devInfo->audioBuiltinAnalog && validateInjection(devInfo->audioBuiltinAnalog)) {
 			uint32_t ven = 0;
 			if (WIOKit::getOSDataValue(devInfo->audioBuiltinAnalog, "vendor-id", ven) && ven == WIOKit::VendorID::Intel) {
-				uint32_t updateTcsel = 0;
-				if (!PE_parse_boot_argn("alctcsel", &updateTcsel, sizeof(updateTcsel)) &&
+				uint32_t updateTcsel = config.tcsel;
+				if (!config.hasTcsel &&
 					!WIOKit::getOSDataValue(devInfo->audioBuiltinAnalog, "alctcsel", updateTcsel)) {
 					updateTcsel = 0;
 				}
@@ -141,6 +331,12 @@ void AlcEnabler::updateProperties() {
 				hdaGfx = "onboard-1";
 			updateDeviceProperties(devInfo->audioBuiltinAnalog, devInfo, hdaGfx, true);
 		}
+
+		// Other analog controllers get the same layout handling, but no digital audio.
+		for (size_t i = 0; i < config.extraAnalogNum; i++) {
+			if (validateInjection(config.extraAnalog[i]))
+				updateDeviceProperties(config.extraAnalog[i], devInfo, nullptr, true);
+		}
 #endif
 
 		// Thirdly, update IGPU device in case we have digital audio
@@ -155,6 +351,7 @@ void AlcEnabler::updateProperties() {
 		}
 
 		uint32_t hdaGfxCounter = hasBuiltinDigitalAudio ? 2 : 1;
+		bool hasExternalAudio = false;
 
 		// Fourthly, update all the GPU devices if any
 		for (size_t gpu = 0; gpu < devInfo->videoExternal.size(); gpu++) {
@@ -171,12 +368,8 @@ void AlcEnabler::updateProperties() {
 				// Register the controller
 				insertController(ven, dev, rev, nullptr != hdaService->getProperty("no-controller-patch"));
 				// Disable the id in the list if any
-				if (ven == WIOKit::VendorID::NVIDIA) {
-					uint32_t device = (dev << 16) | WIOKit::VendorID::NVIDIA;
-					for (size_t i = 0; i < MaxNvidiaDeviceIds; i++)
-						if (nvidiaDeviceIdList[i] == device)
-							nvidiaDeviceIdUsage[i] = true;
-				}
+				if (ven == WIOKit::VendorID::NVIDIA)
+					nvidiaDeviceIds.reserve((dev << 16) | WIOKit::VendorID::NVIDIA);
 			}
 
 			// Refresh the main properties including hda-gfx.
@@ -202,51 +395,23 @@ void AlcEnabler::updateProperties() {
 				}
 			}
 
-			// Check that we allow sending verbs.
-			uint32_t enableHdaVerbs = 0;
-			uint32_t enableAlcDelay = 0;
-			bool checkVerbs = !PE_parse_boot_argn("alcverbs", &enableHdaVerbs, sizeof(enableHdaVerbs));
-			bool checkDelay = !PE_parse_boot_argn("alcdelay", &enableAlcDelay, sizeof(enableAlcDelay));
-
-			if (checkVerbs || checkDelay) {
-				if (devInfo->audioBuiltinAnalog) {
-					if (checkVerbs && devInfo->audioBuiltinAnalog->getProperty("alc-verbs")) {
-						enableHdaVerbs = 1;
-						checkVerbs = false;
-					}
-					if (checkDelay && devInfo->audioBuiltinAnalog->getProperty("alc-delay")) {
-						enableAlcDelay = 1;
-						checkDelay = false;
-					}
-				}
-
-				for (size_t gpu = 0; gpu < devInfo->videoExternal.size(); gpu++) {
-					auto hdaService = devInfo->videoExternal[gpu].audio;
-					if (checkVerbs && hdaService->getProperty("alc-verbs")) {
-						enableHdaVerbs = 1;
-						checkVerbs = false;
-					}
-
-					if (checkDelay && hdaService->getProperty("alc-delay")) {
-						enableAlcDelay = 1;
-						checkDelay = false;
-					}
-				}
-			}
+			hasExternalAudio = true;
+		}
 
-			if (!enableHdaVerbs) {
+		// Verb and delay support is decided from the snapshot, and like before only
+		// when at least one external GPU audio device was updated.
+		if (hasExternalAudio) {
+			if (!config.hdaVerbsEnabled()) {
 				DBGLOG("alc", "no verb support requested, disabling");
 				ADDPR(kextList)[KextIdIOHDAFamily].switchOff();
 			}
 
-			if (enableAlcDelay) {
+			if (config.alcDelayEnabled()) {
 				DBGLOG("alc", "has delay support requested, enabling");
 			} else {
 				progressState |= ProcessingState::PatchHDAController;
 			}
 		}
-
-		DeviceInfo::deleter(devInfo);
 	}
 }
 
@@ -268,8 +433,8 @@ void AlcEnabler::updateDeviceProperties(IORegistryEntry *hdaService, DeviceInfo
 		// alcid=X has highest priority and overrides any other value.
 		// alc-layout-id has normal priority and is expected to be used.
 		// layout-id will be used if both alcid and alc-layout-id are not set on non-Apple platforms.
-		uint32_t layout = 0;
-		if (PE_parse_boot_argn("alcid", &layout, sizeof(layout))) {
+		uint32_t layout = config.layoutId;
+		if (config.hasLayoutId) {
 			DBGLOG("alc", "found alc-layout-id override %u", layout);
 			hdaService->setProperty("alc-layout-id", &layout, sizeof(layout));
 		} else {
@@ -350,8 +515,9 @@ IOService *AlcEnabler::gfxProbe(IOService *ctrl, IOService *provider, SInt32 *sc
 
 bool AlcEnabler::AppleHDAController_start(IOService* service, IOService* provider)
 {
-	uint32_t delay = 0;
-	if (PE_parse_boot_argn("alcdelay", &delay, sizeof(delay))) {
+	auto &config = callbackAlc->getBootConfig();
+	uint32_t delay = config.delay;
+	if (config.hasDelay) {
 		DBGLOG("alc", "found alc-delay override %u", delay);
 		provider->setProperty("alc-delay", &delay, sizeof(delay));
 	} else {
@@ -359,22 +525,194 @@ bool AlcEnabler::AppleHDAController_start(IOService* service, IOService* provide
 			DBGLOG("alc", "found normal alc-delay %u", delay);
 	}
 	
-	if (delay > 3000) {
-		SYSLOG("alc", "alc delay cannot exceed 3000 ms, ignore it");
+	if (delay > MaxControllerDelay) {
+		SYSLOG("alc", "alc delay cannot exceed %u ms, ignore it", MaxControllerDelay);
 		delay = 0;
 	}
-		
+
+	// alc-delay is only a ceiling, start as soon as the controller and its codecs are there.
 	if (delay != 0) {
-		DBGLOG("alc", "delay AppleHDAController::start for %d ms", delay);
-		IOSleep(delay);
+		ControllerProbe probe {provider, nullptr};
+		// Intentionally using static cast to avoid PCI imports.
+		auto pci = static_cast<IOPCIDevice *>(provider->metaCast("IOPCIDevice"));
+		if (pci && (pci->configRead16(kIOPCIConfigCommand) & kIOPCICommandMemorySpace))
+			probe.registers = pci->mapDeviceMemoryWithRegister(kIOPCIConfigBaseAddress0);
+
+		DBGLOG("alc", "delay AppleHDAController::start for up to %u ms, registers %d", delay, probe.registers != nullptr);
+		auto stage = callbackAlc->timings.begin("AppleHDAController_start", nullptr, delay);
+		auto result = ReadinessWait::wait(controllerReady, &probe, 0, delay, [](uint32_t ms) { IOSleep(ms); });
+		callbackAlc->timings.end(stage);
+		OSSafeReleaseNULL(probe.registers);
+
+		DBGLOG("alc", "controller %s after %u ms of %u ms in %u polls", result.ready ? "ready" : "not ready", result.waited, delay, result.polls);
+		provider->setProperty("alc-delay-waited", result.waited, 32);
+		callbackAlc->publishTimings();
 	}
 	return FunctionCast(AppleHDAController_start, callbackAlc->orgAppleHDAController_start)(service, provider);
 }
 
+bool AlcEnabler::controllerReady(void *ctx) {
+	auto probe = static_cast<ControllerProbe *>(ctx);
+
+	// A codec is already published when the controller is restarted.
+	auto iterator = IORegistryIterator::iterateOver(probe->provider, gIOServicePlane, kIORegistryIterateRecursively);
+	if (iterator) {
+		bool found = false;
+		IORegistryEntry *entry = nullptr;
+		while (!found && (entry = OSDynamicCast(IORegistryEntry, iterator->getNextObject())) != nullptr)
+			found = entry->getProperty("IOHDACodecVendorID") != nullptr;
+		iterator->release();
+		if (found)
+			return true;
+	}
+
+	auto pci = static_cast<IOPCIDevice *>(probe->provider->metaCast("IOPCIDevice"));
+	if (!pci || !probe->registers)
+		return false;
+
+	// The device does not answer config cycles until it is powered.
+	if (pci->configRead16(kIOPCIConfigVendorID) == 0xFFFF)
+		return false;
+
+	auto base = probe->registers->getVirtualAddress();
+	auto gctl = *reinterpret_cast<volatile uint32_t *>(base + HdaRegister::GlobalControl);
+	auto statests = *reinterpret_cast<volatile uint16_t *>(base + HdaRegister::StateChangeStatus);
+	return HdaRegister::linkReady(gctl, statests);
+}
+
 IOReturn AlcEnabler::IOHDACodecDevice_executeVerb(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, unsigned int *output, bool waitForSuccess)
 {
-	DBGLOG("alc", "IOHDACodecDevice::executeVerb with parameters nid = %u, verb = %u, param = %u", nid, verb, param);
-	return FunctionCast(IOHDACodecDevice_executeVerb, callbackAlc->orgIOHDACodecDevice_executeVerb)(hdaCodecDevice, nid, verb, param, output, waitForSuccess);
+	return callbackAlc->callVerb(hdaCodecDevice, nid, verb, param, output, waitForSuccess);
+}
+
+IOReturn AlcEnabler::callTracedVerb(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, unsigned int *output, bool wait) {
+	auto start = getCurrentTimeNs();
+	auto ret = FunctionCast(IOHDACodecDevice_executeVerb, orgIOHDACodecDevice_executeVerb)(hdaCodecDevice, nid, verb, param, output, wait);
+	auto duration = getCurrentTimeNs() - start;
+
+	for (size_t i = 0; i < MaxVerbTraces; i++) {
+		if (verbTraces[i].matches(hdaCodecDevice)) {
+			auto trace = verbTraces[i].enter(hdaCodecDevice);
+			if (trace)
+				trace->record(nid, verb, param, output ? *output : 0, ret, start, duration);
+			verbTraces[i].leave();
+			break;
+		}
+	}
+
+	return ret;
+}
+
+IOReturn AlcEnabler::retryExec(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+	return callbackAlc->callVerb(hdaCodecDevice, nid, verb, param, response, false);
+}
+
+bool AlcEnabler::registerVerbTrace(void *hdaCodecDevice, VerbTrace *trace) {
+	for (size_t i = 0; i < MaxVerbTraces; i++) {
+		if (verbTraces[i].claim(hdaCodecDevice, trace))
+			return true;
+	}
+
+	SYSLOG("alc", "no free verb trace slot for codec");
+	return false;
+}
+
+void AlcEnabler::unregisterVerbTrace(void *hdaCodecDevice) {
+	for (size_t i = 0; i < MaxVerbTraces; i++) {
+		if (verbTraces[i].matches(hdaCodecDevice)) {
+			// Verbs of other threads may be recording right now, the caller frees the ring next.
+			verbTraces[i].retire();
+			while (!verbTraces[i].idle())
+				IOSleep(1);
+			verbTraces[i].release();
+			break;
+		}
+	}
+}
+
+IOReturn AlcEnabler::uploadResource(IORegistryEntry *hdaCodecDevice, uint32_t type, uint32_t layout, uint8_t *data, uint32_t size, uint32_t unpackedSize, uint32_t flags) {
+#ifdef HAVE_ANALOG_AUDIO
+	auto codec = findCodec(hdaCodecDevice);
+	IOReturn status = kIOReturnSuccess;
+	if (type != kALCResourceLayout && type != kALCResourcePlatform)
+		status = kIOReturnBadArgument;
+	else if (!codec || !codec->info)
+		status = kIOReturnNotFound;
+	else if (!overrideLock || ((flags & kResourceFlagReload) && !reloadCall))
+		status = kIOReturnNotReady;
+
+	uint32_t codecId = 0;
+	if (status == kIOReturnSuccess) {
+		codecId = (static_cast<uint32_t>(codec->vendor) << 16) | codec->codec;
+		if (layout == 0)
+			layout = controllers[codec->controller]->layout;
+	}
+
+	const uint8_t *released = nullptr;
+	if (status != kIOReturnSuccess) {
+		// Nothing to store.
+	} else if (flags & kResourceFlagRemove) {
+		IOLockLock(overrideLock);
+		bool removed = resourceOverrides.remove(type, codecId, layout, released);
+		IOLockUnlock(overrideLock);
+		if (!removed)
+			status = kIOReturnNotFound;
+	} else if (!validateResource(type, layout, data, size, unpackedSize)) {
+		status = kIOReturnBadArgument;
+	} else {
+		IOLockLock(overrideLock);
+		bool stored = resourceOverrides.install({type, codecId, layout, data, size}, released);
+		IOLockUnlock(overrideLock);
+		if (stored)
+			data = nullptr;
+		else
+			status = kIOReturnNoSpace;
+	}
+
+	if (data)
+		Buffer::deleter(data);
+	if (released)
+		Buffer::deleter(const_cast<uint8_t *>(released));
+
+	if (status != kIOReturnSuccess) {
+		DBGLOG("alc", "resource upload failed with %X", status);
+		return status;
+	}
+
+	DBGLOG("alc", "%s %s for codec %X layout %u", (flags & kResourceFlagRemove) ? "removed" : "uploaded",
+		   type == kALCResourcePlatform ? "platform" : "layout", codecId, layout);
+	if (flags & kResourceFlagReload) {
+		IOLockLock(overrideLock);
+		bool queued = resourceOverrides.queueReload(static_cast<size_t>(codec - codecs[0]));
+		IOLockUnlock(overrideLock);
+		if (!queued)
+			return kIOReturnNoSpace;
+		thread_call_enter(reloadCall);
+	}
+
+	return kIOReturnSuccess;
+#else
+	if (data)
+		Buffer::deleter(data);
+	return kIOReturnUnsupported;
+#endif
+}
+
+IOReturn AlcEnabler::executeVerb(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, unsigned int *output, bool wait, uint32_t *retries) {
+	if (retries)
+		*retries = 0;
+
+	// IOHDAFamily only waits for SET_STREAM_FORMAT, leave everything else as is.
+	if (!wait || verb != HdaVerb::SetStreamFormat)
+		return callVerb(hdaCodecDevice, nid, verb, param, output, wait);
+
+	auto result = StreamFormatRetry::setFormat(retryExec, hdaCodecDevice, nid, param, output, [](uint32_t ms) { IOSleep(ms); });
+	if (retries)
+		*retries = result.retries;
+
+	SYSLOG_COND(result.status != kIOReturnSuccess, "alc", "stream format %X for nid %u failed after %u retries (%u ms) - %08X", param, nid, result.retries, result.slept, result.status);
+	ALCLOG_COND(result.status == kIOReturnSuccess && result.retries > 0, "alc", "stream format %X for nid %u succeeded after %u retries (%u ms)", param, nid, result.retries, result.slept);
+	return result.status;
 }
 
 uint32_t AlcEnabler::getAudioLayout(IOService *hdaDriver) {
@@ -393,11 +731,31 @@ uint32_t AlcEnabler::getAudioLayout(IOService *hdaDriver) {
 }
 
 void AlcEnabler::handleAudioClientEntitlement(task_t task, const char *entitlement, OSObject *&original) {
-	if ((!original || original != kOSBooleanTrue) && !strcmp(entitlement, "com.apple.private.audio.driver-host"))
+	__atomic_fetch_add(&entitlementCalls, 1, __ATOMIC_RELAXED);
+	if (!entitlement || strcmp(entitlement, "com.apple.private.audio.driver-host") != 0)
+		return;
+
+	__atomic_fetch_add(&entitlementMatches, 1, __ATOMIC_RELAXED);
+	if (!original || original != kOSBooleanTrue) {
 		original = kOSBooleanTrue;
+		__atomic_fetch_add(&entitlementGrants, 1, __ATOMIC_RELAXED);
+	}
 }
 
-void AlcEnabler::eraseRedundantLogs(KernelPatcher &patcher, size_t index) {
+void AlcEnabler::publishEntitlementStats() {
+	auto entry = getReportEntry();
+	auto report = entry ? OSDictionary::withCapacity(3) : nullptr;
+	if (!report)
+		return;
+
+	setReportNumber(report, "Calls", __atomic_load_n(&entitlementCalls, __ATOMIC_RELAXED));
+	setReportNumber(report, "Matches", __atomic_load_n(&entitlementMatches, __ATOMIC_RELAXED));
+	setReportNumber(report, "Granted", __atomic_load_n(&entitlementGrants, __ATOMIC_RELAXED));
+	entry->setProperty("alc-entitlement-stats", report);
+	report->release();
+}
+
+void AlcEnabler::eraseRedundantLogs(KernelPatcher &patcher, size_t index, mach_vm_address_t address, size_t size) {
 	static const uint8_t logAssertFind[] = { 0x53, 0x6F, 0x75, 0x6E, 0x64, 0x20, 0x61, 0x73 };
 	static const uint8_t nullReplace[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
@@ -412,8 +770,7 @@ void AlcEnabler::eraseRedundantLogs(KernelPatcher &patcher, size_t index) {
 		else
 			currentPatch.count = 2;
 
-		patcher.applyLookupPatch(&currentPatch);
-		patcher.clearError();
+		applyLookupPatch(patcher, "eraseRedundantLogs", currentPatch, address, size);
 	}
 }
 
@@ -432,6 +789,7 @@ void AlcEnabler::processKext(KernelPatcher &patcher, size_t index, mach_vm_addre
 #ifdef HAVE_ANALOG_AUDIO
 	if (kextIndex == KextIdAppleGFXHDA) {
 		KernelPatcher::RouteRequest request("__ZN21AppleGFXHDAController5probeEP9IOServicePi", gfxProbe, orgGfxProbe);
+		BootTimings::Scope stage(timings, "routeMultiple", ADDPR(kextList)[kextIndex].id);
 		patcher.routeMultiple(index, &request, 1, address, size);
 		return;
 	}
@@ -464,36 +822,18 @@ void AlcEnabler::processKext(KernelPatcher &patcher, size_t index, mach_vm_addre
 			}
 
 			DBGLOG("alc", "handling %lu controller %X:%X with %lu patches - %s", i, info->vendor, info->device, info->patchNum, info->name);
-			// Choose a free device-id for NVIDIA HDAU to support multigpu setups
-			if (info->vendor == WIOKit::VendorID::NVIDIA) {
-				for (size_t j = 0; j < info->patchNum; j++) {
-					auto &p = info->patches[j].patch;
-					if (p.size == sizeof(uint32_t) && *reinterpret_cast<const uint32_t *>(p.find) == NvidiaSpecialFind) {
-						DBGLOG("alc", "finding %08X repl at %lu curr %lu", *reinterpret_cast<const uint32_t *>(p.replace), i, currentFreeNvidiaDeviceId);
-						while (currentFreeNvidiaDeviceId < MaxNvidiaDeviceIds) {
-							if (!nvidiaDeviceIdUsage[currentFreeNvidiaDeviceId]) {
-								p.find = reinterpret_cast<const uint8_t *>(&nvidiaDeviceIdList[currentFreeNvidiaDeviceId]);
-								DBGLOG("alc", "assigned %08X find %08X repl at %lu curr %lu", *reinterpret_cast<const uint32_t *>(p.find), *reinterpret_cast<const uint32_t *>(p.replace), i, currentFreeNvidiaDeviceId);
-								nvidiaDeviceIdUsage[currentFreeNvidiaDeviceId] = true;
-								currentFreeNvidiaDeviceId++;
-								break;
-							}
-							currentFreeNvidiaDeviceId++;
-						}
-					}
-				}
-			}
-
 			if (controllers[i]->nopatch) {
 				DBGLOG("alc", "skipping %lu controller %X:%X:%X due to no-controller-patch", i, controllers[i]->vendor, controllers[i]->device, controllers[i]->revision);
 				continue;
 			}
-			applyPatches(patcher, index, info->patches, info->patchNum);
+
+			BootTimings::Scope stage(timings, "applyPatches", ADDPR(kextList)[kextIndex].id, static_cast<uint32_t>(i));
+			applyPatches(patcher, index, info->patches, info->patchNum, address, size, controllers[i]->hdauId);
 		}
 
 		// Only do this if -alcdbg is not passed
 		if (!ADDPR(debugEnabled))
-			eraseRedundantLogs(patcher, kextIndex);
+			eraseRedundantLogs(patcher, kextIndex, address, size);
 	}
 
 #ifdef HAVE_ANALOG_AUDIO
@@ -509,8 +849,18 @@ void AlcEnabler::processKext(KernelPatcher &patcher, size_t index, mach_vm_addre
 				DBGLOG("alc", "will route resource loading callbacks");
 				progressState |= ProcessingState::CallbacksWantRouting;
 			}
-			
-			applyPatches(patcher, index, info->patches, info->patchNum);
+
+			// Identical codecs on several addresses or controllers share their patches.
+			bool applied = false;
+			for (size_t j = 0; j < i && !applied; j++)
+				applied = codecs[j]->info == info;
+			if (applied) {
+				DBGLOG("alc", "patches of %lu codec were already applied", i);
+				continue;
+			}
+
+			BootTimings::Scope stage(timings, "applyCodecPatches", ADDPR(kextList)[kextIndex].id, static_cast<uint32_t>(i));
+			applyPatches(patcher, index, info->patches, info->patchNum, address, size);
 		}
 	}
 	
@@ -522,93 +872,405 @@ void AlcEnabler::processKext(KernelPatcher &patcher, size_t index, mach_vm_addre
 			KernelPatcher::RouteRequest("__ZN20AppleHDACodecGeneric38initializePinConfigDefaultFromOverrideEP9IOService", initializePinConfig, orgInitializePinConfig),
 		};
 
+		auto stage = timings.begin("routeMultiple", ADDPR(kextList)[kextIndex].id);
 		patcher.routeMultiple(index, requests, address, size);
+		timings.end(stage);
 
 		// patch AppleHDA to remove redundant logs
 		if (!ADDPR(debugEnabled))
-			eraseRedundantLogs(patcher, kextIndex);
+			eraseRedundantLogs(patcher, kextIndex, address, size);
 	}
 #endif
 
 	if (!(progressState & ProcessingState::PatchHDAFamily) && kextIndex == KextIdIOHDAFamily) {
 		progressState |= ProcessingState::PatchHDAFamily;
 		KernelPatcher::RouteRequest request("__ZN16IOHDACodecDevice11executeVerbEtttPjb", IOHDACodecDevice_executeVerb, orgIOHDACodecDevice_executeVerb);
+		BootTimings::Scope stage(timings, "routeMultiple", ADDPR(kextList)[kextIndex].id);
 		patcher.routeMultiple(index, &request, 1, address, size);
 	}
 	
 	if (!(progressState & ProcessingState::PatchHDAController) && kextIndex == KextIdAppleHDAController) {
 		progressState |= ProcessingState::PatchHDAController;
 		KernelPatcher::RouteRequest request("__ZN18AppleHDAController5startEP9IOService", AppleHDAController_start, orgAppleHDAController_start);
+		BootTimings::Scope stage(timings, "routeMultiple", ADDPR(kextList)[kextIndex].id);
 		patcher.routeMultiple(index, &request, 1, address, size);
 	}
 	
 	// Ignore all the errors for other processors
 	patcher.clearError();
+
+	publishTimings();
+	publishPatchReport();
+}
+
+IORegistryEntry *AlcEnabler::getReportEntry() {
+	for (size_t i = 0, num = controllers.size(); i < num; i++)
+		if (controllers[i]->detect)
+			return controllers[i]->detect;
+	return nullptr;
+}
+
+void AlcEnabler::applyLookupPatch(KernelPatcher &patcher, const char *source, const KernelPatcher::LookupPatch &patch, mach_vm_address_t address, size_t size) {
+	PatchRecord record {source, patch.kext->id, static_cast<uint32_t>(patch.count), kALCPatchFoundUnknown, 0, 0, 0};
+
+	// Lilu stops at the expected count and only reports success, so count exact matches separately.
+	if (patchStats && address && patch.size > 0 && size >= patch.size) {
+		auto data = reinterpret_cast<const uint8_t *>(address);
+		uint32_t found = 0;
+		for (size_t i = 0; i + patch.size <= size; i++) {
+			if (data[i] == patch.find[0] && !memcmp(&data[i], patch.find, patch.size))
+				found++;
+		}
+		record.found = found;
+		record.scanned = size;
+	}
+
+	auto start = getCurrentTimeNs();
+	patcher.applyLookupPatch(&patch);
+	record.duration = getCurrentTimeNs() - start;
+	record.status = static_cast<uint32_t>(patcher.getError());
+	ALCLOG_COND(record.status != 0, "alc", "patch %s for %s failed - %u", source, record.kext, record.status);
+
+	// Patches for other kernels or models are expected to fail, they are only reported.
+	patcher.clearError();
+
+	auto index = __atomic_load_n(&patchRecordCount, __ATOMIC_RELAXED);
+	if (index < MaxPatchRecords) {
+		patchReport[index] = record;
+		__atomic_store_n(&patchRecordCount, index + 1, __ATOMIC_RELEASE);
+	} else {
+		patchRecordsDropped++;
+	}
+}
+
+size_t AlcEnabler::copyPatchReport(ALCPatchRecord *records, size_t num) {
+	auto total = __atomic_load_n(&patchRecordCount, __ATOMIC_ACQUIRE);
+	for (size_t i = 0; i < total && i < num; i++) {
+		auto &src = patchReport[i];
+		auto &dst = records[i];
+		bzero(&dst, sizeof(dst));
+		strlcpy(dst.source, src.source ? src.source : "", sizeof(dst.source));
+		strlcpy(dst.kext, src.kext ? src.kext : "", sizeof(dst.kext));
+		dst.count = src.count;
+		dst.found = src.found;
+		dst.status = src.status;
+		dst.duration = src.duration;
+		dst.scanned = src.scanned;
+	}
+	return total;
+}
+
+void AlcEnabler::publishPatchReport() {
+	auto entry = getReportEntry();
+	if (!entry)
+		return;
+
+	auto num = __atomic_load_n(&patchRecordCount, __ATOMIC_ACQUIRE);
+	auto patches = OSArray::withCapacity(static_cast<unsigned>(num));
+	auto report = OSDictionary::withCapacity(3);
+	if (!patches || !report) {
+		SYSLOG("alc", "failed to allocate patch report");
+		OSSafeReleaseNULL(patches);
+		OSSafeReleaseNULL(report);
+		return;
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		auto &record = patchReport[i];
+		auto dict = OSDictionary::withCapacity(7);
+		if (!dict)
+			continue;
+
+		setReportString(dict, "Source", record.source);
+		setReportString(dict, "Kext", record.kext);
+		setReportNumber(dict, "Count", record.count);
+		if (record.found != kALCPatchFoundUnknown) {
+			setReportNumber(dict, "Found", record.found);
+			setReportNumber(dict, "Scanned", record.scanned);
+		}
+		setReportNumber(dict, "Status", record.status);
+		setReportNumber(dict, "Duration", record.duration);
+		patches->setObject(dict);
+		dict->release();
+	}
+
+	report->setObject("Patches", patches);
+	setReportNumber(report, "Dropped", patchRecordsDropped);
+	entry->setProperty("alc-patch-report", report);
+	patches->release();
+	report->release();
+}
+
+void AlcEnabler::publishTimings() {
+	auto entry = getReportEntry();
+	if (!entry)
+		return;
+
+	auto num = timings.count();
+	auto stages = OSArray::withCapacity(static_cast<unsigned>(num));
+	auto report = OSDictionary::withCapacity(2);
+	if (!stages || !report) {
+		SYSLOG("alc", "failed to allocate boot timings report");
+		OSSafeReleaseNULL(stages);
+		OSSafeReleaseNULL(report);
+		return;
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		auto stage = timings.get(i);
+		if (!stage)
+			continue;
+
+		auto dict = OSDictionary::withCapacity(5);
+		if (!dict)
+			continue;
+
+		setReportString(dict, "Name", stage->name);
+		if (stage->target)
+			setReportString(dict, "Target", stage->target);
+		setReportNumber(dict, "Detail", stage->detail);
+		setReportNumber(dict, "Start", stage->start);
+		setReportNumber(dict, "Duration", stage->duration);
+		stages->setObject(dict);
+		dict->release();
+	}
+
+	report->setObject("Stages", stages);
+	setReportNumber(report, "Dropped", timings.droppedCount());
+	entry->setProperty("alc-boot-timings", report);
+	stages->release();
+	report->release();
 }
 
 void AlcEnabler::grabControllers() {
+	BootTimings::Scope stage(timings, "grabControllers");
 	computerModel = BaseDeviceInfo::get().modelType;
 
-	auto devInfo = DeviceInfo::create();
+	// Reuse the device tree captured at patcher load instead of walking it again.
+	auto devInfo = config.devInfo;
 	if (devInfo) {
 		// Nice, we found some controller, add it
-		uint32_t ven {0}, dev {0}, rev {0}, lid {0};
-		auto sect = devInfo->audioBuiltinAnalog;
-		if (sect &&
-			WIOKit::getOSDataValue(sect, "vendor-id", ven) &&
-			WIOKit::getOSDataValue(sect, "device-id", dev) &&
-			WIOKit::getOSDataValue(sect, "revision-id", rev) &&
-			WIOKit::getOSDataValue(sect, "alc-layout-id", lid)) {
-
-			insertController(ven, dev, rev, ControllerModInfo::PlatformAny, nullptr != sect->getProperty("no-controller-patch"), lid, sect);
-		} else {
+		auto insertAnalog = [this](IORegistryEntry *sect) {
+			uint32_t ven {0}, dev {0}, rev {0}, lid {0};
+			if (sect &&
+				WIOKit::getOSDataValue(sect, "vendor-id", ven) &&
+				WIOKit::getOSDataValue(sect, "device-id", dev) &&
+				WIOKit::getOSDataValue(sect, "revision-id", rev) &&
+				WIOKit::getOSDataValue(sect, "alc-layout-id", lid)) {
+
+				insertController(ven, dev, rev, nullptr != sect->getProperty("no-controller-patch"), ControllerModInfo::PlatformAny, lid, sect);
+				return true;
+			}
+			return false;
+		};
+
+		if (!insertAnalog(devInfo->audioBuiltinAnalog))
 			SYSLOG("alc", "failed to obtain device info for analog controller (%d)", devInfo->audioBuiltinAnalog != nullptr);
-		}
 
-		DeviceInfo::deleter(devInfo);
+		for (size_t i = 0; i < config.extraAnalogNum; i++) {
+			if (!insertAnalog(config.extraAnalog[i]))
+				SYSLOG("alc", "failed to obtain device info for extra analog controller %lu", i);
+		}
 	} else {
 		SYSLOG("alc", "failed to obtain device info for analog controller");
 	}
 
+	if (droppedControllers > 0)
+		SYSLOG("alc", "%lu audio controllers exceed the limit of %lu and are not patched", droppedControllers, MaxControllers);
+
 	if (controllers.size() > 0) {
 		DBGLOG("alc", "found %lu audio controllers", controllers.size());
 		validateControllers();
+		assignNvidiaDeviceIds();
+	}
+}
+
+void AlcEnabler::assignNvidiaDeviceIds() {
+	// Choose a free device-id for NVIDIA HDAU to support multigpu setups.
+	// Only controllers with NvidiaSpecialFind patches need one.
+	auto needsId = [](const ControllerInfo *controller) {
+		auto info = controller->info;
+		if (!info || info->vendor != WIOKit::VendorID::NVIDIA)
+			return false;
+		for (size_t j = 0; j < info->patchNum; j++) {
+			auto &p = info->patches[j].patch;
+			if (p.size == sizeof(uint32_t) && *reinterpret_cast<const uint32_t *>(p.find) == NvidiaSpecialFind)
+				return true;
+		}
+		return false;
+	};
+
+	bool requested = false;
+	for (size_t i = 0, num = controllers.size(); i < num; i++) {
+		if (needsId(controllers[i])) {
+			nvidiaDeviceIds.request((controllers[i]->device << 16) | WIOKit::VendorID::NVIDIA);
+			requested = true;
+		}
+	}
+
+	if (!requested)
+		return;
+
+	auto missing = nvidiaDeviceIds.assign();
+	if (missing > 0 || nvidiaDeviceIds.overflowed())
+		SYSLOG("alc", "no free HDAU device-id for %lu%s NVIDIA models", missing, nvidiaDeviceIds.overflowed() ? "+" : "");
+
+	for (size_t i = 0, num = controllers.size(); i < num; i++) {
+		auto controller = controllers[i];
+		if (needsId(controller)) {
+			controller->hdauId = nvidiaDeviceIds.find((controller->device << 16) | WIOKit::VendorID::NVIDIA);
+			DBGLOG("alc", "assigned %08X to %lu controller %X:%X", controller->hdauId ? *controller->hdauId : 0, i, controller->vendor, controller->device);
+		}
+	}
+}
+
+const respack *AlcEnabler::loadResourcePack() {
+	auto state = __atomic_load_n(&packState, __ATOMIC_ACQUIRE);
+	if (state == PackLoaded)
+		return &pack;
+	if (state != PackUnread || config.noPack)
+		return nullptr;
+
+	// Concurrent requests use the compiled-in tables while the pack is being read.
+	uint32_t expected = PackUnread;
+	if (!__atomic_compare_exchange_n(&packState, &expected, PackReading, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return nullptr;
+
+	// XNU cannot map a file into the kernel, so the pack is read once and looked up in place.
+	size_t size = 0;
+	uint8_t *data = nullptr;
+	const char *path = config.packPath;
+	if (path[0] != '\0') {
+		data = FileIO::readFileToBuffer(path, size);
+	} else {
+		for (size_t i = 0; i < arrsize(DefaultPackPaths) && !data; i++) {
+			path = DefaultPackPaths[i];
+			data = FileIO::readFileToBuffer(path, size);
+		}
+	}
+
+	if (!data) {
+		// Until the root filesystem is mounted the pack may just not be readable yet.
+		if (rootMounted()) {
+			DBGLOG("alc", "no resource pack found, using compiled-in tables");
+			__atomic_store_n(&packState, PackFailed, __ATOMIC_RELEASE);
+		} else {
+			DBGLOG("alc", "resource pack is not available yet");
+			__atomic_store_n(&packState, PackUnread, __ATOMIC_RELEASE);
+		}
+		return nullptr;
+	}
+
+	// A pack of another build may carry older files than the compiled-in tables, or patches for another kext list.
+	auto status = respack_open(&pack, data, size);
+	bool sameBuild = status == RESPACK_OK && pack.header->build_hash == ADDPR(resourceBuildHash) &&
+		pack.header->kext_count == ADDPR(kextListSize);
+	if (!sameBuild) {
+		if (status != RESPACK_OK)
+			SYSLOG("alc", "ignoring resource pack %s: %s", path, respack_status_name(status));
+		else
+			SYSLOG("alc", "ignoring resource pack %s of build %08X, expected %08X", path, pack.header->build_hash, ADDPR(resourceBuildHash));
+		Buffer::deleter(data);
+		__atomic_store_n(&packState, PackFailed, __ATOMIC_RELEASE);
+		return nullptr;
+	}
+
+	packData = data;
+	DBGLOG("alc", "loaded resource pack %s of %lu bytes with %u entries", path, size, pack.header->entry_count);
+	auto entry = getReportEntry();
+	auto report = entry ? OSDictionary::withCapacity(2) : nullptr;
+	if (report) {
+		setReportNumber(report, "Size", size);
+		setReportNumber(report, "Entries", pack.header->entry_count);
+		entry->setProperty("alc-resource-pack", report);
+		report->release();
+	}
+
+	__atomic_store_n(&packState, PackLoaded, __ATOMIC_RELEASE);
+	return &pack;
+}
+
+const ControllerModInfo *AlcEnabler::decodePackController(const respack_entry *entry) {
+	for (size_t i = 0; i < packControllerNum; i++)
+		if (packControllerEntries[i] == entry)
+			return &packControllers[i];
+
+	respack_controller_view ctrl;
+	if (packControllerNum == MaxControllers || !respack_controller(&pack, entry, &ctrl) ||
+		ctrl.patch_count > MaxPackPatches - packPatchNum) {
+		SYSLOG("alc", "cannot use resource pack controller %X", entry->id);
+		return nullptr;
+	}
+
+	auto patches = &packPatches[packPatchNum];
+	auto cursor = ctrl.patches;
+	respack_patch_view patch;
+	for (uint32_t i = 0; i < ctrl.patch_count && respack_next_patch(&ctrl, &cursor, &patch); i++) {
+		patches[i] = {{&ADDPR(kextList)[patch.kext], patch.find, patch.replace, patch.size, patch.count},
+			patch.min_kernel, patch.max_kernel, "AppleALC.alcpack"};
 	}
+	packPatchNum += ctrl.patch_count;
+
+	auto &mod = packControllers[packControllerNum];
+	mod = {DEBUG_STRING("AppleALC.alcpack"), entry->id >> 16, entry->id & 0xFFFF, ctrl.revisions, ctrl.revision_count,
+		ctrl.platform, ctrl.model, patches, ctrl.patch_count};
+	packControllerEntries[packControllerNum++] = entry;
+	return &mod;
 }
 
 void AlcEnabler::validateControllers() {
+	BootTimings::Scope stage(timings, "validateControllers");
+	auto packed = loadResourcePack();
 	for (size_t i = 0, num = controllers.size(); i < num; i++) {
-		DBGLOG("alc", "validating %lu controller %X:%X:%X", i, controllers[i]->vendor, controllers[i]->device, controllers[i]->revision);
-		for (size_t mod = 0; mod < ADDPR(controllerModSize); mod++) {
-			DBGLOG("alc", "comparing to %lu mod %X:%X", mod, ADDPR(controllerMod)[mod].vendor, ADDPR(controllerMod)[mod].device);
-			if (controllers[i]->vendor == ADDPR(controllerMod)[mod].vendor &&
-				controllers[i]->device == ADDPR(controllerMod)[mod].device) {
+		ALCLOG("alc", "validating %lu controller %X:%X:%X", i, controllers[i]->vendor, controllers[i]->device, controllers[i]->revision);
+
+		auto suitable = [this, i](const ControllerModInfo &mod) {
+			// Check revision if present
+			size_t rev {0};
+			while (rev < mod.revisionNum && mod.revisions[rev] != controllers[i]->revision)
+				rev++;
+
+			// Check AAPL,ig-platform-id if present
+			if (mod.platform != ControllerModInfo::PlatformAny && mod.platform != controllers[i]->platform) {
+				ALCLOG("alc", "not matching platform was found %X vs %X for %s", mod.platform, controllers[i]->platform, mod.name);
+				return false;
+			}
 
-				// Check revision if present
-				size_t rev {0};
-				while (rev < ADDPR(controllerMod)[mod].revisionNum &&
-					   ADDPR(controllerMod)[mod].revisions[rev] != controllers[i]->revision)
-					rev++;
-
-				// Check AAPL,ig-platform-id if present
-				if (ADDPR(controllerMod)[mod].platform != ControllerModInfo::PlatformAny &&
-					ADDPR(controllerMod)[mod].platform != controllers[i]->platform) {
-					DBGLOG("alc", "not matching platform was found %X vs %X for %s", ADDPR(controllerMod)[mod].platform, controllers[i]->platform, &ADDPR(controllerMod)[mod].name);
-					continue;
-				}
+			// Check if computer model is suitable
+			if (!(computerModel & mod.computerModel)) {
+				ALCLOG("alc", "unsuitable computer model was found %X vs %X for %s", mod.computerModel, computerModel, mod.name);
+				return false;
+			}
 
-				// Check if computer model is suitable
-				if (!(computerModel & ADDPR(controllerMod)[mod].computerModel)) {
-					DBGLOG("alc", "unsuitable computer model was found %X vs %X for %s", ADDPR(controllerMod)[mod].computerModel, computerModel, &ADDPR(controllerMod)[mod].name);
-					continue;
-				}
+			return rev != mod.revisionNum || mod.revisionNum == 0;
+		};
 
-				if (rev != ADDPR(controllerMod)[mod].revisionNum ||
-					ADDPR(controllerMod)[mod].revisionNum == 0) {
-					DBGLOG("alc", "found mod for %lu controller - %s", i, &ADDPR(controllerMod)[mod].name);
-					controllers[i]->info= &ADDPR(controllerMod)[mod];
-					break;
-				}
+		// Resource pack entries take precedence over the compiled-in table.
+		bool found = false;
+		uint32_t id = (controllers[i]->vendor << 16) | controllers[i]->device;
+		for (uint32_t sub = 0; packed && !found; sub++) {
+			auto entry = respack_find(packed, RESPACK_CONTROLLER, id, sub, 0);
+			if (!entry)
+				break;
+			auto mod = decodePackController(entry);
+			if (mod && suitable(*mod)) {
+				ALCLOG("alc", "found pack mod %u for %lu controller", sub, i);
+				controllers[i]->info = mod;
+				found = true;
+			}
+		}
+
+		if (found)
+			continue;
+
+		for (size_t mod = 0; mod < ADDPR(controllerModSize); mod++) {
+			ALCLOG("alc", "comparing to %lu mod %X:%X", mod, ADDPR(controllerMod)[mod].vendor, ADDPR(controllerMod)[mod].device);
+			if (controllers[i]->vendor == ADDPR(controllerMod)[mod].vendor &&
+				controllers[i]->device == ADDPR(controllerMod)[mod].device &&
+				suitable(ADDPR(controllerMod)[mod])) {
+				ALCLOG("alc", "found mod for %lu controller - %s", i, ADDPR(controllerMod)[mod].name);
+				controllers[i]->info = &ADDPR(controllerMod)[mod];
+				break;
 			}
 		}
 	}
@@ -616,9 +1278,17 @@ void AlcEnabler::validateControllers() {
 
 #ifdef HAVE_ANALOG_AUDIO
 IOReturn AlcEnabler::performPowerChange(IOService *hdaDriver, uint32_t from, uint32_t to, unsigned int *timer) {
+	auto hdaCodec = hdaDriver ? OSDynamicCast(IOService, hdaDriver->getParentEntry(gIOServicePlane)) : nullptr;
+
+	// Capture the codec state while it is still powered.
+	if (hdaCodec && to == ALCAudioDeviceSleep) {
+		auto wake = callbackAlc->getWakeConfig(hdaCodec);
+		if (wake && __atomic_load_n(&wake->verbs, __ATOMIC_ACQUIRE))
+			callbackAlc->captureWakeSnapshot(*wake);
+	}
+
 	IOReturn ret = FunctionCast(performPowerChange, callbackAlc->orgPerformPowerChange)(hdaDriver, from, to, timer);
 
-	auto hdaCodec = hdaDriver ? OSDynamicCast(IOService, hdaDriver->getParentEntry(gIOServicePlane)) : nullptr;
 	if (hdaCodec) {
 		auto pinStatus = OSDynamicCast(OSBoolean, hdaCodec->getProperty("alc-pinconfig-status"));
 		auto sleepStatus = OSDynamicCast(OSBoolean, hdaCodec->getProperty("alc-sleep-status"));
@@ -633,8 +1303,18 @@ IOReturn AlcEnabler::performPowerChange(IOService *hdaDriver, uint32_t from, uin
 				if (to == ALCAudioDeviceSleep) {
 					hdaCodec->setProperty("alc-sleep-status", kOSBooleanTrue);
 				} else if (sleep && (to == ALCAudioDeviceIdle || to == ALCAudioDeviceActive)) {
-					DBGLOG("alc", "power change %s at %s forcing wake verbs", safeString(hdaDriver->getName()), safeString(hdaCodec->getName()));
-					auto forceRet = FunctionCast(initializePinConfig, callbackAlc->orgInitializePinConfig)(hdaCodec, hdaCodec);
+					auto wake = callbackAlc->getWakeConfig(hdaCodec);
+					bool replay = wake && __atomic_load_n(&wake->verbs, __ATOMIC_ACQUIRE);
+					DBGLOG("alc", "power change %s at %s forcing wake verbs, replay %d", safeString(hdaDriver->getName()), safeString(hdaCodec->getName()), replay);
+
+					auto start = getCurrentTimeNs();
+					IOReturn forceRet;
+					if (replay)
+						forceRet = callbackAlc->replayWakeVerbs(*wake);
+					else
+						forceRet = FunctionCast(initializePinConfig, callbackAlc->orgInitializePinConfig)(hdaCodec, hdaCodec);
+					callbackAlc->publishWakeLatency(hdaCodec, wake, replay, getCurrentTimeNs() - start);
+
 					SYSLOG_COND(forceRet != kIOReturnSuccess, "alc", "power change %s at %s forcing wake returned %08X",
 								safeString(hdaDriver->getName()), safeString(hdaCodec->getName()), forceRet);
 					hdaCodec->setProperty("alc-sleep-status", kOSBooleanFalse);
@@ -657,12 +1337,19 @@ IOReturn AlcEnabler::initializePinConfig(IOService *hdaCodec, IOService *configD
 		uint32_t appleLayout = getAudioLayout(hdaCodec);
 		uint32_t analogCodec = 0;
 		uint32_t analogLayout = 0;
-		for (size_t i = 0, s = callbackAlc->codecs.size(); i < s; i++) {
-			if (callbackAlc->controllers[callbackAlc->codecs[i]->controller]->layout > 0) {
-				analogCodec = static_cast<uint32_t>(callbackAlc->codecs[i]->vendor) << 16 | callbackAlc->codecs[i]->codec;
-				analogLayout = callbackAlc->controllers[callbackAlc->codecs[i]->controller]->layout;
-				break;
-			}
+		// Use the codec this instance drives, or the first codec with a layout if it is unknown.
+		auto codec = callbackAlc->findCodec(hdaCodec);
+		if (!codec) {
+			auto &codecs = callbackAlc->codecs;
+			auto index = CodecRouting::firstWithLayout(codecs, [](const CodecInfo *info) {
+				return callbackAlc->controllers[info->controller]->layout > 0;
+			});
+			codec = index < codecs.size() ? codecs[index] : nullptr;
+		}
+
+		if (codec && callbackAlc->controllers[codec->controller]->layout > 0) {
+			analogCodec = static_cast<uint32_t>(codec->vendor) << 16 | codec->codec;
+			analogLayout = callbackAlc->controllers[codec->controller]->layout;
 		}
 
 		DBGLOG("alc", "initializePinConfig %s received hda " PRIKADDR ", config " PRIKADDR " config name %s apple layout %u codec %08X layout %u",
@@ -675,118 +1362,303 @@ IOReturn AlcEnabler::initializePinConfig(IOService *hdaCodec, IOService *configD
 		if (appleLayout && analogCodec && analogLayout) {
 			auto configList = OSDynamicCast(OSArray, configDevice->getProperty("HDAConfigDefault"));
 			if (configList) {
-				unsigned int total = configList->getCount();
-				DBGLOG("alc", "discovered HDAConfigDefault with %u entries", total);
+				const PinConfigEntry *entry = nullptr;
+				auto config = findPinConfig(configList, analogCodec, analogLayout, entry);
+				if (config)
+					callbackAlc->applyPinConfig(hdaCodec, configDevice, config, entry, appleLayout);
+			} else {
+				SYSLOG("alc", "invalid HDAConfigDefault, pinconfigs are broken");
+			}
+		}
+	}
 
-				for (unsigned int i = 0; i < total; i++) {
-					auto config = OSDynamicCast(OSDictionary, configList->getObject(i));
-					if (config == nullptr) {
-						SYSLOG("alc", "invalid HDAConfigDefault entry at %u, pinconfigs are broken", i);
-						continue;
-					}
-					auto currCodec = OSDynamicCast(OSNumber, config->getObject("CodecID"));
-					auto currLayout = OSDynamicCast(OSNumber, config->getObject("LayoutID"));
-					if (currCodec == nullptr || currLayout == nullptr ||
-					    currCodec->unsigned32BitValue() != analogCodec || currLayout->unsigned32BitValue() != analogLayout) {
-						// Not analog or wrong entry.
-						continue;
-					}
+	return FunctionCast(initializePinConfig, callbackAlc->orgInitializePinConfig)(hdaCodec, configDevice);
+}
 
-					auto newConfigCollection = config->copyCollection();
-					auto newConfig = OSDynamicCast(OSDictionary, newConfigCollection);
-					const OSObject *newConfigObj  = OSDynamicCast(OSObject, newConfigCollection);
-					if (newConfig == nullptr || newConfigObj == nullptr) {
-						SYSLOG("alc", "failed to copy analog HDAConfigDefault %u collection", i);
-						OSSafeReleaseNULL(newConfigCollection);
-						break;
-					}
+const PinConfigEntry *AlcEnabler::lookupPinConfig(uint32_t codec, uint32_t layout) {
+	return PinConfigEntry::find(ADDPR(pinConfigs), ADDPR(pinConfigsSize), codec, layout);
+}
 
-					auto configData = OSDynamicCast(OSData, config->getObject("ConfigData"));
-					auto wakeConfigData = OSDynamicCast(OSData, config->getObject("WakeConfigData"));
-					auto reinitBool = OSDynamicCast(OSBoolean, config->getObject("WakeVerbReinit"));
-					auto reinit = reinitBool != nullptr ? reinitBool->getValue() : false;
-					DBGLOG("alc", "current config entry has boot %d, wake %d, reinit %d", configData != nullptr,
-						   wakeConfigData != nullptr, reinitBool ? reinit : -1);
-
-					// Replace the config list with a new list to avoid multiple iterations,
-					// and actually fix the LayoutID number we hook in.
-					auto num = OSNumber::withNumber(appleLayout, 32);
-					if (num != nullptr) {
-						newConfig->setObject("LayoutID", num);
-						num->release();
-					}
+OSDictionary *AlcEnabler::findPinConfig(OSArray *configList, uint32_t codec, uint32_t layout, const PinConfigEntry *&entry) {
+	// The generated table is built from the bundled PinConfigs.kext, use it while the entry is where the table says.
+	entry = lookupPinConfig(codec, layout);
+	if (entry) {
+		auto config = OSDynamicCast(OSDictionary, configList->getObject(static_cast<unsigned int>(entry->index)));
+		auto currCodec = config ? OSDynamicCast(OSNumber, config->getObject("CodecID")) : nullptr;
+		auto currLayout = config ? OSDynamicCast(OSNumber, config->getObject("LayoutID")) : nullptr;
+		auto reinitBool = config ? OSDynamicCast(OSBoolean, config->getObject("WakeVerbReinit")) : nullptr;
+		bool reinit = reinitBool != nullptr && reinitBool->getValue();
+		if (currCodec && currLayout && currCodec->unsigned32BitValue() == codec && currLayout->unsigned32BitValue() == layout &&
+			reinit == ((entry->flags & PinConfigEntry::WakeVerbReinit) != 0)) {
+			DBGLOG("alc", "found HDAConfigDefault entry %lu in pinconfig table", entry->index);
+			return config;
+		}
 
-					const OSObject *objForArr = newConfigObj;
-					auto arr = OSArray::withObjects(&objForArr, 1);
-					if (arr != nullptr) {
-						configDevice->setProperty("HDAConfigDefault", arr);
-						newConfig->retain();
-						arr->release();
-					}
+		DBGLOG("alc", "HDAConfigDefault entry %lu differs from pinconfig table, searching", entry->index);
+	}
 
-					if (!reinit) {
-						// We do not need to reinit, thus are done.
-						newConfig->release();
-						break;
-					}
+	entry = nullptr;
+	unsigned int total = configList->getCount();
+	DBGLOG("alc", "discovered HDAConfigDefault with %u entries", total);
 
-					newConfigCollection = newConfig->copyCollection();
-					newConfig->release();
-					newConfig = OSDynamicCast(OSDictionary, newConfigCollection);
-					newConfigObj  = OSDynamicCast(OSObject, newConfigCollection);
-					if (newConfig == nullptr || newConfigObj == nullptr) {
-						SYSLOG("alc", "failed to copy new HDAConfigDefault collection for reinit");
-						OSSafeReleaseNULL(newConfigCollection);
-						break;
-					}
+	for (unsigned int i = 0; i < total; i++) {
+		auto config = OSDynamicCast(OSDictionary, configList->getObject(i));
+		if (config == nullptr) {
+			SYSLOG("alc", "invalid HDAConfigDefault entry at %u, pinconfigs are broken", i);
+			continue;
+		}
+		auto currCodec = OSDynamicCast(OSNumber, config->getObject("CodecID"));
+		auto currLayout = OSDynamicCast(OSNumber, config->getObject("LayoutID"));
+		if (currCodec == nullptr || currLayout == nullptr ||
+			currCodec->unsigned32BitValue() != codec || currLayout->unsigned32BitValue() != layout) {
+			// Not analog or wrong entry.
+			continue;
+		}
 
-					if (wakeConfigData != nullptr) {
-						if (configData != nullptr) {
-							newConfig->setObject("BootConfigData", configData);
-						}
-						newConfig->setObject("ConfigData", wakeConfigData);
-						newConfig->removeObject("WakeConfigData");
-					}
-					objForArr = newConfigObj;
-					arr = OSArray::withObjects(&objForArr, 1);
-					if (arr != nullptr) {
-						hdaCodec->setProperty("HDAConfigDefault", arr);
-						hdaCodec->setProperty("alc-pinconfig-status", kOSBooleanTrue);
-						arr->release();
-					} else {
-						newConfig->release();
-					}
+		return config;
+	}
 
-					break;
-				}
-			} else {
-				SYSLOG("alc", "invalid HDAConfigDefault, pinconfigs are broken");
-			}
+	return nullptr;
+}
+
+void AlcEnabler::applyPinConfig(IOService *hdaCodec, IOService *configDevice, OSDictionary *config, const PinConfigEntry *entry, uint32_t appleLayout) {
+	auto configData = OSDynamicCast(OSData, config->getObject("ConfigData"));
+	auto wakeConfigData = OSDynamicCast(OSData, config->getObject("WakeConfigData"));
+	bool reinit;
+	if (entry) {
+		reinit = (entry->flags & PinConfigEntry::WakeVerbReinit) != 0;
+	} else {
+		auto reinitBool = OSDynamicCast(OSBoolean, config->getObject("WakeVerbReinit"));
+		reinit = reinitBool != nullptr && reinitBool->getValue();
+	}
+	DBGLOG("alc", "current config entry has boot %d, wake %d, reinit %d", configData != nullptr, wakeConfigData != nullptr, reinit);
+
+	// Replace the config list with a new list to avoid multiple iterations,
+	// and actually fix the LayoutID number we hook in.
+	// The values are never modified, so a shallow copy is enough.
+	auto newConfig = OSDictionary::withDictionary(config);
+	if (newConfig == nullptr) {
+		SYSLOG("alc", "failed to copy analog HDAConfigDefault collection");
+		return;
+	}
+
+	auto num = OSNumber::withNumber(appleLayout, 32);
+	if (num != nullptr) {
+		newConfig->setObject("LayoutID", num);
+		num->release();
+	}
+
+	const OSObject *objForArr = newConfig;
+	auto arr = OSArray::withObjects(&objForArr, 1);
+	if (arr != nullptr) {
+		configDevice->setProperty("HDAConfigDefault", arr);
+		arr->release();
+	}
+
+	if (!reinit) {
+		// We do not need to reinit, thus are done.
+		newConfig->release();
+		return;
+	}
+
+	auto wakeConfig = OSDictionary::withDictionary(newConfig);
+	newConfig->release();
+	if (wakeConfig == nullptr) {
+		SYSLOG("alc", "failed to copy new HDAConfigDefault collection for reinit");
+		return;
+	}
+
+	if (wakeConfigData != nullptr) {
+		if (configData != nullptr) {
+			wakeConfig->setObject("BootConfigData", configData);
 		}
+		wakeConfig->setObject("ConfigData", wakeConfigData);
+		wakeConfig->removeObject("WakeConfigData");
 	}
 
-	return FunctionCast(initializePinConfig, callbackAlc->orgInitializePinConfig)(hdaCodec, configDevice);
+	objForArr = wakeConfig;
+	arr = OSArray::withObjects(&objForArr, 1);
+	wakeConfig->release();
+	if (arr == nullptr)
+		return;
+
+	hdaCodec->setProperty("HDAConfigDefault", arr);
+	hdaCodec->setProperty("alc-pinconfig-status", kOSBooleanTrue);
+	arr->release();
+
+	// Decode the wake verbs once instead of parsing HDAConfigDefault on every wake.
+	if (wakeReplay) {
+		auto data = wakeConfigData != nullptr ? wakeConfigData : configData;
+		createWakeConfig(hdaCodec, data ? data->getBytesNoCopy() : nullptr, data ? data->getLength() : 0);
+	}
+}
+
+AlcEnabler::WakeConfig *AlcEnabler::createWakeConfig(IOService *hdaCodec, const void *configData, size_t configSize) {
+	WakeConfig *config = nullptr;
+	for (size_t i = 0; i < MaxWakeConfigs && !config; i++) {
+		IOService *expected = nullptr;
+		if (__atomic_compare_exchange_n(&wakeConfigs[i].hdaCodec, &expected, hdaCodec, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			config = &wakeConfigs[i];
+	}
+
+	if (!config) {
+		SYSLOG("alc", "no free wake config slot for %s", safeString(hdaCodec->getName()));
+		return nullptr;
+	}
+
+	// Wake verbs are sent by IOHDACodecDevice executeVerb, which is only available once IOHDAFamily is routed.
+	IOService *device = hdaCodec->getProvider();
+	while (device && !device->metaCast("IOHDACodecDevice"))
+		device = device->getProvider();
+
+	if (!device || !orgIOHDACodecDevice_executeVerb || !configData || configSize < sizeof(uint32_t)) {
+		DBGLOG("alc", "wake verbs for %s are not replayable, device %d", safeString(hdaCodec->getName()), device != nullptr);
+		return config;
+	}
+
+	auto addressNum = OSDynamicCast(OSNumber, device->getProperty("IOHDACodecAddress"));
+	size_t total = configSize / sizeof(uint32_t);
+
+	auto verbs = Buffer::create<WakeReplay::Verb>(total);
+	if (!verbs) {
+		SYSLOG("alc", "failed to allocate %lu wake verbs", total);
+		return config;
+	}
+
+	// Without a snapshot every verb is replayed.
+	auto snapshot = CodecSnapshot::create();
+	SYSLOG_COND(!snapshot, "alc", "failed to allocate codec snapshot");
+
+	size_t tracked = 0;
+	auto num = WakeReplay::decode(configData, configSize, addressNum == nullptr, addressNum ? addressNum->unsigned32BitValue() : 0,
+								  snapshot, verbs, tracked);
+
+	config->hdaCodecDevice = device;
+	config->verbNum = num;
+	config->snapshot = snapshot;
+	__atomic_store_n(&config->verbs, verbs, __ATOMIC_RELEASE);
+	DBGLOG("alc", "decoded %lu of %lu wake verbs for %s, %lu restored from %lu snapshot registers", num, total,
+		   safeString(hdaCodec->getName()), tracked, snapshot ? snapshot->count() : 0);
+	return config;
+}
+
+AlcEnabler::WakeConfig *AlcEnabler::getWakeConfig(IOService *hdaCodec) {
+	for (size_t i = 0; i < MaxWakeConfigs; i++)
+		if (__atomic_load_n(&wakeConfigs[i].hdaCodec, __ATOMIC_ACQUIRE) == hdaCodec)
+			return &wakeConfigs[i];
+	return nullptr;
+}
+
+IOReturn AlcEnabler::snapshotExec(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+	return callbackAlc->callVerb(hdaCodecDevice, nid, verb, param, response, true);
+}
+
+void AlcEnabler::captureWakeSnapshot(WakeConfig &config) {
+	// Nothing is read back on wake once the codec is known to lose its state.
+	if (!config.snapshot || config.stateLost)
+		return;
+
+	auto start = getCurrentTimeNs();
+	if (config.wakes == 0 && config.afg == 0)
+		config.afg = WakeReplay::findFunctionGroup(snapshotExec, config.hdaCodecDevice);
+	auto num = config.snapshot->capture(snapshotExec, config.hdaCodecDevice);
+	DBGLOG("alc", "captured %lu of %lu codec registers of afg 0x%X in %llu us", num, config.snapshot->count(), config.afg,
+		   (getCurrentTimeNs() - start) / 1000);
+}
+
+IOReturn AlcEnabler::replayWakeVerbs(WakeConfig &config) {
+	auto stats = WakeReplay::replay(config.verbs, config.verbNum, config.snapshot, config.afg, config.stateLost,
+									snapshotExec, config.hdaCodecDevice);
+	config.lastChecked = stats.checked;
+	config.lastRestored = stats.restored;
+	config.lastReplayed = stats.replayed;
+	config.failures += stats.failures;
+	return stats.result;
+}
+
+void AlcEnabler::publishWakeLatency(IOService *hdaCodec, WakeConfig *config, bool replayed, uint64_t latency) {
+	auto report = OSDictionary::withCapacity(9);
+	if (!report)
+		return;
+
+	setReportString(report, "Path", replayed ? "replay" : "reinit");
+	setReportNumber(report, "Last", latency);
+	if (config) {
+		config->lastLatency = latency;
+		if (latency > config->maxLatency)
+			config->maxLatency = latency;
+		config->wakes++;
+		setReportNumber(report, "Max", config->maxLatency);
+		setReportNumber(report, "Wakes", config->wakes);
+		setReportNumber(report, "Verbs", config->verbNum);
+		setReportNumber(report, "Failures", config->failures);
+		if (replayed) {
+			setReportNumber(report, "Checked", config->lastChecked);
+			setReportNumber(report, "Restored", config->lastRestored);
+			setReportNumber(report, "Replayed", config->lastReplayed);
+		}
+	}
+
+	hdaCodec->setProperty("alc-wake-latency", report);
+	report->release();
+	DBGLOG("alc", "wake verbs for %s took %llu us via %s", safeString(hdaCodec->getName()), latency / 1000, replayed ? "replay" : "reinit");
 }
 
 void AlcEnabler::layoutLoadCallback(uint32_t requestTag, kern_return_t result, const void *resourceData, uint32_t resourceDataLength, void *context) {
-	DBGLOG("alc", "layoutLoadCallback %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
-	callbackAlc->updateResource(Resource::Layout, result, resourceData, resourceDataLength);
-	DBGLOG("alc", "layoutLoadCallback done %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
+	ALCLOG("alc", "layoutLoadCallback %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
+	bool timed = !__atomic_exchange_n(&callbackAlc->layoutLoadTimed, true, __ATOMIC_RELAXED);
+	auto stage = timed ? callbackAlc->timings.begin("layoutLoadCallback", nullptr, requestTag) : BootTimings::InvalidStage;
+	callbackAlc->beginResourceRequest();
+	callbackAlc->updateResource(Resource::Layout, context, result, resourceData, resourceDataLength);
+	ALCLOG("alc", "layoutLoadCallback done %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
 	FunctionCast(layoutLoadCallback, callbackAlc->orgLayoutLoadCallback)(requestTag, result, resourceData, resourceDataLength, context);
+	callbackAlc->endResourceRequest();
+	if (timed) {
+		callbackAlc->timings.end(stage);
+		callbackAlc->publishTimings();
+	}
 }
 
 void AlcEnabler::platformLoadCallback(uint32_t requestTag, kern_return_t result, const void *resourceData, uint32_t resourceDataLength, void *context) {
-	DBGLOG("alc", "platformLoadCallback %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
-	callbackAlc->updateResource(Resource::Platform, result, resourceData, resourceDataLength);
-	DBGLOG("alc", "platformLoadCallback done %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
+	ALCLOG("alc", "platformLoadCallback %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
+	callbackAlc->beginResourceRequest();
+	callbackAlc->updateResource(Resource::Platform, context, result, resourceData, resourceDataLength);
+	ALCLOG("alc", "platformLoadCallback done %u %d %d %u %d", requestTag, result, resourceData != nullptr, resourceDataLength, context != nullptr);
 	FunctionCast(platformLoadCallback, callbackAlc->orgPlatformLoadCallback)(requestTag, result, resourceData, resourceDataLength, context);
+	callbackAlc->endResourceRequest();
+}
+
+void AlcEnabler::beginResourceRequest() {
+	if (!overrideLock)
+		return;
+	IOLockLock(overrideLock);
+	resourceOverrides.enter();
+	IOLockUnlock(overrideLock);
 }
 
-void AlcEnabler::updateResource(Resource type, kern_return_t &result, const void * &resourceData, uint32_t &resourceDataLength) {
-	DBGLOG("alc", "resource-request arrived %s", type == Resource::Platform ? "platform" : "layout");
+void AlcEnabler::endResourceRequest() {
+	if (!overrideLock)
+		return;
+	const uint8_t *released[ResourceOverrides::MaxOverrides];
+	IOLockLock(overrideLock);
+	auto num = resourceOverrides.leave(released);
+	IOLockUnlock(overrideLock);
+	for (size_t i = 0; i < num; i++)
+		Buffer::deleter(const_cast<uint8_t *>(released[i]));
+}
+
+void AlcEnabler::updateResource(Resource type, const void *hdaDriver, kern_return_t &result, const void * &resourceData, uint32_t &resourceDataLength) {
+	// Resources are chosen for the codec of the requesting driver, when it is not found any codec may provide them.
+	auto driverCodec = findDriverCodec(hdaDriver);
+	auto packed = loadResourcePack();
+	ALCLOG("alc", "resource-request arrived %s for codec %X:%X", type == Resource::Platform ? "platform" : "layout",
+		   driverCodec ? driverCodec->vendor : 0, driverCodec ? driverCodec->codec : 0);
 
 	for (size_t i = 0, s = codecs.size(); i < s; i++) {
-		DBGLOG("alc", "checking codec %X:%X:%X", codecs[i]->vendor, codecs[i]->codec, codecs[i]->revision);
+		if (driverCodec && codecs[i] != driverCodec)
+			continue;
+
+		ALCLOG("alc", "checking codec %X:%X:%X", codecs[i]->vendor, codecs[i]->codec, codecs[i]->revision);
 
 		auto info = codecs[i]->info;
 		if (!info) {
@@ -794,14 +1666,47 @@ void AlcEnabler::updateResource(Resource type, kern_return_t &result, const void
 			continue;
 		}
 
+		// Uploaded files replace the ones in the resource pack, which replace the compiled-in ones.
+		auto codecId = (static_cast<uint32_t>(codecs[i]->vendor) << 16) | codecs[i]->codec;
+		const uint8_t *uploadedData = nullptr;
+		uint32_t uploadedSize = 0;
+		if (overrideLock) {
+			IOLockLock(overrideLock);
+			auto uploaded = resourceOverrides.find(type == Resource::Platform ? kALCResourcePlatform : kALCResourceLayout,
+				codecId, controllers[codecs[i]->controller]->layout);
+			if (uploaded) {
+				uploadedData = uploaded->data;
+				uploadedSize = uploaded->size;
+			}
+			IOLockUnlock(overrideLock);
+		}
+
+		if (uploadedData) {
+			ALCLOG("alc", "found uploaded %s", type == Resource::Platform ? "platform" : "layout");
+			resourceData = uploadedData;
+			resourceDataLength = uploadedSize;
+			result = kOSReturnSuccess;
+			continue;
+		}
+
+		auto entry = packed ? respack_find(packed, type == Resource::Platform ? RESPACK_PLATFORM : RESPACK_LAYOUT,
+			codecId, controllers[codecs[i]->controller]->layout, getKernelVersion()) : nullptr;
+		if (entry) {
+			ALCLOG("alc", "found %s in resource pack", type == Resource::Platform ? "platform" : "layout");
+			resourceData = respack_blob(packed, entry);
+			resourceDataLength = entry->size;
+			result = kOSReturnSuccess;
+			continue;
+		}
+
 		if ((type == Resource::Platform && info->platforms) || (type == Resource::Layout && info->layouts)) {
 			size_t num = type == Resource::Platform ? info->platformNum : info->layoutNum;
-			DBGLOG("alc", "selecting from %lu files", num);
+			ALCLOG("alc", "selecting from %lu files", num);
 			for (size_t f = 0; f < num; f++) {
 				auto &fi = (type == Resource::Platform ? info->platforms : info->layouts)[f];
-				DBGLOG("alc", "comparing %lu layout %X/%X", f, fi.layout, controllers[codecs[i]->controller]->layout);
+				ALCLOG("alc", "comparing %lu layout %X/%X", f, fi.layout, controllers[codecs[i]->controller]->layout);
 				if (controllers[codecs[i]->controller]->layout == fi.layout && KernelPatcher::compatibleKernel(fi.minKernel, fi.maxKernel)) {
-					DBGLOG("alc", "found %s at %lu index", type == Resource::Platform ? "platform" : "layout", f);
+					ALCLOG("alc", "found %s at %lu index", type == Resource::Platform ? "platform" : "layout", f);
 					resourceData = fi.data;
 					resourceDataLength = fi.dataLength;
 					result = kOSReturnSuccess;
@@ -812,9 +1717,121 @@ void AlcEnabler::updateResource(Resource type, kern_return_t &result, const void
 	}
 }
 
-bool AlcEnabler::appendCodec(void *user, IORegistryEntry *e) {
-	auto alc = static_cast<AlcEnabler *>(user);
+bool AlcEnabler::validateResource(uint32_t type, uint32_t layout, const uint8_t *data, uint32_t size, uint32_t unpackedSize) {
+	if (!ResourceOverrides::validHeader(data, size, unpackedSize)) {
+		SYSLOG("alc", "uploaded resource of %u (%u unpacked) bytes is not a valid zlib stream", size, unpackedSize);
+		return false;
+	}
 
+	// The file is parsed as a C string, shorter output stays terminated.
+	auto text = Buffer::create<uint8_t>(unpackedSize + 1);
+	if (!text) {
+		SYSLOG("alc", "failed to allocate %u bytes for uploaded resource", unpackedSize + 1);
+		return false;
+	}
+	memset(text, 0, unpackedSize + 1);
+
+	bool valid = false;
+	if (Compression::decompress(Compression::ModeZLIB, unpackedSize, data, size, text)) {
+		auto object = OSUnserializeXML(reinterpret_cast<const char *>(text));
+		auto dict = OSDynamicCast(OSDictionary, object);
+		if (dict && type == kALCResourceLayout) {
+			auto layoutId = OSDynamicCast(OSNumber, dict->getObject("LayoutID"));
+			valid = layoutId && layoutId->unsigned32BitValue() == layout;
+			SYSLOG_COND(!valid, "alc", "uploaded layout does not declare LayoutID %u", layout);
+		} else if (dict) {
+			valid = OSDynamicCast(OSArray, dict->getObject("PathMaps")) != nullptr;
+			SYSLOG_COND(!valid, "alc", "uploaded platform has no PathMaps");
+		} else {
+			SYSLOG("alc", "uploaded resource is not a plist dictionary");
+		}
+		OSSafeReleaseNULL(object);
+	} else {
+		SYSLOG("alc", "uploaded resource does not decompress to %u bytes", unpackedSize);
+	}
+
+	Buffer::deleter(text);
+	return valid;
+}
+
+size_t AlcEnabler::reloadCodecDrivers(IORegistryEntry *hdaCodecDevice) {
+	// Terminating drivers changes the registry, so they are collected first.
+	IOService *drivers[MaxCodecDrivers];
+	size_t num = 0;
+	auto iterator = IORegistryIterator::iterateOver(hdaCodecDevice, gIOServicePlane, kIORegistryIterateRecursively);
+	if (iterator) {
+		OSObject *entry;
+		while (num < MaxCodecDrivers && (entry = iterator->getNextObject()) != nullptr) {
+			auto driver = OSDynamicCast(IOService, entry);
+			if (driver && driver->metaCast("AppleHDADriver")) {
+				driver->retain();
+				drivers[num++] = driver;
+			}
+		}
+		iterator->release();
+	}
+
+	size_t reloaded = 0;
+	for (size_t i = 0; i < num; i++) {
+		// Registering the provider again matches a new driver requesting the resources.
+		auto provider = drivers[i]->getProvider();
+		if (provider) {
+			provider->retain();
+			if (drivers[i]->terminate(kIOServiceSynchronous)) {
+				provider->registerService();
+				reloaded++;
+			} else {
+				SYSLOG("alc", "failed to terminate %s for resource reload", safeString(drivers[i]->getName()));
+			}
+			provider->release();
+		}
+		drivers[i]->release();
+	}
+
+	return reloaded;
+}
+
+void AlcEnabler::processReloads(thread_call_param_t alc, thread_call_param_t) {
+	auto that = static_cast<AlcEnabler *>(alc);
+	size_t pending[ResourceOverrides::MaxOverrides];
+	IOLockLock(that->overrideLock);
+	auto num = that->resourceOverrides.takeReloads(pending);
+	IOLockUnlock(that->overrideLock);
+
+	for (size_t i = 0; i < num; i++) {
+		auto codec = that->codecs[pending[i]];
+		auto reloaded = that->reloadCodecDrivers(codec->device);
+		SYSLOG_COND(reloaded == 0, "alc", "no drivers of codec %X:%X to reload", codec->vendor, codec->codec);
+		DBGLOG("alc", "reloaded %lu drivers of codec %X:%X", reloaded, codec->vendor, codec->codec);
+	}
+}
+
+AlcEnabler::CodecInfo *AlcEnabler::findCodec(IORegistryEntry *service) {
+	auto parent = [](IORegistryEntry *entry) { return entry->getParentEntry(gIOServicePlane); };
+	auto index = CodecRouting::findService(codecs, service, parent);
+	return index < codecs.size() ? codecs[index] : nullptr;
+}
+
+AlcEnabler::CodecInfo *AlcEnabler::findDriverCodec(const void *hdaDriver) {
+	// The driver is only compared against codec descendants, it may not be a valid object.
+	auto contains = [](IORegistryEntry *device, const void *driver) {
+		auto iterator = IORegistryIterator::iterateOver(device, gIOServicePlane, kIORegistryIterateRecursively);
+		if (!iterator)
+			return false;
+
+		OSObject *entry;
+		bool found = false;
+		while (!found && (entry = iterator->getNextObject()) != nullptr)
+			found = entry == driver;
+		iterator->release();
+		return found;
+	};
+
+	auto index = CodecRouting::findDriver(codecs, hdaDriver, contains);
+	return index < codecs.size() ? codecs[index] : nullptr;
+}
+
+bool AlcEnabler::appendCodec(size_t controller, IORegistryEntry *e) {
 	auto ven = e->getProperty("IOHDACodecVendorID");
 	auto rev = e->getProperty("IOHDACodecRevisionID");
 
@@ -831,52 +1848,145 @@ bool AlcEnabler::appendCodec(void *user, IORegistryEntry *e) {
 		return true;
 	}
 
-	auto ci = AlcEnabler::CodecInfo::create(alc->currentController, venNum->unsigned32BitValue(), revNum->unsigned32BitValue());
+	uint32_t address = 0;
+	auto addressNum = OSDynamicCast(OSNumber, e->getProperty("IOHDACodecAddress"));
+	if (addressNum)
+		address = addressNum->unsigned32BitValue();
+
+	auto ci = codecs.push_back(CodecInfo(controller, venNum->unsigned32BitValue(), revNum->unsigned32BitValue(), address, e));
 	if (ci) {
-		DBGLOG("alc", "storing codec info for %X:%X:%X", ci->vendor, ci->codec, ci->revision);
-		if (!alc->codecs.push_back(ci)) {
-			SYSLOG("alc", "failed to store codec info for %X:%X:%X", ci->vendor, ci->codec, ci->revision);
-			AlcEnabler::CodecInfo::deleter(ci);
-		}
+		e->retain();
+		DBGLOG("alc", "storing codec info for %X:%X:%X at %lu controller address %u", ci->vendor, ci->codec, ci->revision, controller, address);
 	} else {
-		SYSLOG("alc", "failed to create codec info for %X:%X", venNum->unsigned32BitValue(), revNum->unsigned32BitValue());
+		SYSLOG("alc", "no free slot to store codec info for %X:%X", venNum->unsigned32BitValue(), revNum->unsigned32BitValue());
 	}
 
 	return true;
 }
 
+bool AlcEnabler::storeCodec(CodecWait &wait, size_t controller, IORegistryEntry *codec) {
+	auto addressNum = OSDynamicCast(OSNumber, codec->getProperty("IOHDACodecAddress"));
+	auto address = addressNum ? addressNum->unsigned32BitValue() : static_cast<uint32_t>(MaxCodecAddresses);
+	auto result = wait.discovery.store(controller, codec, address, getCurrentTimeNs());
+	if (result == CodecSlots::Result::Ignored)
+		return false;
+
+	codec->retain();
+	if (result == CodecSlots::Result::Completed)
+		IOLockWakeup(wait.lock, &wait.discovery, true);
+	return true;
+}
+
+bool AlcEnabler::codecPublished(void *target, void *, IOService *newService, IONotifier *) {
+	auto wait = static_cast<CodecWait *>(target);
+	auto &controllers = wait->alc->controllers;
+	if (!newService || !newService->getProperty("IOHDACodecVendorID"))
+		return true;
+
+	// Codecs are published below the controller device, find which one this is.
+	IOLockLock(wait->lock);
+	size_t controller = 0;
+	auto parent = [](IORegistryEntry *entry) { return entry->getParentEntry(gIOServicePlane); };
+	auto match = [&controllers](IORegistryEntry *entry, size_t &index) {
+		for (index = 0; index < controllers.size(); index++)
+			if (controllers[index]->detect == entry)
+				return true;
+		return false;
+	};
+	if (CodecSlots::findController(newService, parent, match, controller))
+		storeCodec(*wait, controller, newService);
+	IOLockUnlock(wait->lock);
+
+	return true;
+}
+
 bool AlcEnabler::grabCodecs() {
-	for (currentController = 0; currentController < controllers.size(); currentController++) {
-		auto ctlr = controllers[currentController];
+	BootTimings::Scope stage(timings, "grabCodecs");
 
-		// Digital controllers normally have no detectible codecs
-		if (!ctlr->detect)
-			continue;
+	CodecWait wait {this, codecLock, {}};
+	if (!wait.lock) {
+		SYSLOG("alc", "missing codec discovery lock");
+		return false;
+	}
 
-		bool found = false;
-		for (size_t brute = 0; !found && brute < WIOKit::bruteMax; brute++) {
-			auto iterator = IORegistryIterator::iterateOver(ctlr->detect, gIOServicePlane, kIORegistryIterateRecursively);
-			if (iterator) {
-				IORegistryEntry *codec = nullptr;
-				while ((codec = OSDynamicCast(IORegistryEntry, iterator->getNextObject())) != nullptr) {
-					if (codec->getProperty("IOHDACodecVendorID")) {
-						DBGLOG("alc", "found analog codec %s", safeString(codec->getName()));
-						found = appendCodec(this, codec);
-						break;
-					}
-				}
+	// Digital controllers normally have no detectible codecs
+	auto &discovery = wait.discovery;
+	discovery.reset(codecSlots, controllers.size(), getCurrentTimeNs());
+	for (size_t i = 0; i < controllers.size(); i++)
+		if (controllers[i]->detect)
+			discovery.expect();
+
+	// Already published codecs are reported before addMatchingNotification returns,
+	// the others as soon as their controllers publish them.
+	IONotifier *notifier = nullptr;
+	if (discovery.remaining() > 0) {
+		auto matching = IOService::serviceMatching("IOHDACodecDevice");
+		if (matching) {
+			notifier = IOService::addMatchingNotification(gIOPublishNotification, matching, codecPublished, &wait);
+			matching->release();
+		}
+
+		if (!notifier)
+			SYSLOG("alc", "failed to install codec publish notification");
+	}
+
+	if (notifier) {
+		uint32_t timeout = config.codecWait;
 
-				iterator->release();
+		// Every controller publishing its first codec ends the wait.
+		uint64_t deadline = 0;
+		clock_interval_to_deadline(timeout, kMillisecondScale, &deadline);
+		IOLockLock(wait.lock);
+		while (discovery.remaining() > 0 &&
+			   IOLockSleepDeadline(wait.lock, &wait.discovery, deadline, THREAD_UNINT) != THREAD_TIMED_OUT) {}
+		IOLockUnlock(wait.lock);
+
+		// Waits for running handlers, nothing touches discovery afterwards.
+		notifier->remove();
+	}
+
+	// Controllers attach all codecs of a link together, pick up the ones attached but not yet published.
+	for (size_t i = 0; i < controllers.size(); i++) {
+		auto slots = discovery.get(i);
+		IORegistryEntry *parent = nullptr;
+		for (size_t a = 0; a < MaxCodecAddresses && !parent; a++)
+			if (slots[a].codec)
+				parent = slots[a].codec->getParentEntry(gIOServicePlane);
+
+		auto iterator = parent ? parent->getChildIterator(gIOServicePlane) : nullptr;
+		if (iterator) {
+			IORegistryEntry *codec;
+			while ((codec = OSDynamicCast(IORegistryEntry, iterator->getNextObject())) != nullptr) {
+				if (codec->metaCast("IOHDACodecDevice") && codec->getProperty("IOHDACodecVendorID") && storeCodec(wait, i, codec))
+					DBGLOG("alc", "found unpublished codec %s for controller %lu", safeString(codec->getName()), i);
 			}
+			iterator->release();
+		}
+	}
 
-			SYSLOG_COND(ADDPR(debugEnabled), "alc", "failed to find IOHDACodecVendorID, retrying %lu", brute);
+	// Append in controller and address order so that codec selection does not depend on publishing order.
+	for (size_t i = 0; i < controllers.size(); i++) {
+		bool found = false;
+		auto slots = discovery.get(i);
+		for (size_t a = 0; a < MaxCodecAddresses; a++) {
+			auto &slot = slots[a];
+			if (slot.codec) {
+				DBGLOG("alc", "found analog codec %s for controller %lu slot %lu in %llu us", safeString(slot.codec->getName()), i, a, slot.latency / 1000);
+				appendCodec(i, slot.codec);
+				slot.codec->release();
+				found = true;
+			}
 		}
+
+		if (!found && controllers[i]->detect)
+			SYSLOG_COND(ADDPR(debugEnabled), "alc", "no codec published for controller %lu within timeout", i);
 	}
 
 	return validateCodecs();
 }
 
 bool AlcEnabler::validateCodecs() {
+	BootTimings::Scope stage(timings, "validateCodecs");
 	size_t i = 0;
 	
 	while (i < codecs.size()) {
@@ -937,16 +2047,27 @@ bool AlcEnabler::validateInjection(IORegistryEntry *hdaService) {
 	return !noControllerInject;
 }
 
-void AlcEnabler::applyPatches(KernelPatcher &patcher, size_t index, const KextPatch *patches, size_t patchNum) {
+void AlcEnabler::applyPatches(KernelPatcher &patcher, size_t index, const KextPatch *patches, size_t patchNum, mach_vm_address_t address, size_t size, const uint32_t *hdauId) {
 	for (size_t p = 0; p < patchNum; p++) {
 		auto &patch = patches[p];
 		if (patch.patch.kext->loadIndex == index) {
-			DBGLOG("alc", "checking patch %lu for %lu kext (%s)", p, index, patch.patch.kext->id);
+			ALCLOG("alc", "checking patch %lu for %lu kext (%s)", p, index, patch.patch.kext->id);
 			if (patcher.compatibleKernel(patch.minKernel, patch.maxKernel)) {
-				DBGLOG("alc", "applying patch %lu  for %lu kext (%s)", p, index, patch.patch.kext->id);
-				patcher.applyLookupPatch(&patch.patch);
-				// Do not really care for the errors for now
-				patcher.clearError();
+				// Patch tables are shared, substitute the assigned HDAU device-id in a copy.
+				if (patch.patch.size == sizeof(uint32_t) && *reinterpret_cast<const uint32_t *>(patch.patch.find) == NvidiaSpecialFind) {
+					if (!hdauId) {
+						ALCLOG("alc", "skipping patch %lu for %lu kext (%s) without HDAU device-id", p, index, patch.patch.kext->id);
+						continue;
+					}
+					auto lookup = patch.patch;
+					lookup.find = reinterpret_cast<const uint8_t *>(hdauId);
+					ALCLOG("alc", "applying patch %lu for %lu kext (%s) with HDAU device-id %08X", p, index, patch.patch.kext->id, *hdauId);
+					applyLookupPatch(patcher, patch.source, lookup, address, size);
+					continue;
+				}
+
+				ALCLOG("alc", "applying patch %lu  for %lu kext (%s)", p, index, patch.patch.kext->id);
+				applyLookupPatch(patcher, patch.source, patch.patch, address, size);
 			}
 		}
 	}
@@ -10,8 +10,24 @@
 
 #include <Headers/kern_patcher.hpp>
 #include <Headers/kern_devinfo.hpp>
+#include <Headers/kern_time.hpp>
 
 #include "kern_resources.hpp"
+#include "kern_hda.hpp"
+#include "kern_trace.hpp"
+#include "kern_snapshot.hpp"
+#include "kern_wake.hpp"
+#include "kern_timing.hpp"
+#include "kern_bootconfig.hpp"
+#include "kern_discovery.hpp"
+#include "kern_routing.hpp"
+#include "kern_ready.hpp"
+#include "kern_retry.hpp"
+#include "kern_hdau.hpp"
+#include "kern_arena.hpp"
+#include "kern_override.hpp"
+#include "kern_binlog.hpp"
+#include "../Tools/respack/respack.h"
 
 class AlcEnabler {
 public:
@@ -31,7 +47,89 @@ public:
 	static AlcEnabler* getShared() {
 		return callbackAlc;
 	}
-	
+
+	/**
+	 *  Boot configuration snapshot, boot-args are captured in init and device
+	 *  properties at patcher load, afterwards it is only read by every stage
+	 */
+	struct BootConfig {
+		/**
+		 *  -alctrace, -alcpatchstats, -alcwakelegacy, -alcdhost and -alcbinlog boot-args
+		 */
+		bool verbTrace {false};
+		bool patchStats {false};
+		bool wakeLegacy {false};
+		bool dhost {false};
+		bool binaryLog {false};
+
+		/**
+		 *  alcid, alcverbs, alcdelay, alctcsel and alceventpoll boot-args, valid when has is set
+		 */
+		bool hasLayoutId {false};
+		uint32_t layoutId {0};
+		bool hasVerbs {false};
+		uint32_t verbs {0};
+		bool hasDelay {false};
+		uint32_t delay {0};
+		bool hasTcsel {false};
+		uint32_t tcsel {0};
+		bool hasEventPoll {false};
+		uint32_t eventPoll {0};
+
+		/**
+		 *  alccodecwait boot-arg or CodecDiscoveryTimeout
+		 */
+		uint32_t codecWait {0};
+
+		/**
+		 *  alcpack boot-arg, empty to look in DefaultPackPaths, -alcnopack disables the pack
+		 */
+		char packPath[128] {};
+		bool noPack {false};
+
+		/**
+		 *  Device tree built once at patcher load, owned by the snapshot
+		 */
+		DeviceInfo *devInfo {nullptr};
+
+		/**
+		 *  Analog HDA controllers besides DeviceInfo audioBuiltinAnalog, which opt in
+		 *  with an alc-layout-id or layout-id property
+		 */
+		static constexpr size_t MaxExtraAnalog = 4;
+		IORegistryEntry *extraAnalog[MaxExtraAnalog] {};
+		size_t extraAnalogNum {0};
+
+		/**
+		 *  alc-verbs or alc-delay is set on the analog or any external audio device
+		 */
+		bool verbsRequested {false};
+		bool delayRequested {false};
+
+		/**
+		 *  Check whether custom verbs are allowed, alcverbs overrides alc-verbs
+		 */
+		bool hdaVerbsEnabled() const {
+			return hasVerbs ? verbs != 0 : verbsRequested;
+		}
+
+		/**
+		 *  Check whether controller start delay is requested, alcdelay overrides alc-delay
+		 */
+		bool alcDelayEnabled() const {
+			return hasDelay ? delay != 0 : delayRequested;
+		}
+	};
+
+	/**
+	 *  Obtain the boot configuration snapshot
+	 *
+	 *  @return boot configuration
+	 */
+	const BootConfig &getBootConfig() const {
+		return config;
+	}
+
 	/**
 	 *  Hooked IOHDACodecDevice executeVerb
 	 *
@@ -45,23 +143,182 @@ public:
 	 *  @return kIOReturnSuccess on successful execution
 	 */
 	static IOReturn IOHDACodecDevice_executeVerb(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, unsigned int *output, bool waitForSuccess);
-	
+
+	/**
+	 *  Execute a verb on behalf of a user-client through the original IOHDACodecDevice executeVerb.
+	 *  Failing SET_STREAM_FORMAT is retried by StreamFormatRetry instead of IOHDAFamily policy,
+	 *  AppleHDA's own verbs keep going through the hook unchanged.
+	 *
+	 *  @param hdaCodecDevice IOHDACodecDevice instance
+	 *  @param nid     Node ID
+	 *  @param verb    The hda-verb command to send (as defined in hdaverb.h)
+	 *  @param param   The parameters for the verb
+	 *  @param output  Pointer to write the output of the command to
+	 *  @param wait    Retry SET_STREAM_FORMAT until it succeeds or the budget is exhausted
+	 *  @param retries Number of performed retries (optional)
+	 *
+	 *  @return kIOReturnSuccess on successful execution
+	 */
+	IOReturn executeVerb(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, unsigned int *output, bool wait, uint32_t *retries=nullptr);
+
 	/**
 	 *	Trampolines for original method invocation
 	 */
 	mach_vm_address_t orgIOHDACodecDevice_executeVerb {0};
 
+	/**
+	 *  Start or stop tracing verbs of all registered codecs
+	 *
+	 *  @param enable Trace verbs
+	 */
+	void setVerbTraceEnabled(bool enable) {
+		verbTraceEnabled = enable;
+	}
+
+	/**
+	 *  Check whether verbs are traced
+	 */
+	bool isVerbTraceEnabled() {
+		return verbTraceEnabled;
+	}
+
+	/**
+	 *  Register a codec verb trace ring
+	 *
+	 *  @param hdaCodecDevice IOHDACodecDevice instance
+	 *  @param trace          Trace ring, must stay valid until the codec is unregistered
+	 *
+	 *  @return true if there was a free slot for the codec
+	 */
+	bool registerVerbTrace(void *hdaCodecDevice, VerbTrace *trace);
+
+	/**
+	 *  Maximum number of recorded patches, later patches are only counted
+	 */
+	static constexpr size_t MaxPatchRecords = 128;
+
+	/**
+	 *  Copy the boot patch report
+	 *
+	 *  @param records Destination records
+	 *  @param num     Number of destination records
+	 *
+	 *  @return total number of records
+	 */
+	size_t copyPatchReport(ALCPatchRecord *records, size_t num);
+
+	/**
+	 *  Publish the entitlement hook counters as alc-entitlement-stats. The hook only counts,
+	 *  the property is refreshed when a user client opens or reads the patch report.
+	 */
+	void publishEntitlementStats();
+
+	/**
+	 *  Unregister a codec verb trace ring and wait for the verbs being recorded in it,
+	 *  so that the ring may be freed afterwards
+	 *
+	 *  @param hdaCodecDevice IOHDACodecDevice instance
+	 */
+	void unregisterVerbTrace(void *hdaCodecDevice);
+
+	/**
+	 *  Replace the layout or platform file of a codec until reboot
+	 *
+	 *  @param hdaCodecDevice IOHDACodecDevice instance
+	 *  @param type           kALCResourceLayout or kALCResourcePlatform
+	 *  @param layout         layout id, 0 for the current one of the codec controller
+	 *  @param data           zlib compressed file allocated with Buffer::create, always consumed
+	 *  @param size           compressed file size
+	 *  @param unpackedSize   uncompressed file size
+	 *  @param flags          kMethodUploadResource flags
+	 *
+	 *  @return kIOReturnSuccess if the file was stored or removed
+	 */
+	IOReturn uploadResource(IORegistryEntry *hdaCodecDevice, uint32_t type, uint32_t layout, uint8_t *data, uint32_t size, uint32_t unpackedSize, uint32_t flags);
+
 private:
 	/**
 	 *	The only allowed instance of this class
 	 */
 	static AlcEnabler* callbackAlc;
+
+	/**
+	 *  Boot configuration snapshot
+	 */
+	BootConfig config {};
+
+	/**
+	 *  Capture device properties and the device tree into the snapshot
+	 */
+	void snapshotDevices();
 	
 	/**
 	 *  Update device properties for digital and analog audio support
 	 */
 	void updateProperties();
 
+	/**
+	 *  Boot stage timings
+	 */
+	BootTimings timings {getCurrentTimeNs};
+
+	/**
+	 *  Only the first layout loading is timed
+	 */
+	bool layoutLoadTimed {false};
+
+	/**
+	 *  Publish boot stage timings as alc-boot-timings property of the first detected controller
+	 */
+	void publishTimings();
+
+	/**
+	 *  Applied lookup patch record
+	 */
+	struct PatchRecord {
+		const char *source;
+		const char *kext;
+		uint32_t count;
+		uint32_t found;
+		uint32_t status;
+		uint64_t duration;
+		uint64_t scanned;
+	};
+
+	/**
+	 *  Lookup patches applied during boot, records are only appended and
+	 *  become visible once patchRecordCount is increased
+	 */
+	PatchRecord patchReport[MaxPatchRecords] {};
+	size_t patchRecordCount {0};
+	size_t patchRecordsDropped {0};
+
+	/**
+	 *  Count exact patch matches with an extra scan, set by -alcpatchstats boot-arg
+	 */
+	bool patchStats {false};
+
+	/**
+	 *  Apply a lookup patch and record its result in the patch report
+	 *
+	 *  @param patcher KernelPatcher instance
+	 *  @param source  Patch origin for the report
+	 *  @param patch   Lookup patch
+	 *  @param address kinfo load address
+	 *  @param size    kinfo memory size
+	 */
+	void applyLookupPatch(KernelPatcher &patcher, const char *source, const KernelPatcher::LookupPatch &patch, mach_vm_address_t address, size_t size);
+
+	/**
+	 *  Publish the patch report as alc-patch-report property of the first detected controller
+	 */
+	void publishPatchReport();
+
+	/**
+	 *  Get the registry entry boot reports are published on
+	 */
+	IORegistryEntry *getReportEntry();
+
 	/**
 	 *  Update audio device properties
 	 *
@@ -72,6 +329,40 @@ private:
 	 */
 	void updateDeviceProperties(IORegistryEntry *hdaService, DeviceInfo *info, const char *hdaGfx, bool isAnalog);
 
+	/**
+	 *  Execute a verb through the original IOHDACodecDevice executeVerb, recording it when tracing is enabled
+	 */
+	IOReturn callVerb(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, unsigned int *output, bool wait) {
+		if (verbTraceEnabled)
+			return callTracedVerb(hdaCodecDevice, nid, verb, param, output, wait);
+		return FunctionCast(IOHDACodecDevice_executeVerb, orgIOHDACodecDevice_executeVerb)(hdaCodecDevice, nid, verb, param, output, wait);
+	}
+
+	/**
+	 *  Execute a verb through the original IOHDACodecDevice executeVerb and record it in the codec trace ring
+	 */
+	IOReturn callTracedVerb(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, unsigned int *output, bool wait);
+
+	/**
+	 *  StreamFormatRetry executor sending verbs to IOHDACodecDevice without waiting
+	 */
+	static IOReturn retryExec(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response);
+
+	/**
+	 *  Maximum number of codecs with verb trace rings
+	 */
+	static constexpr size_t MaxVerbTraces = 8;
+
+	/**
+	 *  Codec verb trace rings
+	 */
+	VerbTraceSlot verbTraces[MaxVerbTraces] {};
+
+	/**
+	 *  Verb tracing status, set by -alctrace boot-arg or user-client
+	 */
+	bool verbTraceEnabled {false};
+
 	/**
 	 *  Maximum available connector count assumed on NVIDIA GPUs
 	 */
@@ -82,8 +373,10 @@ private:
 	 *
 	 *  @param patcher KernelPatcher instance
 	 *  @oaram index  kinfo handle
+	 *  @param address kinfo load address
+	 *  @param size    kinfo memory size
 	 */
-	void eraseRedundantLogs(KernelPatcher &patcher, size_t index);
+	void eraseRedundantLogs(KernelPatcher &patcher, size_t index, mach_vm_address_t address, size_t size);
 
 	/**
 	 *  Patch AppleHDA or another kext if needed and prepare other patches
@@ -104,6 +397,28 @@ private:
 	 *  Hooked AppleHDAController start
 	 */
 	static bool AppleHDAController_start(IOService* service, IOService* provider);
+
+	/**
+	 *  Largest accepted alc-delay in milliseconds
+	 */
+	static constexpr uint32_t MaxControllerDelay = 3000;
+
+	/**
+	 *  Controller readiness probe state used while waiting for alc-delay
+	 */
+	struct ControllerProbe {
+		IOService *provider;
+		IOMemoryMap *registers;
+	};
+
+	/**
+	 *  Check whether the controller is accessible and has codecs on its link
+	 *
+	 *  @param ctx ControllerProbe
+	 *
+	 *  @return true if AppleHDAController can be started
+	 */
+	static bool controllerReady(void *ctx);
 		
 	/**
 	 *  Trampolines for original method invocations
@@ -137,7 +452,14 @@ private:
 	/**
 	 *  Hooked entitlement copying method
 	 */
-	static void handleAudioClientEntitlement(task_t task, const char *entitlement, OSObject *&original);
+	void handleAudioClientEntitlement(task_t task, const char *entitlement, OSObject *&original);
+
+	/**
+	 *  Entitlement hook invocations, audio driver host requests and grants overriding the original value
+	 */
+	uint64_t entitlementCalls {0};
+	uint64_t entitlementMatches {0};
+	uint64_t entitlementGrants {0};
 
 	/**
 	 *  Detects audio controllers
@@ -155,15 +477,55 @@ private:
 	/**
 	 *  Appends registered codec
 	 *
-	 *  @param user  AlcEnabler instance
-	 *  @param e     found codec
+	 *  @param controller  controller index
+	 *  @param e           found codec
 	 *
-	 *  @return true on success and false to continue bruting
+	 *  @return true if the codec had the expected properties
 	 */
-	static bool appendCodec(void *user, IORegistryEntry *e);
+	bool appendCodec(size_t controller, IORegistryEntry *e);
 
 	/**
-	 *  Detects audio codecs
+	 *  Default time to wait for codecs to be published in milliseconds, overridden by alccodecwait
+	 */
+	static constexpr uint32_t CodecDiscoveryTimeout = 500;
+
+	/**
+	 *  Codec discovery over the service plane
+	 */
+	using CodecSlots = CodecDiscovery<IORegistryEntry>;
+
+	/**
+	 *  Codec addresses on a single HDA link
+	 */
+	static constexpr size_t MaxCodecAddresses = CodecSlots::MaxCodecAddresses;
+
+	/**
+	 *  Codec discovery state shared with the publish notification handler
+	 */
+	struct CodecWait {
+		AlcEnabler *alc;
+		IOLock *lock;
+		CodecSlots discovery;
+	};
+
+	/**
+	 *  Store a discovered codec in its controller and address slot
+	 *
+	 *  @param wait       codec discovery state, locked unless no handler may run
+	 *  @param controller controller index
+	 *  @param codec      IOHDACodecDevice instance
+	 *
+	 *  @return true if the codec was stored
+	 */
+	static bool storeCodec(CodecWait &wait, size_t controller, IORegistryEntry *codec);
+
+	/**
+	 *  IOHDACodecDevice publish notification handler, records every codec of every controller
+	 */
+	static bool codecPublished(void *target, void *refCon, IOService *newService, IONotifier *notifier);
+
+	/**
+	 *  Detects audio codecs of all controllers at once, waiting for them to be published
 	 *
 	 *  @return see validateCodecs
 	 */
@@ -196,6 +558,126 @@ private:
 	 */
 	mach_vm_address_t orgInitializePinConfig {0};
 
+	/**
+	 *  Find a generated pinconfig table entry
+	 *
+	 *  @param codec  analog codec id
+	 *  @param layout analog layout id
+	 *
+	 *  @return table entry or nullptr
+	 */
+	static const PinConfigEntry *lookupPinConfig(uint32_t codec, uint32_t layout);
+
+	/**
+	 *  Find the HDAConfigDefault entry for the analog codec
+	 *
+	 *  @param configList HDAConfigDefault array
+	 *  @param codec      analog codec id
+	 *  @param layout     analog layout id
+	 *  @param entry      matching table entry, nullptr if the entry was searched for
+	 *
+	 *  @return config entry or nullptr
+	 */
+	static OSDictionary *findPinConfig(OSArray *configList, uint32_t codec, uint32_t layout, const PinConfigEntry *&entry);
+
+	/**
+	 *  Publish the HDAConfigDefault entry for AppleHDA and prepare wake verbs
+	 *
+	 *  @param hdaCodec     AppleHDACodecGeneric instance
+	 *  @param configDevice config provider with HDAConfigDefault
+	 *  @param config       matching config entry
+	 *  @param entry        matching table entry or nullptr
+	 *  @param appleLayout  layout id AppleHDA looks for
+	 */
+	void applyPinConfig(IOService *hdaCodec, IOService *configDevice, OSDictionary *config, const PinConfigEntry *entry, uint32_t appleLayout);
+
+	/**
+	 *  Wake verbs and latency statistics of an AppleHDACodecGeneric instance.
+	 *  hdaCodec is claimed first, verbs are set once decoded and never change.
+	 */
+	struct WakeConfig {
+		IOService *hdaCodec;
+		void *hdaCodecDevice;
+		WakeReplay::Verb *verbs;
+		size_t verbNum;
+		CodecSnapshot *snapshot;
+		uint16_t afg;
+		bool stateLost;
+		uint64_t lastLatency;
+		uint64_t maxLatency;
+		uint32_t wakes;
+		uint32_t failures;
+		uint32_t lastChecked;
+		uint32_t lastRestored;
+		uint32_t lastReplayed;
+	};
+
+	/**
+	 *  Maximum number of codecs with wake verbs
+	 */
+	static constexpr size_t MaxWakeConfigs = 8;
+
+	/**
+	 *  Codec wake verbs
+	 */
+	WakeConfig wakeConfigs[MaxWakeConfigs] {};
+
+	/**
+	 *  Replay decoded wake verbs instead of reinitialising pin configs, disabled by -alcwakelegacy boot-arg
+	 */
+	bool wakeReplay {true};
+
+	/**
+	 *  Claim a wake config slot and decode the wake verbs into it
+	 *
+	 *  @param hdaCodec   AppleHDACodecGeneric instance
+	 *  @param configData ConfigData sent on wake
+	 *  @param configSize ConfigData size in bytes
+	 *
+	 *  @return wake config or nullptr when no slot is left
+	 */
+	WakeConfig *createWakeConfig(IOService *hdaCodec, const void *configData, size_t configSize);
+
+	/**
+	 *  Find the wake config of a codec
+	 *
+	 *  @param hdaCodec   AppleHDACodecGeneric instance
+	 *
+	 *  @return wake config or nullptr
+	 */
+	WakeConfig *getWakeConfig(IOService *hdaCodec);
+
+	/**
+	 *  Capture the codec registers written by wake verbs before sleep
+	 *
+	 *  @param config wake config with verbs
+	 */
+	void captureWakeSnapshot(WakeConfig &config);
+
+	/**
+	 *  Restore the captured registers that differ and send the remaining wake verbs to the codec
+	 *
+	 *  @param config wake config with verbs
+	 *
+	 *  @return kIOReturnSuccess or the first verb failure
+	 */
+	IOReturn replayWakeVerbs(WakeConfig &config);
+
+	/**
+	 *  CodecSnapshot executor sending verbs to IOHDACodecDevice
+	 */
+	static IOReturn snapshotExec(void *hdaCodecDevice, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response);
+
+	/**
+	 *  Record wake latency and publish it as alc-wake-latency codec property
+	 *
+	 *  @param hdaCodec   AppleHDACodecGeneric instance
+	 *  @param config     wake config or nullptr
+	 *  @param replayed   wake verbs were replayed rather than reinitialised
+	 *  @param latency    wake verb latency in nanoseconds
+	 */
+	void publishWakeLatency(IOService *hdaCodec, WakeConfig *config, bool replayed, uint64_t latency);
+
 	/**
 	 *  Hooked ResourceLoad callbacks returning correct layout/platform
 	 */
@@ -220,11 +702,62 @@ private:
 	 *  Update resource request parameters with hooked data if necessary
 	 *
 	 *  @param type               resource type
+	 *  @param hdaDriver          requesting AppleHDADriver instance
 	 *  @param result             kOSReturnSuccess on resource update
 	 *  @param resourceData       resource data reference
 	 *  @param resourceDataLength resource data length reference
 	 */
-	void updateResource(Resource type, kern_return_t &result, const void * &resourceData, uint32_t &resourceDataLength);
+	void updateResource(Resource type, const void *hdaDriver, kern_return_t &result, const void * &resourceData, uint32_t &resourceDataLength);
+
+	/**
+	 *  Files uploaded through the user client, protected by overrideLock
+	 */
+	ResourceOverrides resourceOverrides;
+	IOLock *overrideLock {nullptr};
+
+	/**
+	 *  Bracket a resource request, so that uploaded files it may use are not freed
+	 */
+	void beginResourceRequest();
+	void endResourceRequest();
+
+	/**
+	 *  Decompress and parse an uploaded file
+	 *
+	 *  @param type         kALCResourceLayout or kALCResourcePlatform
+	 *  @param layout       layout id the file must declare
+	 *  @param data         zlib compressed file
+	 *  @param size         compressed file size
+	 *  @param unpackedSize uncompressed file size
+	 *
+	 *  @return true if AppleHDA may load the file
+	 */
+	static bool validateResource(uint32_t type, uint32_t layout, const uint8_t *data, uint32_t size, uint32_t unpackedSize);
+
+	/**
+	 *  Maximum number of AppleHDADriver instances restarted for a codec
+	 */
+	static constexpr size_t MaxCodecDrivers = 4;
+
+	/**
+	 *  Restart AppleHDADriver instances of a codec so that they request their resources again
+	 *
+	 *  @param hdaCodecDevice IOHDACodecDevice instance
+	 *
+	 *  @return number of restarted drivers
+	 */
+	size_t reloadCodecDrivers(IORegistryEntry *hdaCodecDevice);
+
+	/**
+	 *  Driver restarts queued by uploads, run outside of the user client thread
+	 *  since terminating a driver waits for it to stop
+	 */
+	thread_call_t reloadCall {nullptr};
+
+	/**
+	 *  Restart the drivers of the codecs queued in resourceOverrides
+	 */
+	static void processReloads(thread_call_param_t alc, thread_call_param_t);
 #endif
 	
 	/**
@@ -242,77 +775,172 @@ private:
 	 *  @param index      kinfo index
 	 *  @param patches    patch list
 	 *  @param patchesNum patch number
+	 *  @param address    kinfo load address
+	 *  @param size       kinfo memory size
+	 *  @param hdauId     HDAU device-id to find instead of NvidiaSpecialFind (optional)
 	 */
-	void applyPatches(KernelPatcher &patcher, size_t index, const KextPatch *patches, size_t patchesNum);
+	void applyPatches(KernelPatcher &patcher, size_t index, const KextPatch *patches, size_t patchesNum, mach_vm_address_t address, size_t size, const uint32_t *hdauId=nullptr);
 
 	/**
 	 *  Controller identification and modification info
 	 */
 	class ControllerInfo {
+	public:
+		ControllerInfo() = default;
 		ControllerInfo(uint32_t ven, uint32_t dev, uint32_t rev, uint32_t p, uint32_t lid, IORegistryEntry *d, bool np) :
 		detect(d), vendor(ven), device(dev), revision(rev), platform(p), layout(lid), nopatch(np) {}
-	public:
-		static ControllerInfo *create(uint32_t ven, uint32_t dev, uint32_t rev, uint32_t p, uint32_t lid, IORegistryEntry *d, bool np) {
-			return new ControllerInfo(ven, dev, rev, p, lid, d, np);
-		}
-		static void deleter(ControllerInfo *info) { delete info; }
 		const ControllerModInfo *info {nullptr};
-		IORegistryEntry *detect;
-		uint32_t const vendor;
-		uint32_t const device;
-		uint32_t const revision;
-		uint32_t const platform {ControllerModInfo::PlatformAny};
-		uint32_t const layout;
-		bool const nopatch;
+		const uint32_t *hdauId {nullptr};
+		IORegistryEntry *detect {nullptr};
+		uint32_t vendor {0};
+		uint32_t device {0};
+		uint32_t revision {0};
+		uint32_t platform {ControllerModInfo::PlatformAny};
+		uint32_t layout {0};
+		bool nopatch {false};
 	};
 
+	/**
+	 *  Analog controllers are HDEF and the other HDA devices with alc-layout-id or layout-id
+	 */
+	static constexpr size_t MaxAnalogControllers = 1 + BootConfig::MaxExtraAnalog;
+
+	/**
+	 *  Digital controllers are the IGPU HDAU and one HDAU per discrete GPU. Discrete GPUs have
+	 *  no such bound, this allows as many GPUs as there are HDAU ids for unsupported NVIDIA models.
+	 */
+	static constexpr size_t MaxDigitalControllers = 1 + HdauIdAllocator::MaxIds;
+
+	/**
+	 *  Maximum number of detected controllers
+	 */
+	static constexpr size_t MaxControllers = MaxAnalogControllers + MaxDigitalControllers;
+
 	/**
 	 *  Detected controllers
 	 */
-	evector<ControllerInfo *, ControllerInfo::deleter> controllers;
-	size_t currentController {0};
+	ArenaVector<ControllerInfo, MaxControllers> controllers;
+
+	/**
+	 *  Controllers left without controller patches because there was no free slot
+	 */
+	size_t droppedControllers {0};
 
 	/**
-	 *  Insert a controller with given parameters
+	 *  Insert a controller with given parameters.
+	 *  Digital controllers are inserted first and never take the slots of analog ones, which carry the codecs.
 	 */
 	void insertController(uint32_t ven, uint32_t dev, uint32_t rev, bool np, uint32_t p=ControllerModInfo::PlatformAny, uint32_t lid=0, IORegistryEntry *d=nullptr) {
-		auto controller = ControllerInfo::create(ven, dev, rev, p, lid, d, np);
-		if (controller) {
-			if (!controllers.push_back(controller)) {
-				SYSLOG("alc", "failed to store controller info for %X:%X:%X", ven, dev, rev);
-				ControllerInfo::deleter(controller);
-			}
-		} else {
-			SYSLOG("alc", "failed to create controller info for %X:%X:%X", ven, dev, rev);
+		if (!controllers.push_back(ControllerInfo(ven, dev, rev, p, lid, d, np), d ? 0 : MaxAnalogControllers)) {
+			droppedControllers++;
+			SYSLOG("alc", "no free slot to store controller info for %X:%X:%X, %lu dropped", ven, dev, rev, droppedControllers);
 		}
 	}
 
+	/**
+	 *  External resource pack loading state, failed covers a missing, invalid or other build pack and is final
+	 */
+	enum : uint32_t {
+		PackUnread,
+		PackReading,
+		PackLoaded,
+		PackFailed
+	};
+	uint32_t packState {PackUnread};
+
+	/**
+	 *  External resource pack read from disk, looked up in place
+	 */
+	uint8_t *packData {nullptr};
+	respack pack {};
+
+	/**
+	 *  Controller mods decoded from the pack, their revisions and patch bytes point into the pack
+	 */
+	static constexpr size_t MaxPackPatches = 64;
+	const respack_entry *packControllerEntries[MaxControllers] {};
+	ControllerModInfo packControllers[MaxControllers] {};
+	size_t packControllerNum {0};
+	KextPatch packPatches[MaxPackPatches] {};
+	size_t packPatchNum {0};
+
+	/**
+	 *  Read and verify the resource pack unless it is loaded already.
+	 *  Reading is retried on later calls until the root filesystem is mounted.
+	 *
+	 *  @return pack or nullptr when the compiled-in tables are to be used
+	 */
+	const respack *loadResourcePack();
+
+	/**
+	 *  Decode a pack controller entry into a controller mod
+	 *
+	 *  @param entry controller entry of the loaded pack
+	 *
+	 *  @return controller mod or nullptr when it does not fit
+	 */
+	const ControllerModInfo *decodePackController(const respack_entry *entry);
+
 #ifdef HAVE_ANALOG_AUDIO
 	/**
 	 *  Codec identification and modification info
 	 */
 	class CodecInfo {
-		CodecInfo(size_t ctrl, uint32_t ven, uint32_t rev) :
-		controller(ctrl), revision(rev) {
+	public:
+		CodecInfo() = default;
+		CodecInfo(size_t ctrl, uint32_t ven, uint32_t rev, uint32_t addr, IORegistryEntry *dev) :
+		controller(ctrl), revision(rev), address(addr), device(dev) {
 			vendor = (ven & 0xFFFF0000) >> 16;
 			codec = ven & 0xFFFF;
 		}
-	public:
-		static CodecInfo *create(size_t ctrl, uint32_t ven, uint32_t rev) {
-			return new CodecInfo(ctrl, ven, rev);
+		/**
+		 *  Releases the codec device retained when the codec was stored
+		 */
+		static void deleter(CodecInfo &info) {
+			OSSafeReleaseNULL(info.device);
 		}
-		static void deleter(CodecInfo *info) { delete info; }
 		const CodecModInfo *info {nullptr};
-		size_t controller;
-		uint16_t vendor;
-		uint16_t codec;
-		uint32_t revision;
+		size_t controller {0};
+		uint16_t vendor {0};
+		uint16_t codec {0};
+		uint32_t revision {0};
+		uint32_t address {0};
+		IORegistryEntry *device {nullptr};
 	};
+
+	/**
+	 *  Maximum number of detected codecs, only analog controllers have detectible codecs
+	 */
+	static constexpr size_t MaxCodecs = MaxAnalogControllers * MaxCodecAddresses;
 	
 	/**
 	 *  Detected and validated codec infos
 	 */
-	evector<CodecInfo *, CodecInfo::deleter> codecs;
+	ArenaVector<CodecInfo, MaxCodecs, CodecInfo::deleter> codecs;
+
+	/**
+	 *  Codec discovery slots and lock, allocated once in init
+	 */
+	CodecSlots::Slot codecSlots[MaxControllers * MaxCodecAddresses] {};
+	IOLock *codecLock {nullptr};
+
+	/**
+	 *  Find the detected codec an AppleHDA service is attached to
+	 *
+	 *  @param service AppleHDACodecGeneric or another service below IOHDACodecDevice
+	 *
+	 *  @return codec info or nullptr
+	 */
+	CodecInfo *findCodec(IORegistryEntry *service);
+
+	/**
+	 *  Find the detected codec an AppleHDADriver instance belongs to, the driver is only compared
+	 *
+	 *  @param hdaDriver AppleHDADriver instance
+	 *
+	 *  @return codec info or nullptr
+	 */
+	CodecInfo *findDriverCodec(const void *hdaDriver);
 #endif
 
 	/**
@@ -347,7 +975,7 @@ private:
 	/**
 	 *  Total available NVIDIA HDAU device-ids in 10.13 and newer
 	 */
-	static constexpr size_t MaxNvidiaDeviceIds = 16;
+	static constexpr size_t MaxNvidiaDeviceIds = HdauIdAllocator::MaxIds;
 
 	/**
 	 *  Magic NVIDIA HDAU id find to update the one from the list below
@@ -377,14 +1005,14 @@ private:
 	};
 
 	/**
-	 *  NVIDIA HDAU device-ids usage status
+	 *  NVIDIA HDAU device-id allocator over the list above
 	 */
-	bool nvidiaDeviceIdUsage[MaxNvidiaDeviceIds] = {};
+	HdauIdAllocator nvidiaDeviceIds {nvidiaDeviceIdList, MaxNvidiaDeviceIds};
 
 	/**
-	 *  Current NVIDIA device-id patch to use
+	 *  Assign HDAU device-ids to detected NVIDIA controllers needing them
 	 */
-	size_t currentFreeNvidiaDeviceId = 0;
+	void assignNvidiaDeviceIds();
 };
 
 #endif /* kern_alc_hpp */
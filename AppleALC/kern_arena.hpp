@@ -0,0 +1,104 @@
+//
+//  kern_arena.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_arena_hpp
+#define kern_arena_hpp
+
+#include <stddef.h>
+
+/**
+ *  Default arena element deleter doing nothing
+ */
+template <typename T>
+void arenaEmptyDeleter(T &) {}
+
+/**
+ *  Fixed-capacity vector keeping its elements contiguously in place instead of
+ *  allocating them one by one. Elements are accessed through pointers like in
+ *  an evector of pointers, erasing moves the following elements down.
+ *
+ *  @param T       default constructible and copy assignable element type
+ *  @param N       capacity
+ *  @param deleter releases resources of an erased element
+ */
+template <typename T, size_t N, void (*deleter)(T &)=arenaEmptyDeleter<T>>
+class ArenaVector {
+	T items[N] {};
+	size_t count {0};
+
+public:
+	/**
+	 *  Maximum number of elements
+	 */
+	static constexpr size_t capacity() {
+		return N;
+	}
+
+	/**
+	 *  Current number of elements
+	 */
+	size_t size() const {
+		return count;
+	}
+
+	/**
+	 *  Access an element
+	 *
+	 *  @param index element index, must be less than size
+	 *
+	 *  @return element pointer
+	 */
+	T *operator[](size_t index) {
+		return &items[index];
+	}
+
+	const T *operator[](size_t index) const {
+		return &items[index];
+	}
+
+	/**
+	 *  Copy an element to the end
+	 *
+	 *  @param item     element
+	 *  @param reserved number of elements to leave room for
+	 *
+	 *  @return stored element or nullptr when the vector is full
+	 */
+	T *push_back(const T &item, size_t reserved=0) {
+		if (count + reserved >= N)
+			return nullptr;
+		items[count] = item;
+		return &items[count++];
+	}
+
+	/**
+	 *  Erase an element preserving the order of the others
+	 *
+	 *  @param index element index
+	 */
+	void erase(size_t index) {
+		if (index >= count)
+			return;
+		deleter(items[index]);
+		for (size_t i = index + 1; i < count; i++)
+			items[i - 1] = items[i];
+		items[--count] = T {};
+	}
+
+	/**
+	 *  Erase all elements
+	 */
+	void deinit() {
+		for (size_t i = 0; i < count; i++) {
+			deleter(items[i]);
+			items[i] = T {};
+		}
+		count = 0;
+	}
+};
+
+#endif /* kern_arena_hpp */
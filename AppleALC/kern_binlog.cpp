@@ -0,0 +1,60 @@
+//
+//  kern_binlog.cpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "kern_binlog.hpp"
+
+BinaryLog *BinaryLog::active = nullptr;
+
+uint16_t BinaryLog::registerFormat(const char *module, const char *format) {
+	auto index = __atomic_fetch_add(&formatCount, 1, __ATOMIC_RELAXED);
+	if (index >= kALCLogFormats) {
+		__atomic_store_n(&formatCount, kALCLogFormats, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	// Readers skip the slot until the format is published.
+	formats[index].module = module;
+	__atomic_store_n(&formats[index].format, format, __ATOMIC_RELEASE);
+	return static_cast<uint16_t>(index + 1);
+}
+
+void BinaryLog::read(ALCLogDump &dump) {
+	dump.version = kALCLogVersion;
+	dump.capacity = kALCLogCapacity;
+	dump.head = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	dump.dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	auto first = __atomic_load_n(&base, __ATOMIC_RELAXED);
+
+	auto count = __atomic_load_n(&formatCount, __ATOMIC_RELAXED);
+	dump.formatCount = count < kALCLogFormats ? count : kALCLogFormats;
+	for (size_t i = 0; i < kALCLogFormats; i++) {
+		auto &dst = dump.formats[i];
+		auto format = i < dump.formatCount ? __atomic_load_n(&formats[i].format, __ATOMIC_ACQUIRE) : nullptr;
+		if (format) {
+			strlcpy(dst.module, formats[i].module, sizeof(dst.module));
+			strlcpy(dst.format, format, sizeof(dst.format));
+		} else {
+			dst.module[0] = '\0';
+			dst.format[0] = '\0';
+		}
+	}
+
+	for (size_t i = 0; i < kALCLogCapacity; i++) {
+		auto &src = records[i];
+		auto &dst = dump.records[i];
+		auto sequence = __atomic_load_n(&src.sequence, __ATOMIC_ACQUIRE);
+		dst = src;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (sequence <= first || __atomic_load_n(&src.sequence, __ATOMIC_RELAXED) != sequence)
+			sequence = 0;
+		dst.sequence = sequence;
+	}
+}
+
+void BinaryLog::reset() {
+	__atomic_store_n(&base, __atomic_load_n(&head, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
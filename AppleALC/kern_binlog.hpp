@@ -0,0 +1,173 @@
+//
+//  kern_binlog.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_binlog_hpp
+#define kern_binlog_hpp
+
+#include <Headers/kern_util.hpp>
+#include <Headers/kern_time.hpp>
+
+#include "UserKernelShared.h"
+
+/**
+ *  Lock-free ring of debug log records keeping the format index and raw arguments.
+ *  Formatting is left to the reader in user space, so recording costs a few stores.
+ */
+class BinaryLog {
+	/**
+	 *  Recorded entries, record N is stored at (N - 1) % kALCLogCapacity
+	 */
+	ALCLogRecord records[kALCLogCapacity] {};
+
+	/**
+	 *  Last reserved sequence
+	 */
+	uint64_t head {0};
+
+	/**
+	 *  Last sequence dropped by reset
+	 */
+	uint64_t base {0};
+
+	/**
+	 *  Records of call sites left without a format slot
+	 */
+	uint64_t dropped {0};
+
+	/**
+	 *  Call site format, format is set last and never changes afterwards
+	 */
+	struct Format {
+		const char *module;
+		const char *format;
+	};
+
+	Format formats[kALCLogFormats] {};
+	uint32_t formatCount {0};
+
+	/**
+	 *  Register a call site format
+	 *
+	 *  @return format index plus one or 0 when the table is full
+	 */
+	uint16_t registerFormat(const char *module, const char *format);
+
+	/**
+	 *  Store an argument in the next slots
+	 */
+	static void pack(ALCLogRecord &record, size_t &slot, const char *value) {
+		if (slot >= kALCLogArgs)
+			return;
+
+		// The string is truncated to the remaining slots and always terminated.
+		auto dst = reinterpret_cast<char *>(&record.args[slot]);
+		size_t size = (kALCLogArgs - slot) * sizeof(uint64_t);
+		if (!value)
+			value = "(null)";
+		size_t len = 0;
+		while (len < size - 1 && value[len] != '\0')
+			len++;
+		memcpy(dst, value, len);
+		dst[len] = '\0';
+		record.strings |= 1U << slot;
+		slot += (len + sizeof(uint64_t)) / sizeof(uint64_t);
+	}
+
+	static void pack(ALCLogRecord &record, size_t &slot, char *value) {
+		pack(record, slot, static_cast<const char *>(value));
+	}
+
+	template <typename T>
+	static void pack(ALCLogRecord &record, size_t &slot, T *value) {
+		if (slot < kALCLogArgs)
+			record.args[slot++] = reinterpret_cast<uintptr_t>(value);
+	}
+
+	template <typename T>
+	static void pack(ALCLogRecord &record, size_t &slot, T value) {
+		// Signed values are sign extended, the reader narrows them by the format.
+		if (slot < kALCLogArgs)
+			record.args[slot++] = static_cast<uint64_t>(value);
+	}
+
+public:
+	/**
+	 *  Ring used by ALCLOG, set once at startup by -alcbinlog boot-arg
+	 */
+	static BinaryLog *active;
+
+	/**
+	 *  Record a log call
+	 *
+	 *  @param format call site format cache, 0 until registered
+	 *  @param module log module
+	 *  @param str    format string, must stay valid forever
+	 *  @param args   format arguments
+	 */
+	template <typename... Args>
+	void record(uint16_t &format, const char *module, const char *str, Args... args) {
+		// Racing first calls may register a call site twice, which only costs a slot.
+		auto index = __atomic_load_n(&format, __ATOMIC_RELAXED);
+		if (index == 0) {
+			index = registerFormat(module, str);
+			__atomic_store_n(&format, index, __ATOMIC_RELAXED);
+			if (index == 0) {
+				__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+
+		auto sequence = __atomic_add_fetch(&head, 1, __ATOMIC_RELAXED);
+		auto &entry = records[(sequence - 1) % kALCLogCapacity];
+
+		// Invalidate the entry first, so that readers never accept a partially written one.
+		__atomic_store_n(&entry.sequence, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		entry.timestamp = getCurrentTimeNs();
+		entry.format = index;
+		entry.strings = 0;
+		size_t slot = 0;
+		int expand[] {0, (pack(entry, slot, args), 0)...};
+		(void)expand;
+		entry.count = static_cast<uint8_t>(slot < kALCLogArgs ? slot : kALCLogArgs);
+		__atomic_store_n(&entry.sequence, sequence, __ATOMIC_RELEASE);
+	}
+
+	/**
+	 *  Copy a consistent snapshot of the records and formats
+	 *
+	 *  @param dump Destination
+	 */
+	void read(ALCLogDump &dump);
+
+	/**
+	 *  Drop recorded entries, formats are kept
+	 */
+	void reset();
+};
+
+/**
+ *  Debug logging recorded in BinaryLog::active when -alcbinlog is set, and formatted
+ *  by DBGLOG otherwise. Meant for hot paths, errors still go to SYSLOG.
+ */
+#ifdef DEBUG
+#define ALCLOG(module, str, ...) do {                                                   \
+	auto alcBinaryLog = BinaryLog::active;                                              \
+	if (alcBinaryLog) {                                                                 \
+		static uint16_t alcLogFormat {0};                                               \
+		alcBinaryLog->record(alcLogFormat, module, str, ##__VA_ARGS__);                 \
+	} else {                                                                            \
+		DBGLOG(module, str, ##__VA_ARGS__);                                             \
+	}                                                                                   \
+} while (0)
+#define ALCLOG_COND(cond, module, str, ...) do { if (cond) ALCLOG(module, str, ##__VA_ARGS__); } while (0)
+#else
+#define ALCLOG(module, str, ...) do { } while (0)
+#define ALCLOG_COND(cond, module, str, ...) do { } while (0)
+#endif
+
+#endif /* kern_binlog_hpp */
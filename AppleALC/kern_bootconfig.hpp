@@ -0,0 +1,44 @@
+//
+//  kern_bootconfig.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_bootconfig_hpp
+#define kern_bootconfig_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  alc-verbs and alc-delay requests collected from the audio devices in a single pass.
+ *  Property access is done through a callback, so that the scan can run over a stand-in registry.
+ */
+struct DeviceRequests {
+	/**
+	 *  alc-verbs or alc-delay is set on any checked device
+	 */
+	bool verbs {false};
+	bool delay {false};
+
+	/**
+	 *  Check a device, properties overridden by boot-args or already found are not read
+	 *
+	 *  @param entry           audio device or nullptr
+	 *  @param verbsOverridden alcverbs boot-arg is set
+	 *  @param delayOverridden alcdelay boot-arg is set
+	 *  @param hasProperty     callable returning whether the device has a property
+	 */
+	template <typename Entry, typename HasProperty>
+	void check(Entry *entry, bool verbsOverridden, bool delayOverridden, HasProperty hasProperty) {
+		if (!entry)
+			return;
+		if (!verbsOverridden && !verbs && hasProperty(entry, "alc-verbs"))
+			verbs = true;
+		if (!delayOverridden && !delay && hasProperty(entry, "alc-delay"))
+			delay = true;
+	}
+};
+
+#endif /* kern_bootconfig_hpp */
@@ -0,0 +1,157 @@
+//
+//  kern_discovery.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_discovery_hpp
+#define kern_discovery_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Codecs of all controllers collected from publish notifications. Registry access and
+ *  locking stay with the caller, so that discovery can run against a stand-in registry.
+ *  store and remaining must be serialised by the caller.
+ *
+ *  @param Entry  registry entry type of codecs and controllers
+ */
+template <typename Entry>
+class CodecDiscovery {
+public:
+	/**
+	 *  Codec addresses on a single HDA link
+	 */
+	static constexpr size_t MaxCodecAddresses = 15;
+
+	/**
+	 *  Discovered codec and the time it took to appear
+	 */
+	struct Slot {
+		Entry *codec;
+		uint64_t latency;
+	};
+
+	/**
+	 *  Outcome of storing a codec
+	 */
+	enum class Result {
+		Stored,
+		Completed,	// Stored the first codec of the last controller waited for
+		Ignored
+	};
+
+	/**
+	 *  Start discovery
+	 *
+	 *  @param storage     MaxCodecAddresses slots per controller
+	 *  @param controllers number of controllers
+	 *  @param now         current time in nanoseconds
+	 */
+	void reset(Slot *storage, size_t controllers, uint64_t now) {
+		slots = storage;
+		for (size_t i = 0; i < controllers * MaxCodecAddresses; i++)
+			slots[i] = {};
+		pending = 0;
+		start = now;
+	}
+
+	/**
+	 *  Wait for a codec of one more controller
+	 */
+	void expect() {
+		pending++;
+	}
+
+	/**
+	 *  Number of controllers waited for that have no codec yet
+	 */
+	size_t remaining() const {
+		return pending;
+	}
+
+	/**
+	 *  Store a codec in its controller and address slot. Codecs are kept in address
+	 *  order, codecs without a valid or with a taken address get the first free slot.
+	 *
+	 *  @param controller controller index
+	 *  @param codec      codec entry
+	 *  @param address    IOHDACodecAddress or MaxCodecAddresses when missing
+	 *  @param now        current time in nanoseconds
+	 *
+	 *  @return Ignored when the codec is known or there is no free slot
+	 */
+	Result store(size_t controller, Entry *codec, uint32_t address, uint64_t now) {
+		auto list = get(controller);
+		bool first = true;
+		for (size_t i = 0; i < MaxCodecAddresses; i++) {
+			if (list[i].codec == codec)
+				return Result::Ignored;
+			if (list[i].codec)
+				first = false;
+		}
+
+		size_t slot = MaxCodecAddresses;
+		if (address < MaxCodecAddresses && !list[address].codec)
+			slot = address;
+		for (size_t i = 0; slot == MaxCodecAddresses && i < MaxCodecAddresses; i++)
+			if (!list[i].codec)
+				slot = i;
+		if (slot == MaxCodecAddresses)
+			return Result::Ignored;
+
+		list[slot] = {codec, now - start};
+		if (first && pending > 0 && --pending == 0)
+			return Result::Completed;
+		return Result::Stored;
+	}
+
+	/**
+	 *  Obtain the slots of a controller
+	 *
+	 *  @param controller controller index
+	 *
+	 *  @return MaxCodecAddresses slots in address order
+	 */
+	Slot *get(size_t controller) {
+		return &slots[controller * MaxCodecAddresses];
+	}
+
+	/**
+	 *  Find the controller a codec is published below
+	 *
+	 *  @param codec      codec entry
+	 *  @param parent     callable returning the parent entry or nullptr
+	 *  @param match      callable returning true and setting the index for a controller entry
+	 *  @param controller found controller index
+	 *
+	 *  @return true if a controller was found
+	 */
+	template <typename Parent, typename Match>
+	static bool findController(Entry *codec, Parent parent, Match match, size_t &controller) {
+		for (auto entry = parent(codec); entry; entry = parent(entry))
+			if (match(entry, controller))
+				return true;
+		return false;
+	}
+
+private:
+	/**
+	 *  Slot storage owned by the caller
+	 */
+	Slot *slots {nullptr};
+
+	/**
+	 *  Controllers waited for that have no codec yet
+	 */
+	size_t pending {0};
+
+	/**
+	 *  Discovery start time
+	 */
+	uint64_t start {0};
+};
+
+#endif /* kern_discovery_hpp */
@@ -0,0 +1,205 @@
+//
+//  kern_events.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_events_hpp
+#define kern_events_hpp
+
+#include <Headers/kern_util.hpp>
+#include <Headers/kern_time.hpp>
+
+#include "kern_hda.hpp"
+#include "kern_binlog.hpp"
+#include "UserKernelShared.h"
+
+/**
+ *  Jack sense and GPIO monitor of a codec audio function group. Verbs are sent through
+ *  a callback and events are appended to the queue shared with user-clients, so that the
+ *  monitor can be driven by a simulated codec outside of the kernel.
+ */
+class EventMonitor {
+public:
+	/**
+	 *  Verb executor sending a single verb without waiting
+	 */
+	using Exec = IOReturn (*)(void *ctx, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response);
+
+	/**
+	 *  Maximum number of monitored jack sense pins
+	 */
+	static constexpr size_t MaxPins = 16;
+
+	/**
+	 *  Polling interval in milliseconds, overridden by alc-event-poll or alceventpoll boot-arg
+	 */
+	static constexpr uint32_t DefaultInterval = 500;
+	static constexpr uint32_t MinInterval = 50;
+	static constexpr uint32_t MaxInterval = 10000;
+
+	/**
+	 *  Bring a requested polling interval into the supported range
+	 */
+	static uint32_t clampInterval(uint32_t interval) {
+		return interval < MinInterval ? MinInterval : (interval > MaxInterval ? MaxInterval : interval);
+	}
+
+	/**
+	 *  Check whether the event sources were found
+	 */
+	bool isDiscovered() const {
+		return discovered;
+	}
+
+	/**
+	 *  Number of polls skipped because the function group was powered down
+	 */
+	uint64_t skippedPolls() const {
+		return skipped;
+	}
+
+	/**
+	 *  Find presence detect capable pins and GPIOs of the audio function group
+	 *
+	 *  @param exec Verb executor
+	 *  @param ctx  Executor context
+	 *
+	 *  @return true once the function group was found
+	 */
+	bool discover(Exec exec, void *ctx) {
+		uint32_t response = 0;
+		if (exec(ctx, 0, HdaVerb::GetParameter, HdaParam::NodeCount, &response) != kIOReturnSuccess)
+			return false;
+
+		// Find the audio function group.
+		afg = 0;
+		auto start = HdaResponse::startNode(response);
+		auto count = HdaResponse::nodeCount(response);
+		for (uint16_t nid = start; nid < start + count && afg == 0; nid++) {
+			if (exec(ctx, nid, HdaVerb::GetParameter, HdaParam::FunctionType, &response) == kIOReturnSuccess &&
+				HdaResponse::isAudioFunctionGroup(response))
+				afg = nid;
+		}
+
+		if (afg == 0) {
+			DBGLOG("client", "unable to find audio function group for events");
+			return false;
+		}
+
+		hasGpio = exec(ctx, afg, HdaVerb::GetParameter, HdaParam::GpioCap, &response) == kIOReturnSuccess &&
+			HdaResponse::gpioCount(response) > 0;
+
+		// Find connected pins with working presence detection.
+		pinCount = 0;
+		if (exec(ctx, afg, HdaVerb::GetParameter, HdaParam::NodeCount, &response) == kIOReturnSuccess) {
+			start = HdaResponse::startNode(response);
+			count = HdaResponse::nodeCount(response);
+			for (uint16_t nid = start; nid < start + count && pinCount < MaxPins; nid++) {
+				if (exec(ctx, nid, HdaVerb::GetParameter, HdaParam::AudioWidgetCap, &response) != kIOReturnSuccess ||
+					HdaResponse::widgetType(response) != HdaResponse::WidgetTypePin)
+					continue;
+				if (exec(ctx, nid, HdaVerb::GetParameter, HdaParam::PinCap, &response) != kIOReturnSuccess ||
+					!HdaResponse::hasPresenceDetect(response))
+					continue;
+				if (exec(ctx, nid, HdaVerb::GetConfigDefault, 0, &response) != kIOReturnSuccess ||
+					!HdaResponse::isPinConnected(response) || HdaResponse::hasJackDetectOverride(response))
+					continue;
+				pins[pinCount++] = nid;
+			}
+		}
+
+		DBGLOG("client", "monitoring %lu pins and %s GPIOs of afg 0x%X", pinCount, hasGpio ? "all" : "no", afg);
+		discovered = true;
+		return true;
+	}
+
+	/**
+	 *  Read current jack sense and GPIO state and publish the changes. Nothing but the power
+	 *  state is read while the function group is in D3, so that polling does not keep the
+	 *  codec and the link busy. A requested full publish is then postponed to the next poll.
+	 *
+	 *  @param exec  Verb executor
+	 *  @param ctx   Executor context
+	 *  @param queue Shared event queue
+	 *  @param all   Publish the state of every source even if unchanged
+	 *
+	 *  @return true if any event was published
+	 */
+	bool poll(Exec exec, void *ctx, ALCEventQueue *queue, bool all) {
+		uint32_t response = 0;
+		resync = resync || all;
+		if (exec(ctx, afg, HdaVerb::GetPowerState, 0, &response) == kIOReturnSuccess &&
+			HdaResponse::actualPowerState(response) >= HdaResponse::PowerStateD3) {
+			skipped++;
+			return false;
+		}
+
+		all = resync;
+		resync = false;
+		bool published = false;
+		for (size_t i = 0; i < pinCount; i++) {
+			if (exec(ctx, pins[i], HdaVerb::GetPinSense, 0, &response) != kIOReturnSuccess)
+				continue;
+			if (all || HdaResponse::isPresent(response) != HdaResponse::isPresent(pinState[i])) {
+				pinState[i] = response;
+				publish(queue, pins[i], kALCEventPinSense, response);
+				published = true;
+			}
+		}
+
+		if (hasGpio && exec(ctx, afg, HdaVerb::GetGpioData, 0, &response) == kIOReturnSuccess &&
+			(all || response != gpioState)) {
+			gpioState = response;
+			publish(queue, afg, kALCEventGpio, response);
+			published = true;
+		}
+
+		return published;
+	}
+
+	/**
+	 *  Append an event to the shared queue, there must be a single writer
+	 */
+	static void publish(ALCEventQueue *queue, uint16_t nid, uint16_t type, uint32_t value) {
+		auto sequence = queue->head + 1;
+		auto &event = queue->events[(sequence - 1) % kALCEventQueueCapacity];
+
+		// Invalidate the entry first, so that readers never accept a partially written one.
+		__atomic_store_n(&event.sequence, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		event.timestamp = getCurrentTimeNs();
+		event.nid = nid;
+		event.type = type;
+		event.value = value;
+		__atomic_store_n(&event.sequence, sequence, __ATOMIC_RELEASE);
+		__atomic_store_n(&queue->head, sequence, __ATOMIC_RELEASE);
+
+		ALCLOG("client", "event %llu nid=0x%X, type=%u, value=0x%08x", sequence, nid, type, value);
+	}
+
+private:
+	/**
+	 *  Event sources found by discover
+	 */
+	bool discovered {false};
+	uint16_t afg {0};
+	bool hasGpio {false};
+	uint16_t pins[MaxPins] {};
+	size_t pinCount {0};
+
+	/**
+	 *  Last published state
+	 */
+	uint32_t gpioState {0};
+	uint32_t pinState[MaxPins] {};
+
+	/**
+	 *  Full publish postponed while powered down
+	 */
+	bool resync {false};
+	uint64_t skipped {0};
+};
+
+#endif /* kern_events_hpp */
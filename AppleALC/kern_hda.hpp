@@ -0,0 +1,171 @@
+//
+//  kern_hda.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_hda_hpp
+#define kern_hda_hpp
+
+#include <stdint.h>
+
+/**
+ *  HDA codec verbs used by AppleALC itself.
+ *  See alc-verb/hdaverb.h for the complete list.
+ */
+namespace HdaVerb {
+	static constexpr uint16_t SetStreamFormat     = 0x200;
+	static constexpr uint16_t SetAmpGainMute      = 0x300;
+	static constexpr uint16_t SetProcCoef         = 0x400;
+	static constexpr uint16_t SetCoefIndex        = 0x500;
+	static constexpr uint16_t SetConnectSel       = 0x701;
+	static constexpr uint16_t SetPinWidgetControl = 0x707;
+	static constexpr uint16_t SetEapdBtlEnable    = 0x70C;
+	static constexpr uint16_t SetConfigDefault0   = 0x71C;
+	static constexpr uint16_t SetConfigDefault3   = 0x71F;
+	static constexpr uint16_t GetStreamFormat     = 0xA00;
+	static constexpr uint16_t GetAmpGainMute      = 0xB00;
+	static constexpr uint16_t GetProcCoef         = 0xC00;
+	static constexpr uint16_t GetCoefIndex        = 0xD00;
+	static constexpr uint16_t GetParameter        = 0xF00;
+	static constexpr uint16_t GetConnectSel       = 0xF01;
+	static constexpr uint16_t GetPowerState       = 0xF05;
+	static constexpr uint16_t GetPinWidgetControl = 0xF07;
+	static constexpr uint16_t GetPinSense         = 0xF09;
+	static constexpr uint16_t GetEapdBtlEnable    = 0xF0C;
+	static constexpr uint16_t GetGpioData         = 0xF15;
+	static constexpr uint16_t GetConfigDefault    = 0xF1C;
+}
+
+/**
+ *  HDA controller registers in BAR0
+ */
+namespace HdaRegister {
+	static constexpr uint32_t GlobalControl     = 0x08;
+	static constexpr uint32_t StateChangeStatus = 0x0E;
+
+	/**
+	 *  GCTL controller reset bit, set once the controller is out of reset
+	 */
+	static constexpr uint32_t ControllerReset   = 0x1;
+
+	/**
+	 *  STATESTS SDIN bits, one per codec that signalled presence on the link
+	 */
+	static constexpr uint16_t CodecPresentMask  = 0x7FFF;
+
+	/**
+	 *  Check that GCTL and STATESTS show a controller out of reset with codecs on its link
+	 */
+	static inline bool linkReady(uint32_t gctl, uint16_t statests) {
+		return gctl != 0xFFFFFFFF && (gctl & ControllerReset) && (statests & CodecPresentMask);
+	}
+}
+
+/**
+ *  HDA codec parameters read with HdaVerb::GetParameter
+ */
+namespace HdaParam {
+	static constexpr uint16_t NodeCount      = 0x04;
+	static constexpr uint16_t FunctionType   = 0x05;
+	static constexpr uint16_t AudioWidgetCap = 0x09;
+	static constexpr uint16_t PinCap         = 0x0C;
+	static constexpr uint16_t GpioCap        = 0x11;
+}
+
+/**
+ *  HDA codec response decoding helpers
+ */
+namespace HdaResponse {
+	/**
+	 *  NodeCount response fields
+	 */
+	inline uint16_t startNode(uint32_t response) { return (response >> 16) & 0xFF; }
+	inline uint16_t nodeCount(uint32_t response) { return response & 0xFF; }
+
+	/**
+	 *  FunctionType response check for audio function groups
+	 */
+	inline bool isAudioFunctionGroup(uint32_t response) { return (response & 0xFF) == 0x01; }
+
+	/**
+	 *  AudioWidgetCap widget type field
+	 */
+	inline uint32_t widgetType(uint32_t response) { return (response >> 20) & 0xF; }
+	static constexpr uint32_t WidgetTypePin = 0x4;
+
+	/**
+	 *  PinCap presence detect capability
+	 */
+	inline bool hasPresenceDetect(uint32_t response) { return (response & (1U << 2)) != 0; }
+
+	/**
+	 *  ConfigDefault port connectivity and jack detect override
+	 */
+	inline bool isPinConnected(uint32_t response) { return (response >> 30) != 0x1; }
+	inline bool hasJackDetectOverride(uint32_t response) { return (response & (1U << 8)) != 0; }
+
+	/**
+	 *  GpioCap number of GPIO pins
+	 */
+	inline uint32_t gpioCount(uint32_t response) { return response & 0xFF; }
+
+	/**
+	 *  PinSense presence detect state
+	 */
+	inline bool isPresent(uint32_t response) { return (response & (1U << 31)) != 0; }
+
+	/**
+	 *  GetPowerState actual power state, D3cold and error states are above D3
+	 */
+	inline uint32_t actualPowerState(uint32_t response) { return (response >> 4) & 0xF; }
+	static constexpr uint32_t PowerStateD3 = 0x3;
+
+	/**
+	 *  GetPowerState error and settings reset flags, either means the programmed state is gone
+	 */
+	inline bool powerStateLost(uint32_t response) { return (response & (1U << 8 | 1U << 10)) != 0; }
+}
+
+/**
+ *  SET_AMP_GAIN_MUTE and GET_AMP_GAIN_MUTE parameter fields
+ */
+namespace HdaAmp {
+	static constexpr uint16_t SetOutput = 1U << 15;
+	static constexpr uint16_t SetInput  = 1U << 14;
+	static constexpr uint16_t SetLeft   = 1U << 13;
+	static constexpr uint16_t SetRight  = 1U << 12;
+	static constexpr uint16_t GetOutput = 1U << 15;
+	static constexpr uint16_t GetLeft   = 1U << 13;
+
+	inline uint16_t setIndex(uint16_t param) { return (param >> 8) & 0xF; }
+	inline uint16_t gainMute(uint32_t value) { return value & 0xFF; }
+}
+
+/**
+ *  HDA codec command decoding helpers for 32-bit ConfigData entries
+ */
+namespace HdaCommand {
+	/**
+	 *  Codec address and node id fields
+	 */
+	inline uint32_t codecAddress(uint32_t command) { return command >> 28; }
+	inline uint16_t nid(uint32_t command) { return (command >> 20) & 0xFF; }
+
+	/**
+	 *  12-bit verbs (0x7XX and 0xFXX) carry an 8-bit payload, 4-bit verbs carry a 16-bit payload
+	 */
+	inline bool hasLongPayload(uint32_t command) {
+		auto id = (command >> 16) & 0xF;
+		return id != 0x7 && id != 0xF;
+	}
+
+	/**
+	 *  Verb and payload in executeVerb format
+	 */
+	inline uint16_t verb(uint32_t command) { return hasLongPayload(command) ? (command >> 8) & 0xF00 : (command >> 8) & 0xFFF; }
+	inline uint16_t param(uint32_t command) { return hasLongPayload(command) ? command & 0xFFFF : command & 0xFF; }
+}
+
+#endif /* kern_hda_hpp */
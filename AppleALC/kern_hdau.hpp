@@ -0,0 +1,149 @@
+//
+//  kern_hdau.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_hdau_hpp
+#define kern_hdau_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Allocator of HDAU device-ids recognised by AppleHDAController for unsupported NVIDIA GPUs.
+ *  GPUs of the same model share one id, so any number of GPUs is handled as long as there
+ *  are no more distinct models than ids. The assignment only depends on the set of requested
+ *  devices and not on their discovery order, so the mapping persists across boots.
+ */
+class HdauIdAllocator {
+public:
+	/**
+	 *  Maximum number of replaceable ids
+	 */
+	static constexpr size_t MaxIds = 16;
+
+	/**
+	 *  Create an allocator over a list of replaceable ids
+	 *
+	 *  @param list Replaceable ids, must stay valid while the allocator is used
+	 *  @param num  Number of ids, at most MaxIds
+	 */
+	HdauIdAllocator(const uint32_t *list, size_t num) : ids(list), idNum(num < MaxIds ? num : MaxIds) {}
+
+	/**
+	 *  Mark an id used by a natively supported device
+	 *
+	 *  @param device Device in (device << 16) | vendor form
+	 *
+	 *  @return true if the id was in the list
+	 */
+	bool reserve(uint32_t device) {
+		for (size_t i = 0; i < idNum; i++) {
+			if (ids[i] == device) {
+				owners[i] = device;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 *  Request an id for an unsupported device, repeated requests are merged.
+	 *  When there are more distinct devices than ids, the lowest devices are kept.
+	 *
+	 *  @param device Device in (device << 16) | vendor form
+	 */
+	void request(uint32_t device) {
+		size_t pos = 0;
+		while (pos < pendingNum && pending[pos] < device)
+			pos++;
+		if (pos < pendingNum && pending[pos] == device)
+			return;
+
+		if (pendingNum == MaxIds) {
+			overflow = true;
+			if (pos == MaxIds)
+				return;
+			pendingNum--;
+		}
+
+		for (size_t i = pendingNum; i > pos; i--)
+			pending[i] = pending[i - 1];
+		pending[pos] = device;
+		pendingNum++;
+	}
+
+	/**
+	 *  Assign free ids to the requested devices in ascending device order
+	 *
+	 *  @return number of kept requested devices left without an id
+	 */
+	size_t assign() {
+		size_t slot = 0;
+		size_t missing = 0;
+		for (size_t i = 0; i < pendingNum; i++) {
+			while (slot < idNum && owners[slot] != 0)
+				slot++;
+			if (slot == idNum) {
+				missing += pendingNum - i;
+				break;
+			}
+			owners[slot] = pending[i];
+			assigned[slot] = true;
+		}
+		return missing;
+	}
+
+	/**
+	 *  Obtain the id assigned to a requested device
+	 *
+	 *  @param device Device in (device << 16) | vendor form
+	 *
+	 *  @return pointer to the replaceable id or nullptr
+	 */
+	const uint32_t *find(uint32_t device) const {
+		for (size_t i = 0; i < idNum; i++)
+			if (assigned[i] && owners[i] == device)
+				return &ids[i];
+		return nullptr;
+	}
+
+	/**
+	 *  Check whether more distinct devices were requested than could be kept
+	 */
+	bool overflowed() const {
+		return overflow;
+	}
+
+private:
+	/**
+	 *  Replaceable ids and their number
+	 */
+	const uint32_t *ids;
+	size_t idNum;
+
+	/**
+	 *  Device owning each id, 0 when free
+	 */
+	uint32_t owners[MaxIds] {};
+
+	/**
+	 *  Whether each id was assigned to a requested device rather than reserved
+	 */
+	bool assigned[MaxIds] {};
+
+	/**
+	 *  Requested devices sorted in ascending order
+	 */
+	uint32_t pending[MaxIds] {};
+	size_t pendingNum {0};
+
+	/**
+	 *  Some requested devices did not fit
+	 */
+	bool overflow {false};
+};
+
+#endif /* kern_hdau_hpp */
@@ -0,0 +1,232 @@
+//
+//  kern_override.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_override_hpp
+#define kern_override_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "UserKernelShared.h"
+
+/**
+ *  Layout and platform files uploaded through the user client, replacing the
+ *  generated ones until reboot. The table does not allocate, buffers of replaced
+ *  files are handed back to the caller once no resource request may use them.
+ *  Codecs whose drivers are to be restarted for the new files are queued here too.
+ *  Callers serialise all access.
+ */
+class ResourceOverrides {
+public:
+	/**
+	 *  Maximum number of uploaded files and of replaced files awaiting release
+	 */
+	static constexpr size_t MaxOverrides = 8;
+
+	/**
+	 *  Uploaded file
+	 */
+	struct Override {
+		uint32_t type;
+		uint32_t codec;
+		uint32_t layout;
+		const uint8_t *data;
+		uint32_t size;
+	};
+
+	/**
+	 *  Check that an uploaded file fits the limits and starts with a zlib stream header
+	 *
+	 *  @param data         compressed file
+	 *  @param size         compressed file size
+	 *  @param unpackedSize uncompressed file size
+	 *
+	 *  @return true if the file may be decompressed
+	 */
+	static bool validHeader(const uint8_t *data, size_t size, size_t unpackedSize) {
+		// Two header bytes, at least an empty final block and the adler32 trailer.
+		if (!data || size < 7 || size > kALCResourceMaxSize || unpackedSize == 0 || unpackedSize > kALCResourceMaxUnpackedSize)
+			return false;
+
+		uint8_t cmf = data[0];
+		uint8_t flg = data[1];
+		return (cmf & 0x0F) == 8 && (cmf >> 4) <= 7 && (flg & 0x20) == 0 && ((cmf << 8) | flg) % 31 == 0;
+	}
+
+	/**
+	 *  Find an uploaded file
+	 *
+	 *  @param type   kALCResourceLayout or kALCResourcePlatform
+	 *  @param codec  codec in (vendor << 16) | device form
+	 *  @param layout layout id
+	 *
+	 *  @return uploaded file or nullptr
+	 */
+	const Override *find(uint32_t type, uint32_t codec, uint32_t layout) const {
+		for (size_t i = 0; i < count; i++)
+			if (items[i].type == type && items[i].codec == codec && items[i].layout == layout)
+				return &items[i];
+		return nullptr;
+	}
+
+	/**
+	 *  Add an uploaded file or replace the one with the same key
+	 *
+	 *  @param item     uploaded file, data stays owned by the table
+	 *  @param released replaced buffer to free now or nullptr
+	 *
+	 *  @return false if there is no free slot, the file is not stored
+	 */
+	bool install(const Override &item, const uint8_t *&released) {
+		released = nullptr;
+		auto slot = const_cast<Override *>(find(item.type, item.codec, item.layout));
+		if (slot) {
+			if (!retire(slot->data, released))
+				return false;
+			*slot = item;
+			return true;
+		}
+
+		if (count == MaxOverrides)
+			return false;
+		items[count++] = item;
+		return true;
+	}
+
+	/**
+	 *  Drop an uploaded file
+	 *
+	 *  @param type     kALCResourceLayout or kALCResourcePlatform
+	 *  @param codec    codec in (vendor << 16) | device form
+	 *  @param layout   layout id
+	 *  @param released dropped buffer to free now or nullptr
+	 *
+	 *  @return false if there was no such file or its buffer could not be retired
+	 */
+	bool remove(uint32_t type, uint32_t codec, uint32_t layout, const uint8_t *&released) {
+		released = nullptr;
+		auto slot = find(type, codec, layout);
+		if (!slot || !retire(slot->data, released))
+			return false;
+		size_t index = slot - items;
+		for (size_t i = index + 1; i < count; i++)
+			items[i - 1] = items[i];
+		items[--count] = {};
+		return true;
+	}
+
+	/**
+	 *  Mark the start of a resource request that may use uploaded files
+	 */
+	void enter() {
+		users++;
+	}
+
+	/**
+	 *  Mark the end of a resource request
+	 *
+	 *  @param released buffers retired while there were requests, to free now
+	 *
+	 *  @return number of released buffers
+	 */
+	size_t leave(const uint8_t *(&released)[MaxOverrides]) {
+		if (users == 0 || --users > 0)
+			return 0;
+		size_t num = retiredNum;
+		for (size_t i = 0; i < num; i++) {
+			released[i] = retired[i];
+			retired[i] = nullptr;
+		}
+		retiredNum = 0;
+		return num;
+	}
+
+	/**
+	 *  Queue a driver restart of a codec, a codec already queued is not added again
+	 *
+	 *  @param codec detected codec index
+	 *
+	 *  @return false if the queue is full
+	 */
+	bool queueReload(size_t codec) {
+		for (size_t i = 0; i < reloadNum; i++)
+			if (reloads[i] == codec)
+				return true;
+		if (reloadNum == MaxOverrides)
+			return false;
+		reloads[reloadNum++] = codec;
+		return true;
+	}
+
+	/**
+	 *  Take the queued driver restarts
+	 *
+	 *  @param codecs detected codec indices in the order they were queued
+	 *
+	 *  @return number of codecs
+	 */
+	size_t takeReloads(size_t (&codecs)[MaxOverrides]) {
+		size_t num = reloadNum;
+		for (size_t i = 0; i < num; i++)
+			codecs[i] = reloads[i];
+		reloadNum = 0;
+		return num;
+	}
+
+	/**
+	 *  Number of uploaded files
+	 */
+	size_t size() const {
+		return count;
+	}
+
+	/**
+	 *  Access an uploaded file
+	 *
+	 *  @param index file index, must be less than size
+	 */
+	const Override &operator[](size_t index) const {
+		return items[index];
+	}
+
+private:
+	/**
+	 *  Release a replaced buffer now or once the running requests end
+	 */
+	bool retire(const uint8_t *data, const uint8_t *&released) {
+		if (users == 0) {
+			released = data;
+			return true;
+		}
+		if (retiredNum == MaxOverrides)
+			return false;
+		retired[retiredNum++] = data;
+		return true;
+	}
+
+	Override items[MaxOverrides] {};
+	size_t count {0};
+
+	/**
+	 *  Replaced buffers that running requests may still read
+	 */
+	const uint8_t *retired[MaxOverrides] {};
+	size_t retiredNum {0};
+
+	/**
+	 *  Running resource requests
+	 */
+	size_t users {0};
+
+	/**
+	 *  Codecs waiting for their drivers to be restarted
+	 */
+	size_t reloads[MaxOverrides] {};
+	size_t reloadNum {0};
+};
+
+#endif /* kern_override_hpp */
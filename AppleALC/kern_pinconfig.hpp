@@ -0,0 +1,55 @@
+//
+//  kern_pinconfig.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_pinconfig_hpp
+#define kern_pinconfig_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Corresponds to a PinConfigs.kext HDAConfigDefault entry
+ *  The table is sorted by codec and layout, duplicates are dropped
+ */
+struct PinConfigEntry {
+	enum : uint32_t {
+		WakeVerbReinit = 1
+	};
+
+	uint32_t codec;
+	uint32_t layout;
+	size_t index;	// Position in the HDAConfigDefault array written by alc-pinconfig merge
+	uint32_t flags;
+
+	/**
+	 *  Find the entry of a codec and layout in a sorted table
+	 *
+	 *  @param table  generated table
+	 *  @param num    number of entries
+	 *  @param codec  codec id
+	 *  @param layout layout id
+	 *
+	 *  @return entry or nullptr
+	 */
+	static const PinConfigEntry *find(const PinConfigEntry *table, size_t num, uint32_t codec, uint32_t layout) {
+		size_t low = 0, high = num;
+		while (low < high) {
+			auto mid = low + (high - low) / 2;
+			auto &entry = table[mid];
+			if (entry.codec == codec && entry.layout == layout)
+				return &entry;
+			if (entry.codec < codec || (entry.codec == codec && entry.layout < layout))
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		return nullptr;
+	}
+};
+
+#endif /* kern_pinconfig_hpp */
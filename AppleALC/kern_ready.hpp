@@ -0,0 +1,94 @@
+//
+//  kern_ready.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_ready_hpp
+#define kern_ready_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Readiness wait polling a probe with exponential backoff up to a ceiling.
+ *  Sleeping is done through a callback, so that the policy can be driven by a
+ *  simulated device outside of the kernel.
+ */
+class ReadinessWait {
+public:
+	/**
+	 *  Readiness probe, must return true once the device is ready
+	 */
+	using Probe = bool (*)(void *ctx);
+
+	/**
+	 *  Sleep for the given number of milliseconds
+	 */
+	using Sleep = void (*)(uint32_t ms);
+
+	/**
+	 *  First poll interval in milliseconds
+	 */
+	static constexpr uint32_t InitialInterval = 1;
+
+	/**
+	 *  Largest poll interval in milliseconds
+	 */
+	static constexpr uint32_t MaxInterval = 32;
+
+	/**
+	 *  Wait outcome
+	 */
+	struct Result {
+		uint32_t waited;
+		uint32_t polls;
+		bool ready;
+	};
+
+	/**
+	 *  Poll until the probe succeeds or ceiling milliseconds were slept.
+	 *  Success seen before floor milliseconds is checked again at the floor.
+	 *
+	 *  @param probe   Readiness probe
+	 *  @param ctx     Probe context
+	 *  @param floor   Minimum time to sleep in milliseconds
+	 *  @param ceiling Maximum time to sleep in milliseconds
+	 *  @param sleep   Sleep function
+	 *
+	 *  @return time slept, number of polls and whether the probe succeeded
+	 */
+	static Result wait(Probe probe, void *ctx, uint32_t floor, uint32_t ceiling, Sleep sleep) {
+		Result result {0, 0, false};
+		uint32_t interval = InitialInterval;
+		if (floor > ceiling)
+			floor = ceiling;
+		while (true) {
+			result.polls++;
+			if (probe(ctx)) {
+				if (result.waited >= floor) {
+					result.ready = true;
+					break;
+				}
+
+				sleep(floor - result.waited);
+				result.waited = floor;
+				continue;
+			}
+
+			if (result.waited >= ceiling)
+				break;
+
+			// The last interval is cut to end exactly at the ceiling.
+			uint32_t step = ceiling - result.waited < interval ? ceiling - result.waited : interval;
+			sleep(step);
+			result.waited += step;
+			interval = interval * 2 < MaxInterval ? interval * 2 : MaxInterval;
+		}
+
+		return result;
+	}
+};
+
+#endif /* kern_ready_hpp */
@@ -15,6 +15,8 @@
 #include <sys/types.h>
 #include <stdint.h>
 
+#include "kern_pinconfig.hpp"
+
 #ifdef DEBUG
 #define DEBUG_STRING(x) (x)
 #else
@@ -25,6 +27,7 @@ struct KextPatch {
 	KernelPatcher::LookupPatch patch;
 	uint32_t minKernel;
 	uint32_t maxKernel;
+	const char *source; // Resource file and patch index for patch reports
 };
 
 /**
@@ -93,8 +96,15 @@ extern const size_t ADDPR(controllerModSize);
 #ifdef HAVE_ANALOG_AUDIO
 extern VendorModInfo ADDPR(vendorMod)[];
 extern const size_t ADDPR(vendorModSize);
+extern const PinConfigEntry ADDPR(pinConfigs)[];
+extern const size_t ADDPR(pinConfigsSize);
 #endif
 
+/**
+ *  Hash of the generated tables and resource pack, a pack is only used with the build it was generated with
+ */
+extern const uint32_t ADDPR(resourceBuildHash);
+
 extern const size_t KextIdAppleHDAController;
 extern const size_t KextIdAppleHDA;
 extern const size_t KextIdAppleGFXHDA;
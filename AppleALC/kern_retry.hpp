@@ -0,0 +1,101 @@
+//
+//  kern_retry.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_retry_hpp
+#define kern_retry_hpp
+
+#include <IOKit/IOReturn.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kern_hda.hpp"
+
+/**
+ *  Bounded SET_STREAM_FORMAT retry policy for user-client verbs. Instead of IOHDAFamily
+ *  policy (100 attempts with 1s sleeps) a rejected format is retried with exponential
+ *  backoff within a budget. Verbs and sleeping are done through callbacks, so that the
+ *  policy can be driven by a simulated codec outside of the kernel.
+ */
+class StreamFormatRetry {
+public:
+	/**
+	 *  Verb executor sending a single verb without waiting
+	 */
+	using Exec = IOReturn (*)(void *ctx, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response);
+
+	/**
+	 *  Sleep for the given number of milliseconds
+	 */
+	using Sleep = void (*)(uint32_t ms);
+
+	/**
+	 *  Initial delay between attempts in milliseconds, doubled after each failure
+	 */
+	static constexpr uint32_t InitialDelay = 1;
+
+	/**
+	 *  Maximum delay between attempts in milliseconds
+	 */
+	static constexpr uint32_t MaxDelay = 64;
+
+	/**
+	 *  Total time in milliseconds a single verb may spend sleeping between attempts
+	 */
+	static constexpr uint32_t Budget = 500;
+
+	/**
+	 *  Retry outcome
+	 */
+	struct Result {
+		IOReturn status;
+		uint32_t retries;
+		uint32_t slept;
+	};
+
+	/**
+	 *  Set a converter stream format, retrying until it is accepted or the budget is exhausted.
+	 *  A successful SET_STREAM_FORMAT is trusted as is. After a failure the converter format is
+	 *  read back, since the codec may have taken the format and only the response was lost.
+	 *
+	 *  @param exec     Verb executor
+	 *  @param ctx      Executor context
+	 *  @param nid      Converter node ID
+	 *  @param format   Stream format
+	 *  @param response SET_STREAM_FORMAT response
+	 *  @param sleep    Sleep function
+	 *
+	 *  @return status of the last attempt, number of retries and time slept
+	 */
+	static Result setFormat(Exec exec, void *ctx, uint16_t nid, uint16_t format, uint32_t *response, Sleep sleep) {
+		Result result {kIOReturnSuccess, 0, 0};
+		uint32_t delay = InitialDelay;
+		while (true) {
+			result.status = exec(ctx, nid, HdaVerb::SetStreamFormat, format, response);
+			if (result.status == kIOReturnSuccess)
+				break;
+
+			uint32_t current = 0;
+			if (exec(ctx, nid, HdaVerb::GetStreamFormat, 0, &current) == kIOReturnSuccess && (current & 0xFFFF) == format) {
+				result.status = kIOReturnSuccess;
+				break;
+			}
+
+			if (result.slept + delay > Budget)
+				break;
+
+			sleep(delay);
+			result.slept += delay;
+			result.retries++;
+			delay = delay * 2 < MaxDelay ? delay * 2 : MaxDelay;
+		}
+
+		return result;
+	}
+};
+
+#endif /* kern_retry_hpp */
@@ -0,0 +1,75 @@
+//
+//  kern_routing.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_routing_hpp
+#define kern_routing_hpp
+
+#include <stddef.h>
+
+/**
+ *  Routing of AppleHDA services and drivers to the codecs detected on every controller.
+ *  Codecs are any indexable list of pointers to elements with a device member, registry
+ *  access is done through callbacks, so that routing can run over a stand-in registry.
+ */
+class CodecRouting {
+public:
+	/**
+	 *  Find the codec a service is attached to
+	 *
+	 *  @param codecs  detected codecs
+	 *  @param service IOHDACodecDevice or any service below it
+	 *  @param parent  callable returning the parent entry or nullptr
+	 *
+	 *  @return codec index or codecs.size()
+	 */
+	template <typename Codecs, typename Entry, typename Parent>
+	static size_t findService(Codecs &codecs, Entry *service, Parent parent) {
+		for (auto entry = service; entry; entry = parent(entry)) {
+			for (size_t i = 0, s = codecs.size(); i < s; i++)
+				if (codecs[i]->device == entry)
+					return i;
+		}
+		return codecs.size();
+	}
+
+	/**
+	 *  Find the codec an AppleHDA driver is attached below
+	 *
+	 *  @param codecs   detected codecs
+	 *  @param driver   driver pointer, only compared and never dereferenced
+	 *  @param contains callable returning true if a codec device has the driver among its descendants
+	 *
+	 *  @return codec index or codecs.size()
+	 */
+	template <typename Codecs, typename Contains>
+	static size_t findDriver(Codecs &codecs, const void *driver, Contains contains) {
+		if (!driver)
+			return codecs.size();
+		for (size_t i = 0, s = codecs.size(); i < s; i++)
+			if (codecs[i]->device && contains(codecs[i]->device, driver))
+				return i;
+		return codecs.size();
+	}
+
+	/**
+	 *  Find the first codec on a controller with a layout, used when the requesting codec is unknown
+	 *
+	 *  @param codecs    detected codecs
+	 *  @param hasLayout callable returning true if the controller of a codec has a layout
+	 *
+	 *  @return codec index or codecs.size()
+	 */
+	template <typename Codecs, typename HasLayout>
+	static size_t firstWithLayout(Codecs &codecs, HasLayout hasLayout) {
+		for (size_t i = 0, s = codecs.size(); i < s; i++)
+			if (hasLayout(codecs[i]))
+				return i;
+		return codecs.size();
+	}
+};
+
+#endif /* kern_routing_hpp */
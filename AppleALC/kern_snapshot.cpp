@@ -0,0 +1,196 @@
+//
+//  kern_snapshot.cpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "kern_snapshot.hpp"
+#include "kern_hda.hpp"
+
+bool CodecSnapshot::track(uint16_t nid, Kind kind, uint16_t index) {
+	for (size_t i = 0; i < registerNum; i++) {
+		auto &reg = registers[i];
+		if (reg.nid == nid && reg.kind == kind && reg.index == index)
+			return true;
+	}
+
+	if (registerNum >= MaxRegisters)
+		return false;
+
+	registers[registerNum++] = {nid, index, kind, false, 0};
+	return true;
+}
+
+bool CodecSnapshot::add(uint16_t nid, uint16_t verb, uint16_t param) {
+	// Realtek codecs auto-increment the coefficient index after every write,
+	// so follow the index per node to know which coefficient a write targets.
+	CoefIndex *coef = nullptr;
+	if (verb == HdaVerb::SetCoefIndex || verb == HdaVerb::SetProcCoef) {
+		for (size_t i = 0; i < coefNodeNum && !coef; i++) {
+			if (coefIndexes[i].nid == nid)
+				coef = &coefIndexes[i];
+		}
+		if (!coef && coefNodeNum < MaxCoefNodes) {
+			coef = &coefIndexes[coefNodeNum++];
+			*coef = {nid, 0};
+		}
+		if (!coef)
+			return false;
+	}
+
+	switch (verb) {
+		case HdaVerb::SetPinWidgetControl:
+			return track(nid, Kind::PinControl, 0);
+		case HdaVerb::SetEapdBtlEnable:
+			return track(nid, Kind::Eapd, 0);
+		case HdaVerb::SetConnectSel:
+			return track(nid, Kind::ConnectionSelect, 0);
+		case HdaVerb::SetCoefIndex:
+			// Keep replaying index writes, coefficient writes that are not tracked depend on them.
+			coef->index = param;
+			return false;
+		case HdaVerb::SetProcCoef:
+			return track(nid, Kind::Coefficient, coef->index++);
+		case HdaVerb::SetAmpGainMute: {
+			// A single write may update up to four amps, track each of them separately.
+			bool covered = true;
+			auto index = HdaAmp::setIndex(param);
+			if (param & HdaAmp::SetOutput) {
+				if (param & HdaAmp::SetLeft)
+					covered &= track(nid, Kind::Amp, HdaAmp::GetOutput | HdaAmp::GetLeft | index);
+				if (param & HdaAmp::SetRight)
+					covered &= track(nid, Kind::Amp, HdaAmp::GetOutput | index);
+			}
+			if (param & HdaAmp::SetInput) {
+				if (param & HdaAmp::SetLeft)
+					covered &= track(nid, Kind::Amp, HdaAmp::GetLeft | index);
+				if (param & HdaAmp::SetRight)
+					covered &= track(nid, Kind::Amp, index);
+			}
+			return covered;
+		}
+		default:
+			if (verb >= HdaVerb::SetConfigDefault0 && verb <= HdaVerb::SetConfigDefault3)
+				return track(nid, Kind::ConfigDefault, 0);
+			return false;
+	}
+}
+
+IOReturn CodecSnapshot::read(Exec exec, void *ctx, const Register &reg, uint32_t &value) {
+	IOReturn ret;
+	switch (reg.kind) {
+		case Kind::PinControl:
+			ret = exec(ctx, reg.nid, HdaVerb::GetPinWidgetControl, 0, &value);
+			value &= 0xFF;
+			break;
+		case Kind::Eapd:
+			ret = exec(ctx, reg.nid, HdaVerb::GetEapdBtlEnable, 0, &value);
+			value &= 0xFF;
+			break;
+		case Kind::ConnectionSelect:
+			ret = exec(ctx, reg.nid, HdaVerb::GetConnectSel, 0, &value);
+			value &= 0xFF;
+			break;
+		case Kind::Amp:
+			ret = exec(ctx, reg.nid, HdaVerb::GetAmpGainMute, reg.index, &value);
+			value = HdaAmp::gainMute(value);
+			break;
+		case Kind::Coefficient: {
+			uint32_t unused = 0;
+			ret = exec(ctx, reg.nid, HdaVerb::SetCoefIndex, reg.index, &unused);
+			if (ret == kIOReturnSuccess)
+				ret = exec(ctx, reg.nid, HdaVerb::GetProcCoef, 0, &value);
+			value &= 0xFFFF;
+			break;
+		}
+		case Kind::ConfigDefault:
+			ret = exec(ctx, reg.nid, HdaVerb::GetConfigDefault, 0, &value);
+			break;
+		default:
+			ret = kIOReturnUnsupported;
+			break;
+	}
+
+	return ret;
+}
+
+IOReturn CodecSnapshot::write(Exec exec, void *ctx, const Register &reg) {
+	uint32_t unused = 0;
+	switch (reg.kind) {
+		case Kind::PinControl:
+			return exec(ctx, reg.nid, HdaVerb::SetPinWidgetControl, reg.value, &unused);
+		case Kind::Eapd:
+			return exec(ctx, reg.nid, HdaVerb::SetEapdBtlEnable, reg.value, &unused);
+		case Kind::ConnectionSelect:
+			return exec(ctx, reg.nid, HdaVerb::SetConnectSel, reg.value, &unused);
+		case Kind::Amp: {
+			uint16_t param = (reg.index & HdaAmp::GetOutput) ? HdaAmp::SetOutput : HdaAmp::SetInput;
+			param |= (reg.index & HdaAmp::GetLeft) ? HdaAmp::SetLeft : HdaAmp::SetRight;
+			param |= ((reg.index & 0xF) << 8) | reg.value;
+			return exec(ctx, reg.nid, HdaVerb::SetAmpGainMute, param, &unused);
+		}
+		case Kind::Coefficient: {
+			auto ret = exec(ctx, reg.nid, HdaVerb::SetCoefIndex, reg.index, &unused);
+			if (ret == kIOReturnSuccess)
+				ret = exec(ctx, reg.nid, HdaVerb::SetProcCoef, reg.value, &unused);
+			return ret;
+		}
+		case Kind::ConfigDefault:
+			for (uint16_t i = 0; i < 4; i++) {
+				auto ret = exec(ctx, reg.nid, static_cast<uint16_t>(HdaVerb::SetConfigDefault0 + i), (reg.value >> (i * 8)) & 0xFF, &unused);
+				if (ret != kIOReturnSuccess)
+					return ret;
+			}
+			return kIOReturnSuccess;
+		default:
+			return kIOReturnUnsupported;
+	}
+}
+
+size_t CodecSnapshot::capture(Exec exec, void *ctx) {
+	size_t num = 0;
+	for (size_t i = 0; i < registerNum; i++) {
+		auto &reg = registers[i];
+		uint32_t value = 0;
+		reg.valid = read(exec, ctx, reg, value) == kIOReturnSuccess;
+		if (reg.valid) {
+			reg.value = value;
+			num++;
+		}
+	}
+
+	captured = num > 0;
+	return num;
+}
+
+CodecSnapshot::RestoreStats CodecSnapshot::restore(Exec exec, void *ctx) {
+	RestoreStats stats {};
+	if (!captured)
+		return stats;
+
+	// Read everything back first so that the writes go out in one burst.
+	bool differs[MaxRegisters] {};
+	for (size_t i = 0; i < registerNum; i++) {
+		auto &reg = registers[i];
+		if (!reg.valid)
+			continue;
+
+		uint32_t value = 0;
+		stats.checked++;
+		// A register failing to read back is assumed lost.
+		differs[i] = read(exec, ctx, reg, value) != kIOReturnSuccess || value != reg.value;
+	}
+
+	for (size_t i = 0; i < registerNum; i++) {
+		if (!differs[i])
+			continue;
+
+		if (write(exec, ctx, registers[i]) == kIOReturnSuccess)
+			stats.restored++;
+		else
+			stats.failures++;
+	}
+
+	return stats;
+}
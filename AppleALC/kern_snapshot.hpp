@@ -0,0 +1,153 @@
+//
+//  kern_snapshot.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_snapshot_hpp
+#define kern_snapshot_hpp
+
+#include <Headers/kern_util.hpp>
+
+/**
+ *  Codec register snapshot taken before sleep and restored differentially after wake.
+ *  Registers are collected from the SET verbs of the wake configuration, so only the
+ *  state AppleALC configures is tracked. Verbs without a readable counterpart are left
+ *  to the caller to replay.
+ */
+class CodecSnapshot {
+public:
+	/**
+	 *  Verb executor, must return kIOReturnSuccess and fill response on success
+	 */
+	using Exec = IOReturn (*)(void *ctx, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response);
+
+	/**
+	 *  Maximum number of tracked registers
+	 */
+	static constexpr size_t MaxRegisters = 128;
+
+	/**
+	 *  Tracked register kinds
+	 */
+	enum class Kind : uint8_t {
+		PinControl,
+		Eapd,
+		ConnectionSelect,
+		Amp,
+		Coefficient,
+		ConfigDefault
+	};
+
+	/**
+	 *  Differential restore statistics
+	 */
+	struct RestoreStats {
+		uint32_t checked;
+		uint32_t restored;
+		uint32_t failures;
+	};
+
+	static CodecSnapshot *create() {
+		return new CodecSnapshot;
+	}
+
+	static void deleter(CodecSnapshot *snapshot) {
+		delete snapshot;
+	}
+
+	/**
+	 *  Track the register written by a wake verb
+	 *
+	 *  @param nid   Node ID
+	 *  @param verb  SET verb
+	 *  @param param Verb parameter
+	 *
+	 *  @return true if restore() covers the verb and it does not need to be replayed
+	 */
+	bool add(uint16_t nid, uint16_t verb, uint16_t param);
+
+	/**
+	 *  Read all tracked registers, registers failing to read are not restored
+	 *
+	 *  @param exec Verb executor
+	 *  @param ctx  Executor context
+	 *
+	 *  @return number of registers read
+	 */
+	size_t capture(Exec exec, void *ctx);
+
+	/**
+	 *  Read back all captured registers and write the ones that differ
+	 *
+	 *  @param exec Verb executor
+	 *  @param ctx  Executor context
+	 *
+	 *  @return restore statistics
+	 */
+	RestoreStats restore(Exec exec, void *ctx);
+
+	/**
+	 *  Check whether a snapshot was captured
+	 */
+	bool isCaptured() const {
+		return captured;
+	}
+
+	/**
+	 *  Number of tracked registers
+	 */
+	size_t count() const {
+		return registerNum;
+	}
+
+private:
+	/**
+	 *  Tracked register
+	 *
+	 *  index is the coefficient index for coefficients and GET_AMP_GAIN_MUTE param for amps
+	 */
+	struct Register {
+		uint16_t nid;
+		uint16_t index;
+		Kind kind;
+		bool valid;
+		uint32_t value;
+	};
+
+	/**
+	 *  Find or append a register
+	 *
+	 *  @return true if the register is tracked
+	 */
+	bool track(uint16_t nid, Kind kind, uint16_t index);
+
+	/**
+	 *  Read a register value
+	 */
+	IOReturn read(Exec exec, void *ctx, const Register &reg, uint32_t &value);
+
+	/**
+	 *  Write a register value
+	 */
+	IOReturn write(Exec exec, void *ctx, const Register &reg);
+
+	/**
+	 *  Coefficient index tracking for consecutive coefficient writes
+	 */
+	struct CoefIndex {
+		uint16_t nid;
+		uint16_t index;
+	};
+
+	static constexpr size_t MaxCoefNodes = 8;
+	CoefIndex coefIndexes[MaxCoefNodes] {};
+	size_t coefNodeNum {0};
+
+	Register registers[MaxRegisters] {};
+	size_t registerNum {0};
+	bool captured {false};
+};
+
+#endif /* kern_snapshot_hpp */
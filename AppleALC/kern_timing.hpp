@@ -0,0 +1,135 @@
+//
+//  kern_timing.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_timing_hpp
+#define kern_timing_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Boot stage timing collector. It has no kernel dependencies besides the clock,
+ *  so that it can be driven by a fake clock outside of the kernel.
+ *  Stages may be started and finished from different threads.
+ */
+class BootTimings {
+public:
+	/**
+	 *  Monotonic clock in nanoseconds
+	 */
+	using Clock = uint64_t (*)();
+
+	/**
+	 *  Maximum number of recorded stages, later stages are only counted
+	 */
+	static constexpr size_t MaxStages = 128;
+
+	/**
+	 *  Invalid stage handle returned when there is no room left
+	 */
+	static constexpr size_t InvalidStage = MaxStages;
+
+	/**
+	 *  Recorded stage
+	 */
+	struct Stage {
+		const char *name;
+		const char *target;
+		uint32_t detail;
+		uint64_t start;
+		uint64_t duration;
+		bool done;
+	};
+
+	explicit BootTimings(Clock clock) : clock(clock) {}
+
+	/**
+	 *  Start a stage
+	 *
+	 *  @param name   Stage name, must be a static string
+	 *  @param target Stage target like kext identifier or nullptr, must be a static string
+	 *  @param detail Stage specific number like retry index
+	 *
+	 *  @return stage handle for end
+	 */
+	size_t begin(const char *name, const char *target=nullptr, uint32_t detail=0) {
+		auto stage = __atomic_fetch_add(&reserved, 1, __ATOMIC_RELAXED);
+		if (stage >= MaxStages) {
+			__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+			return InvalidStage;
+		}
+
+		auto &s = stages[stage];
+		s.name = name;
+		s.target = target;
+		s.detail = detail;
+		s.start = clock();
+		return stage;
+	}
+
+	/**
+	 *  Finish a stage
+	 *
+	 *  @param stage Stage handle returned by begin
+	 */
+	void end(size_t stage) {
+		if (stage >= MaxStages)
+			return;
+		stages[stage].duration = clock() - stages[stage].start;
+		__atomic_store_n(&stages[stage].done, true, __ATOMIC_RELEASE);
+	}
+
+	/**
+	 *  Get the number of started stages that were recorded
+	 */
+	size_t count() const {
+		auto num = __atomic_load_n(&reserved, __ATOMIC_RELAXED);
+		return num < MaxStages ? num : MaxStages;
+	}
+
+	/**
+	 *  Get a recorded stage
+	 *
+	 *  @param stage Stage index below count()
+	 *
+	 *  @return stage or nullptr if it is not finished yet
+	 */
+	const Stage *get(size_t stage) const {
+		if (stage >= count() || !__atomic_load_n(&stages[stage].done, __ATOMIC_ACQUIRE))
+			return nullptr;
+		return &stages[stage];
+	}
+
+	/**
+	 *  Get the number of stages that did not fit
+	 */
+	size_t droppedCount() const {
+		return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	}
+
+	/**
+	 *  Scoped stage finished on destruction
+	 */
+	class Scope {
+		BootTimings &timings;
+		size_t stage;
+	public:
+		Scope(BootTimings &timings, const char *name, const char *target=nullptr, uint32_t detail=0) :
+			timings(timings), stage(timings.begin(name, target, detail)) {}
+		~Scope() { timings.end(stage); }
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+	};
+
+private:
+	Clock clock;
+	Stage stages[MaxStages] {};
+	size_t reserved {0};
+	size_t dropped {0};
+};
+
+#endif /* kern_timing_hpp */
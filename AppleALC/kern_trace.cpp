@@ -0,0 +1,100 @@
+//
+//  kern_trace.cpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "kern_trace.hpp"
+#include "kern_hda.hpp"
+
+size_t VerbTrace::verbClass(uint16_t verb) {
+	switch (verb) {
+		case HdaVerb::GetParameter:
+			return kALCTraceClassParameter;
+		case HdaVerb::SetStreamFormat:
+		case HdaVerb::GetStreamFormat:
+			return kALCTraceClassStreamFormat;
+		case HdaVerb::SetProcCoef:
+		case HdaVerb::SetCoefIndex:
+		case HdaVerb::GetProcCoef:
+		case HdaVerb::GetCoefIndex:
+			return kALCTraceClassCoefficient;
+		default:
+			// GET verbs are 0xA00-0xF00 and 0xF01-0xFFF, SET verbs are 0x200-0x500 and 0x701-0x7FF.
+			return verb >= 0xA00 ? kALCTraceClassGet : kALCTraceClassSet;
+	}
+}
+
+size_t VerbTrace::durationBucket(uint64_t duration) {
+	uint64_t us = duration / 1000;
+	if (us == 0)
+		return 0;
+	size_t bucket = 64 - __builtin_clzll(us);
+	return bucket < kALCTraceBuckets ? bucket : kALCTraceBuckets - 1;
+}
+
+void VerbTrace::record(uint16_t nid, uint16_t verb, uint16_t param, uint32_t response, IOReturn status, uint64_t start, uint64_t duration) {
+	auto sequence = __atomic_add_fetch(&head, 1, __ATOMIC_RELAXED);
+	auto &entry = entries[(sequence - 1) % kALCTraceCapacity];
+
+	// Invalidate the entry first, so that readers never accept a partially written one.
+	__atomic_store_n(&entry.sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	entry.timestamp = start;
+	entry.duration = static_cast<uint32_t>(min(duration, static_cast<uint64_t>(UINT32_MAX)));
+	entry.response = response;
+	entry.status = static_cast<uint32_t>(status);
+	entry.nid = nid;
+	entry.verb = verb;
+	entry.param = param;
+	__atomic_store_n(&entry.sequence, sequence, __ATOMIC_RELEASE);
+
+	auto &histogram = histograms[verbClass(verb)];
+	__atomic_add_fetch(&histogram.count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram.totalTime, duration, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram.buckets[durationBucket(duration)], 1, __ATOMIC_RELAXED);
+	auto maxTime = __atomic_load_n(&histogram.maxTime, __ATOMIC_RELAXED);
+	while (duration > maxTime && !__atomic_compare_exchange_n(&histogram.maxTime, &maxTime, duration, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void VerbTrace::read(ALCTraceDump &dump) {
+	dump.version = kALCTraceVersion;
+	dump.capacity = kALCTraceCapacity;
+	dump.head = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	auto first = __atomic_load_n(&base, __ATOMIC_RELAXED);
+
+	for (size_t i = 0; i < kALCTraceClassCount; i++) {
+		auto &src = histograms[i];
+		auto &dst = dump.histograms[i];
+		dst.count = __atomic_load_n(&src.count, __ATOMIC_RELAXED);
+		dst.totalTime = __atomic_load_n(&src.totalTime, __ATOMIC_RELAXED);
+		dst.maxTime = __atomic_load_n(&src.maxTime, __ATOMIC_RELAXED);
+		for (size_t b = 0; b < kALCTraceBuckets; b++)
+			dst.buckets[b] = __atomic_load_n(&src.buckets[b], __ATOMIC_RELAXED);
+	}
+
+	for (size_t i = 0; i < kALCTraceCapacity; i++) {
+		auto &src = entries[i];
+		auto &dst = dump.entries[i];
+		auto sequence = __atomic_load_n(&src.sequence, __ATOMIC_ACQUIRE);
+		dst = src;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (sequence <= first || __atomic_load_n(&src.sequence, __ATOMIC_RELAXED) != sequence)
+			sequence = 0;
+		dst.sequence = sequence;
+	}
+}
+
+void VerbTrace::reset() {
+	// Writers are not stopped, so a verb recorded right now may still land in the histograms.
+	__atomic_store_n(&base, __atomic_load_n(&head, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	for (size_t i = 0; i < kALCTraceClassCount; i++) {
+		auto &histogram = histograms[i];
+		__atomic_store_n(&histogram.count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&histogram.totalTime, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&histogram.maxTime, 0, __ATOMIC_RELAXED);
+		for (size_t b = 0; b < kALCTraceBuckets; b++)
+			__atomic_store_n(&histogram.buckets[b], 0, __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,159 @@
+//
+//  kern_trace.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_trace_hpp
+#define kern_trace_hpp
+
+#include <Headers/kern_util.hpp>
+
+#include "UserKernelShared.h"
+
+/**
+ *  Lock-free ring of the latest verbs sent to a single codec with per-class latency histograms.
+ *  Any number of threads may record verbs concurrently, readers detect entries being overwritten.
+ */
+class VerbTrace {
+	/**
+	 *  Recorded entries, entry N is stored at (N - 1) % kALCTraceCapacity
+	 */
+	ALCTraceEntry entries[kALCTraceCapacity] {};
+
+	/**
+	 *  Last reserved sequence
+	 */
+	uint64_t head {0};
+
+	/**
+	 *  Last sequence dropped by reset
+	 */
+	uint64_t base {0};
+
+	/**
+	 *  Latency histograms for every verb class
+	 */
+	ALCTraceHistogram histograms[kALCTraceClassCount] {};
+
+	/**
+	 *  Get histogram class of a verb
+	 */
+	static size_t verbClass(uint16_t verb);
+
+	/**
+	 *  Get histogram bucket of a verb duration
+	 */
+	static size_t durationBucket(uint64_t duration);
+
+public:
+	/**
+	 *  Record a completed verb
+	 *
+	 *  @param nid      Node ID
+	 *  @param verb     Executed verb
+	 *  @param param    Verb parameter
+	 *  @param response Codec response
+	 *  @param status   Execution status
+	 *  @param start    Time the verb was sent in nanoseconds
+	 *  @param duration Verb duration in nanoseconds
+	 */
+	void record(uint16_t nid, uint16_t verb, uint16_t param, uint32_t response, IOReturn status, uint64_t start, uint64_t duration);
+
+	/**
+	 *  Copy a consistent snapshot of the entries and histograms
+	 *
+	 *  @param dump Destination
+	 */
+	void read(ALCTraceDump &dump);
+
+	/**
+	 *  Drop recorded entries and histograms
+	 */
+	void reset();
+};
+
+/**
+ *  Registration of a codec trace ring. Recorders enter the slot before using the ring and
+ *  leave it afterwards, so that the owner can wait for them before freeing the ring.
+ */
+class VerbTraceSlot {
+	/**
+	 *  Traced codec, set before the ring and cleared after it
+	 */
+	void *codec {nullptr};
+
+	/**
+	 *  Trace ring of the codec
+	 */
+	VerbTrace *trace {nullptr};
+
+	/**
+	 *  Recorders between enter and leave
+	 */
+	uint32_t users {0};
+
+public:
+	/**
+	 *  Check whether the slot belongs to a codec
+	 */
+	bool matches(void *hdaCodecDevice) const {
+		return __atomic_load_n(&codec, __ATOMIC_RELAXED) == hdaCodecDevice;
+	}
+
+	/**
+	 *  Take a free slot for a codec
+	 *
+	 *  @return true if the slot was free
+	 */
+	bool claim(void *hdaCodecDevice, VerbTrace *ring) {
+		void *expected = nullptr;
+		if (!__atomic_compare_exchange_n(&codec, &expected, hdaCodecDevice, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return false;
+		__atomic_store_n(&trace, ring, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/**
+	 *  Start using the ring of a codec, leave must be called even if nothing was returned
+	 *
+	 *  @return trace ring valid until leave or nullptr
+	 */
+	VerbTrace *enter(void *hdaCodecDevice) {
+		// Sequentially consistent with retire, so that either retire sees us or we see no ring.
+		__atomic_add_fetch(&users, 1, __ATOMIC_SEQ_CST);
+		auto ring = __atomic_load_n(&trace, __ATOMIC_SEQ_CST);
+		return ring && matches(hdaCodecDevice) ? ring : nullptr;
+	}
+
+	/**
+	 *  Stop using the ring returned by enter
+	 */
+	void leave() {
+		__atomic_sub_fetch(&users, 1, __ATOMIC_RELEASE);
+	}
+
+	/**
+	 *  Hide the ring from new recorders, it may still be used until the slot is idle
+	 */
+	void retire() {
+		__atomic_store_n(&trace, nullptr, __ATOMIC_SEQ_CST);
+	}
+
+	/**
+	 *  Check that no recorder uses a retired ring any longer
+	 */
+	bool idle() const {
+		return __atomic_load_n(&users, __ATOMIC_SEQ_CST) == 0;
+	}
+
+	/**
+	 *  Free the slot of a retired and idle ring
+	 */
+	void release() {
+		__atomic_store_n(&codec, nullptr, __ATOMIC_RELEASE);
+	}
+};
+
+#endif /* kern_trace_hpp */
@@ -0,0 +1,133 @@
+//
+//  kern_verbqueue.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_verbqueue_hpp
+#define kern_verbqueue_hpp
+
+#include <IOKit/IOReturn.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "UserKernelShared.h"
+
+/**
+ *  Fixed-capacity FIFO of asynchronous verb requests. Not synchronised,
+ *  the owner protects it with its queue lock.
+ *
+ *  @param T request type
+ *  @param N capacity
+ */
+template <typename T, size_t N>
+class VerbQueue {
+	T items[N] {};
+	size_t head {0};
+	size_t count {0};
+
+public:
+	/**
+	 *  Maximum number of requests
+	 */
+	static constexpr size_t capacity() {
+		return N;
+	}
+
+	/**
+	 *  Current number of requests
+	 */
+	size_t size() const {
+		return count;
+	}
+
+	/**
+	 *  Append a request
+	 *
+	 *  @return false when the queue is full
+	 */
+	bool push(const T &item) {
+		if (count == N)
+			return false;
+		items[(head + count) % N] = item;
+		count++;
+		return true;
+	}
+
+	/**
+	 *  Take the oldest request
+	 *
+	 *  @return false when the queue is empty
+	 */
+	bool pop(T &item) {
+		if (count == 0)
+			return false;
+		item = items[head];
+		items[head] = T {};
+		head = (head + 1) % N;
+		count--;
+		return true;
+	}
+
+	/**
+	 *  Take the oldest request matching a predicate preserving the order of the others
+	 *
+	 *  @param item  taken request
+	 *  @param match predicate called as match(const T &)
+	 *
+	 *  @return false when no request matches
+	 */
+	template <typename Match>
+	bool take(T &item, Match match) {
+		for (size_t i = 0; i < count; i++) {
+			if (!match(items[(head + i) % N]))
+				continue;
+
+			item = items[(head + i) % N];
+			for (size_t j = i + 1; j < count; j++)
+				items[(head + j - 1) % N] = items[(head + j) % N];
+			items[(head + count - 1) % N] = T {};
+			count--;
+			return true;
+		}
+		return false;
+	}
+};
+
+/**
+ *  User-client verb transaction. The caller holds the codec lock around run,
+ *  so that no other verb gets between the verbs of the transaction.
+ */
+namespace VerbTransaction {
+	/**
+	 *  Execute the verbs in order, aborting the remaining ones after the first failure
+	 *
+	 *  @param commands Verbs to execute
+	 *  @param results  Responses and statuses for every verb
+	 *  @param num      Number of verbs
+	 *  @param exec     Executor called as exec(nid, verb, param, wait, response) returning IOReturn
+	 *
+	 *  @return status of the failed verb or kIOReturnSuccess
+	 */
+	template <typename Exec>
+	IOReturn run(const ALCVerbCommand *commands, ALCVerbResult *results, size_t num, Exec exec) {
+		IOReturn status = kIOReturnSuccess;
+		for (size_t i = 0; i < num; i++) {
+			if (status != kIOReturnSuccess) {
+				results[i].response = 0;
+				results[i].status = kIOReturnAborted;
+				continue;
+			}
+
+			uint32_t response = 0;
+			status = exec(commands[i].nid, commands[i].verb, commands[i].param, !(commands[i].flags & kVerbFlagNoWait), response);
+			results[i].response = response;
+			results[i].status = status;
+		}
+		return status;
+	}
+}
+
+#endif /* kern_verbqueue_hpp */
@@ -0,0 +1,167 @@
+//
+//  kern_wake.hpp
+//  AppleALC
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_wake_hpp
+#define kern_wake_hpp
+
+#include <Headers/kern_util.hpp>
+
+#include "kern_binlog.hpp"
+#include "kern_hda.hpp"
+#include "kern_snapshot.hpp"
+
+/**
+ *  Wake verbs decoded once from ConfigData and replayed without AppleHDA on every wake.
+ *  Verbs are sent through a callback, so that the replay can run against a simulated codec.
+ */
+class WakeReplay {
+public:
+	/**
+	 *  Decoded wake verb
+	 */
+	struct Verb {
+		uint16_t nid;
+		uint16_t verb;
+		uint16_t param;
+		bool snapshot;	// State is restored from the codec snapshot when captured
+	};
+
+	/**
+	 *  Replay outcome
+	 */
+	struct Stats {
+		IOReturn result;
+		uint32_t checked;
+		uint32_t restored;
+		uint32_t replayed;
+		uint32_t failures;
+	};
+
+	/**
+	 *  Decode big endian ConfigData commands of a single codec
+	 *
+	 *  @param configData  ConfigData bytes
+	 *  @param configSize  ConfigData size in bytes
+	 *  @param anyAddress  Keep commands for every codec address
+	 *  @param address     Codec address to keep otherwise
+	 *  @param snapshot    Snapshot tracking the registers of the verbs or nullptr
+	 *  @param verbs       Destination of at least configSize / 4 verbs
+	 *  @param tracked     Number of verbs covered by the snapshot
+	 *
+	 *  @return number of decoded verbs
+	 */
+	static size_t decode(const void *configData, size_t configSize, bool anyAddress, uint32_t address,
+						 CodecSnapshot *snapshot, Verb *verbs, size_t &tracked) {
+		auto bytes = static_cast<const uint8_t *>(configData);
+		size_t total = configSize / sizeof(uint32_t);
+		size_t num = 0;
+		tracked = 0;
+		for (size_t i = 0; i < total; i++) {
+			auto b = &bytes[i * sizeof(uint32_t)];
+			uint32_t command = static_cast<uint32_t>(b[0]) << 24 | static_cast<uint32_t>(b[1]) << 16 |
+				static_cast<uint32_t>(b[2]) << 8 | b[3];
+			// Entries for other codecs on the link are not sent by AppleHDA either.
+			if (!anyAddress && HdaCommand::codecAddress(command) != address)
+				continue;
+			auto &verb = verbs[num++];
+			verb = {HdaCommand::nid(command), HdaCommand::verb(command), HdaCommand::param(command), false};
+			verb.snapshot = snapshot && snapshot->add(verb.nid, verb.verb, verb.param);
+			if (verb.snapshot)
+				tracked++;
+		}
+		return num;
+	}
+
+	/**
+	 *  Find the audio function group, whose power state tells if the codec kept its state
+	 *
+	 *  @param exec Verb executor
+	 *  @param ctx  Executor context
+	 *
+	 *  @return function group node or 0 when none was found
+	 */
+	static uint16_t findFunctionGroup(CodecSnapshot::Exec exec, void *ctx) {
+		uint32_t response = 0;
+		if (exec(ctx, 0, HdaVerb::GetParameter, HdaParam::NodeCount, &response) != kIOReturnSuccess)
+			return 0;
+
+		auto start = HdaResponse::startNode(response);
+		auto count = HdaResponse::nodeCount(response);
+		for (uint16_t nid = start; nid < start + count; nid++) {
+			if (exec(ctx, nid, HdaVerb::GetParameter, HdaParam::FunctionType, &response) == kIOReturnSuccess &&
+				HdaResponse::isAudioFunctionGroup(response))
+				return nid;
+		}
+
+		return 0;
+	}
+
+	/**
+	 *  Restore the captured registers that differ and send the remaining wake verbs.
+	 *  Reading the registers back only pays off while the codec keeps power in D3.
+	 *  Once the function group reports a reset, or most registers had to be restored,
+	 *  every verb is sent in one batch without readback, now and on later wakes.
+	 *
+	 *  @param verbs     Decoded verbs
+	 *  @param num       Number of verbs
+	 *  @param snapshot  Codec snapshot or nullptr
+	 *  @param afg       Audio function group or 0 when unknown
+	 *  @param stateLost Codec is known to lose its state in D3, updated by the replay
+	 *  @param exec      Verb executor
+	 *  @param ctx       Executor context
+	 *
+	 *  @return replay statistics with kIOReturnSuccess or the first failure as result
+	 */
+	static Stats replay(const Verb *verbs, size_t num, CodecSnapshot *snapshot, uint16_t afg, bool &stateLost,
+						CodecSnapshot::Exec exec, void *ctx) {
+		Stats stats {kIOReturnSuccess, 0, 0, 0, 0};
+
+		bool restore = snapshot && snapshot->isCaptured() && !stateLost;
+		uint32_t response = 0;
+		if (restore && afg != 0 && exec(ctx, afg, HdaVerb::GetPowerState, 0, &response) == kIOReturnSuccess &&
+			HdaResponse::powerStateLost(response)) {
+			DBGLOG("alc", "afg 0x%X reports power state %08X, replaying wake verbs without readback", afg, response);
+			stateLost = true;
+			restore = false;
+		}
+
+		// Only write back registers the codec actually lost, the rest of the verbs are replayed as is.
+		if (restore) {
+			auto restored = snapshot->restore(exec, ctx);
+			stats.checked = restored.checked;
+			stats.restored = restored.restored;
+			stats.failures = restored.failures;
+			if (restored.failures > 0)
+				stats.result = kIOReturnIOError;
+			// Codecs without a settings reset flag are caught by the diff.
+			if (restored.restored * 2 > restored.checked) {
+				DBGLOG("alc", "restored %u of %u registers, replaying wake verbs without readback", restored.restored, restored.checked);
+				stateLost = true;
+			}
+		}
+
+		for (size_t i = 0; i < num; i++) {
+			auto &verb = verbs[i];
+			if (restore && verb.snapshot)
+				continue;
+
+			stats.replayed++;
+			auto ret = exec(ctx, verb.nid, verb.verb, verb.param, &response);
+			if (ret != kIOReturnSuccess) {
+				// Keep going like AppleHDA does, a single rejected verb should not leave the rest unconfigured.
+				ALCLOG("alc", "wake verb %lu nid %u verb %X param %X failed - %08X", i, verb.nid, verb.verb, verb.param, ret);
+				stats.failures++;
+				if (stats.result == kIOReturnSuccess)
+					stats.result = ret;
+			}
+		}
+
+		return stats;
+	}
+};
+
+#endif /* kern_wake_hpp */
@@ -34,20 +34,29 @@ find "${PROJECT_DIR}/Resources" -name "*.plist" -o -name '*.xml' | xargs -P $(ge
   fi' -- {}
 echo "$(date) Done formatting"
 
+# Build profile limiting the generated resources, set ALC_PROFILE to another profile or to an empty string to build everything
+profile="${ALC_PROFILE-${PROJECT_DIR}/Resources/Profiles/ThinkCentreM73.plist}"
+# External resource pack copied into the kext bundle, looked up before the compiled-in tables
+pack="${PROJECT_DIR}/AppleALC/AppleALC.alcpack"
+
 echo "$(date) Start building resources"
 find "${PROJECT_DIR}/Resources" -name "*.md5" -exec cat "{}" + > "${PROJECT_DIR}/Resources.tmp.md5" || exit 1
+echo "profile ${profile}" >> "${PROJECT_DIR}/Resources.tmp.md5" || exit 1
 h=$(md5 "${PROJECT_DIR}/Resources.tmp.md5")
-if [ -f "${PROJECT_DIR}/AppleALC/kern_resources.cpp" ] && [ -f "${PROJECT_DIR}/Resources.md5" ] && [ "$h" = "$(cat ${PROJECT_DIR}/Resources.md5)" ]; then
+if [ -f "${PROJECT_DIR}/AppleALC/kern_resources.cpp" ] && [ -f "${pack}" ] && [ -f "${PROJECT_DIR}/Resources.md5" ] && [ "$h" = "$(cat ${PROJECT_DIR}/Resources.md5)" ]; then
   echo "Trusting existing kern_resources.cpp"
 else
   # Remove the original resources
-  rm -f "${PROJECT_DIR}/AppleALC/kern_resources.cpp"
+  rm -f "${PROJECT_DIR}/AppleALC/kern_resources.cpp" "${pack}"
   ret=0
   "${TARGET_BUILD_DIR}/ResourceConverter" \
     "${PROJECT_DIR}/Resources" \
-    "${PROJECT_DIR}/AppleALC/kern_resources.cpp" || ret=1
+    "${PROJECT_DIR}/AppleALC/kern_resources.cpp" \
+    ${profile:+"${profile}"} \
+    -pack "${pack}" || ret=1
 
   if (( $ret )); then
+    rm -f "${PROJECT_DIR}/AppleALC/kern_resources.cpp" "${pack}"
     echo "Failed to build kern_resources.cpp"
     exit 1
   fi
@@ -10,10 +10,15 @@
 
 #import <Foundation/Foundation.h>
 #import <Cocoa/Cocoa.h>
+#include <climits>
 #include <initializer_list>
+#include <map>
+#include <set>
 #include <unordered_map>
 #include <vector>
 
+#include "../Tools/respack/respack.h"
+
 #define SYSLOG(str, ...) printf("ResourceConverter: " str "\n", ## __VA_ARGS__)
 #define ERROR(str, ...) do { SYSLOG(str, ## __VA_ARGS__); exit(1); } while(0)
 NSString *ResourceHeader {@"\
@@ -54,6 +59,283 @@ static NSString *makeStringList(NSString *name, size_t index, NSArray *array, NS
 	return str;
 }
 
+// Build profile restricting the generated resources, everything is generated without one.
+// A missing Codecs or Controllers key keeps all entries of that kind.
+static struct {
+	bool active {false};
+	NSString *name {@"all"};
+	bool codecsActive {false};
+	// (vendor << 16) | codec to layout ids
+	std::map<uint32_t, std::set<uint32_t>> codecs;
+	bool controllersActive {false};
+	// (vendor << 16) | device
+	std::set<uint32_t> controllers;
+	long minKernel {0};
+	long maxKernel {LONG_MAX};
+	// Profiled entries found in the resources, keyed like pinconfigs
+	std::set<uint32_t> foundCodecs;
+	std::set<uint64_t> foundLayouts;
+	std::set<uint64_t> foundPlatforms;
+	std::set<uint64_t> foundPinConfigs;
+	std::set<uint32_t> foundControllers;
+} profile;
+
+// Size report of the generated resources
+static struct {
+	size_t codecs, layouts, platforms, controllers, patches, pinConfigs;
+	size_t fileBytes, patchBytes;
+	size_t skippedCodecs, skippedFiles, skippedControllers, skippedPatches, skippedPinConfigs;
+} report;
+
+// External resource pack written next to kern_resources.cpp, nullptr when not requested
+static struct respack_writer *packWriter;
+
+static void packFiles(NSArray *files, uint32_t kind, uint32_t codecId, NSString *path) {
+	if (!packWriter)
+		return;
+	for (NSDictionary *f in files) {
+		auto fullPath = [[NSString alloc] initWithFormat:@"%@/%@", path, [f objectForKey:@"Path"]];
+		auto data = [[NSFileManager defaultManager] contentsAtPath:fullPath];
+		if (!data)
+			continue;
+		if (!respack_writer_add(packWriter, kind, codecId, [[f objectForKey:@"Id"] unsignedIntValue],
+			[[f objectForKey:@"MinKernel"] unsignedIntValue], [[f objectForKey:@"MaxKernel"] unsignedIntValue], [data bytes], [data length]))
+			ERROR("Failed to pack %s, duplicate layout %u of codec 0x%08X?", [fullPath UTF8String], [[f objectForKey:@"Id"] unsignedIntValue], codecId);
+	}
+}
+
+static void packController(NSDictionary *entry, uint32_t ctrlId, NSArray *patches, NSDictionary *kextIndexes) {
+	if (!packWriter)
+		return;
+
+	std::vector<uint32_t> revisions;
+	for (NSNumber *rev in [entry objectForKey:@"Revisions"])
+		revisions.push_back([rev unsignedIntValue]);
+
+	std::vector<respack_patch_view> views;
+	for (NSDictionary *p in patches) {
+		NSData *find = [p objectForKey:@"Find"];
+		NSData *replace = [p objectForKey:@"Replace"];
+		NSNumber *kext = [kextIndexes objectForKey:[p objectForKey:@"Name"]];
+		if (!kext || [find length] != [replace length] || [find length] == 0)
+			ERROR("Failed to pack a patch of %s", [[entry objectForKey:@"Name"] UTF8String]);
+		views.push_back({[kext unsignedIntValue], [[p objectForKey:@"Count"] unsignedIntValue],
+			[[p objectForKey:@"MinKernel"] unsignedIntValue], [[p objectForKey:@"MaxKernel"] unsignedIntValue],
+			static_cast<uint32_t>([find length]), static_cast<const uint8_t *>([find bytes]), static_cast<const uint8_t *>([replace bytes])});
+	}
+
+	// Same values as WIOKit::ComputerModel
+	int32_t model = 3;
+	if ([[entry objectForKey:@"Model"] isEqualToString:@"Laptop"])
+		model = 1;
+	else if ([[entry objectForKey:@"Model"] isEqualToString:@"Desktop"])
+		model = 2;
+
+	unsigned long long platform = 0;
+	if ([entry objectForKey:@"Platform"])
+		[[NSScanner scannerWithString:[entry objectForKey:@"Platform"]] scanHexLongLong:&platform];
+
+	if (!respack_writer_add_controller(packWriter, ctrlId, static_cast<uint32_t>(platform), model,
+		revisions.data(), static_cast<uint32_t>(revisions.size()), views.data(), static_cast<uint32_t>(views.size())))
+		ERROR("Failed to pack controller %s", [[entry objectForKey:@"Name"] UTF8String]);
+}
+
+// Identifies the generated tables together with the pack, so that the kext rejects packs of other builds
+static uint32_t buildHash;
+
+static void generateBuildHash(NSString *file) {
+	auto generated = [NSData dataWithContentsOfFile:file];
+	if (!generated)
+		ERROR("Failed to read back %s", [file UTF8String]);
+	buildHash = respack_crc32(0, [generated bytes], [generated length]);
+	if (packWriter)
+		buildHash = respack_writer_digest(packWriter, buildHash);
+	appendFile(file, [[NSString alloc] initWithFormat:@"\n// Build section\n\nconst uint32_t ADDPR(resourceBuildHash) {0x%08X};\n", buildHash]);
+}
+
+static void writePack(NSString *path) {
+	size_t size {0};
+	auto image = respack_writer_finish(packWriter, buildHash, &size);
+	if (!image)
+		ERROR("Failed to build resource pack");
+
+	struct respack pack;
+	auto status = respack_open(&pack, image, size);
+	if (status != RESPACK_OK)
+		ERROR("Built resource pack is invalid: %s", respack_status_name(status));
+
+	auto entries = pack.header->entry_count;
+	if (![[NSData dataWithBytesNoCopy:image length:size freeWhenDone:YES] writeToFile:path atomically:YES])
+		ERROR("Failed to write %s", [path UTF8String]);
+	SYSLOG("profile %s: resource pack of %zu bytes with %u entries", [profile.name UTF8String], size, entries);
+}
+
+static uint64_t profileKey(uint32_t codec, uint32_t layout) {
+	return (static_cast<uint64_t>(codec) << 32) | layout;
+}
+
+static bool parseDeviceId(id value, uint32_t &out) {
+	if (![value isKindOfClass:[NSString class]])
+		return false;
+	NSArray *parts = [value componentsSeparatedByString:@":"];
+	unsigned vendor = 0, device = 0;
+	if ([parts count] != 2 ||
+		![[NSScanner scannerWithString:[parts objectAtIndex:0]] scanHexInt:&vendor] ||
+		![[NSScanner scannerWithString:[parts objectAtIndex:1]] scanHexInt:&device] ||
+		vendor > 0xFFFF || device > 0xFFFF)
+		return false;
+	out = (vendor << 16) | device;
+	return true;
+}
+
+static void loadProfile(NSString *path) {
+	auto dict = [NSDictionary dictionaryWithContentsOfFile:path];
+	if (!dict)
+		ERROR("Missing profile %s", [path UTF8String]);
+
+	profile.active = true;
+	profile.name = [dict objectForKey:@"Name"] ?: [[path lastPathComponent] stringByDeletingPathExtension];
+
+	NSArray *codecs = [dict objectForKey:@"Codecs"];
+	profile.codecsActive = codecs != nil;
+	for (NSDictionary *codec in codecs) {
+		uint32_t codecId {0};
+		if (!parseDeviceId([codec objectForKey:@"CodecID"], codecId))
+			ERROR("Invalid codec %s in profile %s, expected vendor:codec", [[[codec objectForKey:@"CodecID"] description] UTF8String], [path UTF8String]);
+		auto &layouts = profile.codecs[codecId];
+		for (NSNumber *layout in [codec objectForKey:@"Layouts"])
+			layouts.insert([layout unsignedIntValue]);
+		if (layouts.empty())
+			ERROR("No layouts for codec 0x%08X in profile %s", codecId, [path UTF8String]);
+	}
+
+	NSArray *ctrls = [dict objectForKey:@"Controllers"];
+	profile.controllersActive = ctrls != nil;
+	for (id ctrl in ctrls) {
+		uint32_t ctrlId {0};
+		if (!parseDeviceId(ctrl, ctrlId))
+			ERROR("Invalid controller %s in profile %s, expected vendor:device", [[ctrl description] UTF8String], [path UTF8String]);
+		profile.controllers.insert(ctrlId);
+	}
+
+	if ([dict objectForKey:@"MinKernel"])
+		profile.minKernel = [[dict objectForKey:@"MinKernel"] longValue];
+	if ([dict objectForKey:@"MaxKernel"])
+		profile.maxKernel = [[dict objectForKey:@"MaxKernel"] longValue];
+	if (profile.minKernel > profile.maxKernel)
+		ERROR("Empty kernel range in profile %s", [path UTF8String]);
+}
+
+static bool profileKernelMatch(NSDictionary *entry) {
+	long minKernel = [entry objectForKey:@"MinKernel"] ? [[entry objectForKey:@"MinKernel"] longValue] : 0;
+	long maxKernel = [entry objectForKey:@"MaxKernel"] ? [[entry objectForKey:@"MaxKernel"] longValue] : LONG_MAX;
+	return minKernel <= profile.maxKernel && profile.minKernel <= maxKernel;
+}
+
+static NSArray *profilePatches(NSArray *patches) {
+	if (!patches || !profile.active)
+		return patches;
+	auto kept = [[NSMutableArray alloc] init];
+	for (NSDictionary *p in patches) {
+		if (profileKernelMatch(p))
+			[kept addObject:p];
+		else
+			report.skippedPatches++;
+	}
+	return [kept count] > 0 ? kept : nil;
+}
+
+static NSArray *profileFiles(NSArray *files, uint32_t codecId, std::set<uint64_t> &found) {
+	if (!files || !profile.active)
+		return files;
+	auto kept = [[NSMutableArray alloc] init];
+	for (NSDictionary *f in files) {
+		uint32_t layout = [[f objectForKey:@"Id"] unsignedIntValue];
+		if ((!profile.codecsActive || profile.codecs[codecId].count(layout)) && profileKernelMatch(f)) {
+			[kept addObject:f];
+			found.insert(profileKey(codecId, layout));
+		} else {
+			report.skippedFiles++;
+		}
+	}
+	return [kept count] > 0 ? kept : nil;
+}
+
+static NSDictionary *profileCodec(NSDictionary *codecDict, uint32_t codecId) {
+	if (!profile.active)
+		return codecDict;
+	if (profile.codecsActive && profile.codecs.find(codecId) == profile.codecs.end()) {
+		report.skippedCodecs++;
+		return nil;
+	}
+
+	profile.foundCodecs.insert(codecId);
+	auto files = [[NSMutableDictionary alloc] init];
+	NSDictionary *origFiles = [codecDict objectForKey:@"Files"];
+	NSArray *layouts = profileFiles([origFiles objectForKey:@"Layouts"], codecId, profile.foundLayouts);
+	NSArray *platforms = profileFiles([origFiles objectForKey:@"Platforms"], codecId, profile.foundPlatforms);
+	if (layouts)
+		[files setObject:layouts forKey:@"Layouts"];
+	if (platforms)
+		[files setObject:platforms forKey:@"Platforms"];
+
+	auto dict = [codecDict mutableCopy];
+	[dict setObject:files forKey:@"Files"];
+	NSArray *patches = profilePatches([codecDict objectForKey:@"Patches"]);
+	if (patches)
+		[dict setObject:patches forKey:@"Patches"];
+	else
+		[dict removeObjectForKey:@"Patches"];
+	return dict;
+}
+
+static void checkProfile() {
+	if (!profile.active)
+		return;
+
+	bool missing = false;
+	for (auto &codec : profile.codecs) {
+		if (profile.foundCodecs.find(codec.first) == profile.foundCodecs.end()) {
+			SYSLOG("profile %s: codec 0x%08X is missing", [profile.name UTF8String], codec.first);
+			missing = true;
+			continue;
+		}
+		for (auto layout : codec.second) {
+			auto key = profileKey(codec.first, layout);
+			if (profile.foundLayouts.find(key) == profile.foundLayouts.end())
+				SYSLOG("profile %s: layout %u of codec 0x%08X is missing", [profile.name UTF8String], layout, codec.first);
+			if (profile.foundPlatforms.find(key) == profile.foundPlatforms.end())
+				SYSLOG("profile %s: platform %u of codec 0x%08X is missing", [profile.name UTF8String], layout, codec.first);
+			if (profile.foundPinConfigs.find(key) == profile.foundPinConfigs.end())
+				SYSLOG("profile %s: pinconfig %u of codec 0x%08X is missing", [profile.name UTF8String], layout, codec.first);
+			missing |= profile.foundLayouts.find(key) == profile.foundLayouts.end() ||
+				profile.foundPlatforms.find(key) == profile.foundPlatforms.end() ||
+				profile.foundPinConfigs.find(key) == profile.foundPinConfigs.end();
+		}
+	}
+
+	for (auto ctrl : profile.controllers) {
+		if (profile.foundControllers.find(ctrl) == profile.foundControllers.end()) {
+			SYSLOG("profile %s: controller %04X:%04X is missing", [profile.name UTF8String], ctrl >> 16, ctrl & 0xFFFF);
+			missing = true;
+		}
+	}
+
+	if (missing)
+		ERROR("Profile %s does not match the resources", [profile.name UTF8String]);
+}
+
+static void printReport() {
+	auto name = [profile.name UTF8String];
+	SYSLOG("profile %s: %zu codecs, %zu layouts, %zu platforms, %zu controllers, %zu patches, %zu pinconfigs",
+		   name, report.codecs, report.layouts, report.platforms, report.controllers, report.patches, report.pinConfigs);
+	SYSLOG("profile %s: %zu bytes of resource files, %zu bytes of patches, %zu bytes total",
+		   name, report.fileBytes, report.patchBytes, report.fileBytes + report.patchBytes);
+	if (profile.active)
+		SYSLOG("profile %s: skipped %zu codecs, %zu files, %zu controllers, %zu patches, %zu pinconfigs",
+			   name, report.skippedCodecs, report.skippedFiles, report.skippedControllers, report.skippedPatches, report.skippedPinConfigs);
+}
+
 static NSDictionary * generateKexts(NSString *file, NSDictionary *kexts) {
 	auto kextPathsSection = [[NSMutableString alloc] initWithUTF8String:"\n// Kext section\n\n"];
 	auto kextSection = [[NSMutableString alloc] init];
@@ -120,6 +402,7 @@ static NSString *generateFile(NSString *file, NSString *path, NSString *inFile)
 		}
 		
 		appendFile(file, [[NSString alloc] initWithFormat:@"};\n"]);
+		report.fileBytes += [data length];
 		[fileList setValue:[NSNumber numberWithUnsignedLongLong:fileIndex] forKey:fullInPath];
 		fileIndex++;
 		return [[NSString alloc] initWithFormat:@"file%zu, %zu", fileIndex-1, [data length]];
@@ -160,6 +443,7 @@ static NSString *generatePlatforms(NSString *file, NSDictionary *codecDict, NSSt
 		[pStr appendString:@"};\n"];
 	
 		appendFile(file, pStr);
+		report.platforms += [plats count];
 		platformIndex++;
 		return [[NSString alloc] initWithFormat:@"platforms%zu, %lu", platformIndex-1, [plats count]];
 	}
@@ -185,6 +469,7 @@ static NSString *generateLayouts(NSString *file, NSDictionary *codecDict, NSStri
 		[pStr appendString:@"};\n"];
 		
 		appendFile(file, pStr);
+		report.layouts += [lts count];
 		layoutIndex++;
 		return [[NSString alloc] initWithFormat:@"layouts%zu, %lu", layoutIndex-1, [lts count]];
 	}
@@ -221,7 +506,7 @@ static void storePatchBufIndex(const uint8_t *patch, size_t len, size_t index) {
 	patchBufMap[k] = index;
 }
 
-static NSString *generatePatches(NSString *file, NSArray *patches, NSDictionary *kextIndexes, long *num=nullptr, NSString *header=nullptr) {
+static NSString *generatePatches(NSString *file, NSString *source, NSArray *patches, NSDictionary *kextIndexes, long *num=nullptr, NSString *header=nullptr) {
 	static size_t patchIndex {0};
 	static size_t patchBufIndex {0};
 
@@ -229,6 +514,7 @@ static NSString *generatePatches(NSString *file, NSArray *patches, NSDictionary
 		auto pStr = [NSMutableString alloc];
 		pStr = header ? [pStr initWithString:header] : [pStr initWithFormat:@"static KextPatch patches%zu[] {\n", patchIndex];
 		auto pbStr = [[NSMutableString alloc] init];
+		size_t sourceIndex {0};
 		for (NSDictionary *p in patches) {
 			const size_t PatchNum = 2;
             NSData *f[PatchNum] = {[p objectForKey:@"Find"], [p objectForKey:@"Replace"]};
@@ -252,24 +538,27 @@ static NSString *generatePatches(NSString *file, NSArray *patches, NSDictionary
 					
 					[pbStr appendString:@"};\n"];
 					
+					report.patchBytes += patchLen;
 					patchBufIndexes[i] = patchBufIndex++;
 					storePatchBufIndex(patchBuf, patchLen, patchBufIndexes[i]);
 				}
 			}
 			
-			[pStr appendFormat:@"\t{ { &ADDPR(kextList)[%@], patchBuf%zu, patchBuf%zu, %zu, %@ }, %@, %@ },\n",
+			[pStr appendFormat:@"\t{ { &ADDPR(kextList)[%@], patchBuf%zu, patchBuf%zu, %zu, %@ }, %@, %@, \"%@#%zu\" },\n",
 			 [kextIndexes objectForKey:[p objectForKey:@"Name"]],
 			 patchBufIndexes[0],
 			 patchBufIndexes[1],
 			 [f[0] length],
 			 [p objectForKey:@"Count"] ?: @"0",
 			 [p objectForKey:@"MinKernel"] ?: @"KernelPatcher::KernelAny",
-			 [p objectForKey:@"MaxKernel"] ?: @"KernelPatcher::KernelAny"
+			 [p objectForKey:@"MaxKernel"] ?: @"KernelPatcher::KernelAny",
+			 source, sourceIndex++
 			];
 		}
 		[pStr appendString:@"};\n"];
 		if (num)
 			*num = [patches count];
+		report.patches += [patches count];
 		
 		appendFile(file, pbStr);
 		appendFile(file, pStr);
@@ -280,12 +569,13 @@ static NSString *generatePatches(NSString *file, NSArray *patches, NSDictionary
 	return @"nullptr, 0";
 }
 
-static size_t generateCodecs(NSString *file, NSString *vendor, NSString *path, NSDictionary *kextIndexes) {
+static size_t generateCodecs(NSString *file, NSString *vendor, uint16_t vendorID, NSString *path, NSDictionary *kextIndexes) {
 	appendFile(file, [[NSString alloc] initWithFormat:@"\n// %@ CodecMod section\n\n", vendor]);
 
 	auto codecModSection = [[NSMutableString alloc] initWithFormat:@"static CodecModInfo codecMod%@[] {\n", vendor];
 	auto fm = [NSFileManager defaultManager];
-	NSArray *entries = [fm contentsOfDirectoryAtPath:path error:nil];
+	// Sorted, so that every build generates the codecs in the same order.
+	NSArray *entries = [[fm contentsOfDirectoryAtPath:path error:nil] sortedArrayUsingSelector:@selector(compare:)];
 	
 	size_t codecs {0};
 	for (NSString *entry in entries) {
@@ -294,13 +584,20 @@ static size_t generateCodecs(NSString *file, NSString *vendor, NSString *path, N
 		
 		// Dir exists and is codec dir
 		if ([fm fileExistsAtPath:infoCfgStr]) {
-			auto codecDict = [NSDictionary dictionaryWithContentsOfFile:infoCfgStr];
+			NSDictionary *codecDict = [NSDictionary dictionaryWithContentsOfFile:infoCfgStr];
 			// Vendor match
 			if ([[codecDict objectForKey:@"Vendor"] isEqualToString:vendor]) {
+				codecDict = profileCodec(codecDict, (static_cast<uint32_t>(vendorID) << 16) | [[codecDict objectForKey:@"CodecID"] unsignedShortValue]);
+				if (!codecDict)
+					continue;
 				auto revs = generateRevisions(file, codecDict);
 				auto platforms = generatePlatforms(file, codecDict, baseDirStr);
 				auto layouts = generateLayouts(file, codecDict, baseDirStr);
-				auto patches = generatePatches(file, [codecDict objectForKey:@"Patches"], kextIndexes);
+				auto codecId = (static_cast<uint32_t>(vendorID) << 16) | [[codecDict objectForKey:@"CodecID"] unsignedShortValue];
+				packFiles([[codecDict objectForKey:@"Files"] objectForKey:@"Platforms"], RESPACK_PLATFORM, codecId, baseDirStr);
+				packFiles([[codecDict objectForKey:@"Files"] objectForKey:@"Layouts"], RESPACK_LAYOUT, codecId, baseDirStr);
+				auto source = [[NSString alloc] initWithFormat:@"%@/Info.plist", entry];
+				auto patches = generatePatches(file, source, [codecDict objectForKey:@"Patches"], kextIndexes);
 			
 				[codecModSection appendFormat:@"\t{ DEBUG_STRING(\"%@\"), 0x%X, %@, %@, %@, %@ },\n",
 				 [codecDict objectForKey:@"CodecName"],
@@ -314,6 +611,7 @@ static size_t generateCodecs(NSString *file, NSString *vendor, NSString *path, N
 	
 	[codecModSection appendString:@"};\n"];
 	appendFile(file, codecModSection);
+	report.codecs += codecs;
 	
 	return codecs;
 }
@@ -323,9 +621,23 @@ static void generateControllers(NSString *file, NSArray *ctrls, NSDictionary *ve
 	
 	auto ctrlModSection = [[NSMutableString alloc] initWithString:@"ControllerModInfo ADDPR(controllerMod)[] {\n"];
 
+	size_t num {0};
 	for (NSDictionary *entry in ctrls) {
+		uint32_t ctrlId = (static_cast<uint32_t>([[vendors objectForKey:[entry objectForKey:@"Vendor"]] unsignedShortValue]) << 16) |
+			[[entry objectForKey:@"Device"] unsignedShortValue];
+		NSArray *ctrlPatches = profilePatches([entry objectForKey:@"Patches"]);
+		// Controller entries only exist for their patches, drop them once none apply to the profiled kernels.
+		if (profile.active && ((profile.controllersActive && !profile.controllers.count(ctrlId)) ||
+			([entry objectForKey:@"Patches"] && !ctrlPatches))) {
+			report.skippedControllers++;
+			continue;
+		}
+		profile.foundControllers.insert(ctrlId);
+
 		auto revs = generateRevisions(file, entry);
-		auto patches = generatePatches(file, [entry objectForKey:@"Patches"], kextIndexes);
+		auto source = [[NSString alloc] initWithFormat:@"Controllers.plist/%@", [entry objectForKey:@"Name"]];
+		auto patches = generatePatches(file, source, ctrlPatches, kextIndexes);
+		packController(entry, ctrlId, ctrlPatches, kextIndexes);
 		
 		auto model = @"WIOKit::ComputerModel::ComputerAny";
 		if ([entry objectForKey:@"Model"]) {
@@ -343,10 +655,14 @@ static void generateControllers(NSString *file, NSArray *ctrls, NSDictionary *ve
 		 revs, [entry objectForKey:@"Platform"] ?: @"ControllerModInfo::PlatformAny",
 		 model, patches
 		];
+		num++;
 	}
 	
+	if (num == 0)
+		[ctrlModSection appendString:@"\t{}\n"];
 	[ctrlModSection appendString:@"};\n"];
-	[ctrlModSection appendFormat:@"\nconst size_t ADDPR(controllerModSize) {%lu};\n", [ctrls count]];
+	[ctrlModSection appendFormat:@"\nconst size_t ADDPR(controllerModSize) {%zu};\n", num];
+	report.controllers += num;
 	appendFile(file, ctrlModSection);
 }
 
@@ -357,21 +673,105 @@ static void generateVendors(NSString *file, NSDictionary *vendors, NSString *pat
 
 	[vendorSection appendString:@"VendorModInfo ADDPR(vendorMod)[] {\n"];
 	
-	for (NSString *dictKey in vendors) {
+	size_t vendorNum {0};
+	for (NSString *dictKey in [[vendors allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
 		NSNumber *vendorID = [vendors objectForKey:dictKey];
-		size_t num = generateCodecs(file, dictKey, path, kextIndexes);
+		// Vendors without profiled codecs are left out altogether.
+		if (profile.codecsActive) {
+			auto it = profile.codecs.lower_bound(static_cast<uint32_t>([vendorID unsignedShortValue]) << 16);
+			if (it == profile.codecs.end() || (it->first >> 16) != [vendorID unsignedShortValue])
+				continue;
+		}
+		size_t num = generateCodecs(file, dictKey, [vendorID unsignedShortValue], path, kextIndexes);
 		[vendorSection appendFormat:@"\t{ DEBUG_STRING(\"%@\"), 0x%X, codecMod%@, %zu },\n",
 			dictKey, [vendorID unsignedShortValue], dictKey, num];
+		vendorNum++;
 	}
 	
+	if (vendorNum == 0)
+		[vendorSection appendString:@"\t{}\n"];
 	[vendorSection appendString:@"};\n"];
-	[vendorSection appendFormat:@"\nconst size_t ADDPR(vendorModSize) {%lu};\n", [vendors count]];
+	[vendorSection appendFormat:@"\nconst size_t ADDPR(vendorModSize) {%zu};\n", vendorNum];
 	appendFile(file, vendorSection);
 	appendFile(file, @"#endif\n");
 }
 
+/**
+ *  Check an HDAConfigDefault entry the way alc-pinconfig merge does, invalid entries are dropped from the merged array
+ */
+static bool validPinConfig(NSDictionary *config) {
+	if (![config isKindOfClass:[NSDictionary class]])
+		return false;
+	for (NSString *key in @[@"CodecID", @"LayoutID"]) {
+		NSNumber *value = [config objectForKey:key];
+		if (![value isKindOfClass:[NSNumber class]] || [value longLongValue] < 0 || [value longLongValue] > 0xFFFFFFFFLL)
+			return false;
+	}
+	for (NSString *key in @[@"ConfigData", @"WakeConfigData"]) {
+		id value = [config objectForKey:key];
+		if (value && ![value isKindOfClass:[NSData class]])
+			return false;
+	}
+	return true;
+}
+
+static void generatePinConfigs(NSString *file, NSString *path) {
+	auto pinConfigsCfg = [[NSString alloc] initWithFormat:@"%@/PinConfigs.kext/Contents/Info.plist", path];
+	auto pinConfigs = [NSDictionary dictionaryWithContentsOfFile:pinConfigsCfg];
+	NSArray *configs = [[[pinConfigs objectForKey:@"IOKitPersonalities"] objectForKey:@"HDA Hardware Config Resource"] objectForKey:@"HDAConfigDefault"];
+	if (!configs)
+		SYSLOG("no HDAConfigDefault in %s, pinconfig table is empty", [pinConfigsCfg UTF8String]);
+
+	appendFile(file, @"\n// PinConfig section\n\n#ifdef HAVE_ANALOG_AUDIO\n");
+
+	// Entries are sorted by CodecID and LayoutID for binary search, the first entry wins like in AppleHDA.
+	// The kext indexes the HDAConfigDefault array written by alc-pinconfig merge, which keeps PinConfigs
+	// entries in order without invalid ones and duplicates, so count positions the same way.
+	std::map<uint64_t, NSString *> entries;
+	std::set<uint64_t> merged;
+	size_t position = 0;
+	for (NSUInteger i = 0; i < [configs count]; i++) {
+		NSDictionary *config = [configs objectAtIndex:i];
+		if (!validPinConfig(config)) {
+			SYSLOG("skipping invalid HDAConfigDefault entry %lu", i);
+			continue;
+		}
+
+		NSNumber *codec = [config objectForKey:@"CodecID"];
+		NSNumber *layout = [config objectForKey:@"LayoutID"];
+		uint64_t key = profileKey([codec unsignedIntValue], [layout unsignedIntValue]);
+		if (!merged.insert(key).second) {
+			SYSLOG("skipping duplicate HDAConfigDefault entry %lu for codec 0x%08X layout %u", i, [codec unsignedIntValue], [layout unsignedIntValue]);
+			continue;
+		}
+
+		auto index = position++;
+		if (profile.codecsActive && (!profile.codecs.count([codec unsignedIntValue]) || !profile.codecs[[codec unsignedIntValue]].count([layout unsignedIntValue]))) {
+			report.skippedPinConfigs++;
+			continue;
+		}
+
+		NSNumber *reinit = [config objectForKey:@"WakeVerbReinit"];
+		auto flags = [reinit isKindOfClass:[NSNumber class]] && [reinit boolValue] ? @"PinConfigEntry::WakeVerbReinit" : @"0";
+		entries[key] = [[NSString alloc] initWithFormat:@"\t{ 0x%08X, %u, %zu, %@ },\n",
+			[codec unsignedIntValue], [layout unsignedIntValue], index, flags];
+	}
+
+	auto pcStr = [[NSMutableString alloc] initWithString:@"const PinConfigEntry ADDPR(pinConfigs)[] {\n"];
+	for (auto &entry : entries)
+		[pcStr appendString:entry.second];
+	if (entries.empty())
+		[pcStr appendString:@"\t{}\n"];
+	[pcStr appendString:@"};\n"];
+	[pcStr appendFormat:@"\nconst size_t ADDPR(pinConfigsSize) {%zu};\n#endif\n", entries.size()];
+	appendFile(file, pcStr);
+	report.pinConfigs += entries.size();
+	for (auto &entry : entries)
+		profile.foundPinConfigs.insert(entry.first);
+}
+
 int main(int argc, const char * argv[]) {
-	if (argc != 3)
+	if (argc < 3)
 		ERROR("Invalid usage");
 
 	auto basePath = [[NSString alloc] initWithUTF8String:argv[1]];
@@ -386,6 +786,17 @@ int main(int argc, const char * argv[]) {
 	auto ctrls = [NSArray arrayWithContentsOfFile:ctrlsCfg];
 	//auto userp = [NSArray arrayWithContentsOfFile:userCfg];
 
+	// Optional arguments: a build profile and -pack <file> for the external resource pack
+	NSString *packPath = nil;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "-pack") == 0 && i + 1 < argc)
+			packPath = [[NSString alloc] initWithUTF8String:argv[++i]];
+		else if (!profile.active)
+			loadProfile([[NSString alloc] initWithUTF8String:argv[i]]);
+		else
+			ERROR("Invalid usage");
+	}
+
 	if (!vendors || !kexts || !ctrls)
 		ERROR("Missing resource data (vendors:%p, kexts:%p, ctrls:%p)", vendors, kexts, ctrls);
 
@@ -395,9 +806,23 @@ int main(int argc, const char * argv[]) {
 	try {
 		appendFile(outputCpp, ResourceHeader);
 		auto kextIndexes = generateKexts(outputCpp, kexts);
+		if (packPath) {
+			packWriter = respack_writer_create(static_cast<uint32_t>([kextIndexes count]));
+			if (!packWriter)
+				ERROR("Failed to allocate resource pack writer");
+		}
 		generateVendors(outputCpp, vendors, basePath, kextIndexes);
 		generateControllers(outputCpp, ctrls, vendors, kextIndexes);
+		generatePinConfigs(outputCpp, basePath);
+		generateBuildHash(outputCpp);
 	} catch (...) {
 		ERROR("Fatal error during generation");
 	}
+
+	checkProfile();
+	printReport();
+	if (packWriter) {
+		writePack(packPath);
+		respack_writer_free(packWriter);
+	}
 }
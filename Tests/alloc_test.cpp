@@ -0,0 +1,346 @@
+//
+//  alloc_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_arena.hpp>
+#include <kern_discovery.hpp>
+#include <kern_hdau.hpp>
+#include <kern_routing.hpp>
+
+#include <new>
+#include <vector>
+
+#include <stdlib.h>
+
+/**
+ *  Heap allocations made while counting is enabled. On glibc malloc is counted as well,
+ *  elsewhere only operator new is.
+ */
+static bool counting {false};
+static size_t allocations {0};
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+	if (counting)
+		allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size) {
+	if (counting)
+		allocations++;
+	return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if (counting)
+		allocations++;
+	return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+static void *countedAlloc(size_t size) {
+#ifndef __GLIBC__
+	if (counting)
+		allocations++;
+#endif
+	return malloc(size ? size : 1);
+}
+
+/**
+ *  Kept out of line, so that the compiler does not pair the free below with a mismatched new
+ */
+__attribute__((noinline)) static void countedFree(void *ptr) {
+	free(ptr);
+}
+
+void *operator new(size_t size) {
+	auto ptr = countedAlloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](size_t size) {
+	auto ptr = countedAlloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	return countedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return countedAlloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+	countedFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+	countedFree(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	countedFree(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+	countedFree(ptr);
+}
+
+namespace {
+
+/**
+ *  Service plane entry with a reference count
+ */
+struct Entry {
+	Entry *parent;
+	uint32_t address;
+	uint32_t vendor;
+	int refs;
+
+	bool contains(const void *entry) const {
+		for (auto node = static_cast<const Entry *>(entry); node; node = node->parent)
+			if (node == this)
+				return true;
+		return false;
+	}
+};
+
+using Discovery = CodecDiscovery<Entry>;
+
+/**
+ *  Stand-in for AlcEnabler::ControllerInfo
+ */
+struct Controller {
+	uint32_t device;
+	Entry *detect;
+	uint32_t layout;
+};
+
+/**
+ *  Stand-in for AlcEnabler::CodecInfo, the deleter drops the reference taken when storing it
+ */
+struct Codec {
+	size_t controller;
+	uint32_t address;
+	Entry *device;
+
+	static void deleter(Codec &codec) {
+		if (codec.device)
+			codec.device->refs--;
+	}
+};
+
+/**
+ *  Same limits as AlcEnabler
+ */
+constexpr size_t MaxAnalogControllers = 5;
+constexpr size_t MaxDigitalControllers = 1 + HdauIdAllocator::MaxIds;
+constexpr size_t MaxControllers = MaxAnalogControllers + MaxDigitalControllers;
+constexpr size_t MaxCodecs = MaxAnalogControllers * Discovery::MaxCodecAddresses;
+
+/**
+ *  Supported codec vendor, codecs of other vendors are dropped like in validateCodecs
+ */
+constexpr uint32_t SupportedVendor = 0x10EC;
+
+/**
+ *  Machine with every analog controller populated, three codecs per link of which one is
+ *  unsupported, and more discrete GPUs than there are digital controller slots
+ */
+struct Machine {
+	static constexpr size_t Gpus = MaxDigitalControllers + 8;
+	static constexpr size_t CodecsPerLink = 3;
+
+	Entry root {nullptr, 0, 0, 0};
+	Entry analog[MaxAnalogControllers] {};
+	Entry codecs[MaxAnalogControllers][CodecsPerLink] {};
+	Entry drivers[MaxAnalogControllers][CodecsPerLink] {};
+	const uint32_t hdauIds[4] {0x0E0810DE, 0x0BEE10DE, 0x10F010DE, 0x10F110DE};
+
+	Machine() {
+		for (size_t c = 0; c < MaxAnalogControllers; c++) {
+			analog[c] = {&root, 0, 0, 0};
+			for (size_t a = 0; a < CodecsPerLink; a++) {
+				codecs[c][a] = {&analog[c], static_cast<uint32_t>(CodecsPerLink - a), a == 1 ? 0x1106U : SupportedVendor, 1};
+				drivers[c][a] = {&codecs[c][a], 0, 0, 0};
+			}
+		}
+	}
+};
+
+/**
+ *  Detected state kept across detection rounds, like the AlcEnabler members
+ */
+struct Detection {
+	ArenaVector<Controller, MaxControllers> controllers;
+	size_t dropped {0};
+	ArenaVector<Codec, MaxCodecs, Codec::deleter> codecs;
+	Discovery::Slot slots[MaxControllers * Discovery::MaxCodecAddresses] {};
+
+	void insert(uint32_t device, Entry *detect, uint32_t layout) {
+		if (!controllers.push_back({device, detect, layout}, detect ? 0 : MaxAnalogControllers))
+			dropped++;
+	}
+
+	/**
+	 *  Run updateProperties, grabControllers, grabCodecs, validateCodecs, codec routing and HDAU id
+	 *  assignment over the machine, then tear everything down like deinit
+	 *
+	 *  @return number of codecs routed to their drivers
+	 */
+	size_t run(Machine &machine) {
+		// Digital controllers are inserted at patcher load, the analog ones afterwards.
+		dropped = 0;
+		HdauIdAllocator hdau(machine.hdauIds, arrsize(machine.hdauIds));
+		for (size_t i = 0; i < Machine::Gpus; i++) {
+			uint32_t device = static_cast<uint32_t>(0x1000 + i) << 16 | 0x10DE;
+			insert(device, nullptr, 0);
+			hdau.request(device);
+		}
+		for (size_t c = 0; c < MaxAnalogControllers; c++)
+			insert(0xA0F08086, &machine.analog[c], c == 0 ? 11 : 0);
+		hdau.assign();
+
+		Discovery discovery;
+		discovery.reset(slots, controllers.size(), getCurrentTimeNs());
+		for (size_t i = 0; i < controllers.size(); i++)
+			if (controllers[i]->detect)
+				discovery.expect();
+
+		auto parent = [](Entry *entry) { return entry->parent; };
+		auto match = [this](Entry *entry, size_t &index) {
+			for (index = 0; index < controllers.size(); index++)
+				if (controllers[index]->detect == entry)
+					return true;
+			return false;
+		};
+		for (auto &link : machine.codecs) {
+			for (auto &codec : link) {
+				size_t controller = 0;
+				if (Discovery::findController(&codec, parent, match, controller) &&
+					discovery.store(controller, &codec, codec.address, getCurrentTimeNs()) != Discovery::Result::Ignored)
+					codec.refs++;
+			}
+		}
+
+		for (size_t i = 0; i < controllers.size(); i++) {
+			auto list = discovery.get(i);
+			for (size_t a = 0; a < Discovery::MaxCodecAddresses; a++) {
+				if (list[a].codec) {
+					if (codecs.push_back({i, list[a].codec->address, list[a].codec}))
+						list[a].codec->refs++;
+					list[a].codec->refs--;
+				}
+			}
+		}
+
+		size_t i = 0;
+		while (i < codecs.size()) {
+			if (codecs[i]->device->vendor == SupportedVendor)
+				i++;
+			else
+				codecs.erase(i);
+		}
+
+		size_t routed = 0;
+		auto contains = [](Entry *device, const void *driver) { return device->contains(driver); };
+		for (auto &link : machine.drivers) {
+			for (auto &driver : link) {
+				auto index = CodecRouting::findDriver(codecs, &driver, contains);
+				if (index < codecs.size() && CodecRouting::findService(codecs, &driver, parent) == index)
+					routed++;
+			}
+		}
+		auto hasLayout = [this](const Codec *codec) { return controllers[codec->controller]->layout > 0; };
+		if (CodecRouting::firstWithLayout(codecs, hasLayout) < codecs.size() && hdau.find(0x100010DE))
+			routed++;
+
+		codecs.deinit();
+		controllers.deinit();
+		return routed;
+	}
+};
+
+void testCounter() {
+	// The counter sees both allocation paths, otherwise a zero below proves nothing.
+	counting = true;
+	allocations = 0;
+	{
+		std::vector<int> list;
+		list.push_back(1);
+		benchKeep(list.data());
+	}
+	auto buffer = malloc(64);
+	benchKeep(buffer);
+	counting = false;
+	free(buffer);
+	CHECK(allocations >= 2);
+}
+
+void testDetection() {
+	Machine machine;
+	Detection detection;
+	static constexpr size_t Rounds = 100;
+	static constexpr size_t Supported = MaxAnalogControllers * (Machine::CodecsPerLink - 1);
+
+	counting = true;
+	allocations = 0;
+	size_t routed = 0;
+	for (size_t round = 0; round < Rounds; round++)
+		routed += detection.run(machine);
+	counting = false;
+
+	CHECK_EQ(allocations, 0);
+	CHECK_EQ(routed, Rounds * (Supported + 1));
+	// GPUs past the digital slots are dropped, every analog controller still fits.
+	CHECK_EQ(detection.dropped, Machine::Gpus - MaxDigitalControllers);
+	// Every reference taken while storing a codec is dropped again.
+	for (auto &link : machine.codecs)
+		for (auto &codec : link)
+			CHECK_EQ(codec.refs, 1);
+}
+
+void testLimits() {
+	// Every codec address of every analog controller fits.
+	Machine machine;
+	Detection detection;
+	for (size_t c = 0; c < MaxAnalogControllers; c++)
+		detection.insert(0xA0F08086, &machine.analog[c], 0);
+	CHECK_EQ(detection.dropped, 0);
+	for (size_t c = 0; c < MaxAnalogControllers; c++)
+		for (uint32_t a = 0; a < Discovery::MaxCodecAddresses; a++)
+			CHECK(detection.codecs.push_back({c, a, nullptr}) != nullptr);
+	CHECK(detection.codecs.push_back({0, 0, nullptr}) == nullptr);
+
+	// Analog controllers inserted first leave the digital ones fewer slots.
+	for (size_t i = 0; i < MaxDigitalControllers; i++)
+		detection.insert(0x100010DE, nullptr, 0);
+	CHECK_EQ(detection.dropped, MaxAnalogControllers);
+	CHECK_EQ(detection.controllers.size(), MaxControllers - MaxAnalogControllers);
+}
+
+}
+
+int main() {
+	testCounter();
+	testDetection();
+	testLimits();
+	return testResult("alloc_test");
+}
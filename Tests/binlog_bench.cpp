@@ -0,0 +1,83 @@
+//
+//  binlog_bench.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_binlog.hpp>
+
+extern "C" {
+#include "logdecode.h"
+}
+
+#include <memory>
+
+namespace {
+
+static constexpr size_t Iterations = 1000000;
+
+/**
+ *  Record a call site in the ring, format it with snprintf as DBGLOG does, and decode
+ *  the recorded ring like alc-verb --log. Every decoded line must match snprintf.
+ */
+template <typename... Args>
+void bench(const char *name, const char *format, Args... args) {
+	std::unique_ptr<BinaryLog> log(new BinaryLog);
+	uint16_t index = 0;
+	auto start = getCurrentTimeNs();
+	for (size_t i = 0; i < Iterations; i++)
+		log->record(index, "alc", format, args...);
+	auto recorded = getCurrentTimeNs() - start;
+
+	char expected[256], text[256];
+	start = getCurrentTimeNs();
+	for (size_t i = 0; i < Iterations; i++) {
+		snprintf(text, sizeof(text), format, args...);
+		benchKeep(text[0]);
+	}
+	auto formatted = getCurrentTimeNs() - start;
+	snprintf(expected, sizeof(expected), format, args...);
+
+	std::unique_ptr<ALCLogDump> dump(new ALCLogDump);
+	log->read(*dump);
+	CHECK_EQ(dump->formatCount, 1);
+	CHECK_EQ(dump->head, Iterations);
+
+	size_t decodes = 0, mismatches = 0;
+	start = getCurrentTimeNs();
+	for (size_t pass = 0; pass < Iterations / kALCLogCapacity; pass++) {
+		for (auto &record : dump->records) {
+			if (record.sequence == 0)
+				continue;
+			log_decode(text, sizeof(text), dump->formats[record.format - 1].format, &record);
+			if (strcmp(text, expected) != 0)
+				mismatches++;
+			decodes++;
+		}
+	}
+	auto decoded = getCurrentTimeNs() - start;
+	CHECK_EQ(decodes, Iterations / kALCLogCapacity * kALCLogCapacity);
+	CHECK_EQ(mismatches, 0);
+
+	char label[64];
+	snprintf(label, sizeof(label), "%s, record", name);
+	benchReport(label, Iterations, recorded);
+	snprintf(label, sizeof(label), "%s, snprintf", name);
+	benchReport(label, Iterations, formatted);
+	snprintf(label, sizeof(label), "%s, decode", name);
+	benchReport(label, decodes, decoded);
+}
+
+}
+
+int main() {
+	uint16_t nid = 0x21, verb = 0xF09, param = 0;
+	bench("verb, 7 arguments", "send HDA command nid=0x%X, verb=0x%X, param=0x%X, wait=%d, result=0x%08x, status=%08X, retries=%u",
+		  nid, verb, param, 1, 0x80000000U, 0xE00002BCU, 2U);
+	bench("controller, string", "found mod for %lu controller - %s", static_cast<size_t>(1), "Intel 8 Series HD Audio");
+	bench("callback, 5 arguments", "layoutLoadCallback %u %d %d %u %d", 17U, 0, true, 18432U, false);
+	return testResult("binlog_bench");
+}
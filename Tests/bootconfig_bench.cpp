@@ -0,0 +1,172 @@
+//
+//  bootconfig_bench.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_bootconfig.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+namespace {
+
+/**
+ *  Stand-in for an IORegistryEntry with an OSDictionary of properties
+ */
+struct Device {
+	std::map<std::string, uint32_t> properties;
+};
+
+size_t propertyReads {0};
+size_t bootArgParses {0};
+
+bool hasProperty(Device *device, const char *name) {
+	propertyReads++;
+	return device->properties.count(name) != 0;
+}
+
+/**
+ *  Stand-in for PE_parse_boot_argn scanning the boot-args string
+ */
+const char bootArgs[] = "keepsyms=1 debug=0x100 -v alcid=11 agdpmod=pikera shikigva=80 -lilubetaall -wegnoegpu";
+
+bool parseBootArg(const char *name, uint32_t &value) {
+	bootArgParses++;
+	auto len = strlen(name);
+	for (const char *arg = bootArgs; arg && *arg; arg = strchr(arg, ' ')) {
+		while (*arg == ' ')
+			arg++;
+		if (!strncmp(arg, name, len) && arg[len] == '=') {
+			value = static_cast<uint32_t>(strtoul(arg + len + 1, nullptr, 0));
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ *  Machine with an analog controller and GPUs with HDMI audio
+ */
+struct Machine {
+	Device analog;
+	std::vector<Device> gpus;
+
+	explicit Machine(size_t num) : gpus(num) {}
+};
+
+/**
+ *  Previous updateProperties: boot-args parsed and every GPU rescanned for every GPU
+ */
+void scanPerGpu(Machine &machine, bool &verbs, bool &delay) {
+	verbs = delay = false;
+	for (size_t g = 0; g < machine.gpus.size(); g++) {
+		uint32_t enableHdaVerbs = 0, enableAlcDelay = 0;
+		bool checkVerbs = !parseBootArg("alcverbs", enableHdaVerbs);
+		bool checkDelay = !parseBootArg("alcdelay", enableAlcDelay);
+		if (checkVerbs || checkDelay) {
+			if (checkVerbs && hasProperty(&machine.analog, "alc-verbs")) {
+				enableHdaVerbs = 1;
+				checkVerbs = false;
+			}
+			if (checkDelay && hasProperty(&machine.analog, "alc-delay")) {
+				enableAlcDelay = 1;
+				checkDelay = false;
+			}
+			for (auto &gpu : machine.gpus) {
+				if (checkVerbs && hasProperty(&gpu, "alc-verbs")) {
+					enableHdaVerbs = 1;
+					checkVerbs = false;
+				}
+				if (checkDelay && hasProperty(&gpu, "alc-delay")) {
+					enableAlcDelay = 1;
+					checkDelay = false;
+				}
+			}
+		}
+		verbs = verbs || enableHdaVerbs != 0;
+		delay = delay || enableAlcDelay != 0;
+	}
+}
+
+/**
+ *  Snapshot: boot-args parsed once in init, devices scanned once at patcher load
+ */
+void scanSnapshot(Machine &machine, bool &verbs, bool &delay) {
+	uint32_t value = 0;
+	bool hasVerbs = parseBootArg("alcverbs", value);
+	bool verbsValue = value != 0;
+	value = 0;
+	bool hasDelay = parseBootArg("alcdelay", value);
+	bool delayValue = value != 0;
+
+	DeviceRequests requests;
+	requests.check(&machine.analog, hasVerbs, hasDelay, hasProperty);
+	for (auto &gpu : machine.gpus)
+		requests.check(&gpu, hasVerbs, hasDelay, hasProperty);
+	verbs = hasVerbs ? verbsValue : requests.verbs;
+	delay = hasDelay ? delayValue : requests.delay;
+}
+
+void testSame() {
+	// Both scans agree on where the properties are.
+	Machine machine(16);
+	bool verbs[2], delay[2];
+	scanPerGpu(machine, verbs[0], delay[0]);
+	scanSnapshot(machine, verbs[1], delay[1]);
+	CHECK(!verbs[0] && !verbs[1] && !delay[0] && !delay[1]);
+
+	machine.gpus[11].properties["alc-delay"] = 1;
+	machine.analog.properties["alc-verbs"] = 1;
+	scanPerGpu(machine, verbs[0], delay[0]);
+	scanSnapshot(machine, verbs[1], delay[1]);
+	CHECK(verbs[0] && verbs[1] && delay[0] && delay[1]);
+
+	// Nothing is read for an entry that is not there.
+	DeviceRequests requests;
+	requests.check(static_cast<Device *>(nullptr), false, false, hasProperty);
+	CHECK(!requests.verbs && !requests.delay);
+}
+
+template <typename Scan>
+void bench(const char *name, size_t gpus, Scan scan) {
+	static constexpr size_t Rounds = 2000;
+	Machine machine(gpus);
+	// The last GPU carries alc-delay, alc-verbs is nowhere, so every device is read.
+	machine.gpus.back().properties["alc-delay"] = 500;
+
+	propertyReads = bootArgParses = 0;
+	bool verbs = false, delay = false;
+	scan(machine, verbs, delay);
+	auto reads = propertyReads, parses = bootArgParses;
+	CHECK(!verbs && delay);
+
+	auto start = getCurrentTimeNs();
+	for (size_t i = 0; i < Rounds; i++) {
+		scan(machine, verbs, delay);
+		benchKeep(delay);
+	}
+	auto elapsed = getCurrentTimeNs() - start;
+
+	char title[64];
+	snprintf(title, sizeof(title), "%s, %zu gpus", name, gpus);
+	benchReport(title, Rounds, elapsed);
+	printf("%-48s %12zu property reads %6zu boot-arg parses\n", "", reads, parses);
+}
+
+}
+
+int main() {
+	testSame();
+	for (size_t gpus : {16, 32, 64, 128}) {
+		bench("per gpu rescan", gpus, scanPerGpu);
+		bench("snapshot", gpus, scanSnapshot);
+	}
+	return testResult("bootconfig_bench");
+}
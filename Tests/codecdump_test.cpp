@@ -0,0 +1,190 @@
+//
+//  codecdump_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+#include <kern_hda.hpp>
+#include <kern_verbqueue.hpp>
+
+extern "C" {
+#include "codecdump.h"
+}
+
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+/**
+ *  Stand-in for kMethodExecuteVerbs running the batch on a simulated codec. One verb
+ *  can be made to fail, and every batch is checked against the transaction limits.
+ */
+struct Dumper {
+	SimCodec codec;
+	uint16_t failNid {0};
+	uint16_t failVerb {0};
+	uint16_t failParam {0};
+	IOReturn failStatus {kIOReturnTimeout};
+	size_t batches {0};
+	size_t oversized {0};
+	size_t splitPairs {0};
+
+	static int exec(void *ctx, const ALCVerbCommand *commands, ALCVerbResult *results, size_t count) {
+		auto that = static_cast<Dumper *>(ctx);
+		that->batches++;
+		if (count == 0 || count > kMaxTransactionVerbs)
+			that->oversized++;
+		// GET_PROC_COEF of a dumped coefficient always follows its SET_COEF_INDEX.
+		if (count > 0 && commands[0].verb == HdaVerb::GetProcCoef)
+			that->splitPairs++;
+
+		VerbTransaction::run(commands, results, count, [that](uint16_t nid, uint16_t verb, uint16_t param, bool, uint32_t &response) {
+			if (that->failVerb != 0 && nid == that->failNid && verb == that->failVerb && param == that->failParam)
+				return that->failStatus;
+			return that->codec.exec(nid, verb, param, &response);
+		});
+		return 0;
+	}
+
+	std::string dump(codec_dump_stats &stats) {
+		char *buffer = nullptr;
+		size_t size = 0;
+		auto out = open_memstream(&buffer, &size);
+		CHECK(out != nullptr);
+		if (!out)
+			return {};
+		CHECK_EQ(codec_dump(out, exec, this, &stats), 0);
+		fclose(out);
+		std::string result(buffer, size);
+		free(buffer);
+		return result;
+	}
+};
+
+std::vector<std::string> lines(const std::string &text) {
+	std::vector<std::string> result;
+	size_t start = 0;
+	while (start < text.size()) {
+		auto end = text.find('\n', start);
+		if (end == std::string::npos)
+			end = text.size();
+		result.emplace_back(text, start, end - start);
+		start = end + 1;
+	}
+	return result;
+}
+
+bool hasLine(const std::vector<std::string> &all, const char *prefix) {
+	for (auto &line : all)
+		if (line.compare(0, strlen(prefix), prefix) == 0)
+			return true;
+	return false;
+}
+
+void testDump() {
+	Dumper dumper;
+	dumper.codec.buildAlc283();
+	dumper.codec.setRegister(0x21, 0xF1C, 0, 0x04211020);
+	dumper.codec.plug(0x21, true);
+	// The dump must put back the coefficient index it found.
+	uint32_t response = 0;
+	dumper.codec.exec(0x20, HdaVerb::SetCoefIndex, 0x33, &response);
+
+	codec_dump_stats stats {};
+	auto text = dumper.dump(stats);
+	auto all = lines(text);
+
+	CHECK(!all.empty() && all[0] == "# alc-verb codec dump: nid verb param response");
+	CHECK(hasLine(all, "0x00 0xf00 0x0000 0x10ec0283"));
+	CHECK(hasLine(all, "0x01 0xf00 0x0005 0x00000001"));
+	CHECK(hasLine(all, "0x21 0xf1c 0x0000 0x04211020"));
+	CHECK(hasLine(all, "0x21 0xf09 0x0000 0x80000000"));
+	CHECK(hasLine(all, "0x12 0xf1c 0x0000 0x411111f0"));
+	CHECK(hasLine(all, "0x20 0xc00 0x0000 0x00008000"));
+	CHECK(hasLine(all, "0x20 0xc00 0x007f 0x0000807f"));
+	CHECK(hasLine(all, "0x20 0xd00 0x0000 0x00000033"));
+	CHECK(!hasLine(all, "0x20 0x500"));
+
+	dumper.codec.exec(0x20, HdaVerb::GetCoefIndex, 0, &response);
+	CHECK_EQ(response, 0x33);
+
+	// Root, function group and 0x02-0x23.
+	CHECK_EQ(stats.nodes, 1 + 0x22);
+	CHECK_EQ(stats.reads, all.size() - 1);
+	CHECK_EQ(stats.failures, 0);
+	CHECK(stats.duplicates > 0);
+	CHECK_EQ(stats.transactions, dumper.batches);
+	CHECK_EQ(dumper.oversized, 0);
+	CHECK_EQ(dumper.splitPairs, 0);
+
+	// Every hidden SET_COEF_INDEX and the final restore is sent, nothing else beyond the printed reads.
+	CHECK_EQ(dumper.codec.verbs.load() - 2, stats.reads + 0x80 + 1);
+	CHECK(stats.transactions <= (stats.reads + 0x80 + 1) / kMaxTransactionVerbs + 8);
+
+	// The output is sorted by nid, verb and param.
+	for (size_t i = 2; i < all.size(); i++)
+		CHECK(all[i - 1].compare(0, 18, all[i], 0, 18) < 0);
+
+	printf("dump: %zu nodes, %zu reads, %zu duplicates, %zu transactions, %.2f ms of link time\n",
+		stats.nodes, stats.reads, stats.duplicates, stats.transactions, dumper.codec.elapsed.load() / 1e6);
+}
+
+void testDeterministic() {
+	std::string first;
+	for (int run = 0; run < 2; run++) {
+		Dumper dumper;
+		dumper.codec.buildAlc283();
+		codec_dump_stats stats {};
+		auto text = dumper.dump(stats);
+		if (run == 0)
+			first = text;
+		else
+			CHECK(text == first);
+	}
+}
+
+void testErrors() {
+	// A rejected read is printed as an error and the rest of its batch is retried.
+	Dumper dumper;
+	dumper.codec.buildAlc283();
+	dumper.failNid = 0x14;
+	dumper.failVerb = HdaVerb::GetConfigDefault;
+	codec_dump_stats stats {};
+	auto all = lines(dumper.dump(stats));
+	CHECK(hasLine(all, "0x14 0xf1c 0x0000 error:e00002d6"));
+	CHECK(hasLine(all, "0x14 0xf07 0x0000 0x00000000"));
+	CHECK(hasLine(all, "0x17 0xf1c 0x0000 0x411111f0"));
+	CHECK_EQ(stats.failures, 1);
+
+	// A failed SET_COEF_INDEX fails its GET_PROC_COEF with the same status, later coefficients are read.
+	Dumper coefs;
+	coefs.codec.buildAlc283();
+	coefs.failNid = 0x20;
+	coefs.failVerb = HdaVerb::SetCoefIndex;
+	coefs.failParam = 0x10;
+	coefs.failStatus = kIOReturnBusy;
+	codec_dump_stats coefStats {};
+	all = lines(coefs.dump(coefStats));
+	CHECK(hasLine(all, "0x20 0xc00 0x0010 error:e00002d5"));
+	CHECK(hasLine(all, "0x20 0xc00 0x000f 0x0000800f"));
+	CHECK(hasLine(all, "0x20 0xc00 0x0011 0x00008011"));
+	CHECK_EQ(coefStats.failures, 2);
+	CHECK_EQ(coefs.splitPairs, 0);
+}
+
+}
+
+int main() {
+	testDump();
+	testDeterministic();
+	testErrors();
+	return testResult("codecdump_test");
+}
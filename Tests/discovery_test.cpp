@@ -0,0 +1,138 @@
+//
+//  discovery_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_registry.hpp"
+
+namespace {
+
+void testStore() {
+	Discovery discovery;
+	Discovery::Slot slots[2 * Discovery::MaxCodecAddresses];
+	discovery.reset(slots, 2, 100);
+	discovery.expect();
+	discovery.expect();
+
+	Node codecs[Discovery::MaxCodecAddresses + 4] {};
+	// Codecs land in their address slot, a taken or invalid address takes the first free one.
+	CHECK(discovery.store(0, &codecs[0], 2, 150) == Discovery::Result::Stored);
+	CHECK(discovery.store(0, &codecs[1], 2, 160) == Discovery::Result::Stored);
+	CHECK(discovery.store(0, &codecs[2], 99, 170) == Discovery::Result::Stored);
+	CHECK(discovery.get(0)[2].codec == &codecs[0]);
+	CHECK(discovery.get(0)[0].codec == &codecs[1]);
+	CHECK(discovery.get(0)[1].codec == &codecs[2]);
+	CHECK_EQ(discovery.get(0)[2].latency, 50);
+	CHECK_EQ(discovery.remaining(), 1);
+
+	// Repeated notifications are ignored.
+	CHECK(discovery.store(0, &codecs[0], 2, 180) == Discovery::Result::Ignored);
+
+	// The first codec of the last controller completes the wait, later ones do not.
+	CHECK(discovery.store(1, &codecs[3], 0, 200) == Discovery::Result::Completed);
+	CHECK(discovery.store(1, &codecs[4], 1, 210) == Discovery::Result::Stored);
+	CHECK_EQ(discovery.remaining(), 0);
+
+	// A full link ignores further codecs.
+	for (size_t i = 5; i < Discovery::MaxCodecAddresses + 3; i++)
+		CHECK(discovery.store(1, &codecs[i], static_cast<uint32_t>(i), 220) == Discovery::Result::Stored);
+	CHECK(discovery.store(1, &codecs[Discovery::MaxCodecAddresses + 3], 0, 230) == Discovery::Result::Ignored);
+
+	// Codecs are looked up through any number of intermediate entries.
+	Node controller {nullptr, 0}, bridge {&controller, 0}, codec {&bridge, 0}, other {nullptr, 0};
+	Node *detect[] {&other, &controller};
+	size_t index = 0;
+	auto parent = [](Node *node) { return node->parent; };
+	auto match = [&detect](Node *node, size_t &i) {
+		for (i = 0; i < arrsize(detect); i++)
+			if (detect[i] == node)
+				return true;
+		return false;
+	};
+	CHECK(Discovery::findController(&codec, parent, match, index));
+	CHECK_EQ(index, 1);
+	CHECK(!Discovery::findController(&controller, parent, match, index));
+}
+
+/**
+ *  Detection latency with codecs published before, during and never within the wait
+ */
+void testLatency() {
+	static constexpr uint64_t TimeoutMs = 100;
+	printf("%-36s %12s %12s\n", "scenario", "wait ms", "codecs");
+
+	// Everything published before discovery starts is reported at once.
+	{
+		SimRegistry registry;
+		Node pci[2] {}, codecs[] {{&pci[0], 0}, {&pci[0], 2}, {&pci[1], 0}};
+		for (auto &codec : codecs)
+			registry.publish(&codec);
+		Node *detect[] {&pci[0], &pci[1]};
+		SimDiscoverer discoverer;
+		auto elapsed = discoverer.run(registry, detect, arrsize(detect), TimeoutMs);
+		CHECK(elapsed < TimeoutMs * 1000000 / 2);
+		CHECK(discoverer.discovery.get(0)[0].codec == &codecs[0]);
+		CHECK(discoverer.discovery.get(0)[2].codec == &codecs[1]);
+		CHECK(discoverer.discovery.get(1)[0].codec == &codecs[2]);
+		printf("%-36s %12.3f %12u\n", "already published", elapsed / 1e6, 3);
+	}
+
+	// Controllers publishing at 30 and 20 ms are waited for together, not one after another.
+	{
+		SimRegistry registry;
+		Node pci[2] {}, bridge {&pci[1], 0}, codecs[] {{&pci[0], 0}, {&bridge, 1}};
+		registry.publishAfter(&codecs[0], 30);
+		registry.publishAfter(&codecs[1], 20);
+		Node *detect[] {&pci[0], &pci[1]};
+		SimDiscoverer discoverer;
+		auto elapsed = discoverer.run(registry, detect, arrsize(detect), TimeoutMs);
+		registry.join();
+		CHECK(elapsed >= 30 * 1000000ULL);
+		CHECK(elapsed < TimeoutMs * 1000000);
+		auto first = discoverer.discovery.get(0)[0];
+		auto second = discoverer.discovery.get(1)[1];
+		CHECK(first.codec == &codecs[0]);
+		CHECK(second.codec == &codecs[1]);
+		CHECK(second.latency < first.latency);
+		printf("%-36s %12.3f %12u\n", "published at 30 and 20 ms", elapsed / 1e6, 2);
+		printf("%-36s %12.3f %12.3f\n", "  detection latency ms", first.latency / 1e6, second.latency / 1e6);
+	}
+
+	// A controller that never publishes bounds the wait by the timeout, found codecs are kept.
+	{
+		SimRegistry registry;
+		Node pci[3] {}, codec {&pci[0], 0};
+		registry.publishAfter(&codec, 10);
+		Node *detect[] {&pci[0], &pci[1], nullptr};
+		SimDiscoverer discoverer;
+		auto elapsed = discoverer.run(registry, detect, arrsize(detect), TimeoutMs);
+		registry.join();
+		CHECK(elapsed >= TimeoutMs * 1000000);
+		CHECK_EQ(discoverer.discovery.remaining(), 1);
+		CHECK(discoverer.discovery.get(0)[0].codec == &codec);
+		CHECK(discoverer.discovery.get(1)[0].codec == nullptr);
+		printf("%-36s %12.3f %12u\n", "one controller never publishes", elapsed / 1e6, 1);
+	}
+
+	// Codecs published after the wait reach no handler.
+	{
+		SimRegistry registry;
+		Node pci {}, codec {&pci, 0};
+		Node *detect[] {&pci};
+		SimDiscoverer discoverer;
+		discoverer.run(registry, detect, arrsize(detect), 5);
+		registry.publish(&codec);
+		CHECK(discoverer.discovery.get(0)[0].codec == nullptr);
+	}
+}
+
+}
+
+int main() {
+	testStore();
+	testLatency();
+	return testResult("discovery_test");
+}
@@ -0,0 +1,169 @@
+//
+//  events_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+#include <kern_events.hpp>
+
+#include <memory>
+
+namespace {
+
+void buildCodec(SimCodec &codec) {
+	codec.buildAlc283();
+	// Internal speaker without jack detect, headphone and mic jacks.
+	codec.setRegister(0x14, 0xF1C, 0, 0x90170110);
+	codec.setRegister(0x21, 0xF1C, 0, 0x04211020);
+	codec.setRegister(0x19, 0xF1C, 0, 0x04A11030);
+	codec.captureDefaults();
+}
+
+void setAfgPower(SimCodec &codec, uint16_t state) {
+	codec.exec(SimCodec::Afg, 0x705, state, nullptr);
+}
+
+/**
+ *  Check that the queue holds the events with the given sequences at their slots
+ */
+void checkQueue(const ALCEventQueue &queue, uint64_t first, uint64_t last) {
+	CHECK_EQ(queue.head, last);
+	for (auto sequence = first; sequence <= last; sequence++)
+		CHECK_EQ(queue.events[(sequence - 1) % kALCEventQueueCapacity].sequence, sequence);
+}
+
+void testDiscoverAndPoll() {
+	SimCodec codec;
+	buildCodec(codec);
+	std::unique_ptr<ALCEventQueue> queue(new ALCEventQueue {});
+	EventMonitor monitor;
+
+	CHECK(monitor.discover(SimCodec::exec, &codec));
+	CHECK(monitor.isDiscovered());
+
+	// Two jacks and the GPIOs are published on the first full poll.
+	CHECK(monitor.poll(SimCodec::exec, &codec, queue.get(), true));
+	checkQueue(*queue, 1, 3);
+	CHECK_EQ(queue->events[0].nid, 0x19);
+	CHECK_EQ(queue->events[1].nid, 0x21);
+	CHECK_EQ(queue->events[2].type, kALCEventGpio);
+
+	// Nothing changed.
+	CHECK(!monitor.poll(SimCodec::exec, &codec, queue.get(), false));
+	CHECK_EQ(queue->head, 3);
+
+	codec.plug(0x21, true);
+	CHECK(monitor.poll(SimCodec::exec, &codec, queue.get(), false));
+	checkQueue(*queue, 1, 4);
+	CHECK_EQ(queue->events[3].nid, 0x21);
+	CHECK(HdaResponse::isPresent(queue->events[3].value));
+
+	codec.setRegister(SimCodec::Afg, 0xF15, 0, 0x2);
+	CHECK(monitor.poll(SimCodec::exec, &codec, queue.get(), false));
+	CHECK_EQ(queue->events[4].type, kALCEventGpio);
+	CHECK_EQ(queue->events[4].value, 0x2);
+}
+
+void testPowerDown() {
+	SimCodec codec;
+	buildCodec(codec);
+	std::unique_ptr<ALCEventQueue> queue(new ALCEventQueue {});
+	EventMonitor monitor;
+	CHECK(monitor.discover(SimCodec::exec, &codec));
+	CHECK(monitor.poll(SimCodec::exec, &codec, queue.get(), true));
+	CHECK_EQ(queue->head, 3);
+
+	// Only the power state is read in D3, and a requested full publish waits for D0.
+	setAfgPower(codec, 3);
+	codec.plug(0x19, true);
+	auto verbs = codec.verbs.load();
+	CHECK(!monitor.poll(SimCodec::exec, &codec, queue.get(), true));
+	CHECK_EQ(codec.verbs.load() - verbs, 1);
+	CHECK_EQ(monitor.skippedPolls(), 1);
+	CHECK_EQ(queue->head, 3);
+
+	setAfgPower(codec, 0);
+	CHECK(monitor.poll(SimCodec::exec, &codec, queue.get(), false));
+	checkQueue(*queue, 1, 6);
+	CHECK_EQ(queue->events[3].nid, 0x19);
+	CHECK(HdaResponse::isPresent(queue->events[3].value));
+}
+
+void testWrap() {
+	std::unique_ptr<ALCEventQueue> queue(new ALCEventQueue {});
+	const uint64_t total = kALCEventQueueCapacity * 2 + 17;
+	for (uint64_t i = 0; i < total; i++)
+		EventMonitor::publish(queue.get(), 0x21, kALCEventPinSense, static_cast<uint32_t>(i));
+	checkQueue(*queue, total - kALCEventQueueCapacity + 1, total);
+	CHECK_EQ(queue->events[(total - 1) % kALCEventQueueCapacity].value, total - 1);
+}
+
+void testInterval() {
+	CHECK_EQ(EventMonitor::clampInterval(0), EventMonitor::MinInterval);
+	CHECK_EQ(EventMonitor::clampInterval(250), 250);
+	CHECK_EQ(EventMonitor::clampInterval(UINT32_MAX), EventMonitor::MaxInterval);
+}
+
+/**
+ *  Link traffic of an hour with a watcher attached while the codec sleeps 80% of the time
+ */
+void testTraffic() {
+	static constexpr uint32_t Seconds = 3600;
+	static constexpr uint32_t AwakePercent = 20;
+
+	struct Policy {
+		const char *name;
+		uint32_t interval;
+		bool powerCheck;
+	};
+	const Policy policies[] {
+		{"100 ms, always polled", 100, false},
+		{"500 ms, skipped in D3", EventMonitor::DefaultInterval, true}
+	};
+
+	uint64_t verbs[arrsize(policies)] {};
+	for (size_t p = 0; p < arrsize(policies); p++) {
+		SimCodec codec;
+		buildCodec(codec);
+		std::unique_ptr<ALCEventQueue> queue(new ALCEventQueue {});
+		EventMonitor monitor;
+		CHECK(monitor.discover(SimCodec::exec, &codec));
+		auto start = codec.verbs.load();
+
+		uint32_t polls = Seconds * 1000 / policies[p].interval;
+		for (uint32_t i = 0; i < polls; i++) {
+			bool awake = (i * 100 / polls) < AwakePercent;
+			setAfgPower(codec, awake ? 0 : 3);
+			codec.verbs--;
+			if (policies[p].powerCheck) {
+				monitor.poll(SimCodec::exec, &codec, queue.get(), false);
+			} else {
+				// The previous monitor polled every source unconditionally.
+				setAfgPower(codec, 0);
+				codec.verbs--;
+				monitor.poll(SimCodec::exec, &codec, queue.get(), false);
+				codec.verbs--;
+			}
+		}
+		verbs[p] = codec.verbs.load() - start;
+		printf("%-28s %8llu verbs per hour, %6.2f s of link time\n", policies[p].name,
+			static_cast<unsigned long long>(verbs[p]), verbs[p] * codec.verbTime / 1e9);
+	}
+
+	CHECK(verbs[1] * 5 < verbs[0]);
+}
+
+}
+
+int main() {
+	testDiscoverAndPoll();
+	testPowerDown();
+	testWrap();
+	testInterval();
+	testTraffic();
+	return testResult("events_test");
+}
@@ -0,0 +1,190 @@
+//
+//  hdau_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_hdau.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+static constexpr uint32_t Nvidia = 0x10DE;
+
+/**
+ *  Replaceable HDAU ids in the order of AlcEnabler::nvidiaDeviceIdList
+ */
+const uint32_t ids[HdauIdAllocator::MaxIds] {
+	0x0E0A10DE, 0x0E0B10DE, 0x0E1B10DE, 0x0E1A10DE, 0x0BE510DE, 0x0BEB10DE, 0x0BE910DE, 0x0BEA10DE,
+	0x0E0910DE, 0x0BEE10DE, 0x0E0810DE, 0x0BE310DE, 0x0AC010DE, 0x0D9410DE, 0x0BE210DE, 0x0BE410DE
+};
+
+/**
+ *  HDMI audio function of a GPU, either natively supported with an id from the list or needing one
+ */
+struct Gpu {
+	uint16_t device;
+	bool native;
+
+	uint32_t id() const {
+		return static_cast<uint32_t>(device) << 16 | Nvidia;
+	}
+};
+
+/**
+ *  Allocate ids for a topology the way updateProperties and processControllers do
+ *
+ *  @return assigned id of every GPU, 0 for native ones and the ones left without an id
+ */
+std::vector<uint32_t> allocate(const std::vector<Gpu> &gpus, size_t *missing = nullptr, bool *overflow = nullptr) {
+	HdauIdAllocator allocator(ids, arrsize(ids));
+	for (auto &gpu : gpus)
+		if (gpu.native)
+			allocator.reserve(gpu.id());
+	for (auto &gpu : gpus)
+		if (!gpu.native)
+			allocator.request(gpu.id());
+
+	auto left = allocator.assign();
+	if (missing)
+		*missing = left;
+	if (overflow)
+		*overflow = allocator.overflowed();
+
+	std::vector<uint32_t> result;
+	for (auto &gpu : gpus) {
+		auto id = gpu.native ? nullptr : allocator.find(gpu.id());
+		result.push_back(id ? *id : 0);
+	}
+	return result;
+}
+
+/**
+ *  Render node with count GPUs of unsupported models cycled in order
+ */
+std::vector<Gpu> renderNode(size_t count, size_t models, uint16_t firstModel = 0x1E80) {
+	std::vector<Gpu> gpus;
+	for (size_t i = 0; i < count; i++)
+		gpus.push_back({static_cast<uint16_t>(firstModel + i % models), false});
+	return gpus;
+}
+
+void testSharedModels() {
+	// 64 GPUs of four models take four ids, GPUs of the same model share one.
+	auto gpus = renderNode(64, 4);
+	size_t missing = 0;
+	bool overflow = false;
+	auto assigned = allocate(gpus, &missing, &overflow);
+	CHECK_EQ(missing, 0);
+	CHECK(!overflow);
+	for (size_t i = 0; i < gpus.size(); i++) {
+		CHECK_EQ(assigned[i], ids[i % 4]);
+		CHECK(assigned[i] == assigned[i % 4]);
+	}
+}
+
+void testNativeReserved() {
+	// A natively supported GPU keeps its own id, the others skip it.
+	std::vector<Gpu> gpus {{0x1E84, false}, {0x0E0B, true}, {0x1E82, false}, {0x0E0A, true}, {0x1E84, false}};
+	auto assigned = allocate(gpus);
+	CHECK_EQ(assigned[0], ids[3]);
+	CHECK_EQ(assigned[1], 0);
+	CHECK_EQ(assigned[2], ids[2]);
+	CHECK_EQ(assigned[4], ids[3]);
+
+	// A native device outside of the list reserves nothing.
+	gpus = {{0x1234, true}, {0x1E82, false}};
+	assigned = allocate(gpus);
+	CHECK_EQ(assigned[1], ids[0]);
+}
+
+void testOrderIndependent() {
+	// The mapping only depends on the set of GPUs, not on the order they are found in.
+	auto gpus = renderNode(48, 12, 0x2200);
+	gpus.push_back({0x0E1B, true});
+	gpus.push_back({0x0BE5, true});
+	auto reference = allocate(gpus);
+	std::vector<std::pair<uint16_t, uint32_t>> expected;
+	for (size_t i = 0; i < gpus.size(); i++)
+		expected.emplace_back(gpus[i].device, reference[i]);
+
+	std::mt19937 rng(0x42);
+	for (size_t round = 0; round < 200; round++) {
+		std::shuffle(expected.begin(), expected.end(), rng);
+		std::vector<Gpu> shuffled;
+		for (auto &gpu : expected)
+			shuffled.push_back({gpu.first, gpu.first == 0x0E1B || gpu.first == 0x0BE5});
+		auto assigned = allocate(shuffled);
+		for (size_t i = 0; i < shuffled.size(); i++)
+			CHECK_EQ(assigned[i], expected[i].second);
+	}
+}
+
+void testPersistent() {
+	// Adding a GPU of an existing model or a model sorting after the others keeps every id.
+	auto gpus = renderNode(16, 3, 0x2400);
+	auto before = allocate(gpus);
+	gpus.push_back({0x2401, false});
+	gpus.push_back({0x2500, false});
+	auto after = allocate(gpus);
+	for (size_t i = 0; i < before.size(); i++)
+		CHECK_EQ(after[i], before[i]);
+	CHECK_EQ(after[16], before[1]);
+	CHECK_EQ(after[17], ids[3]);
+
+	// Removing GPUs of a model keeps the ids of lower models.
+	gpus = renderNode(16, 3, 0x2400);
+	gpus.erase(std::remove_if(gpus.begin(), gpus.end(), [](const Gpu &gpu) { return gpu.device == 0x2402; }), gpus.end());
+	after = allocate(gpus);
+	for (size_t i = 0; i < gpus.size(); i++)
+		CHECK_EQ(after[i], ids[gpus[i].device - 0x2400]);
+}
+
+void testOverflow() {
+	// More models than ids keep the lowest ones, the rest is reported.
+	auto gpus = renderNode(40, 20, 0x2000);
+	size_t missing = 0;
+	bool overflow = false;
+	auto assigned = allocate(gpus, &missing, &overflow);
+	CHECK(overflow);
+	CHECK_EQ(missing, 0);
+	for (size_t i = 0; i < gpus.size(); i++)
+		CHECK_EQ(assigned[i], i % 20 < HdauIdAllocator::MaxIds ? ids[i % 20] : 0);
+
+	// Reserved ids leave fewer for the kept models.
+	gpus = renderNode(16, 16, 0x2000);
+	gpus.push_back({0x0E0A, true});
+	gpus.push_back({0x0E0B, true});
+	assigned = allocate(gpus, &missing, &overflow);
+	CHECK(!overflow);
+	CHECK_EQ(missing, 2);
+	CHECK_EQ(assigned[0], ids[2]);
+	CHECK_EQ(assigned[13], ids[15]);
+	CHECK_EQ(assigned[14], 0);
+	CHECK_EQ(assigned[15], 0);
+
+	// A shorter list is never indexed past its end.
+	HdauIdAllocator small(ids, 2);
+	for (uint32_t device = 0x30; device > 0x20; device--)
+		small.request(device << 16 | Nvidia);
+	CHECK_EQ(small.assign(), HdauIdAllocator::MaxIds - 2);
+	CHECK(small.find(0x21 << 16 | Nvidia) != nullptr);
+	CHECK(small.find(0x23 << 16 | Nvidia) == nullptr);
+}
+
+}
+
+int main() {
+	testSharedModels();
+	testNativeReserved();
+	testOrderIndependent();
+	testPersistent();
+	testOverflow();
+	return testResult("hdau_test");
+}
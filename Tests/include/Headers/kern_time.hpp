@@ -0,0 +1,23 @@
+//
+//  kern_time.hpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_time_hpp
+#define kern_time_hpp
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ *  Host stand-in for Lilu getCurrentTimeNs
+ */
+inline uint64_t getCurrentTimeNs() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+#endif /* kern_time_hpp */
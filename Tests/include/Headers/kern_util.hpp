@@ -0,0 +1,60 @@
+//
+//  kern_util.hpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef kern_util_hpp
+#define kern_util_hpp
+
+#include <IOKit/IOReturn.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ *  Host stand-in for the parts of Lilu kern_util.hpp used by the kext helpers.
+ *  Logging goes to stderr only when ALC_TEST_VERBOSE is defined.
+ */
+#ifdef ALC_TEST_VERBOSE
+#define SYSLOG(module, str, ...) fprintf(stderr, module ": " str "\n", ##__VA_ARGS__)
+#define DBGLOG(module, str, ...) fprintf(stderr, module ": " str "\n", ##__VA_ARGS__)
+#else
+#define SYSLOG(module, str, ...) do { } while (0)
+#define DBGLOG(module, str, ...) do { } while (0)
+#endif
+
+#define SYSLOG_COND(cond, module, str, ...) do { if (cond) SYSLOG(module, str, ##__VA_ARGS__); } while (0)
+#define DBGLOG_COND(cond, module, str, ...) do { if (cond) DBGLOG(module, str, ##__VA_ARGS__); } while (0)
+
+template <typename T, size_t N>
+constexpr size_t arrsize(const T (&)[N]) {
+	return N;
+}
+
+template <typename T>
+constexpr T min(T a, T b) {
+	return a < b ? a : b;
+}
+
+template <typename T>
+constexpr T max(T a, T b) {
+	return a > b ? a : b;
+}
+
+#if defined(__GLIBC__) && (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+inline size_t strlcpy(char *dst, const char *src, size_t size) {
+	size_t len = strlen(src);
+	if (size > 0) {
+		size_t copy = len < size - 1 ? len : size - 1;
+		memcpy(dst, src, copy);
+		dst[copy] = '\0';
+	}
+	return len;
+}
+#endif
+
+#endif /* kern_util_hpp */
@@ -0,0 +1,30 @@
+//
+//  IOReturn.h
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef IOReturn_h
+#define IOReturn_h
+
+#include <stdint.h>
+
+/**
+ *  Host stand-in for the IOKit return codes used by the kext helpers
+ */
+typedef int IOReturn;
+
+#define kIOReturnSuccess     0
+#define kIOReturnError       ((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory    ((IOReturn)0xe00002bd)
+#define kIOReturnNoResources ((IOReturn)0xe00002be)
+#define kIOReturnBadArgument ((IOReturn)0xe00002c2)
+#define kIOReturnUnsupported ((IOReturn)0xe00002c7)
+#define kIOReturnIOError     ((IOReturn)0xe00002ca)
+#define kIOReturnBusy        ((IOReturn)0xe00002d5)
+#define kIOReturnTimeout     ((IOReturn)0xe00002d6)
+#define kIOReturnNotReady    ((IOReturn)0xe00002d8)
+#define kIOReturnAborted     ((IOReturn)0xe00002eb)
+
+#endif /* IOReturn_h */
@@ -0,0 +1,149 @@
+//
+//  multicodec_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_registry.hpp"
+
+#include <kern_arena.hpp>
+#include <kern_routing.hpp>
+
+#include <algorithm>
+#include <random>
+
+namespace {
+
+/**
+ *  Stand-in for AlcEnabler::CodecInfo
+ */
+struct Codec {
+	size_t controller;
+	uint32_t address;
+	Node *device;
+};
+
+/**
+ *  Stand-in for AlcEnabler::ControllerInfo
+ */
+struct Controller {
+	Node *detect;
+	uint32_t layout;
+};
+
+/**
+ *  Workstation with two analog controllers, two codecs on the first link, one codec
+ *  behind a bridge on the second and GPU HDMI audio without detectible codecs.
+ *  Every codec has an AppleHDACodecGeneric with an AppleHDADriver below it.
+ */
+struct Workstation {
+	Node root {nullptr, 0};
+	Node hdef0 {&root, 0}, hdef1 {&root, 0}, bridge {&hdef1, 0}, hdau {&root, 0};
+	Node codecs[3] {{&hdef0, 2}, {&hdef0, 0}, {&bridge, 0}};
+	Node generic[3] {{&codecs[0], 0}, {&codecs[1], 0}, {&codecs[2], 0}};
+	Node drivers[3] {{&generic[0], 0}, {&generic[1], 0}, {&generic[2], 0}};
+	Controller controllers[3] {{&hdef0, 0}, {&hdef1, 11}, {nullptr, 0}};
+	Node *detect[3] {&hdef0, &hdef1, nullptr};
+
+	/**
+	 *  Discover the codecs and append them in controller and address order like grabCodecs
+	 */
+	void grab(SimRegistry &registry, ArenaVector<Codec, 8> &found) {
+		SimDiscoverer discoverer;
+		discoverer.run(registry, detect, arrsize(detect), 200);
+		for (size_t i = 0; i < arrsize(controllers); i++) {
+			// Codecs attached to the same link but not yet published are picked up as its children.
+			auto slots = discoverer.discovery.get(i);
+			Node *parent = nullptr;
+			for (size_t a = 0; a < Discovery::MaxCodecAddresses && !parent; a++)
+				if (slots[a].codec)
+					parent = slots[a].codec->parent;
+			for (auto &codec : codecs)
+				if (parent && codec.parent == parent)
+					discoverer.discovery.store(i, &codec, codec.address, getCurrentTimeNs());
+
+			for (size_t a = 0; a < Discovery::MaxCodecAddresses; a++)
+				if (slots[a].codec)
+					found.push_back({i, slots[a].codec->address, slots[a].codec});
+		}
+	}
+};
+
+void testEnumeration() {
+	// Every codec address of every controller is found whatever order they are published in.
+	Workstation ws;
+	std::mt19937 rng(0x43);
+	for (size_t round = 0; round < 20; round++) {
+		Node *order[] {&ws.codecs[0], &ws.codecs[1], &ws.codecs[2]};
+		std::shuffle(std::begin(order), std::end(order), rng);
+
+		SimRegistry registry;
+		// Some codecs are there before discovery starts, the others show up while it waits.
+		registry.publish(order[0]);
+		registry.publishAfter(order[1], 2);
+		registry.publishAfter(order[2], 4);
+
+		// The wait ends with the first codec of each controller, a later one on the same link is still found.
+		ArenaVector<Codec, 8> found;
+		ws.grab(registry, found);
+		registry.join();
+
+		CHECK_EQ(found.size(), 3);
+		if (found.size() != 3)
+			return;
+		CHECK(found[0]->device == &ws.codecs[1]);
+		CHECK(found[1]->device == &ws.codecs[0]);
+		CHECK(found[2]->device == &ws.codecs[2]);
+		CHECK_EQ(found[0]->controller, 0);
+		CHECK_EQ(found[1]->controller, 0);
+		CHECK_EQ(found[2]->controller, 1);
+		CHECK_EQ(found[1]->address, 2);
+	}
+}
+
+void testRouting() {
+	Workstation ws;
+	SimRegistry registry;
+	for (auto &codec : ws.codecs)
+		registry.publish(&codec);
+	ArenaVector<Codec, 8> codecs;
+	ws.grab(registry, codecs);
+	CHECK_EQ(codecs.size(), 3);
+	if (codecs.size() != 3)
+		return;
+
+	// Pin configs and wake verbs go to the codec an AppleHDACodecGeneric instance is attached to.
+	for (size_t i = 0; i < arrsize(ws.codecs); i++) {
+		auto index = CodecRouting::findService(codecs, &ws.generic[i], Node::parentOf);
+		CHECK(index < codecs.size() && codecs[index]->device == &ws.codecs[i]);
+		CHECK_EQ(CodecRouting::findService(codecs, &ws.codecs[i], Node::parentOf), index);
+	}
+	CHECK_EQ(CodecRouting::findService(codecs, &ws.hdau, Node::parentOf), codecs.size());
+
+	// Layout and platform requests go to the codec of the requesting AppleHDADriver.
+	auto contains = [](Node *device, const void *driver) { return device->contains(driver); };
+	for (size_t i = 0; i < arrsize(ws.codecs); i++) {
+		auto index = CodecRouting::findDriver(codecs, &ws.drivers[i], contains);
+		CHECK(index < codecs.size() && codecs[index]->device == &ws.codecs[i]);
+	}
+	Node stray {&ws.hdau, 0};
+	CHECK_EQ(CodecRouting::findDriver(codecs, &stray, contains), codecs.size());
+	CHECK_EQ(CodecRouting::findDriver(codecs, nullptr, contains), codecs.size());
+
+	// An unknown requester falls back to the first codec on a controller with a layout.
+	auto hasLayout = [&ws](const Codec *codec) { return ws.controllers[codec->controller].layout > 0; };
+	auto index = CodecRouting::firstWithLayout(codecs, hasLayout);
+	CHECK(index < codecs.size() && codecs[index]->device == &ws.codecs[2]);
+	ws.controllers[1].layout = 0;
+	CHECK_EQ(CodecRouting::firstWithLayout(codecs, hasLayout), codecs.size());
+}
+
+}
+
+int main() {
+	testEnumeration();
+	testRouting();
+	return testResult("multicodec_test");
+}
@@ -0,0 +1,158 @@
+//
+//  override_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_override.hpp>
+
+#include <string.h>
+
+namespace {
+
+constexpr uint32_t Codec = 0x10EC0283;
+
+/**
+ *  Header of an empty zlib stream with default compression, padded to the minimum size
+ */
+const uint8_t emptyStream[] {0x78, 0x9C, 0x03, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+void testValidate() {
+	CHECK(ResourceOverrides::validHeader(emptyStream, sizeof(emptyStream), 1));
+	CHECK(ResourceOverrides::validHeader(emptyStream, kALCResourceMaxSize, kALCResourceMaxUnpackedSize));
+
+	// Sizes outside of the limits.
+	CHECK(!ResourceOverrides::validHeader(nullptr, sizeof(emptyStream), 1));
+	CHECK(!ResourceOverrides::validHeader(emptyStream, 6, 1));
+	CHECK(!ResourceOverrides::validHeader(emptyStream, kALCResourceMaxSize + 1, 1));
+	CHECK(!ResourceOverrides::validHeader(emptyStream, sizeof(emptyStream), 0));
+	CHECK(!ResourceOverrides::validHeader(emptyStream, sizeof(emptyStream), kALCResourceMaxUnpackedSize + 1));
+
+	// Headers other than a plain deflate stream.
+	struct {
+		uint8_t cmf;
+		uint8_t flg;
+		bool valid;
+	} headers[] {
+		{0x78, 0x01, true},   // Fastest compression
+		{0x78, 0x9D, false},  // Header checksum
+		{0x79, 0x9C, false},  // Compression method
+		{0x88, 0x1C, false},  // Window size
+		{0x78, 0xBB, false}   // Preset dictionary
+	};
+	for (auto &header : headers) {
+		uint8_t data[sizeof(emptyStream)];
+		memcpy(data, emptyStream, sizeof(data));
+		data[0] = header.cmf;
+		data[1] = header.flg;
+		CHECK_EQ(ResourceOverrides::validHeader(data, sizeof(data), 1), header.valid);
+	}
+}
+
+void testLookup() {
+	ResourceOverrides overrides;
+	uint8_t buffers[ResourceOverrides::MaxOverrides + 2][1] {};
+	const uint8_t *released = nullptr;
+
+	CHECK(overrides.find(kALCResourceLayout, Codec, 11) == nullptr);
+	CHECK(overrides.install({kALCResourceLayout, Codec, 11, buffers[0], 1}, released));
+	CHECK(released == nullptr);
+	CHECK(overrides.install({kALCResourcePlatform, Codec, 11, buffers[1], 1}, released));
+
+	// Files differ by type, codec and layout.
+	auto layout = overrides.find(kALCResourceLayout, Codec, 11);
+	CHECK(layout != nullptr && layout->data == buffers[0]);
+	auto platform = overrides.find(kALCResourcePlatform, Codec, 11);
+	CHECK(platform != nullptr && platform->data == buffers[1]);
+	CHECK(overrides.find(kALCResourceLayout, Codec, 12) == nullptr);
+	CHECK(overrides.find(kALCResourceLayout, 0x10EC0282, 11) == nullptr);
+
+	// Replacing hands back the previous buffer.
+	CHECK(overrides.install({kALCResourceLayout, Codec, 11, buffers[2], 1}, released));
+	CHECK(released == buffers[0]);
+	CHECK_EQ(overrides.size(), 2);
+	CHECK(overrides.find(kALCResourceLayout, Codec, 11)->data == buffers[2]);
+
+	// A full table rejects new keys and still replaces existing ones.
+	for (uint32_t l = 1; overrides.size() < ResourceOverrides::MaxOverrides; l++)
+		CHECK(overrides.install({kALCResourceLayout, Codec, l, buffers[3], 1}, released));
+	CHECK(!overrides.install({kALCResourceLayout, Codec, 99, buffers[4], 1}, released));
+	CHECK(overrides.find(kALCResourceLayout, Codec, 99) == nullptr);
+	CHECK(overrides.install({kALCResourcePlatform, Codec, 11, buffers[4], 1}, released));
+	CHECK(released == buffers[1]);
+
+	// Removal keeps the other files reachable.
+	CHECK(overrides.remove(kALCResourceLayout, Codec, 11, released));
+	CHECK(released == buffers[2]);
+	CHECK(!overrides.remove(kALCResourceLayout, Codec, 11, released));
+	CHECK(released == nullptr);
+	CHECK_EQ(overrides.size(), ResourceOverrides::MaxOverrides - 1);
+	CHECK(overrides.find(kALCResourcePlatform, Codec, 11)->data == buffers[4]);
+	for (size_t i = 0; i < overrides.size(); i++)
+		CHECK(overrides.find(overrides[i].type, overrides[i].codec, overrides[i].layout) == &overrides[i]);
+}
+
+void testRetire() {
+	ResourceOverrides overrides;
+	uint8_t buffers[ResourceOverrides::MaxOverrides + 2][1] {};
+	const uint8_t *released = nullptr;
+	const uint8_t *freed[ResourceOverrides::MaxOverrides] {};
+
+	CHECK(overrides.install({kALCResourceLayout, Codec, 1, buffers[0], 1}, released));
+	CHECK(overrides.install({kALCResourceLayout, Codec, 2, buffers[1], 1}, released));
+
+	// Buffers replaced during a request are held until the last request ends.
+	overrides.enter();
+	overrides.enter();
+	CHECK(overrides.install({kALCResourceLayout, Codec, 1, buffers[2], 1}, released));
+	CHECK(released == nullptr);
+	CHECK(overrides.remove(kALCResourceLayout, Codec, 2, released));
+	CHECK(released == nullptr);
+	CHECK_EQ(overrides.leave(freed), 0);
+	CHECK_EQ(overrides.leave(freed), 2);
+	CHECK(freed[0] == buffers[0] && freed[1] == buffers[1]);
+	CHECK_EQ(overrides.leave(freed), 0);
+
+	// Once the held buffers fill up replacing fails and keeps the file.
+	overrides.enter();
+	for (size_t i = 0; i < ResourceOverrides::MaxOverrides; i++)
+		CHECK(overrides.install({kALCResourceLayout, Codec, 1, buffers[i % 2], 1}, released));
+	CHECK(!overrides.install({kALCResourceLayout, Codec, 1, buffers[9], 1}, released));
+	CHECK(overrides.find(kALCResourceLayout, Codec, 1)->data == buffers[(ResourceOverrides::MaxOverrides - 1) % 2]);
+	CHECK_EQ(overrides.leave(freed), ResourceOverrides::MaxOverrides);
+	CHECK(freed[0] == buffers[2]);
+}
+
+void testReload() {
+	ResourceOverrides overrides;
+	size_t pending[ResourceOverrides::MaxOverrides] {};
+	CHECK_EQ(overrides.takeReloads(pending), 0);
+
+	// Repeated uploads of one codec restart its drivers once.
+	CHECK(overrides.queueReload(3));
+	CHECK(overrides.queueReload(0));
+	CHECK(overrides.queueReload(3));
+	CHECK_EQ(overrides.takeReloads(pending), 2);
+	CHECK(pending[0] == 3 && pending[1] == 0);
+	CHECK_EQ(overrides.takeReloads(pending), 0);
+
+	for (size_t i = 0; i < ResourceOverrides::MaxOverrides; i++)
+		CHECK(overrides.queueReload(i));
+	CHECK(overrides.queueReload(0));
+	CHECK(!overrides.queueReload(ResourceOverrides::MaxOverrides));
+	CHECK_EQ(overrides.takeReloads(pending), ResourceOverrides::MaxOverrides);
+	CHECK(overrides.queueReload(ResourceOverrides::MaxOverrides));
+}
+
+}
+
+int main() {
+	testValidate();
+	testLookup();
+	testRetire();
+	testReload();
+	return testResult("override_test");
+}
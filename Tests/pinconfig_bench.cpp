@@ -0,0 +1,117 @@
+//
+//  pinconfig_bench.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_pinconfig.hpp>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+static constexpr size_t Iterations = 200000;
+
+/**
+ *  Stand-in for an HDAConfigDefault OSDictionary, lookups go through a string-keyed map
+ *  just like OSDictionary::getObject compares OSSymbols
+ */
+using ConfigDict = std::map<std::string, uint32_t>;
+
+/**
+ *  HDAConfigDefault of a merged PinConfigs.kext with the matching generated table.
+ *  Entries are spread over codecs the way alc-pinconfig merge writes them, not sorted.
+ */
+struct PinConfigs {
+	std::vector<std::unique_ptr<ConfigDict>> configList;
+	std::vector<PinConfigEntry> table;
+
+	explicit PinConfigs(size_t num) {
+		for (size_t i = 0; i < num; i++) {
+			auto codec = 0x10EC0000U | static_cast<uint32_t>((i * 7919) % 512);
+			auto layout = static_cast<uint32_t>(i / 512 + 1);
+			configList.emplace_back(new ConfigDict {{"CodecID", codec}, {"LayoutID", layout}, {"WakeVerbReinit", 0}});
+			table.push_back({codec, layout, i, 0});
+		}
+
+		std::sort(table.begin(), table.end(), [](const PinConfigEntry &a, const PinConfigEntry &b) {
+			return a.codec < b.codec || (a.codec == b.codec && a.layout < b.layout);
+		});
+	}
+
+	/**
+	 *  Previous initializePinConfig lookup walking every dictionary
+	 */
+	const ConfigDict *linear(uint32_t codec, uint32_t layout) const {
+		for (auto &config : configList) {
+			auto currCodec = config->find("CodecID");
+			auto currLayout = config->find("LayoutID");
+			if (currCodec != config->end() && currLayout != config->end() &&
+				currCodec->second == codec && currLayout->second == layout)
+				return config.get();
+		}
+		return nullptr;
+	}
+
+	/**
+	 *  Table lookup followed by the entry check done in findPinConfig
+	 */
+	const ConfigDict *indexed(uint32_t codec, uint32_t layout) const {
+		auto entry = PinConfigEntry::find(table.data(), table.size(), codec, layout);
+		if (!entry)
+			return nullptr;
+		auto &config = configList[entry->index];
+		auto currCodec = config->find("CodecID");
+		auto currLayout = config->find("LayoutID");
+		if (currCodec != config->end() && currLayout != config->end() &&
+			currCodec->second == codec && currLayout->second == layout)
+			return config.get();
+		return nullptr;
+	}
+};
+
+void bench(size_t num) {
+	PinConfigs configs(num);
+
+	// Both lookups must agree before timing them.
+	for (auto &entry : configs.table)
+		CHECK(configs.indexed(entry.codec, entry.layout) == configs.linear(entry.codec, entry.layout));
+	CHECK(configs.indexed(0x10EC0000, 0xFFFF) == nullptr);
+
+	// The linear walk is slow enough to need fewer rounds on the larger tables.
+	size_t linearIterations = Iterations / num * 16;
+	auto start = getCurrentTimeNs();
+	for (size_t i = 0; i < linearIterations; i++) {
+		auto &entry = configs.table[(i * 31) % num];
+		benchKeep(configs.linear(entry.codec, entry.layout));
+	}
+	auto linear = getCurrentTimeNs() - start;
+
+	start = getCurrentTimeNs();
+	for (size_t i = 0; i < Iterations; i++) {
+		auto &entry = configs.table[(i * 31) % num];
+		benchKeep(configs.indexed(entry.codec, entry.layout));
+	}
+	auto indexed = getCurrentTimeNs() - start;
+
+	char name[64];
+	snprintf(name, sizeof(name), "linear, %zu entries", num);
+	benchReport(name, linearIterations, linear);
+	snprintf(name, sizeof(name), "indexed, %zu entries", num);
+	benchReport(name, Iterations, indexed);
+}
+
+}
+
+int main() {
+	for (size_t num : {256, 1024, 4096})
+		bench(num);
+	return testResult("pinconfig_bench");
+}
@@ -0,0 +1,163 @@
+//
+//  ready_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_hda.hpp>
+#include <kern_ready.hpp>
+
+#include <random>
+
+namespace {
+
+/**
+ *  Fake clock advanced by the sleep callback
+ */
+uint32_t clockMs {0};
+
+void fakeSleep(uint32_t ms) {
+	clockMs += ms;
+}
+
+/**
+ *  Simulated HDA controller: config space answers once powered, GCTL leaves reset
+ *  and codecs show up in STATESTS at their own times
+ */
+struct SimController {
+	uint32_t poweredAt;
+	uint32_t outOfResetAt;
+	uint32_t codecAt;
+
+	uint32_t gctl() const {
+		if (clockMs < poweredAt)
+			return 0xFFFFFFFF;
+		return clockMs >= outOfResetAt ? HdaRegister::ControllerReset : 0;
+	}
+
+	uint16_t statests() const {
+		if (clockMs < poweredAt)
+			return 0xFFFF;
+		return clockMs >= codecAt ? 0x0001 : 0;
+	}
+
+	uint32_t readyAt() const {
+		auto ready = poweredAt > outOfResetAt ? poweredAt : outOfResetAt;
+		return ready > codecAt ? ready : codecAt;
+	}
+
+	static bool probe(void *ctx) {
+		auto that = static_cast<SimController *>(ctx);
+		return HdaRegister::linkReady(that->gctl(), that->statests());
+	}
+};
+
+/**
+ *  Device showing the firmware link state until it drops at lostAt and comes back at readyAt
+ */
+struct FlappingDevice {
+	uint32_t lostAt;
+	uint32_t readyAt;
+
+	static bool probe(void *ctx) {
+		auto that = static_cast<FlappingDevice *>(ctx);
+		return clockMs < that->lostAt || clockMs >= that->readyAt;
+	}
+};
+
+void testLinkReady() {
+	CHECK(HdaRegister::linkReady(HdaRegister::ControllerReset, 0x0001));
+	CHECK(HdaRegister::linkReady(HdaRegister::ControllerReset | 0x100, 0x4000));
+	// Powered down devices read as all ones.
+	CHECK(!HdaRegister::linkReady(0xFFFFFFFF, 0xFFFF));
+	CHECK(!HdaRegister::linkReady(0, 0x0001));
+	CHECK(!HdaRegister::linkReady(HdaRegister::ControllerReset, 0));
+	CHECK(!HdaRegister::linkReady(HdaRegister::ControllerReset, 0x8000));
+}
+
+void testFloor() {
+	// A device ready from the start is still waited for until the floor.
+	FlappingDevice ready {0, 0};
+	clockMs = 0;
+	auto result = ReadinessWait::wait(FlappingDevice::probe, &ready, 500, 1000, fakeSleep);
+	CHECK(result.ready);
+	CHECK_EQ(result.waited, 500);
+	CHECK_EQ(clockMs, 500);
+	CHECK_EQ(result.polls, 2);
+
+	// A link seen before the floor that goes down meanwhile is polled until it is back.
+	FlappingDevice flapping {100, 700};
+	clockMs = 0;
+	result = ReadinessWait::wait(FlappingDevice::probe, &flapping, 500, 1000, fakeSleep);
+	CHECK(result.ready);
+	CHECK(result.waited >= 700);
+	CHECK(result.waited < 700 + ReadinessWait::MaxInterval);
+
+	// A link that never comes back waits the ceiling.
+	FlappingDevice lost {100, 5000};
+	clockMs = 0;
+	result = ReadinessWait::wait(FlappingDevice::probe, &lost, 500, 1000, fakeSleep);
+	CHECK(!result.ready);
+	CHECK_EQ(result.waited, 1000);
+
+	// A floor past the ceiling is cut to the ceiling, no floor means no wait for a ready device.
+	clockMs = 0;
+	result = ReadinessWait::wait(FlappingDevice::probe, &ready, 2000, 1000, fakeSleep);
+	CHECK_EQ(result.waited, 1000);
+	clockMs = 0;
+	result = ReadinessWait::wait(FlappingDevice::probe, &ready, 0, 1000, fakeSleep);
+	CHECK_EQ(result.waited, 0);
+	CHECK_EQ(result.polls, 1);
+}
+
+/**
+ *  Controllers getting ready at random times up to past the ceiling: the wait must end
+ *  within one backoff step after both the floor and the ready time, never past the ceiling
+ */
+void testRandomDevices() {
+	static constexpr size_t Devices = 20000;
+	static constexpr uint32_t Ceiling = 3000;
+	static constexpr uint32_t Floor = Ceiling / 2;
+	std::mt19937 rng(0x40);
+	std::uniform_int_distribution<uint32_t> when(0, 3500);
+
+	uint64_t total = 0;
+	uint32_t maxOvershoot = 0;
+	size_t readyCount = 0;
+	for (size_t i = 0; i < Devices; i++) {
+		SimController controller {when(rng) / 4, when(rng) / 2, when(rng)};
+		clockMs = 0;
+		auto result = ReadinessWait::wait(SimController::probe, &controller, Floor, Ceiling, fakeSleep);
+		auto expected = controller.readyAt() > Floor ? controller.readyAt() : Floor;
+
+		CHECK_EQ(result.waited, clockMs);
+		CHECK(result.waited <= Ceiling);
+		if (controller.readyAt() <= Ceiling) {
+			CHECK(result.ready);
+			CHECK(result.waited >= expected);
+			CHECK(result.waited < expected + ReadinessWait::MaxInterval);
+			if (result.waited - expected > maxOvershoot)
+				maxOvershoot = result.waited - expected;
+			readyCount++;
+		} else {
+			CHECK(!result.ready);
+			CHECK_EQ(result.waited, Ceiling);
+		}
+		total += result.waited;
+	}
+
+	printf("readiness: %zu devices, %zu ready, %llu ms average wait of %u ms, %u ms largest overshoot\n", Devices,
+		readyCount, static_cast<unsigned long long>(total / Devices), Ceiling, maxOvershoot);
+}
+
+}
+
+int main() {
+	testLinkReady();
+	testFloor();
+	testRandomDevices();
+	return testResult("ready_test");
+}
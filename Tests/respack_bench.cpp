@@ -0,0 +1,164 @@
+//
+//  respack_bench.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <respack.h>
+
+#include <stdlib.h>
+
+#include <vector>
+
+namespace {
+
+static constexpr size_t Lookups = 1000000;
+static constexpr size_t Layouts = 4;
+static constexpr uint32_t Kernel = 20;
+
+uint32_t nextRandom(uint32_t &state) {
+	state = state * 1103515245U + 12345U;
+	return state >> 8;
+}
+
+/**
+ *  Stand-in for the compiled-in CodecModInfo tables searched by updateResource
+ */
+struct CodecFiles {
+	struct File {
+		const uint8_t *data;
+		uint32_t size;
+		uint32_t layout;
+		uint32_t minKernel;
+		uint32_t maxKernel;
+	};
+
+	uint32_t codec;
+	std::vector<File> layouts;
+	std::vector<File> platforms;
+};
+
+/**
+ *  Pack of layout and platform files for a number of codecs with the same files as compiled-in tables.
+ *  Every other layout has a second file for newer kernels.
+ */
+struct Pack {
+	std::vector<std::vector<uint8_t>> files;
+	std::vector<CodecFiles> codecs;
+	uint8_t *image {nullptr};
+	size_t size {0};
+
+	explicit Pack(size_t num) {
+		auto writer = respack_writer_create(1);
+		uint32_t seed = 1;
+		bool ok = writer != nullptr;
+		for (size_t c = 0; c < num && ok; c++) {
+			CodecFiles codec {0x10EC0000U | static_cast<uint32_t>(c), {}, {}};
+			for (uint32_t l = 1; l <= Layouts && ok; l++) {
+				for (uint32_t variant = 0; variant < (l % 2 ? 2U : 1U) && ok; variant++) {
+					uint32_t minKernel = variant ? 19 : 0, maxKernel = variant ? 0 : (l % 2 ? 18 : 0);
+					for (uint32_t kind : {RESPACK_LAYOUT, RESPACK_PLATFORM}) {
+						std::vector<uint8_t> file(256 + nextRandom(seed) % 1792);
+						for (auto &byte : file)
+							byte = static_cast<uint8_t>(nextRandom(seed));
+						ok = respack_writer_add(writer, kind, codec.codec, l, minKernel, maxKernel, file.data(), file.size());
+						files.push_back(std::move(file));
+						auto &list = kind == RESPACK_LAYOUT ? codec.layouts : codec.platforms;
+						list.push_back({files.back().data(), static_cast<uint32_t>(files.back().size()), l, minKernel, maxKernel});
+					}
+				}
+			}
+			codecs.push_back(std::move(codec));
+		}
+
+		image = ok ? respack_writer_finish(writer, 0x1234, &size) : nullptr;
+		respack_writer_free(writer);
+	}
+
+	~Pack() {
+		free(image);
+	}
+
+	/**
+	 *  updateResource lookup over the compiled-in tables
+	 */
+	const CodecFiles::File *linear(uint32_t kind, uint32_t codec, uint32_t layout) const {
+		for (auto &info : codecs) {
+			if (info.codec != codec)
+				continue;
+			for (auto &file : kind == RESPACK_LAYOUT ? info.layouts : info.platforms)
+				if (file.layout == layout && (file.minKernel == 0 || Kernel >= file.minKernel) &&
+					(file.maxKernel == 0 || Kernel <= file.maxKernel))
+					return &file;
+		}
+		return nullptr;
+	}
+};
+
+void bench(size_t num) {
+	Pack source(num);
+	CHECK(source.image != nullptr);
+	if (!source.image)
+		return;
+
+	// Verification reads every byte once, it happens a single time per boot.
+	respack pack;
+	size_t opens = 8;
+	auto start = getCurrentTimeNs();
+	for (size_t i = 0; i < opens; i++)
+		CHECK_EQ(respack_open(&pack, source.image, source.size), RESPACK_OK);
+	auto opened = getCurrentTimeNs() - start;
+
+	// Both lookups must return the same file before timing them.
+	for (auto &info : source.codecs) {
+		for (uint32_t l = 1; l <= Layouts + 1; l++) {
+			for (uint32_t kind : {RESPACK_LAYOUT, RESPACK_PLATFORM}) {
+				auto entry = respack_find(&pack, kind, info.codec, l, Kernel);
+				auto file = source.linear(kind, info.codec, l);
+				CHECK_EQ(entry != nullptr, file != nullptr);
+				if (entry && file)
+					CHECK(entry->size == file->size && memcmp(respack_blob(&pack, entry), file->data, file->size) == 0);
+			}
+		}
+	}
+
+	// One lookup in eight asks for a codec the pack does not have.
+	std::vector<uint32_t> keys(1024);
+	uint32_t seed = 7;
+	for (auto &key : keys)
+		key = static_cast<uint32_t>(nextRandom(seed) % (num + num / 8 + 1)) << 8 | (1 + nextRandom(seed) % Layouts);
+
+	size_t linearLookups = Lookups / num;
+	start = getCurrentTimeNs();
+	for (size_t i = 0; i < linearLookups; i++) {
+		auto key = keys[i % keys.size()];
+		benchKeep(source.linear(RESPACK_LAYOUT, 0x10EC0000U | key >> 8, key & 0xFF));
+	}
+	auto linear = getCurrentTimeNs() - start;
+
+	start = getCurrentTimeNs();
+	for (size_t i = 0; i < Lookups; i++) {
+		auto key = keys[i % keys.size()];
+		benchKeep(respack_find(&pack, RESPACK_LAYOUT, 0x10EC0000U | key >> 8, key & 0xFF, Kernel));
+	}
+	auto indexed = getCurrentTimeNs() - start;
+
+	char name[64];
+	snprintf(name, sizeof(name), "open, %u entries, %zu KB", pack.header->entry_count, source.size / 1024);
+	benchReport(name, opens, opened);
+	snprintf(name, sizeof(name), "compiled-in scan, %zu codecs", num);
+	benchReport(name, linearLookups, linear);
+	snprintf(name, sizeof(name), "pack find, %zu codecs", num);
+	benchReport(name, Lookups, indexed);
+}
+
+}
+
+int main() {
+	for (size_t num : {64, 512, 2048})
+		bench(num);
+	return testResult("respack_bench");
+}
@@ -0,0 +1,127 @@
+//
+//  retry_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+#include <kern_retry.hpp>
+
+namespace {
+
+/**
+ *  Simulated clock advanced by the sleep callback in milliseconds
+ */
+uint32_t clockMs;
+
+void fakeSleep(uint32_t ms) {
+	clockMs += ms;
+}
+
+/**
+ *  Codec rejecting stream formats until readyAt milliseconds after the start
+ */
+struct SlowCodec {
+	SimCodec codec;
+	uint32_t readyAt;
+
+	static IOReturn exec(void *ctx, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+		auto that = static_cast<SlowCodec *>(ctx);
+		that->codec.formatBusy = verb == HdaVerb::SetStreamFormat && clockMs < that->readyAt ? 1 : 0;
+		return that->codec.exec(nid, verb, param, response);
+	}
+};
+
+void testImmediate() {
+	SimCodec codec;
+	clockMs = 0;
+	uint32_t response = 0;
+	auto result = StreamFormatRetry::setFormat(SimCodec::exec, &codec, 0x02, 0x4011, &response, fakeSleep);
+	CHECK_EQ(result.status, kIOReturnSuccess);
+	CHECK_EQ(result.retries, 0);
+	CHECK_EQ(clockMs, 0);
+	// A successful SET_STREAM_FORMAT is not read back.
+	CHECK_EQ(codec.verbs.load(), 1);
+	CHECK_EQ(codec.peek(0x02, HdaVerb::GetStreamFormat), 0x4011);
+}
+
+void testLostResponse() {
+	SimCodec codec;
+	codec.formatLostResponse = 1;
+	clockMs = 0;
+	uint32_t response = 0;
+	auto result = StreamFormatRetry::setFormat(SimCodec::exec, &codec, 0x02, 0x4011, &response, fakeSleep);
+	CHECK_EQ(result.status, kIOReturnSuccess);
+	CHECK_EQ(result.retries, 0);
+	CHECK_EQ(codec.verbs.load(), 2);
+}
+
+void testBusy() {
+	SimCodec codec;
+	codec.formatBusy = 5;
+	clockMs = 0;
+	uint32_t response = 0;
+	auto result = StreamFormatRetry::setFormat(SimCodec::exec, &codec, 0x03, 0x11, &response, fakeSleep);
+	CHECK_EQ(result.status, kIOReturnSuccess);
+	CHECK_EQ(result.retries, 5);
+	CHECK_EQ(result.slept, 1 + 2 + 4 + 8 + 16);
+	CHECK_EQ(clockMs, result.slept);
+	CHECK_EQ(codec.verbs.load(), 5 * 2 + 1);
+}
+
+void testBudget() {
+	SimCodec codec;
+	codec.formatBusy = UINT32_MAX;
+	clockMs = 0;
+	uint32_t response = 0;
+	auto result = StreamFormatRetry::setFormat(SimCodec::exec, &codec, 0x03, 0x11, &response, fakeSleep);
+	CHECK_EQ(result.status, kIOReturnNotReady);
+	CHECK(result.slept <= StreamFormatRetry::Budget);
+	CHECK(result.slept + StreamFormatRetry::MaxDelay > StreamFormatRetry::Budget);
+	CHECK_EQ(result.slept, 1 + 2 + 4 + 8 + 16 + 32 + 6 * 64);
+	CHECK_EQ(result.retries, 12);
+	CHECK_EQ(codec.peek(0x03, HdaVerb::GetStreamFormat), 0);
+}
+
+/**
+ *  Codecs getting ready after a given time: the wait must end within one backoff step
+ *  and never exceed the budget, while IOHDAFamily sleeps a whole second per attempt.
+ */
+void testSlowCodec() {
+	const uint32_t readyTimes[] {0, 3, 10, 45, 120, 300, 480, 700};
+	printf("%-10s %-10s %-8s %-8s %s\n", "ready ms", "waited ms", "retries", "status", "IOHDAFamily ms");
+	for (auto readyAt : readyTimes) {
+		SlowCodec slow {};
+		slow.readyAt = readyAt;
+		clockMs = 0;
+		uint32_t response = 0;
+		auto result = StreamFormatRetry::setFormat(SlowCodec::exec, &slow, 0x02, 0x4011, &response, fakeSleep);
+		uint32_t family = readyAt == 0 ? 0 : ((readyAt + 999) / 1000) * 1000;
+		printf("%-10u %-10u %-8u %-8s %u\n", readyAt, result.slept, result.retries,
+			result.status == kIOReturnSuccess ? "ok" : "failed", family);
+
+		CHECK(result.slept <= StreamFormatRetry::Budget);
+		if (readyAt <= StreamFormatRetry::Budget - StreamFormatRetry::MaxDelay) {
+			CHECK_EQ(result.status, kIOReturnSuccess);
+			CHECK(result.slept >= readyAt);
+			CHECK(result.slept < readyAt * 2 + StreamFormatRetry::InitialDelay || result.slept < readyAt + StreamFormatRetry::MaxDelay);
+			CHECK_EQ(slow.codec.peek(0x02, HdaVerb::GetStreamFormat), 0x4011);
+		} else if (readyAt > StreamFormatRetry::Budget) {
+			CHECK_EQ(result.status, kIOReturnNotReady);
+		}
+	}
+}
+
+}
+
+int main() {
+	testImmediate();
+	testLostResponse();
+	testBusy();
+	testBudget();
+	testSlowCodec();
+	return testResult("retry_test");
+}
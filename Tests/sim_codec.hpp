@@ -0,0 +1,323 @@
+//
+//  sim_codec.hpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef sim_codec_hpp
+#define sim_codec_hpp
+
+#include <IOKit/IOReturn.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <stdint.h>
+
+/**
+ *  Simulated HDA codec answering verbs in executeVerb format. It models the state
+ *  AppleALC touches: widget parameters, SET verbs with a GET counterpart, processing
+ *  coefficients, stream formats, jack sense and the function group power state.
+ *
+ *  Verbs are internally serialised, overlapping callers are only counted, so that
+ *  tests can check their own serialisation. Link time is simulated, nothing sleeps
+ *  unless yieldInside is set.
+ */
+class SimCodec {
+public:
+	/**
+	 *  Simulated link time of a single verb in nanoseconds
+	 */
+	uint64_t verbTime {20000};
+
+	/**
+	 *  Number of upcoming SET_STREAM_FORMAT verbs rejected by the codec
+	 */
+	uint32_t formatBusy {0};
+
+	/**
+	 *  Number of upcoming SET_STREAM_FORMAT verbs applied, but reported as failed
+	 */
+	uint32_t formatLostResponse {0};
+
+	/**
+	 *  Drop all programmed state when the function group enters D3
+	 */
+	bool losesStateInD3 {false};
+
+	/**
+	 *  Report PS-SettingsReset in the function group power state after a reset in D3
+	 */
+	bool reportsReset {true};
+
+	/**
+	 *  Advance the coefficient index after every SET_PROC_COEF like Realtek codecs do
+	 */
+	bool coefAutoIncrement {false};
+
+	/**
+	 *  Yield in the middle of every verb to widen race windows
+	 */
+	bool yieldInside {false};
+
+	/**
+	 *  Verbs sent, verbs executed while another one was in progress and simulated link time
+	 */
+	std::atomic<uint64_t> verbs {0};
+	std::atomic<uint64_t> overlaps {0};
+	std::atomic<uint64_t> elapsed {0};
+
+	/**
+	 *  Execute a verb the way IOHDACodecDevice::executeVerb does without waiting
+	 */
+	IOReturn exec(uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+		if (active.fetch_add(1) != 0)
+			overlaps++;
+		if (yieldInside)
+			std::this_thread::yield();
+
+		IOReturn status;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			status = execLocked(nid, verb, param, response);
+		}
+
+		verbs++;
+		elapsed += verbTime;
+		active--;
+		return status;
+	}
+
+	static IOReturn exec(void *ctx, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+		return static_cast<SimCodec *>(ctx)->exec(nid, verb, param, response);
+	}
+
+	/**
+	 *  Graph setup, done before the codec is used
+	 */
+	void setParam(uint16_t nid, uint16_t param, uint32_t value) {
+		registers[key(nid, 0xF00, param)] = value;
+	}
+
+	void setRegister(uint16_t nid, uint16_t verb, uint16_t param, uint32_t value) {
+		registers[key(nid, verb, param)] = value;
+	}
+
+	/**
+	 *  Read a register directly without sending a verb
+	 */
+	uint32_t peek(uint16_t nid, uint16_t verb, uint16_t param = 0) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto it = registers.find(key(nid, verb, param));
+		return it != registers.end() ? it->second : 0;
+	}
+
+	uint16_t peekCoef(uint16_t nid, uint16_t index) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto it = coefs.find(key(nid, 0, index));
+		return it != coefs.end() ? it->second : 0;
+	}
+
+	/**
+	 *  Compare every register, coefficient and coefficient index with another codec
+	 */
+	bool sameState(SimCodec &other) {
+		std::lock_guard<std::mutex> guard(lock);
+		std::lock_guard<std::mutex> otherGuard(other.lock);
+		return registers == other.registers && coefs == other.coefs && coefIndex == other.coefIndex;
+	}
+
+	/**
+	 *  Change jack presence of a pin
+	 */
+	void plug(uint16_t nid, bool present) {
+		std::lock_guard<std::mutex> guard(lock);
+		registers[key(nid, 0xF09, 0)] = present ? 0x80000000 : 0;
+	}
+
+	/**
+	 *  Remember the current state as the power-on defaults
+	 */
+	void captureDefaults() {
+		std::lock_guard<std::mutex> guard(lock);
+		defaults = registers;
+		defaultCoefs = coefs;
+	}
+
+	/**
+	 *  Small ALC283-like codec: a root node, an audio function group at nid 1
+	 *  and widgets 0x02-0x23 with two DACs, two ADCs, mixers, pins and the
+	 *  vendor processing widget 0x20
+	 */
+	void buildAlc283() {
+		setParam(0, 0x00, 0x10EC0283);
+		setParam(0, 0x01, 0x100000);
+		setParam(0, 0x02, 0x100003);
+		setParam(0, 0x04, 0x010001);
+
+		setParam(Afg, 0x04, 0x020022);
+		setParam(Afg, 0x05, 0x01);
+		setParam(Afg, 0x08, 0x10);
+		setParam(Afg, 0x0A, 0x60160);
+		setParam(Afg, 0x0B, 0x1);
+		setParam(Afg, 0x0F, 0x8000000F);
+		setParam(Afg, 0x11, 0x40000002);
+
+		for (uint16_t nid = 0x02; nid <= 0x03; nid++)
+			setParam(nid, 0x09, 0x00000405 | 0x1D);
+		for (uint16_t nid = 0x08; nid <= 0x09; nid++) {
+			setParam(nid, 0x09, 0x0010051B);
+			setParam(nid, 0x0E, 0x1);
+			setRegister(nid, 0xF02, 0, nid == 0x08 ? 0x23 : 0x22);
+		}
+		for (uint16_t nid = 0x0C; nid <= 0x0D; nid++) {
+			setParam(nid, 0x09, 0x0020010B);
+			setParam(nid, 0x0E, 0x2);
+			setRegister(nid, 0xF02, 0, nid == 0x0C ? 0x0B02 : 0x0B03);
+		}
+
+		const uint16_t pins[] {0x12, 0x14, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1D, 0x1E, 0x21};
+		for (auto nid : pins) {
+			bool output = nid == 0x14 || nid == 0x17 || nid == 0x1B || nid == 0x21;
+			setParam(nid, 0x09, output ? 0x0040058D : 0x0040048B);
+			setParam(nid, 0x0C, output ? 0x0001003C : 0x00003724);
+			setParam(nid, 0x0E, output ? 0x2 : 0x1);
+			setRegister(nid, 0xF02, 0, output ? 0x0D0C : 0x0B);
+			setRegister(nid, 0xF1C, 0, 0x411111F0);
+		}
+
+		setParam(0x20, 0x09, 0x00F00040);
+		setParam(0x20, 0x0D, 0x00000001);
+		for (uint16_t index = 0; index < 0x80; index++)
+			coefs[key(0x20, 0, index)] = static_cast<uint16_t>(0x8000 | index);
+
+		setParam(0x22, 0x09, 0x0020010B);
+		setParam(0x23, 0x09, 0x0020010B);
+		captureDefaults();
+	}
+
+	static constexpr uint16_t Afg = 1;
+
+private:
+	std::mutex lock;
+	std::atomic<int> active {0};
+	std::map<uint64_t, uint32_t> registers;
+	std::map<uint64_t, uint16_t> coefs;
+	std::map<uint64_t, uint32_t> defaults;
+	std::map<uint64_t, uint16_t> defaultCoefs;
+	std::map<uint16_t, uint16_t> coefIndex;
+	bool settingsReset {false};
+
+	static uint64_t key(uint16_t nid, uint16_t verb, uint16_t param) {
+		return (static_cast<uint64_t>(nid) << 32) | (static_cast<uint64_t>(verb) << 16) | param;
+	}
+
+	uint32_t get(uint16_t nid, uint16_t verb, uint16_t param) {
+		auto it = registers.find(key(nid, verb, param));
+		return it != registers.end() ? it->second : 0;
+	}
+
+	IOReturn execLocked(uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+		uint32_t value = 0;
+		auto id = verb >> 8;
+		if (id == 0x7 || id == 0xF) {
+			switch (verb) {
+				case 0x705:
+					setPower(nid, param & 0xF);
+					break;
+				case 0x71C: case 0x71D: case 0x71E: case 0x71F: {
+					auto shift = (verb - 0x71C) * 8;
+					auto &config = registers[key(nid, 0xF1C, 0)];
+					config = (config & ~(0xFFU << shift)) | (static_cast<uint32_t>(param & 0xFF) << shift);
+					break;
+				}
+				case 0xF05: {
+					uint32_t set = get(nid, 0xF05, 0) & 0xF;
+					uint32_t afg = get(Afg, 0xF05, 0) & 0xF;
+					value = ((set > afg ? set : afg) << 4) | set;
+					if (nid == Afg && settingsReset)
+						value |= 1U << 10;
+					break;
+				}
+				default:
+					if (id == 0x7)
+						registers[key(nid, verb | 0x800, 0)] = param & 0xFF;
+					else
+						value = get(nid, verb, verb == 0xF00 || verb == 0xF02 ? param : 0);
+					break;
+			}
+		} else {
+			switch (id) {
+				case 0x2:
+					if (formatBusy > 0) {
+						formatBusy--;
+						return kIOReturnNotReady;
+					}
+					registers[key(nid, 0xA00, 0)] = param;
+					if (formatLostResponse > 0) {
+						formatLostResponse--;
+						return kIOReturnTimeout;
+					}
+					break;
+				case 0xA:
+					value = get(nid, 0xA00, 0);
+					break;
+				case 0x3:
+					for (uint16_t side = 0; side < 2; side++) {
+						if (!(param & (side == 0 ? 0x2000 : 0x1000)))
+							continue;
+						uint16_t index = (param >> 8) & 0xF;
+						if (param & 0x8000)
+							registers[key(nid, 0xB00, 0x8000 | (side == 0 ? 0x2000 : 0) | 0)] = param & 0xFF;
+						if (param & 0x4000)
+							registers[key(nid, 0xB00, (side == 0 ? 0x2000 : 0) | index)] = param & 0xFF;
+					}
+					break;
+				case 0xB:
+					value = get(nid, 0xB00, param & 0xA00F);
+					break;
+				case 0x5:
+					coefIndex[nid] = param;
+					break;
+				case 0xD:
+					value = coefIndex[nid];
+					break;
+				case 0x4:
+					coefs[key(nid, 0, coefIndex[nid])] = param;
+					if (coefAutoIncrement)
+						coefIndex[nid]++;
+					break;
+				case 0xC: {
+					auto it = coefs.find(key(nid, 0, coefIndex[nid]));
+					value = it != coefs.end() ? it->second : 0;
+					break;
+				}
+				default:
+					return kIOReturnUnsupported;
+			}
+		}
+
+		if (response)
+			*response = value;
+		return kIOReturnSuccess;
+	}
+
+	void setPower(uint16_t nid, uint32_t state) {
+		auto previous = get(nid, 0xF05, 0) & 0xF;
+		registers[key(nid, 0xF05, 0)] = state;
+		if (nid == Afg && state == 3 && previous != 3) {
+			settingsReset = losesStateInD3 && reportsReset;
+			if (losesStateInD3) {
+				registers = defaults;
+				coefs = defaultCoefs;
+				coefIndex.clear();
+				registers[key(nid, 0xF05, 0)] = state;
+			}
+		}
+	}
+};
+
+#endif /* sim_codec_hpp */
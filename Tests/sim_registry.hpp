@@ -0,0 +1,147 @@
+//
+//  sim_registry.hpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef sim_registry_hpp
+#define sim_registry_hpp
+
+#include <Headers/kern_time.hpp>
+
+#include <kern_discovery.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+/**
+ *  Service plane entry of the stand-in registry
+ */
+struct Node {
+	Node *parent;
+	uint32_t address;
+
+	/**
+	 *  Check whether an entry is this node or one of its descendants
+	 */
+	bool contains(const void *entry) const {
+		for (auto node = static_cast<const Node *>(entry); node; node = node->parent)
+			if (node == this)
+				return true;
+		return false;
+	}
+
+	static Node *parentOf(Node *node) {
+		return node->parent;
+	}
+};
+
+using Discovery = CodecDiscovery<Node>;
+
+/**
+ *  Stand-in for the IOKit publish notifications of IOHDACodecDevice. Like IOKit it reports
+ *  already published codecs while the notification is installed, calls handlers on the
+ *  publishing thread and waits for running handlers when a notification is removed.
+ */
+class SimRegistry {
+public:
+	using Handler = std::function<void(Node *)>;
+
+	void publish(Node *codec) {
+		std::lock_guard<std::mutex> handlerGuard(handlerLock);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			published.push_back(codec);
+		}
+		if (handler)
+			handler(codec);
+	}
+
+	void publishAfter(Node *codec, uint64_t delayMs) {
+		publishers.emplace_back([this, codec, delayMs]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+			publish(codec);
+		});
+	}
+
+	void install(Handler notification) {
+		std::lock_guard<std::mutex> handlerGuard(handlerLock);
+		handler = notification;
+		std::vector<Node *> existing;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			existing = published;
+		}
+		for (auto codec : existing)
+			handler(codec);
+	}
+
+	void remove() {
+		std::lock_guard<std::mutex> handlerGuard(handlerLock);
+		handler = nullptr;
+	}
+
+	void join() {
+		for (auto &publisher : publishers)
+			publisher.join();
+		publishers.clear();
+	}
+
+private:
+	std::mutex lock;
+	std::mutex handlerLock;
+	std::vector<Node *> published;
+	std::vector<std::thread> publishers;
+	Handler handler;
+};
+
+/**
+ *  grabCodecs over the stand-in registry: wait for every controller with a detect entry
+ *  to publish a codec or for the timeout
+ */
+struct SimDiscoverer {
+	Discovery discovery;
+	Discovery::Slot slots[8 * Discovery::MaxCodecAddresses] {};
+	std::mutex lock;
+	std::condition_variable done;
+
+	uint64_t run(SimRegistry &registry, Node *const *detect, size_t controllers, uint64_t timeoutMs) {
+		auto start = getCurrentTimeNs();
+		discovery.reset(slots, controllers, start);
+		for (size_t i = 0; i < controllers; i++)
+			if (detect[i])
+				discovery.expect();
+
+		registry.install([this, detect, controllers](Node *codec) {
+			size_t controller = 0;
+			auto match = [detect, controllers](Node *node, size_t &index) {
+				for (index = 0; index < controllers; index++)
+					if (detect[index] && detect[index] == node)
+						return true;
+				return false;
+			};
+
+			std::lock_guard<std::mutex> guard(lock);
+			if (Discovery::findController(codec, Node::parentOf, match, controller) &&
+				discovery.store(controller, codec, codec->address, getCurrentTimeNs()) == Discovery::Result::Completed)
+				done.notify_all();
+		});
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			done.wait_for(guard, std::chrono::milliseconds(timeoutMs), [this]() { return discovery.remaining() == 0; });
+		}
+
+		registry.remove();
+		return getCurrentTimeNs() - start;
+	}
+};
+
+#endif /* sim_registry_hpp */
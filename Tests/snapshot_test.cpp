@@ -0,0 +1,206 @@
+//
+//  snapshot_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+#include <kern_hda.hpp>
+#include <kern_snapshot.hpp>
+
+#include <memory>
+
+namespace {
+
+/**
+ *  Simulated codec rejecting GET or SET verbs of one node
+ */
+struct FaultyCodec {
+	SimCodec codec;
+	uint16_t failNid {0};
+	bool failReads {false};
+	bool failWrites {false};
+
+	static IOReturn exec(void *ctx, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *response) {
+		auto that = static_cast<FaultyCodec *>(ctx);
+		bool read = verb >= 0xA00 && verb != HdaVerb::SetCoefIndex;
+		if (nid == that->failNid && ((read && that->failReads) || (!read && that->failWrites)))
+			return kIOReturnIOError;
+		return that->codec.exec(nid, verb, param, response);
+	}
+};
+
+struct Write {
+	uint16_t nid;
+	uint16_t verb;
+	uint16_t param;
+};
+
+/**
+ *  Wake verbs of a typical layout, consecutive coefficient writes rely on the index auto-increment
+ */
+const Write wakeVerbs[] {
+	{0x21, 0x71C, 0x20}, {0x21, 0x71D, 0x10}, {0x21, 0x71E, 0x21}, {0x21, 0x71F, 0x04},
+	{0x17, 0x71C, 0xF0}, {0x17, 0x71D, 0x11}, {0x17, 0x71E, 0x11}, {0x17, 0x71F, 0x41},
+	{0x21, HdaVerb::SetPinWidgetControl, 0xC0},
+	{0x14, HdaVerb::SetEapdBtlEnable, 0x02},
+	{0x0C, HdaVerb::SetConnectSel, 0x01},
+	{0x14, HdaVerb::SetAmpGainMute, HdaAmp::SetOutput | HdaAmp::SetLeft | HdaAmp::SetRight | 0x1F},
+	{0x20, HdaVerb::SetCoefIndex, 0x0F},
+	{0x20, HdaVerb::SetProcCoef, 0x0E00},
+	{0x20, HdaVerb::SetProcCoef, 0x0E01},
+	{0x20, HdaVerb::SetProcCoef, 0x0E02}
+};
+
+void configure(SimCodec &codec) {
+	codec.buildAlc283();
+	codec.coefAutoIncrement = true;
+	codec.losesStateInD3 = true;
+	for (auto &write : wakeVerbs)
+		codec.exec(write.nid, write.verb, write.param, nullptr);
+}
+
+void track(CodecSnapshot &snapshot) {
+	for (auto &write : wakeVerbs)
+		snapshot.add(write.nid, write.verb, write.param);
+}
+
+void powerCycle(SimCodec &codec) {
+	codec.exec(SimCodec::Afg, 0x705, 3, nullptr);
+	codec.exec(SimCodec::Afg, 0x705, 0, nullptr);
+}
+
+void checkConfigured(SimCodec &codec) {
+	CHECK_EQ(codec.peek(0x21, HdaVerb::GetConfigDefault), 0x04211020);
+	CHECK_EQ(codec.peek(0x21, HdaVerb::GetPinWidgetControl), 0xC0);
+	CHECK_EQ(codec.peek(0x14, HdaVerb::GetEapdBtlEnable), 0x02);
+	CHECK_EQ(codec.peek(0x0C, HdaVerb::GetConnectSel), 0x01);
+	CHECK_EQ(codec.peek(0x14, HdaVerb::GetAmpGainMute, HdaAmp::GetOutput | HdaAmp::GetLeft), 0x1F);
+	CHECK_EQ(codec.peek(0x14, HdaVerb::GetAmpGainMute, HdaAmp::GetOutput), 0x1F);
+	CHECK_EQ(codec.peekCoef(0x20, 0x0F), 0x0E00);
+	CHECK_EQ(codec.peekCoef(0x20, 0x10), 0x0E01);
+	CHECK_EQ(codec.peekCoef(0x20, 0x11), 0x0E02);
+}
+
+void testAdd() {
+	std::unique_ptr<CodecSnapshot> snapshot(CodecSnapshot::create());
+	CHECK(snapshot->add(0x21, HdaVerb::SetPinWidgetControl, 0xC0));
+	CHECK(snapshot->add(0x21, HdaVerb::SetPinWidgetControl, 0x40));
+	CHECK(snapshot->add(0x21, 0x71E, 0x21));
+	// Index writes are always replayed, verbs without a readable counterpart are not covered.
+	CHECK(!snapshot->add(0x20, HdaVerb::SetCoefIndex, 0x0F));
+	CHECK(!snapshot->add(0x01, 0x715, 0x02));
+	CHECK(!snapshot->add(0x02, HdaVerb::SetStreamFormat, 0x11));
+	CHECK(snapshot->add(0x20, HdaVerb::SetProcCoef, 0x0E00));
+	CHECK(snapshot->add(0x20, HdaVerb::SetProcCoef, 0x0E01));
+	// Four amps from one write, a repeated write adds nothing.
+	CHECK(snapshot->add(0x0C, HdaVerb::SetAmpGainMute, HdaAmp::SetOutput | HdaAmp::SetInput | HdaAmp::SetLeft | HdaAmp::SetRight | 0x10));
+	CHECK(snapshot->add(0x0C, HdaVerb::SetAmpGainMute, HdaAmp::SetOutput | HdaAmp::SetLeft | 0x10));
+	CHECK_EQ(snapshot->count(), 2 + 2 + 4);
+	CHECK(!snapshot->isCaptured());
+
+	// The table is bounded, registers past it are left to the replay.
+	std::unique_ptr<CodecSnapshot> full(CodecSnapshot::create());
+	for (uint16_t i = 0; i < CodecSnapshot::MaxRegisters; i++)
+		CHECK(full->add(0x20, HdaVerb::SetProcCoef, i));
+	CHECK(!full->add(0x21, HdaVerb::SetPinWidgetControl, 0xC0));
+	CHECK_EQ(full->count(), CodecSnapshot::MaxRegisters);
+}
+
+void testKept() {
+	SimCodec codec;
+	configure(codec);
+	codec.losesStateInD3 = false;
+	std::unique_ptr<CodecSnapshot> snapshot(CodecSnapshot::create());
+	track(*snapshot);
+	CHECK_EQ(snapshot->capture(SimCodec::exec, &codec), snapshot->count());
+	CHECK(snapshot->isCaptured());
+
+	powerCycle(codec);
+	auto verbs = codec.verbs.load();
+	auto stats = snapshot->restore(SimCodec::exec, &codec);
+	CHECK_EQ(stats.checked, snapshot->count());
+	CHECK_EQ(stats.restored, 0);
+	CHECK_EQ(stats.failures, 0);
+	// Only reads, coefficients take an index write and a read each.
+	CHECK_EQ(codec.verbs.load() - verbs, snapshot->count() + 3);
+	checkConfigured(codec);
+}
+
+void testLost() {
+	SimCodec codec;
+	configure(codec);
+	std::unique_ptr<CodecSnapshot> snapshot(CodecSnapshot::create());
+	track(*snapshot);
+	snapshot->capture(SimCodec::exec, &codec);
+
+	powerCycle(codec);
+	CHECK_EQ(codec.peek(0x21, HdaVerb::GetPinWidgetControl), 0);
+	auto stats = snapshot->restore(SimCodec::exec, &codec);
+	CHECK_EQ(stats.checked, snapshot->count());
+	// Pin 0x17 keeps its power-on default config, everything else was lost.
+	CHECK_EQ(stats.restored, snapshot->count() - 1);
+	CHECK_EQ(stats.failures, 0);
+	checkConfigured(codec);
+
+	// A second wake with one register changed behind our back restores just that one.
+	snapshot->capture(SimCodec::exec, &codec);
+	codec.losesStateInD3 = false;
+	powerCycle(codec);
+	codec.exec(0x20, HdaVerb::SetCoefIndex, 0x10, nullptr);
+	codec.exec(0x20, HdaVerb::SetProcCoef, 0x1234, nullptr);
+	stats = snapshot->restore(SimCodec::exec, &codec);
+	CHECK_EQ(stats.restored, 1);
+	checkConfigured(codec);
+}
+
+void testErrors() {
+	// Registers failing to capture are skipped, the rest is restored.
+	FaultyCodec faulty;
+	configure(faulty.codec);
+	std::unique_ptr<CodecSnapshot> snapshot(CodecSnapshot::create());
+	track(*snapshot);
+	faulty.failNid = 0x14;
+	faulty.failReads = true;
+	CHECK_EQ(snapshot->capture(FaultyCodec::exec, &faulty), snapshot->count() - 3);
+	faulty.failReads = false;
+
+	powerCycle(faulty.codec);
+	auto stats = snapshot->restore(FaultyCodec::exec, &faulty);
+	CHECK_EQ(stats.checked, snapshot->count() - 3);
+	CHECK_EQ(stats.restored, snapshot->count() - 4);
+	CHECK_EQ(faulty.codec.peek(0x14, HdaVerb::GetEapdBtlEnable), 0);
+
+	// Registers failing to read back are rewritten, rejected writes are counted.
+	FaultyCodec rejecting;
+	configure(rejecting.codec);
+	snapshot.reset(CodecSnapshot::create());
+	track(*snapshot);
+	snapshot->capture(FaultyCodec::exec, &rejecting);
+	rejecting.failNid = 0x21;
+	rejecting.failReads = true;
+	rejecting.failWrites = true;
+	powerCycle(rejecting.codec);
+	stats = snapshot->restore(FaultyCodec::exec, &rejecting);
+	CHECK_EQ(stats.failures, 2);
+	CHECK_EQ(stats.restored, snapshot->count() - 3);
+
+	// Nothing is restored without a capture.
+	std::unique_ptr<CodecSnapshot> empty(CodecSnapshot::create());
+	track(*empty);
+	stats = empty->restore(FaultyCodec::exec, &rejecting);
+	CHECK_EQ(stats.checked, 0);
+}
+
+}
+
+int main() {
+	testAdd();
+	testKept();
+	testLost();
+	testErrors();
+	return testResult("snapshot_test");
+}
@@ -0,0 +1,82 @@
+//
+//  test.hpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#ifndef test_hpp
+#define test_hpp
+
+#include <Headers/kern_time.hpp>
+#include <Headers/kern_util.hpp>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ *  Number of failed checks of the running test binary
+ */
+inline int &testFailures() {
+	static int failures {0};
+	return failures;
+}
+
+/**
+ *  Report a failed check and keep going, so that one run shows every failure
+ */
+#define CHECK(cond) do {                                                                \
+	if (!(cond)) {                                                                      \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+		testFailures()++;                                                               \
+	}                                                                                   \
+} while (0)
+
+#define CHECK_EQ(a, b) do {                                                             \
+	auto testA = (a);                                                                   \
+	auto testB = static_cast<decltype(testA)>(b);                                       \
+	if (!(testA == testB)) {                                                            \
+		fprintf(stderr, "%s:%d: check failed: %s == %s (0x%llX != 0x%llX)\n", __FILE__, \
+			__LINE__, #a, #b, static_cast<unsigned long long>(testA),                   \
+			static_cast<unsigned long long>(testB));                                    \
+		testFailures()++;                                                               \
+	}                                                                                   \
+} while (0)
+
+/**
+ *  Print the outcome of a test binary
+ *
+ *  @param name test name
+ *
+ *  @return process exit code
+ */
+inline int testResult(const char *name) {
+	if (testFailures() > 0) {
+		fprintf(stderr, "%s: %d checks failed\n", name, testFailures());
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+/**
+ *  Print a benchmark line
+ *
+ *  @param name       measured operation
+ *  @param iterations number of operations
+ *  @param elapsed    total time in nanoseconds
+ */
+inline void benchReport(const char *name, uint64_t iterations, uint64_t elapsed) {
+	printf("%-48s %12llu ops %10.1f ns/op\n", name, static_cast<unsigned long long>(iterations),
+		iterations ? static_cast<double>(elapsed) / static_cast<double>(iterations) : 0.0);
+}
+
+/**
+ *  Keep a computed value alive, so that the compiler does not drop benchmarked work
+ */
+template <typename T>
+inline void benchKeep(const T &value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif /* test_hpp */
@@ -0,0 +1,151 @@
+//
+//  timing_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_timing.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <string.h>
+
+namespace {
+
+/**
+ *  Fake clock advanced by the test, every reading also moves it by one nanosecond
+ *  so that the order of readings is visible in the stages
+ */
+std::atomic<uint64_t> fakeNow {0};
+
+uint64_t fakeClock() {
+	return fakeNow.fetch_add(1);
+}
+
+void advance(uint64_t ns) {
+	fakeNow += ns;
+}
+
+void testStages() {
+	fakeNow = 1000;
+	std::unique_ptr<BootTimings> timings(new BootTimings(fakeClock));
+	{
+		BootTimings::Scope outer(*timings, "grabControllers");
+		advance(500);
+		{
+			BootTimings::Scope inner(*timings, "applyPatches", "com.apple.driver.AppleHDA", 2);
+			advance(2000);
+		}
+		advance(100);
+	}
+
+	CHECK_EQ(timings->count(), 2);
+	CHECK_EQ(timings->droppedCount(), 0);
+	auto outer = timings->get(0);
+	auto inner = timings->get(1);
+	CHECK(outer && inner);
+	if (!outer || !inner)
+		return;
+	CHECK(!strcmp(outer->name, "grabControllers"));
+	CHECK(outer->target == nullptr);
+	CHECK_EQ(outer->start, 1000);
+	CHECK_EQ(outer->duration, 500 + 2000 + 100 + 3);
+	CHECK(!strcmp(inner->target, "com.apple.driver.AppleHDA"));
+	CHECK_EQ(inner->detail, 2);
+	CHECK_EQ(inner->start, 1501);
+	CHECK_EQ(inner->duration, 2001);
+	CHECK(inner->start + inner->duration <= outer->start + outer->duration);
+}
+
+void testUnfinished() {
+	fakeNow = 0;
+	std::unique_ptr<BootTimings> timings(new BootTimings(fakeClock));
+
+	// AppleHDAController start may finish on another thread long after it began.
+	auto stage = timings->begin("AppleHDAController_start", nullptr, 3000);
+	CHECK_EQ(timings->count(), 1);
+	CHECK(timings->get(stage) == nullptr);
+	CHECK(timings->get(1) == nullptr);
+
+	std::thread([&]() {
+		advance(3000000);
+		timings->end(stage);
+	}).join();
+	auto done = timings->get(stage);
+	CHECK(done != nullptr);
+	if (done)
+		CHECK_EQ(done->duration, 3000001);
+}
+
+void testOverflow() {
+	fakeNow = 0;
+	std::unique_ptr<BootTimings> timings(new BootTimings(fakeClock));
+	for (size_t i = 0; i < BootTimings::MaxStages; i++)
+		CHECK_EQ(timings->begin("routeMultiple", nullptr, static_cast<uint32_t>(i)), i);
+
+	auto before = fakeNow.load();
+	auto extra = timings->begin("layoutLoadCallback");
+	CHECK_EQ(extra, BootTimings::InvalidStage);
+	{
+		BootTimings::Scope scope(*timings, "layoutLoadCallback");
+	}
+	// Dropped stages do not read the clock and finishing them does nothing.
+	timings->end(extra);
+	CHECK_EQ(fakeNow.load(), before);
+	CHECK_EQ(timings->count(), BootTimings::MaxStages);
+	CHECK_EQ(timings->droppedCount(), 2);
+	CHECK(timings->get(BootTimings::MaxStages) == nullptr);
+}
+
+/**
+ *  Codec and controller callbacks record stages concurrently. Every stage lands
+ *  in its own slot and the surplus is counted as dropped.
+ */
+void testConcurrent() {
+	static constexpr size_t Threads = 4;
+	static constexpr size_t PerThread = 40;
+	fakeNow = 0;
+	std::unique_ptr<BootTimings> timings(new BootTimings(fakeClock));
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < Threads; t++) {
+		threads.emplace_back([&, t]() {
+			for (size_t i = 0; i < PerThread; i++) {
+				BootTimings::Scope stage(*timings, "applyCodecPatches", nullptr, static_cast<uint32_t>(t * PerThread + i));
+				advance(10);
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	CHECK_EQ(timings->count(), BootTimings::MaxStages);
+	CHECK_EQ(timings->droppedCount(), Threads * PerThread - BootTimings::MaxStages);
+	std::vector<bool> seen(Threads * PerThread);
+	for (size_t i = 0; i < timings->count(); i++) {
+		auto stage = timings->get(i);
+		CHECK(stage != nullptr);
+		if (!stage)
+			continue;
+		CHECK(stage->detail < seen.size() && !seen[stage->detail]);
+		if (stage->detail < seen.size())
+			seen[stage->detail] = true;
+		CHECK(stage->duration >= 11);
+	}
+}
+
+}
+
+int main() {
+	testStages();
+	testUnfinished();
+	testOverflow();
+	testConcurrent();
+	return testResult("timing_test");
+}
@@ -0,0 +1,97 @@
+//
+//  trace_bench.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+#include <kern_hda.hpp>
+#include <kern_trace.hpp>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+static constexpr size_t Iterations = 2000000;
+static constexpr size_t MaxTraces = 8;
+
+/**
+ *  Stand-in for AlcEnabler::callVerb with the executeVerb original replaced by a simulated codec
+ */
+struct Enabler {
+	SimCodec codec;
+	VerbTraceSlot slots[MaxTraces] {};
+	bool traceEnabled {false};
+
+	IOReturn callVerb(void *device, uint16_t nid, uint16_t verb, uint16_t param, uint32_t *output) {
+		if (!traceEnabled)
+			return codec.exec(nid, verb, param, output);
+
+		auto start = getCurrentTimeNs();
+		auto ret = codec.exec(nid, verb, param, output);
+		auto duration = getCurrentTimeNs() - start;
+		for (size_t i = 0; i < MaxTraces; i++) {
+			if (slots[i].matches(device)) {
+				auto trace = slots[i].enter(device);
+				if (trace)
+					trace->record(nid, verb, param, output ? *output : 0, ret, start, duration);
+				slots[i].leave();
+				break;
+			}
+		}
+		return ret;
+	}
+};
+
+uint64_t run(Enabler &enabler, void *device, size_t iterations) {
+	uint32_t response = 0;
+	auto start = getCurrentTimeNs();
+	for (size_t i = 0; i < iterations; i++) {
+		enabler.callVerb(device, 0x21, HdaVerb::GetPinSense, 0, &response);
+		benchKeep(response);
+	}
+	return getCurrentTimeNs() - start;
+}
+
+}
+
+int main() {
+	std::unique_ptr<Enabler> enabler(new Enabler);
+	enabler->codec.buildAlc283();
+	std::unique_ptr<VerbTrace> trace(new VerbTrace);
+	int codecs[MaxTraces] {};
+	// The traced codec takes the last slot, so that the lookup walks all of them.
+	for (size_t i = 0; i + 1 < MaxTraces; i++)
+		enabler->slots[i].claim(&codecs[i], nullptr);
+	enabler->slots[MaxTraces - 1].claim(&codecs[MaxTraces - 1], trace.get());
+	void *device = &codecs[MaxTraces - 1];
+
+	auto plain = run(*enabler, device, Iterations);
+	benchReport("verb, tracing disabled", Iterations, plain);
+
+	enabler->traceEnabled = true;
+	auto traced = run(*enabler, device, Iterations);
+	benchReport("verb, tracing enabled", Iterations, traced);
+
+	static constexpr size_t Threads = 4;
+	std::vector<std::thread> threads;
+	auto start = getCurrentTimeNs();
+	for (size_t t = 0; t < Threads; t++)
+		threads.emplace_back([&]() { run(*enabler, device, Iterations / Threads); });
+	for (auto &thread : threads)
+		thread.join();
+	benchReport("verb, tracing enabled, 4 threads", Iterations, getCurrentTimeNs() - start);
+
+	auto record = getCurrentTimeNs();
+	for (size_t i = 0; i < Iterations; i++)
+		trace->record(0x21, HdaVerb::GetPinSense, 0, 0, kIOReturnSuccess, i, 1000);
+	benchReport("VerbTrace::record", Iterations, getCurrentTimeNs() - record);
+
+	printf("tracing overhead %.1f ns per verb\n", (static_cast<double>(traced) - plain) / Iterations);
+	return 0;
+}
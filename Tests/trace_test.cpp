@@ -0,0 +1,117 @@
+//
+//  trace_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+
+#include <kern_hda.hpp>
+#include <kern_trace.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/**
+ *  Trace ring with a liveness flag standing in for the memory freed by ALCUserClientProvider::free
+ */
+struct Ring {
+	VerbTrace trace;
+	std::atomic<bool> alive {true};
+};
+
+void testRecord() {
+	std::unique_ptr<VerbTrace> trace(new VerbTrace);
+	std::unique_ptr<ALCTraceDump> dump(new ALCTraceDump {});
+	for (uint32_t i = 0; i < kALCTraceCapacity + 3; i++)
+		trace->record(0x20, HdaVerb::GetProcCoef, 0, i, kIOReturnSuccess, i, 3000);
+	trace->read(*dump);
+	CHECK_EQ(dump->head, kALCTraceCapacity + 3);
+	CHECK_EQ(dump->entries[0].sequence, kALCTraceCapacity + 1);
+	CHECK_EQ(dump->entries[0].response, kALCTraceCapacity);
+	CHECK_EQ(dump->histograms[kALCTraceClassCoefficient].count, kALCTraceCapacity + 3);
+	CHECK_EQ(dump->histograms[kALCTraceClassCoefficient].maxTime, 3000);
+
+	trace->reset();
+	trace->read(*dump);
+	for (auto &entry : dump->entries)
+		CHECK_EQ(entry.sequence, 0);
+	CHECK_EQ(dump->histograms[kALCTraceClassCoefficient].count, 0);
+}
+
+/**
+ *  Recorder threads trace verbs of a codec while its ring is registered and unregistered
+ *  over and over. No recorder may touch a ring after unregistering has waited for it.
+ */
+void testUnregister() {
+	static constexpr size_t Threads = 4;
+	static constexpr size_t Cycles = 200;
+
+	VerbTraceSlot slot;
+	std::atomic<bool> done {false};
+	std::atomic<uint64_t> recorded {0};
+	std::atomic<uint64_t> stale {0};
+	int codec = 0;
+
+	std::vector<std::thread> recorders;
+	for (size_t t = 0; t < Threads; t++) {
+		recorders.emplace_back([&]() {
+			while (!done.load()) {
+				if (!slot.matches(&codec)) {
+					std::this_thread::sleep_for(std::chrono::microseconds(1));
+					continue;
+				}
+				auto trace = slot.enter(&codec);
+				if (trace) {
+					auto ring = reinterpret_cast<Ring *>(trace);
+					std::this_thread::yield();
+					if (!ring->alive.load())
+						stale++;
+					trace->record(0x21, HdaVerb::GetPinSense, 0, 0, kIOReturnSuccess, 0, 1000);
+					recorded++;
+				}
+				slot.leave();
+			}
+		});
+	}
+
+	size_t waits = 0;
+	for (size_t i = 0; i < Cycles; i++) {
+		auto ring = new Ring;
+		CHECK(slot.claim(&codec, &ring->trace));
+		CHECK(!slot.claim(&codec, &ring->trace));
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+
+		slot.retire();
+		while (!slot.idle()) {
+			waits++;
+			std::this_thread::sleep_for(std::chrono::microseconds(1));
+		}
+		slot.release();
+		ring->alive = false;
+		delete ring;
+	}
+	done = true;
+	for (auto &recorder : recorders)
+		recorder.join();
+
+	CHECK_EQ(stale.load(), 0);
+	CHECK(slot.idle());
+	CHECK(!slot.matches(&codec));
+	printf("unregister: %zu cycles, %llu verbs recorded, %zu waits for recorders\n", Cycles,
+		static_cast<unsigned long long>(recorded.load()), waits);
+}
+
+}
+
+int main() {
+	testRecord();
+	testUnregister();
+	return testResult("trace_test");
+}
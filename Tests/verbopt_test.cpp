@@ -0,0 +1,199 @@
+//
+//  verbopt_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+extern "C" {
+#include "verbopt.h"
+}
+
+#include <random>
+#include <vector>
+
+namespace {
+
+uint32_t shortVerb(uint16_t nid, uint16_t verb, uint8_t payload) {
+	return static_cast<uint32_t>(nid) << 20 | static_cast<uint32_t>(verb) << 8 | payload;
+}
+
+uint32_t longVerb(uint16_t nid, uint8_t id, uint16_t payload) {
+	return static_cast<uint32_t>(nid) << 20 | static_cast<uint32_t>(id) << 16 | payload;
+}
+
+/**
+ *  Run a stream on a fresh simulated ALC283 losing its state in D3. The simulator has its
+ *  own register model, unlike verbopt_equivalent it knows nothing of the optimizer classes.
+ */
+void execute(SimCodec &codec, const std::vector<uint32_t> &stream) {
+	codec.buildAlc283();
+	codec.losesStateInD3 = true;
+	for (auto command : stream) {
+		uint16_t nid = (command >> 20) & 0xFF;
+		auto id = (command >> 16) & 0xF;
+		if (id == 0x7 || id == 0xF)
+			codec.exec(nid, (command >> 8) & 0xFFF, command & 0xFF, nullptr);
+		else
+			codec.exec(nid, static_cast<uint16_t>(id << 8), command & 0xFFFF, nullptr);
+	}
+}
+
+std::vector<uint32_t> optimize(const std::vector<uint32_t> &stream, verbopt_stats *stats = nullptr) {
+	std::vector<uint32_t> out(stream.size());
+	out.resize(verbopt_optimize(stream.data(), stream.size(), out.data(), stats));
+	return out;
+}
+
+bool sameOnCodec(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+	SimCodec first, second;
+	execute(first, a);
+	execute(second, b);
+	return first.sameState(second);
+}
+
+/**
+ *  Random ConfigData-like stream over the pins, mixers and the vendor widget of the codec
+ */
+std::vector<uint32_t> randomStream(std::mt19937 &rng) {
+	static constexpr uint16_t pins[] {0x12, 0x14, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1D, 0x1E, 0x21};
+	static constexpr uint16_t amps[] {0x02, 0x08, 0x0C, 0x14, 0x21};
+	auto pick = [&rng](uint32_t num) { return static_cast<uint32_t>(rng() % num); };
+
+	std::vector<uint32_t> stream(1 + pick(64));
+	for (auto &command : stream) {
+		auto pin = pins[pick(sizeof(pins) / sizeof(pins[0]))];
+		auto value = static_cast<uint8_t>(pick(4) == 0 ? pick(256) : pick(4));
+		switch (pick(10)) {
+			case 0:
+				command = shortVerb(pin, static_cast<uint16_t>(0x71C + pick(4)), value);
+				break;
+			case 1:
+				command = shortVerb(pin, 0x707, value);
+				break;
+			case 2:
+				command = shortVerb(pin, 0x70C, value);
+				break;
+			case 3:
+				command = shortVerb(pick(2) ? 0x0C : pin, 0x701, value & 1);
+				break;
+			case 4: {
+				// Mostly D0, sometimes D3 of a widget or of the whole function group.
+				uint16_t nid = pick(3) == 0 ? SimCodec::Afg : pin;
+				command = shortVerb(nid, 0x705, pick(4) == 0 ? 3 : 0);
+				break;
+			}
+			case 5:
+			case 6: {
+				auto bits = static_cast<uint16_t>((pick(3) + 1) << 14 | (pick(3) + 1) << 12 | pick(2) << 8);
+				command = longVerb(amps[pick(sizeof(amps) / sizeof(amps[0]))], 0x3, bits | value);
+				break;
+			}
+			case 7:
+				command = longVerb(0x20, 0x5, static_cast<uint16_t>(pick(4)));
+				break;
+			case 8:
+				command = longVerb(0x20, 0x4, static_cast<uint16_t>(pick(0x10000)));
+				break;
+			default:
+				command = shortVerb(SimCodec::Afg, 0x715, value & 3);
+				break;
+		}
+	}
+	return stream;
+}
+
+void testPowerStates() {
+	// A D0 write is moved ahead of the writes to the powered node.
+	std::vector<uint32_t> stream {shortVerb(0x21, 0x707, 0xC0), shortVerb(0x21, 0x705, 0)};
+	verbopt_stats stats;
+	auto out = optimize(stream, &stats);
+	CHECK_EQ(out.size(), 2);
+	CHECK_EQ(out[0], stream[1]);
+	CHECK_EQ(stats.hoisted, 1);
+
+	// Entering D3 drops the settings, the writes before it must not survive and the D0 stays after it.
+	stream = {
+		shortVerb(0x21, 0x707, 0xC0), shortVerb(SimCodec::Afg, 0x705, 3),
+		shortVerb(0x14, 0x707, 0x40), shortVerb(SimCodec::Afg, 0x705, 0)
+	};
+	out = optimize(stream, &stats);
+	CHECK(out == std::vector<uint32_t>({stream[0], stream[1], stream[3], stream[2]}));
+	CHECK(verbopt_equivalent(stream.data(), stream.size(), out.data(), out.size()));
+	CHECK(sameOnCodec(stream, out));
+
+	// A trailing D3 is kept at the end instead of being moved ahead of the writes.
+	stream = {shortVerb(0x21, 0x707, 0xC0), shortVerb(SimCodec::Afg, 0x705, 3)};
+	out = optimize(stream);
+	CHECK(out == stream);
+	CHECK(sameOnCodec(stream, out));
+
+	// Writes before a D3 are not overwrites of the writes after it.
+	stream = {shortVerb(0x21, 0x707, 0xC0), shortVerb(SimCodec::Afg, 0x705, 3), shortVerb(0x21, 0x707, 0xC0)};
+	out = optimize(stream, &stats);
+	CHECK(out == stream);
+	CHECK_EQ(stats.overwritten, 0);
+}
+
+void testReference() {
+	static constexpr size_t Streams = 3000;
+	std::mt19937 rng(0x283);
+	size_t dropped = 0, hoisted = 0;
+	for (size_t i = 0; i < Streams; i++) {
+		auto stream = randomStream(rng);
+		verbopt_stats stats;
+		auto out = optimize(stream, &stats);
+		dropped += stats.overwritten;
+		hoisted += stats.hoisted;
+
+		CHECK(out.size() <= stream.size());
+		CHECK(verbopt_equivalent(stream.data(), stream.size(), out.data(), out.size()));
+		CHECK(sameOnCodec(stream, out));
+		CHECK(optimize(out) == out);
+	}
+
+	// The streams must exercise both transformations for the comparison to mean anything.
+	CHECK(dropped > Streams);
+	CHECK(hoisted > Streams / 10);
+	printf("reference: %zu streams, %zu writes dropped, %zu D0 writes moved ahead\n", Streams, dropped, hoisted);
+}
+
+void testDetects() {
+	// Both checks notice a stream leaving a different value behind.
+	std::mt19937 rng(0x269);
+	size_t detected = 0, compared = 0;
+	for (size_t i = 0; i < 500; i++) {
+		auto stream = randomStream(rng);
+		auto changed = stream;
+		auto &last = changed.back();
+		// Only flip values the codec keeps, so that the reference simulator can see the change.
+		auto id = (last >> 16) & 0xF;
+		if (id == 0x7 && ((last >> 8) & 0xFFF) != 0x705)
+			last ^= 0x01;
+		else if (id == 0x4)
+			last ^= 0x0100;
+		else
+			continue;
+
+		compared++;
+		bool model = verbopt_equivalent(stream.data(), stream.size(), changed.data(), changed.size());
+		bool reference = sameOnCodec(stream, changed);
+		CHECK_EQ(model, reference);
+		if (!model)
+			detected++;
+	}
+	CHECK(compared > 0);
+	CHECK_EQ(detected, compared);
+}
+
+}
+
+int main() {
+	testPowerStates();
+	testReference();
+	testDetects();
+	return testResult("verbopt_test");
+}
@@ -0,0 +1,319 @@
+//
+//  verbqueue_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+#include <kern_hda.hpp>
+#include <kern_verbqueue.hpp>
+
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/**
+ *  Stand-in for ALCUserClientProvider: one lock per codec held around every verb and transaction
+ */
+struct Provider {
+	SimCodec codec;
+	std::mutex verbLock;
+
+	IOReturn transaction(const ALCVerbCommand *commands, ALCVerbResult *results, size_t num) {
+		std::lock_guard<std::mutex> guard(verbLock);
+		return VerbTransaction::run(commands, results, num, [this](uint16_t nid, uint16_t verb, uint16_t param, bool, uint32_t &response) {
+			return codec.exec(nid, verb, param, &response);
+		});
+	}
+
+	IOReturn single(uint16_t nid, uint16_t verb, uint16_t param, uint32_t &response) {
+		std::lock_guard<std::mutex> guard(verbLock);
+		return codec.exec(nid, verb, param, &response);
+	}
+};
+
+void testAbort() {
+	Provider provider;
+	provider.codec.buildAlc283();
+
+	const ALCVerbCommand commands[] {
+		{0x20, HdaVerb::SetCoefIndex, 0x10, 0},
+		{0x20, HdaVerb::GetProcCoef, 0, 0},
+		{0x20, 0x100, 0, 0},
+		{0x20, HdaVerb::SetProcCoef, 0x1234, 0},
+		{0x20, HdaVerb::GetProcCoef, 0, kVerbFlagNoWait}
+	};
+	ALCVerbResult results[arrsize(commands)] {};
+
+	auto status = provider.transaction(commands, results, arrsize(commands));
+	CHECK_EQ(status, kIOReturnUnsupported);
+	CHECK_EQ(results[0].status, kIOReturnSuccess);
+	CHECK_EQ(results[1].status, kIOReturnSuccess);
+	CHECK_EQ(results[1].response, 0x8010);
+	CHECK_EQ(results[2].status, kIOReturnUnsupported);
+	CHECK_EQ(results[3].status, kIOReturnAborted);
+	CHECK_EQ(results[4].status, kIOReturnAborted);
+	CHECK_EQ(provider.codec.peekCoef(0x20, 0x10), 0x8010);
+	CHECK_EQ(provider.codec.verbs.load(), 3);
+}
+
+void testQueue() {
+	VerbQueue<int, 4> queue;
+	int item = 0;
+	CHECK(!queue.pop(item));
+	for (int i = 1; i <= 4; i++)
+		CHECK(queue.push(i));
+	CHECK(!queue.push(5));
+	CHECK(queue.pop(item));
+	CHECK_EQ(item, 1);
+	CHECK(queue.push(5));
+	CHECK(queue.take(item, [](int curr) { return curr % 2 == 1; }));
+	CHECK_EQ(item, 3);
+	CHECK(!queue.take(item, [](int curr) { return curr > 10; }));
+	CHECK_EQ(queue.size(), 3);
+
+	// The ring wraps around, the order of the remaining items is kept.
+	const int expected[] {2, 4, 5};
+	for (auto value : expected) {
+		CHECK(queue.pop(item));
+		CHECK_EQ(item, value);
+	}
+	CHECK_EQ(queue.size(), 0);
+}
+
+/**
+ *  Stand-in for the asynchronous path of ALCUserClientProvider: submit queues under the queue
+ *  lock and schedules a worker like thread_call_enter, the worker drains the queue and posts
+ *  completions, and cancel aborts the queued requests of a closing client.
+ */
+struct AsyncProvider {
+	struct Request {
+		size_t client;
+		size_t id;
+		uint16_t nid;
+		uint16_t verb;
+		uint16_t param;
+	};
+
+	struct Completion {
+		IOReturn status;
+		uint32_t response;
+		size_t count;
+		size_t order;
+	};
+
+	static constexpr size_t MaxQueuedVerbs = 64;
+
+	Provider provider;
+	VerbQueue<Request, MaxQueuedVerbs> verbQueue;
+	bool verbQueueActive {false};
+	std::mutex verbQueueLock;
+	std::vector<std::thread> workers;
+	std::mutex workerLock;
+	std::mutex completionLock;
+	std::condition_variable completed;
+	std::vector<Completion> completions;
+	size_t completionCount {0};
+
+	explicit AsyncProvider(size_t num) : completions(num) {
+		provider.codec.buildAlc283();
+	}
+
+	~AsyncProvider() {
+		for (auto &worker : workers)
+			worker.join();
+	}
+
+	IOReturn submit(const Request &request) {
+		std::unique_lock<std::mutex> guard(verbQueueLock);
+		if (!verbQueue.push(request))
+			return kIOReturnNoResources;
+		bool schedule = !verbQueueActive;
+		verbQueueActive = true;
+		guard.unlock();
+		if (schedule) {
+			std::lock_guard<std::mutex> workerGuard(workerLock);
+			workers.emplace_back(&AsyncProvider::process, this);
+		}
+		return kIOReturnSuccess;
+	}
+
+	void cancel(size_t client) {
+		Request request;
+		while (true) {
+			std::unique_lock<std::mutex> guard(verbQueueLock);
+			bool found = verbQueue.take(request, [client](const Request &curr) { return curr.client == client; });
+			guard.unlock();
+			if (!found)
+				break;
+			complete(request, kIOReturnAborted, 0);
+		}
+	}
+
+	void process() {
+		Request request;
+		while (true) {
+			std::unique_lock<std::mutex> guard(verbQueueLock);
+			if (!verbQueue.pop(request)) {
+				verbQueueActive = false;
+				break;
+			}
+			guard.unlock();
+
+			uint32_t response = 0;
+			auto status = provider.single(request.nid, request.verb, request.param, response);
+			complete(request, status, response);
+		}
+	}
+
+	void complete(const Request &request, IOReturn status, uint32_t response) {
+		std::lock_guard<std::mutex> guard(completionLock);
+		auto &completion = completions[request.id];
+		completion.status = status;
+		completion.response = response;
+		completion.order = completionCount++;
+		completion.count++;
+		completed.notify_all();
+	}
+
+	void wait(size_t num) {
+		std::unique_lock<std::mutex> guard(completionLock);
+		completed.wait(guard, [&]() { return completionCount >= num; });
+	}
+};
+
+/**
+ *  Three clients keep up to MaxQueuedVerbs verbs in flight, the last one closes half way
+ *  and gets its queued verbs aborted. Every submitted request must complete exactly once, in submission order per client, with the
+ *  response of its own coefficient.
+ */
+void testAsync() {
+	static constexpr size_t Clients = 3;
+	static constexpr size_t PerClient = 1000;
+	AsyncProvider async(Clients * PerClient);
+
+	std::vector<std::thread> clients;
+	std::atomic<size_t> rejected {0};
+	for (size_t c = 0; c < Clients; c++) {
+		clients.emplace_back([&, c]() {
+			for (size_t i = 0; i < PerClient; i++) {
+				if (c == Clients - 1 && i == PerClient / 2) {
+					async.cancel(c);
+					break;
+				}
+
+				AsyncProvider::Request request {c, c * PerClient + i, 0x20, HdaVerb::GetProcCoef, 0};
+				// A full queue is retried after letting some verbs complete, like alc-verb -a does.
+				while (async.submit(request) == kIOReturnNoResources) {
+					rejected++;
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+	for (auto &client : clients)
+		client.join();
+	static constexpr size_t Submitted = Clients * PerClient - PerClient / 2;
+	async.wait(Submitted);
+
+	size_t aborted = 0;
+	for (size_t c = 0; c < Clients; c++) {
+		size_t lastOrder = 0;
+		for (size_t i = 0; i < PerClient; i++) {
+			auto &completion = async.completions[c * PerClient + i];
+			if (c == Clients - 1 && i >= PerClient / 2) {
+				CHECK_EQ(completion.count, 0);
+				continue;
+			}
+			CHECK_EQ(completion.count, 1);
+			if (completion.status == kIOReturnAborted) {
+				aborted++;
+				CHECK_EQ(c, Clients - 1);
+				continue;
+			}
+			CHECK_EQ(completion.status, kIOReturnSuccess);
+			CHECK_EQ(completion.response, 0x8000);
+			CHECK(i == 0 || completion.order > lastOrder);
+			lastOrder = completion.order;
+		}
+	}
+
+	CHECK_EQ(async.completionCount, Submitted);
+	CHECK_EQ(async.provider.codec.verbs.load(), Submitted - aborted);
+	CHECK_EQ(async.provider.codec.overlaps.load(), 0);
+	CHECK_EQ(async.verbQueue.size(), 0);
+	printf("async: %zu verbs, %zu aborted, %zu submissions rejected by a full queue\n",
+		Submitted, aborted, rejected.load());
+}
+
+/**
+ *  Threads write a private value to a shared coefficient and read it back in one transaction,
+ *  while single verbs move the coefficient index. Any interleaving returns a foreign value.
+ */
+void testStress() {
+	static constexpr size_t Codecs = 2;
+	static constexpr size_t Threads = 8;
+	static constexpr size_t Iterations = 2000;
+
+	Provider providers[Codecs];
+	for (auto &provider : providers) {
+		provider.codec.buildAlc283();
+		provider.codec.yieldInside = true;
+	}
+
+	std::atomic<size_t> mismatches {0};
+	std::atomic<size_t> failures {0};
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < Threads; t++) {
+		threads.emplace_back([&, t]() {
+			for (size_t i = 0; i < Iterations; i++) {
+				auto &provider = providers[(t + i) % Codecs];
+				if (i % 4 == 3) {
+					uint32_t response = 0;
+					if (provider.single(0x20, HdaVerb::SetCoefIndex, static_cast<uint16_t>(0x40 + t), response) != kIOReturnSuccess)
+						failures++;
+					continue;
+				}
+
+				auto value = static_cast<uint16_t>((t << 12) | (i & 0xFFF));
+				const ALCVerbCommand commands[] {
+					{0x20, HdaVerb::SetCoefIndex, 0x10, 0},
+					{0x20, HdaVerb::SetProcCoef, value, 0},
+					{0x20, HdaVerb::SetCoefIndex, 0x10, 0},
+					{0x20, HdaVerb::GetProcCoef, 0, 0}
+				};
+				ALCVerbResult results[arrsize(commands)] {};
+				if (provider.transaction(commands, results, arrsize(commands)) != kIOReturnSuccess)
+					failures++;
+				else if (results[3].response != value)
+					mismatches++;
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	CHECK_EQ(failures.load(), 0);
+	CHECK_EQ(mismatches.load(), 0);
+	uint64_t verbs = 0;
+	for (auto &provider : providers) {
+		CHECK_EQ(provider.codec.overlaps.load(), 0);
+		verbs += provider.codec.verbs.load();
+	}
+	CHECK_EQ(verbs, Threads * Iterations / 4 * (3 * 4 + 1));
+}
+
+}
+
+int main() {
+	testAbort();
+	testStress();
+	testQueue();
+	testAsync();
+	return testResult("verbqueue_test");
+}
@@ -0,0 +1,283 @@
+//
+//  wake_test.cpp
+//  AppleALC Tests
+//
+//  Copyright © 2021 vit9696. All rights reserved.
+//
+
+#include "test.hpp"
+#include "sim_codec.hpp"
+
+#include <kern_wake.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+/**
+ *  Encode a verb the way ConfigData stores it: big endian, 12-bit verbs with an
+ *  8-bit payload and 4-bit verbs with a 16-bit payload
+ */
+void encode(std::vector<uint8_t> &data, uint32_t address, uint16_t nid, uint16_t verb, uint16_t param) {
+	uint32_t command = address << 28 | static_cast<uint32_t>(nid) << 20;
+	auto id = verb >> 8;
+	if (id == 0x7 || id == 0xF)
+		command |= static_cast<uint32_t>(verb) << 8 | (param & 0xFF);
+	else
+		command |= static_cast<uint32_t>(id) << 16 | param;
+	data.push_back(command >> 24);
+	data.push_back((command >> 16) & 0xFF);
+	data.push_back((command >> 8) & 0xFF);
+	data.push_back(command & 0xFF);
+}
+
+/**
+ *  Wake ConfigData of a ThinkCentre-like ALC283 layout: pin configs, pin controls,
+ *  EAPD, amps and a few vendor coefficients, plus one verb for a second codec
+ */
+std::vector<uint8_t> wakeConfigData() {
+	struct Pin {
+		uint16_t nid;
+		uint32_t config;
+	};
+	const Pin pins[] {
+		{0x12, 0x90A60130}, {0x14, 0x90170110}, {0x17, 0x411111F0}, {0x18, 0x411111F0},
+		{0x19, 0x04A11040}, {0x1A, 0x411111F0}, {0x1B, 0x411111F0}, {0x1D, 0x40400001},
+		{0x1E, 0x411111F0}, {0x21, 0x04211020}
+	};
+
+	std::vector<uint8_t> data;
+	for (auto &pin : pins)
+		for (uint16_t i = 0; i < 4; i++)
+			encode(data, 0, pin.nid, static_cast<uint16_t>(HdaVerb::SetConfigDefault0 + i), (pin.config >> (i * 8)) & 0xFF);
+	encode(data, 0, 0x14, HdaVerb::SetPinWidgetControl, 0x40);
+	encode(data, 0, 0x21, HdaVerb::SetPinWidgetControl, 0xC0);
+	encode(data, 0, 0x19, HdaVerb::SetPinWidgetControl, 0x24);
+	encode(data, 0, 0x14, HdaVerb::SetEapdBtlEnable, 0x02);
+	encode(data, 0, 0x0C, HdaVerb::SetConnectSel, 0x01);
+	encode(data, 0, 0x14, HdaVerb::SetAmpGainMute, HdaAmp::SetOutput | HdaAmp::SetLeft | HdaAmp::SetRight | 0x1F);
+	encode(data, 0, 0x08, HdaVerb::SetAmpGainMute, HdaAmp::SetInput | HdaAmp::SetLeft | HdaAmp::SetRight | 0x22);
+	const uint16_t coefs[][2] {{0x0F, 0x0E00}, {0x10, 0x0020}, {0x1A, 0x8801}};
+	for (auto &coef : coefs) {
+		encode(data, 0, 0x20, HdaVerb::SetCoefIndex, coef[0]);
+		encode(data, 0, 0x20, HdaVerb::SetProcCoef, coef[1]);
+	}
+	encode(data, 2, 0x03, HdaVerb::SetPinWidgetControl, 0x40);
+	return data;
+}
+
+/**
+ *  Check that the codec holds every value the wake ConfigData programs
+ */
+void checkConfigured(SimCodec &codec) {
+	CHECK_EQ(codec.peek(0x21, HdaVerb::GetConfigDefault), 0x04211020);
+	CHECK_EQ(codec.peek(0x12, HdaVerb::GetConfigDefault), 0x90A60130);
+	CHECK_EQ(codec.peek(0x21, HdaVerb::GetPinWidgetControl), 0xC0);
+	CHECK_EQ(codec.peek(0x14, HdaVerb::GetEapdBtlEnable), 0x02);
+	CHECK_EQ(codec.peek(0x0C, HdaVerb::GetConnectSel), 0x01);
+	CHECK_EQ(codec.peek(0x14, HdaVerb::GetAmpGainMute, HdaAmp::GetOutput | HdaAmp::GetLeft), 0x1F);
+	CHECK_EQ(codec.peek(0x14, HdaVerb::GetAmpGainMute, HdaAmp::GetOutput), 0x1F);
+	CHECK_EQ(codec.peek(0x08, HdaVerb::GetAmpGainMute, HdaAmp::GetLeft), 0x22);
+	CHECK_EQ(codec.peekCoef(0x20, 0x0F), 0x0E00);
+	CHECK_EQ(codec.peekCoef(0x20, 0x1A), 0x8801);
+	CHECK_EQ(codec.peek(0x03, HdaVerb::GetPinWidgetControl), 0);
+}
+
+void sleepCodec(SimCodec &codec) {
+	uint32_t response = 0;
+	codec.exec(SimCodec::Afg, 0x705, 3, &response);
+	codec.exec(SimCodec::Afg, 0x705, 0, &response);
+}
+
+void testDecode() {
+	auto data = wakeConfigData();
+	std::unique_ptr<CodecSnapshot> snapshot(CodecSnapshot::create());
+	std::vector<WakeReplay::Verb> verbs(data.size() / sizeof(uint32_t));
+	size_t tracked = 0;
+
+	auto num = WakeReplay::decode(data.data(), data.size(), false, 0, snapshot.get(), verbs.data(), tracked);
+	CHECK_EQ(num, verbs.size() - 1);
+	CHECK_EQ(verbs[0].nid, 0x12);
+	CHECK_EQ(verbs[0].verb, HdaVerb::SetConfigDefault0);
+	CHECK_EQ(verbs[0].param, 0x30);
+	CHECK(verbs[0].snapshot);
+	CHECK_EQ(verbs[num - 1].verb, HdaVerb::SetProcCoef);
+	CHECK_EQ(verbs[num - 1].param, 0x8801);
+	CHECK_EQ(verbs[num - 2].verb, HdaVerb::SetCoefIndex);
+	CHECK(!verbs[num - 2].snapshot);
+	// Every verb but the three coefficient index writes is covered by the snapshot.
+	CHECK_EQ(tracked, num - 3);
+	// 10 pin configs, 3 pin controls, EAPD, connection select, 4 amps and 3 coefficients.
+	CHECK_EQ(snapshot->count(), 10 + 3 + 1 + 1 + 4 + 3);
+
+	// Without a codec address every entry is kept, a truncated command is ignored.
+	auto all = WakeReplay::decode(data.data(), data.size() - 2, true, 0, nullptr, verbs.data(), tracked);
+	CHECK_EQ(all, verbs.size() - 1);
+	CHECK_EQ(verbs[all - 1].nid, 0x20);
+	CHECK_EQ(tracked, 0);
+}
+
+void testReplayFailures() {
+	SimCodec codec;
+	codec.buildAlc283();
+	auto data = wakeConfigData();
+	// A verb the codec rejects is counted, the rest still goes out.
+	std::vector<WakeReplay::Verb> verbs(data.size() / sizeof(uint32_t));
+	size_t tracked = 0;
+	auto num = WakeReplay::decode(data.data(), data.size(), true, 0, nullptr, verbs.data(), tracked);
+	verbs[0].verb = 0x100;
+	bool stateLost = false;
+	auto stats = WakeReplay::replay(verbs.data(), num, nullptr, SimCodec::Afg, stateLost, SimCodec::exec, &codec);
+	CHECK_EQ(stats.result, kIOReturnUnsupported);
+	CHECK_EQ(stats.failures, 1);
+	CHECK_EQ(stats.replayed, num);
+	CHECK_EQ(stats.checked, 0);
+	CHECK_EQ(codec.peek(0x21, HdaVerb::GetPinWidgetControl), 0xC0);
+}
+
+void testStateLost() {
+	auto data = wakeConfigData();
+	for (bool reportsReset : {true, false}) {
+		SimCodec codec;
+		codec.buildAlc283();
+		codec.losesStateInD3 = true;
+		codec.reportsReset = reportsReset;
+
+		std::unique_ptr<CodecSnapshot> snapshot(CodecSnapshot::create());
+		std::vector<WakeReplay::Verb> verbs(data.size() / sizeof(uint32_t));
+		size_t tracked = 0;
+		auto num = WakeReplay::decode(data.data(), data.size(), false, 0, snapshot.get(), verbs.data(), tracked);
+		bool stateLost = false;
+		WakeReplay::replay(verbs.data(), num, nullptr, 0, stateLost, SimCodec::exec, &codec);
+		CHECK_EQ(WakeReplay::findFunctionGroup(SimCodec::exec, &codec), SimCodec::Afg);
+
+		// A reset reported by the function group skips the readback right away, otherwise the diff gives it away.
+		snapshot->capture(SimCodec::exec, &codec);
+		sleepCodec(codec);
+		auto stats = WakeReplay::replay(verbs.data(), num, snapshot.get(), SimCodec::Afg, stateLost, SimCodec::exec, &codec);
+		CHECK_EQ(stats.result, kIOReturnSuccess);
+		CHECK(stateLost);
+		CHECK_EQ(stats.checked, reportsReset ? 0 : snapshot->count());
+		CHECK_EQ(stats.replayed, reportsReset ? num : num - tracked);
+		checkConfigured(codec);
+
+		// Later wakes send the verbs without asking the codec.
+		snapshot->capture(SimCodec::exec, &codec);
+		sleepCodec(codec);
+		auto verbsBefore = codec.verbs.load();
+		stats = WakeReplay::replay(verbs.data(), num, snapshot.get(), SimCodec::Afg, stateLost, SimCodec::exec, &codec);
+		CHECK_EQ(stats.checked, 0);
+		CHECK_EQ(stats.replayed, num);
+		CHECK_EQ(codec.verbs.load() - verbsBefore, num);
+		checkConfigured(codec);
+	}
+
+	// A codec keeping power is still restored from the snapshot.
+	SimCodec codec;
+	codec.buildAlc283();
+	std::unique_ptr<CodecSnapshot> snapshot(CodecSnapshot::create());
+	std::vector<WakeReplay::Verb> verbs(data.size() / sizeof(uint32_t));
+	size_t tracked = 0;
+	auto num = WakeReplay::decode(data.data(), data.size(), false, 0, snapshot.get(), verbs.data(), tracked);
+	bool stateLost = false;
+	WakeReplay::replay(verbs.data(), num, nullptr, 0, stateLost, SimCodec::exec, &codec);
+	snapshot->capture(SimCodec::exec, &codec);
+	sleepCodec(codec);
+	auto stats = WakeReplay::replay(verbs.data(), num, snapshot.get(), SimCodec::Afg, stateLost, SimCodec::exec, &codec);
+	CHECK(!stateLost);
+	CHECK_EQ(stats.checked, snapshot->count());
+	CHECK_EQ(stats.restored, 0);
+	CHECK_EQ(stats.replayed, num - tracked);
+}
+
+/**
+ *  Wake latency of the previous path re-sending the whole ConfigData through AppleHDA
+ *  against the decoded replay with and without the codec losing its state in D3.
+ *  Link time is simulated, host time covers decoding and snapshot bookkeeping.
+ *  The first wake, which finds out whether the codec keeps its state, is not measured.
+ */
+void testLatency() {
+	static constexpr size_t Wakes = 100;
+	auto data = wakeConfigData();
+
+	struct Path {
+		const char *name;
+		bool snapshot;
+		bool losesState;
+		bool reportsReset;
+	};
+	const Path paths[] {
+		{"reinit, every verb", false, true, true},
+		{"replay, state lost in D3", true, true, true},
+		{"replay, lost without flag", true, true, false},
+		{"replay, state kept in D3", true, false, true}
+	};
+
+	uint64_t verbsPerWake[arrsize(paths)] {};
+	uint64_t linkPerWake[arrsize(paths)] {};
+	printf("%-28s %10s %14s %12s\n", "wake path", "verbs", "link time us", "host ns");
+	for (size_t p = 0; p < arrsize(paths); p++) {
+		SimCodec codec;
+		codec.buildAlc283();
+		codec.losesStateInD3 = paths[p].losesState;
+		codec.reportsReset = paths[p].reportsReset;
+
+		std::unique_ptr<CodecSnapshot> snapshot(paths[p].snapshot ? CodecSnapshot::create() : nullptr);
+		std::vector<WakeReplay::Verb> verbs(data.size() / sizeof(uint32_t));
+		size_t tracked = 0;
+		auto num = WakeReplay::decode(data.data(), data.size(), false, 0, snapshot.get(), verbs.data(), tracked);
+
+		// Initial configuration at boot, done by AppleHDA in every case.
+		bool stateLost = false;
+		WakeReplay::replay(verbs.data(), num, nullptr, 0, stateLost, SimCodec::exec, &codec);
+		checkConfigured(codec);
+
+		uint64_t verbCount = 0, linkTime = 0, hostTime = 0;
+		for (size_t w = 0; w <= Wakes; w++) {
+			if (snapshot && !stateLost)
+				snapshot->capture(SimCodec::exec, &codec);
+			sleepCodec(codec);
+
+			auto verbsBefore = codec.verbs.load();
+			auto elapsedBefore = codec.elapsed.load();
+			auto start = getCurrentTimeNs();
+			auto stats = WakeReplay::replay(verbs.data(), num, snapshot.get(), SimCodec::Afg, stateLost, SimCodec::exec, &codec);
+			if (w > 0) {
+				hostTime += getCurrentTimeNs() - start;
+				verbCount += codec.verbs.load() - verbsBefore;
+				linkTime += codec.elapsed.load() - elapsedBefore;
+			}
+
+			CHECK_EQ(stats.result, kIOReturnSuccess);
+			if (snapshot)
+				CHECK_EQ(stateLost, paths[p].losesState);
+			if (snapshot && !paths[p].losesState)
+				CHECK_EQ(stats.restored, 0);
+			checkConfigured(codec);
+		}
+
+		verbsPerWake[p] = verbCount / Wakes;
+		linkPerWake[p] = linkTime / Wakes;
+		printf("%-28s %10llu %14.1f %12llu\n", paths[p].name, static_cast<unsigned long long>(verbsPerWake[p]),
+			linkPerWake[p] / 1e3, static_cast<unsigned long long>(hostTime / Wakes));
+	}
+
+	// Reads are as slow as writes on the link, so a lost state is sent in one batch like reinit does
+	// and no replay may take longer than it, a kept one is cheaper.
+	for (size_t p = 1; p < arrsize(paths); p++) {
+		CHECK(verbsPerWake[p] <= verbsPerWake[0]);
+		CHECK(linkPerWake[p] <= linkPerWake[0]);
+	}
+	CHECK(verbsPerWake[3] < verbsPerWake[0]);
+}
+
+}
+
+int main() {
+	testDecode();
+	testReplayFailures();
+	testStateLost();
+	testLatency();
+	return testResult("wake_test");
+}
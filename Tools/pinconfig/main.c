@@ -0,0 +1,645 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "plist.h"
+#include "verbopt.h"
+
+static const char *config_keys[] = { "ConfigData", "WakeConfigData" };
+
+static struct verbopt_codec *load_codec(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Failed to open codec dump %s.\n", path);
+		return NULL;
+	}
+
+	char error[256];
+	struct verbopt_codec *codec = verbopt_codec_load(file, error, sizeof(error));
+	fclose(file);
+	if (codec == NULL)
+		fprintf(stderr, "Failed to read codec dump %s: %s.\n", path, error);
+	return codec;
+}
+
+/* optimize one verb stream in place, returns false if the optimized stream does not match the original */
+static bool optimize_stream(uint32_t **verbs, size_t *count, struct verbopt_stats *stats)
+{
+	uint32_t *out = malloc(*count * sizeof(uint32_t) + 1);
+	if (out == NULL)
+		return false;
+
+	size_t written = verbopt_optimize(*verbs, *count, out, stats);
+	if (!verbopt_equivalent(*verbs, *count, out, written))
+	{
+		free(out);
+		return false;
+	}
+
+	free(*verbs);
+	*verbs = out;
+	*count = written;
+	return true;
+}
+
+static void print_verb(uint32_t value)
+{
+	unsigned nid = (value >> 20) & 0xff;
+	unsigned high = (value >> 16) & 0xf;
+	if (high == 0x7 || high == 0xf)
+		printf("0x%08x  cad %u nid 0x%02x verb 0x%03x param 0x%02x\n", value, value >> 28, nid, (value >> 8) & 0xfff, value & 0xff);
+	else
+		printf("0x%08x  cad %u nid 0x%02x verb 0x%x param 0x%04x\n", value, value >> 28, nid, high, value & 0xffff);
+}
+
+static int verbs_command(int argc, char **argv)
+{
+	const char *dump = NULL;
+	int c;
+	while ((c = getopt(argc, argv, "d:")) >= 0)
+	{
+		if (c != 'd')
+			return 1;
+		dump = optarg;
+	}
+
+	if (optind >= argc)
+	{
+		fprintf(stderr, "No verbs given.\n");
+		return 1;
+	}
+
+	/* either a list of 32-bit hex words or a single base64 ConfigData string */
+	size_t count = 0;
+	uint32_t *verbs = calloc((size_t)(argc - optind) + 1, sizeof(uint32_t));
+	bool hex = true;
+	for (int i = optind; i < argc && hex && verbs; i++)
+	{
+		char *end;
+		unsigned long value = strtoul(argv[i], &end, 16);
+		hex = *argv[i] != '\0' && *end == '\0' && value <= 0xFFFFFFFFUL;
+		verbs[count++] = (uint32_t)value;
+	}
+
+	if (verbs && !hex)
+	{
+		free(verbs);
+		size_t size = 0;
+		uint8_t *data = plist_base64_decode(argv[optind], strlen(argv[optind]), &size);
+		if (data == NULL || size % 4 != 0)
+		{
+			fprintf(stderr, "Verbs must be 32-bit hex words or base64 ConfigData.\n");
+			free(data);
+			return 1;
+		}
+		verbs = malloc(size + 1);
+		if (verbs)
+			count = verbopt_decode(data, size, verbs);
+		free(data);
+	}
+
+	if (verbs == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return 1;
+	}
+
+	struct verbopt_stats stats;
+	if (!optimize_stream(&verbs, &count, &stats))
+	{
+		fprintf(stderr, "Optimized verbs do not match the original, leaving them as is.\n");
+		free(verbs);
+		return 1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		print_verb(verbs[i]);
+
+	uint8_t *data = malloc(count * 4 + 1);
+	char *encoded = data ? (verbopt_encode(verbs, count, data), plist_base64_encode(data, count * 4)) : NULL;
+	if (encoded)
+		printf("%s\n", encoded);
+	fprintf(stderr, "%zu verbs in, %zu out, %zu overwritten, %zu D0 writes moved ahead\n",
+		stats.input, stats.output, stats.overwritten, stats.hoisted);
+	free(encoded);
+	free(data);
+
+	int ret = 0;
+	if (dump)
+	{
+		struct verbopt_codec *codec = load_codec(dump);
+		if (codec == NULL || verbopt_validate(codec, verbs, count, stderr, "verbs") > 0)
+			ret = 1;
+		verbopt_codec_free(codec);
+	}
+
+	free(verbs);
+	return ret;
+}
+
+struct optimize_totals
+{
+	struct verbopt_stats stats;
+	size_t streams;		/* ConfigData and WakeConfigData values seen */
+	size_t changed;		/* streams rewritten */
+	size_t skipped;		/* streams left as is */
+	size_t errors;		/* verbs rejected by the codec dump */
+};
+
+static void entry_name(const plist_t *entry, char *name, size_t size)
+{
+	const plist_t *codec_id = plist_dict_get(entry, "CodecID");
+	const plist_t *layout_id = plist_dict_get(entry, "LayoutID");
+	snprintf(name, size, "codec 0x%08llx layout %lld",
+		codec_id && codec_id->type == PLIST_INTEGER ? (unsigned long long)codec_id->integer & 0xFFFFFFFFULL : 0ULL,
+		layout_id && layout_id->type == PLIST_INTEGER ? layout_id->integer : -1LL);
+}
+
+/* optimize the verb streams of one HDAConfigDefault entry in place, returns false if out of memory */
+static bool optimize_entry(plist_t *entry, const struct verbopt_codec *codec, struct optimize_totals *totals)
+{
+	plist_t *codec_id = plist_dict_get(entry, "CodecID");
+	char name[64];
+	entry_name(entry, name, sizeof(name));
+
+	for (size_t k = 0; k < sizeof(config_keys) / sizeof(config_keys[0]); k++)
+	{
+		plist_t *value = plist_dict_get(entry, config_keys[k]);
+		if (value == NULL || value->type != PLIST_DATA)
+			continue;
+
+		totals->streams++;
+		if (value->size % 4 != 0)
+		{
+			fprintf(stderr, "%s: %s is not made of 32-bit verbs, leaving it as is\n", name, config_keys[k]);
+			totals->skipped++;
+			continue;
+		}
+
+		size_t count = value->size / 4;
+		uint32_t *verbs = malloc(value->size + 1);
+		if (verbs == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory.\n");
+			return false;
+		}
+		verbopt_decode(value->data, value->size, verbs);
+
+		struct verbopt_stats stats;
+		if (!optimize_stream(&verbs, &count, &stats))
+		{
+			fprintf(stderr, "%s: optimized %s does not match the original, leaving it as is\n", name, config_keys[k]);
+			totals->skipped++;
+			free(verbs);
+			continue;
+		}
+
+		if (codec && codec_id && codec_id->type == PLIST_INTEGER &&
+			(uint32_t)codec_id->integer == verbopt_codec_id(codec))
+		{
+			char stream[96];
+			snprintf(stream, sizeof(stream), "%s %s", name, config_keys[k]);
+			totals->errors += verbopt_validate(codec, verbs, count, stderr, stream);
+		}
+
+		totals->stats.input += stats.input;
+		totals->stats.output += stats.output;
+		totals->stats.overwritten += stats.overwritten;
+		totals->stats.hoisted += stats.hoisted;
+
+		if (count * 4 != value->size || stats.hoisted > 0)
+		{
+			verbopt_encode(verbs, count, value->data);
+			value->size = count * 4;
+			totals->changed++;
+		}
+		free(verbs);
+	}
+
+	return true;
+}
+
+static void print_totals(const struct optimize_totals *totals)
+{
+	printf("%zu streams, %zu changed, %zu skipped: %zu verbs in, %zu out, %zu overwritten, %zu D0 writes moved ahead\n",
+		totals->streams, totals->changed, totals->skipped, totals->stats.input, totals->stats.output,
+		totals->stats.overwritten, totals->stats.hoisted);
+}
+
+static int optimize_command(int argc, char **argv)
+{
+	const char *dump = NULL;
+	bool dry_run = false;
+	int c;
+	while ((c = getopt(argc, argv, "nd:")) >= 0)
+	{
+		switch (c)
+		{
+			case 'n':
+				dry_run = true;
+				break;
+			case 'd':
+				dump = optarg;
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	if (optind + 1 != argc)
+	{
+		fprintf(stderr, "Expected a single Info.plist.\n");
+		return 1;
+	}
+
+	const char *path = argv[optind];
+	char error[256];
+	plist_t *root = plist_read(path, error, sizeof(error));
+	if (root == NULL)
+	{
+		fprintf(stderr, "Failed to read %s: %s.\n", path, error);
+		return 1;
+	}
+
+	plist_t *configs = plist_get_path(root, "IOKitPersonalities", "HDA Hardware Config Resource", "HDAConfigDefault", NULL);
+	if (configs == NULL || configs->type != PLIST_ARRAY)
+	{
+		fprintf(stderr, "%s has no HDAConfigDefault array.\n", path);
+		plist_free(root);
+		return 1;
+	}
+
+	struct verbopt_codec *codec = NULL;
+	if (dump && (codec = load_codec(dump)) == NULL)
+	{
+		plist_free(root);
+		return 1;
+	}
+
+	struct optimize_totals totals;
+	memset(&totals, 0, sizeof(totals));
+
+	for (size_t i = 0; i < configs->count; i++)
+	{
+		if (configs->items[i]->type == PLIST_DICT && !optimize_entry(configs->items[i], codec, &totals))
+		{
+			verbopt_codec_free(codec);
+			plist_free(root);
+			return 1;
+		}
+	}
+
+	print_totals(&totals);
+
+	int ret = totals.errors > 0 ? 1 : 0;
+	if (codec)
+		printf("%zu verbs rejected by the codec dump\n", totals.errors);
+
+	if (!dry_run && totals.changed > 0 && ret == 0 && plist_write(root, path) != 0)
+	{
+		fprintf(stderr, "Failed to write %s.\n", path);
+		ret = 1;
+	}
+
+	verbopt_codec_free(codec);
+	plist_free(root);
+	return ret;
+}
+
+/* (CodecID, LayoutID) index over merged HDAConfigDefault entries */
+struct entry_slot
+{
+	uint64_t key;
+	plist_t *entry;			/* NULL for an empty slot */
+	const char *source;
+	size_t position;
+};
+
+struct entry_index
+{
+	struct entry_slot *slots;
+	size_t mask;
+};
+
+static bool index_init(struct entry_index *index, size_t count)
+{
+	size_t size = 16;
+	while (size < count * 2)
+		size <<= 1;
+	index->mask = size - 1;
+	index->slots = calloc(size, sizeof(struct entry_slot));
+	return index->slots != NULL;
+}
+
+/* returns the slot holding key, or the empty slot to insert it at */
+static struct entry_slot *index_find(const struct entry_index *index, uint64_t key)
+{
+	size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & index->mask;
+	while (index->slots[i].entry != NULL && index->slots[i].key != key)
+		i = (i + 1) & index->mask;
+	return &index->slots[i];
+}
+
+struct merge_totals
+{
+	size_t added;			/* entries taken from PinConfigs */
+	size_t kept;			/* entries only present in Info.plist */
+	size_t duplicates;		/* identical entries dropped */
+	size_t replaced;		/* Info.plist entries replaced by different PinConfigs ones */
+	size_t conflicts;		/* different entries for the same codec and layout in one file */
+	size_t invalid;			/* entries without usable CodecID, LayoutID or verb data */
+};
+
+static bool validate_entry(const plist_t *entry, const char *source, size_t position)
+{
+	const char *problem = NULL;
+	const plist_t *codec_id = NULL, *layout_id = NULL;
+	if (entry->type != PLIST_DICT)
+		problem = "is not a dictionary";
+	else if ((codec_id = plist_dict_get(entry, "CodecID")) == NULL || codec_id->type != PLIST_INTEGER ||
+		codec_id->integer < 0 || codec_id->integer > 0xFFFFFFFFLL)
+		problem = "has no valid CodecID";
+	else if ((layout_id = plist_dict_get(entry, "LayoutID")) == NULL || layout_id->type != PLIST_INTEGER ||
+		layout_id->integer < 0 || layout_id->integer > 0xFFFFFFFFLL)
+		problem = "has no valid LayoutID";
+
+	for (size_t k = 0; !problem && k < sizeof(config_keys) / sizeof(config_keys[0]); k++)
+	{
+		const plist_t *value = plist_dict_get(entry, config_keys[k]);
+		if (value != NULL && value->type != PLIST_DATA)
+			problem = k == 0 ? "has ConfigData that is not data" : "has WakeConfigData that is not data";
+	}
+
+	if (problem)
+		fprintf(stderr, "%s: HDAConfigDefault entry %zu %s\n", source, position, problem);
+	return problem == NULL;
+}
+
+/* move the entries of configs into merged, configs is left with empty slots */
+static bool merge_entries(plist_t *configs, const char *source, bool primary, bool optimize,
+	struct entry_index *index, plist_t *merged, struct merge_totals *totals, struct optimize_totals *optimized)
+{
+	for (size_t i = 0; i < configs->count; i++)
+	{
+		plist_t *entry = configs->items[i];
+		if (!validate_entry(entry, source, i))
+		{
+			totals->invalid++;
+			continue;
+		}
+
+		if (optimize && !optimize_entry(entry, NULL, optimized))
+			return false;
+
+		uint64_t key = ((uint64_t)plist_dict_get(entry, "CodecID")->integer << 32) |
+			(uint64_t)plist_dict_get(entry, "LayoutID")->integer;
+		struct entry_slot *slot = index_find(index, key);
+		if (slot->entry != NULL)
+		{
+			char name[64];
+			entry_name(entry, name, sizeof(name));
+			if (plist_equal(slot->entry, entry))
+			{
+				totals->duplicates++;
+			}
+			else if (!primary && slot->source != source)
+			{
+				totals->replaced++;
+			}
+			else
+			{
+				/* AppleHDA uses the first entry, the same as ResourceConverter */
+				fprintf(stderr, "%s: entry %zu for %s conflicts with %s entry %zu, keeping the first one\n",
+					source, i, name, slot->source, slot->position);
+				totals->conflicts++;
+			}
+			continue;
+		}
+
+		if (plist_array_append(merged, entry) != 0)
+		{
+			fprintf(stderr, "Failed to allocate memory.\n");
+			return false;
+		}
+
+		configs->items[i] = NULL;
+		slot->key = key;
+		slot->entry = entry;
+		slot->source = source;
+		slot->position = i;
+		if (primary)
+			totals->added++;
+		else
+			totals->kept++;
+	}
+
+	return true;
+}
+
+/* detach the value of key from dict without freeing it */
+static plist_t *dict_take(plist_t *dict, const char *key)
+{
+	for (size_t i = 0; i < dict->count; i++)
+	{
+		if (strcmp(dict->keys[i], key) == 0)
+		{
+			plist_t *value = dict->items[i];
+			dict->items[i] = NULL;
+			plist_dict_remove(dict, key);
+			return value;
+		}
+	}
+	return NULL;
+}
+
+static int merge_command(int argc, char **argv)
+{
+	bool dry_run = false, force = false, optimize = true;
+	int c;
+	while ((c = getopt(argc, argv, "nfk")) >= 0)
+	{
+		switch (c)
+		{
+			case 'n':
+				dry_run = true;
+				break;
+			case 'f':
+				force = true;
+				break;
+			case 'k':
+				optimize = false;
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	if (optind + 2 != argc)
+	{
+		fprintf(stderr, "Expected AppleALC and PinConfigs Info.plist.\n");
+		return 1;
+	}
+
+	const char *info_path = argv[optind];
+	const char *pins_path = argv[optind + 1];
+	char error[256];
+	plist_t *info = plist_read(info_path, error, sizeof(error));
+	if (info == NULL)
+	{
+		fprintf(stderr, "Failed to read %s: %s.\n", info_path, error);
+		return 1;
+	}
+
+	plist_t *pins = plist_read(pins_path, error, sizeof(error));
+	if (pins == NULL)
+	{
+		fprintf(stderr, "Failed to read %s: %s.\n", pins_path, error);
+		plist_free(info);
+		return 1;
+	}
+
+	int ret = 1;
+	struct entry_index index = { NULL, 0 };
+	plist_t *merged = NULL, *personality = NULL;
+	plist_t *pins_personalities = plist_get_path(pins, "IOKitPersonalities", NULL);
+	plist_t *info_personalities = plist_get_path(info, "IOKitPersonalities", NULL);
+	plist_t *pins_configs = plist_get_path(pins, "IOKitPersonalities", "HDA Hardware Config Resource", "HDAConfigDefault", NULL);
+	if (pins_configs == NULL || pins_configs->type != PLIST_ARRAY)
+	{
+		fprintf(stderr, "%s has no HDAConfigDefault array.\n", pins_path);
+		goto done;
+	}
+
+	if (info_personalities == NULL || info_personalities->type != PLIST_DICT)
+	{
+		fprintf(stderr, "%s has no IOKitPersonalities.\n", info_path);
+		goto done;
+	}
+
+	/* entries left by an earlier merge are kept unless PinConfigs has its own */
+	plist_t *info_configs = plist_get_path(info_personalities, "HDA Hardware Config Resource", "HDAConfigDefault", NULL);
+	if (info_configs != NULL && info_configs->type != PLIST_ARRAY)
+		info_configs = NULL;
+
+	merged = plist_new(PLIST_ARRAY);
+	if (merged == NULL || !index_init(&index, pins_configs->count + (info_configs ? info_configs->count : 0)))
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto done;
+	}
+
+	struct merge_totals totals;
+	struct optimize_totals optimized;
+	memset(&totals, 0, sizeof(totals));
+	memset(&optimized, 0, sizeof(optimized));
+
+	if (!merge_entries(pins_configs, pins_path, true, optimize, &index, merged, &totals, &optimized) ||
+		(info_configs && !merge_entries(info_configs, info_path, false, optimize, &index, merged, &totals, &optimized)))
+		goto done;
+
+	printf("%zu entries: %zu from PinConfigs, %zu kept, %zu duplicates, %zu replaced, %zu conflicts, %zu invalid\n",
+		merged->count, totals.added, totals.kept, totals.duplicates, totals.replaced, totals.conflicts, totals.invalid);
+	if (optimize)
+		print_totals(&optimized);
+
+	if ((totals.conflicts > 0 || totals.invalid > 0) && !force)
+	{
+		fprintf(stderr, "Not merging, pass -f to keep the first of conflicting entries and skip invalid ones.\n");
+		goto done;
+	}
+
+	/* the PinConfigs personality replaces the AppleALC one, carrying the merged entries */
+	personality = dict_take(pins_personalities, "HDA Hardware Config Resource");
+	if (plist_dict_set(personality, "HDAConfigDefault", merged) != 0)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto done;
+	}
+	merged = NULL;
+
+	if (plist_dict_set(info_personalities, "HDA Hardware Config Resource", personality) != 0)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto done;
+	}
+	personality = NULL;
+
+	plist_t *libraries = plist_get_path(info, "OSBundleLibraries", NULL);
+	if (libraries != NULL && libraries->type == PLIST_DICT)
+		plist_dict_remove(libraries, "as.vit9696.PinConfigs");
+
+	ret = 0;
+	if (!dry_run && plist_write(info, info_path) != 0)
+	{
+		fprintf(stderr, "Failed to write %s.\n", info_path);
+		ret = 1;
+	}
+
+done:
+	free(index.slots);
+	plist_free(personality);
+	plist_free(merged);
+	plist_free(pins);
+	plist_free(info);
+	return ret;
+}
+
+static void usage(void)
+{
+	printf("alc-pinconfig for AppleALC\n");
+	printf("usage: alc-pinconfig optimize [-n] [-d codec.txt] Info.plist\n");
+	printf("       alc-pinconfig merge [-n] [-f] [-k] AppleALC-Info.plist PinConfigs-Info.plist\n");
+	printf("       alc-pinconfig verbs [-d codec.txt] verb [verb ...]\n");
+	printf("       alc-pinconfig verbs [-d codec.txt] base64\n");
+	printf("   optimize  Drop overwritten verbs from every ConfigData and WakeConfigData in place\n");
+	printf("   merge     Merge and optimize PinConfigs HDAConfigDefault entries into AppleALC\n");
+	printf("   verbs     Optimize and print a single verb stream\n");
+	printf("   -d <file> Validate verbs against an alc-verb --dump of the codec\n");
+	printf("   -f        Keep the first of conflicting entries and skip invalid ones\n");
+	printf("   -k        Keep verb streams as they are when merging\n");
+	printf("   -n        Only report what would change\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 1;
+	}
+
+	if (strcmp(argv[1], "optimize") == 0)
+		return optimize_command(argc - 1, argv + 1);
+	if (strcmp(argv[1], "merge") == 0)
+		return merge_command(argc - 1, argv + 1);
+	if (strcmp(argv[1], "verbs") == 0)
+		return verbs_command(argc - 1, argv + 1);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,789 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plist.h"
+
+#define PLIST_MAX_DEPTH		64
+
+struct parser
+{
+	const char *p;
+	const char *end;
+	const char *start;
+	char *error;
+	size_t error_size;
+};
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void parse_error(struct parser *ps, const char *message)
+{
+	if (ps->error[0] != '\0')
+		return;
+
+	size_t line = 1;
+	for (const char *c = ps->start; c < ps->p && c < ps->end; c++)
+		if (*c == '\n')
+			line++;
+	snprintf(ps->error, ps->error_size, "line %zu: %s", line, message);
+}
+
+static char *dup_range(const char *start, size_t length)
+{
+	char *s = malloc(length + 1);
+	if (s == NULL)
+		return NULL;
+	memcpy(s, start, length);
+	s[length] = '\0';
+	return s;
+}
+
+uint8_t *plist_base64_decode(const char *text, size_t length, size_t *size)
+{
+	uint8_t *out = malloc(length / 4 * 3 + 3);
+	if (out == NULL)
+		return NULL;
+
+	uint32_t acc = 0;
+	int bits = 0;
+	size_t n = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		char c = text[i];
+		if (isspace((unsigned char)c))
+			continue;
+		if (c == '=')
+			break;
+		const char *pos = strchr(base64_chars, c);
+		if (pos == NULL || c == '\0')
+		{
+			free(out);
+			return NULL;
+		}
+		acc = (acc << 6) | (uint32_t)(pos - base64_chars);
+		bits += 6;
+		if (bits >= 8)
+		{
+			bits -= 8;
+			out[n++] = (uint8_t)(acc >> bits);
+		}
+	}
+
+	*size = n;
+	return out;
+}
+
+char *plist_base64_encode(const uint8_t *data, size_t size)
+{
+	char *out = malloc((size + 2) / 3 * 4 + 1);
+	if (out == NULL)
+		return NULL;
+
+	size_t n = 0;
+	for (size_t i = 0; i < size; i += 3)
+	{
+		uint32_t v = (uint32_t)data[i] << 16;
+		if (i + 1 < size)
+			v |= (uint32_t)data[i + 1] << 8;
+		if (i + 2 < size)
+			v |= data[i + 2];
+		out[n++] = base64_chars[(v >> 18) & 0x3F];
+		out[n++] = base64_chars[(v >> 12) & 0x3F];
+		out[n++] = i + 1 < size ? base64_chars[(v >> 6) & 0x3F] : '=';
+		out[n++] = i + 2 < size ? base64_chars[v & 0x3F] : '=';
+	}
+	out[n] = '\0';
+	return out;
+}
+
+/* decode the XML entities plist writers produce */
+static char *unescape(const char *start, size_t length)
+{
+	char *out = malloc(length + 1);
+	if (out == NULL)
+		return NULL;
+
+	size_t n = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		if (start[i] != '&')
+		{
+			out[n++] = start[i];
+			continue;
+		}
+
+		static const struct { const char *name; char c; } entities[] =
+		{
+			{ "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' }
+		};
+
+		bool done = false;
+		for (size_t e = 0; e < sizeof(entities) / sizeof(entities[0]) && !done; e++)
+		{
+			size_t len = strlen(entities[e].name);
+			if (i + len <= length && strncmp(&start[i], entities[e].name, len) == 0)
+			{
+				out[n++] = entities[e].c;
+				i += len - 1;
+				done = true;
+			}
+		}
+
+		if (!done && i + 3 < length && start[i + 1] == '#')
+		{
+			/* only ASCII character references are expected in kext plists */
+			char *stop = NULL;
+			long c = start[i + 2] == 'x' ? strtol(&start[i + 3], &stop, 16) : strtol(&start[i + 2], &stop, 10);
+			if (stop != NULL && *stop == ';' && c > 0 && c < 0x80)
+			{
+				out[n++] = (char)c;
+				i = (size_t)(stop - start);
+				done = true;
+			}
+		}
+
+		if (!done)
+			out[n++] = '&';
+	}
+
+	out[n] = '\0';
+	return out;
+}
+
+/* skip whitespace, comments, processing instructions and the doctype */
+static void skip_misc(struct parser *ps)
+{
+	while (ps->p < ps->end)
+	{
+		if (isspace((unsigned char)*ps->p))
+		{
+			ps->p++;
+		}
+		else if (strncmp(ps->p, "<!--", 4) == 0)
+		{
+			const char *e = strstr(ps->p + 4, "-->");
+			ps->p = e != NULL ? e + 3 : ps->end;
+		}
+		else if (strncmp(ps->p, "<?", 2) == 0 || strncmp(ps->p, "<!", 2) == 0)
+		{
+			const char *e = strchr(ps->p, '>');
+			ps->p = e != NULL ? e + 1 : ps->end;
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+/* read <name ...>, </name> or <name/>, returns false on malformed input */
+static bool read_tag(struct parser *ps, char *name, size_t name_size, bool *closing, bool *empty)
+{
+	skip_misc(ps);
+	if (ps->p >= ps->end || *ps->p != '<')
+	{
+		parse_error(ps, "expected a tag");
+		return false;
+	}
+
+	ps->p++;
+	*closing = *ps->p == '/';
+	if (*closing)
+		ps->p++;
+
+	size_t n = 0;
+	while (ps->p < ps->end && !isspace((unsigned char)*ps->p) && *ps->p != '>' && *ps->p != '/')
+	{
+		if (n + 1 < name_size)
+			name[n++] = *ps->p;
+		ps->p++;
+	}
+	name[n] = '\0';
+
+	const char *e = memchr(ps->p, '>', (size_t)(ps->end - ps->p));
+	if (e == NULL)
+	{
+		parse_error(ps, "unterminated tag");
+		return false;
+	}
+
+	*empty = e > ps->p && e[-1] == '/';
+	ps->p = e + 1;
+	return true;
+}
+
+/* read text up to </name> */
+static bool read_text(struct parser *ps, const char *name, const char **start, size_t *length)
+{
+	char closing[32];
+	snprintf(closing, sizeof(closing), "</%s>", name);
+	const char *e = strstr(ps->p, closing);
+	if (e == NULL)
+	{
+		parse_error(ps, "missing closing tag");
+		return false;
+	}
+
+	*start = ps->p;
+	*length = (size_t)(e - ps->p);
+	ps->p = e + strlen(closing);
+	return true;
+}
+
+static plist_t *parse_value(struct parser *ps, const char *name, bool empty, int depth);
+
+static plist_t *parse_container(struct parser *ps, plist_t *node, const char *name, bool empty, int depth)
+{
+	bool dict = node->type == PLIST_DICT;
+	while (!empty)
+	{
+		char tag[32];
+		bool closing, tag_empty;
+		if (!read_tag(ps, tag, sizeof(tag), &closing, &tag_empty))
+			break;
+
+		if (closing)
+		{
+			if (strcmp(tag, name) == 0)
+				return node;
+			parse_error(ps, "unexpected closing tag");
+			break;
+		}
+
+		char *key = NULL;
+		if (dict)
+		{
+			const char *text;
+			size_t length;
+			if (strcmp(tag, "key") != 0 || tag_empty || !read_text(ps, "key", &text, &length))
+			{
+				parse_error(ps, "expected a key");
+				break;
+			}
+
+			key = unescape(text, length);
+			if (key == NULL || !read_tag(ps, tag, sizeof(tag), &closing, &tag_empty) || closing)
+			{
+				parse_error(ps, "expected a value");
+				free(key);
+				break;
+			}
+		}
+
+		plist_t *item = parse_value(ps, tag, tag_empty, depth + 1);
+		int ret = -1;
+		if (item != NULL)
+			ret = dict ? plist_dict_set(node, key, item) : plist_array_append(node, item);
+		free(key);
+		if (ret != 0)
+			break;
+	}
+
+	if (empty)
+		return node;
+
+	plist_free(node);
+	return NULL;
+}
+
+static plist_t *parse_value(struct parser *ps, const char *name, bool empty, int depth)
+{
+	if (depth > PLIST_MAX_DEPTH)
+	{
+		parse_error(ps, "nesting is too deep");
+		return NULL;
+	}
+
+	plist_t *node = NULL;
+	const char *text = "";
+	size_t length = 0;
+
+	if (strcmp(name, "dict") == 0 || strcmp(name, "array") == 0)
+	{
+		node = plist_new(name[0] == 'd' ? PLIST_DICT : PLIST_ARRAY);
+		return node != NULL ? parse_container(ps, node, name, empty, depth) : NULL;
+	}
+
+	if (strcmp(name, "true") == 0 || strcmp(name, "false") == 0)
+	{
+		if (!empty && !read_text(ps, name, &text, &length))
+			return NULL;
+		node = plist_new(PLIST_BOOL);
+		if (node != NULL)
+			node->boolean = name[0] == 't';
+		return node;
+	}
+
+	if (!empty && !read_text(ps, name, &text, &length))
+		return NULL;
+
+	if (strcmp(name, "string") == 0)
+	{
+		node = plist_new(PLIST_STRING);
+		if (node != NULL && (node->text = unescape(text, length)) == NULL)
+		{
+			plist_free(node);
+			node = NULL;
+		}
+	}
+	else if (strcmp(name, "integer") == 0)
+	{
+		char *value = dup_range(text, length);
+		char *stop = NULL;
+		node = value != NULL ? plist_new(PLIST_INTEGER) : NULL;
+		if (node != NULL)
+			node->integer = strtoll(value, &stop, strstr(value, "0x") != NULL ? 16 : 10);
+		if (node != NULL && (stop == value || (*stop != '\0' && !isspace((unsigned char)*stop))))
+		{
+			parse_error(ps, "invalid integer");
+			plist_free(node);
+			node = NULL;
+		}
+		free(value);
+	}
+	else if (strcmp(name, "real") == 0 || strcmp(name, "date") == 0)
+	{
+		node = plist_new(name[0] == 'r' ? PLIST_REAL : PLIST_DATE);
+		if (node != NULL && (node->text = dup_range(text, length)) == NULL)
+		{
+			plist_free(node);
+			node = NULL;
+		}
+	}
+	else if (strcmp(name, "data") == 0)
+	{
+		node = plist_new(PLIST_DATA);
+		if (node != NULL && (node->data = plist_base64_decode(text, length, &node->size)) == NULL)
+		{
+			parse_error(ps, "invalid base64 data");
+			plist_free(node);
+			node = NULL;
+		}
+	}
+	else
+	{
+		parse_error(ps, "unsupported value type");
+	}
+
+	return node;
+}
+
+plist_t *plist_read(const char *path, char *error, size_t error_size)
+{
+	error[0] = '\0';
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		snprintf(error, error_size, "cannot open file");
+		return NULL;
+	}
+
+	char *buffer = NULL;
+	size_t size = 0, capacity = 0;
+	while (true)
+	{
+		if (size + 4096 + 1 > capacity)
+		{
+			capacity = capacity ? capacity * 2 : 65536;
+			char *grown = realloc(buffer, capacity);
+			if (grown == NULL)
+			{
+				free(buffer);
+				fclose(f);
+				snprintf(error, error_size, "out of memory");
+				return NULL;
+			}
+			buffer = grown;
+		}
+
+		size_t n = fread(buffer + size, 1, 4096, f);
+		size += n;
+		if (n < 4096)
+			break;
+	}
+	fclose(f);
+	buffer[size] = '\0';
+
+	if (size >= 8 && memcmp(buffer, "bplist00", 8) == 0)
+	{
+		free(buffer);
+		snprintf(error, error_size, "binary plists are not supported, convert with plutil -convert xml1");
+		return NULL;
+	}
+
+	struct parser ps = { buffer, buffer + size, buffer, error, error_size };
+	plist_t *root = NULL;
+	char tag[32];
+	bool closing, empty;
+	if (read_tag(&ps, tag, sizeof(tag), &closing, &empty) && !closing && strcmp(tag, "plist") == 0 &&
+		read_tag(&ps, tag, sizeof(tag), &closing, &empty) && !closing)
+	{
+		root = parse_value(&ps, tag, empty, 0);
+		if (root != NULL && (!read_tag(&ps, tag, sizeof(tag), &closing, &empty) || !closing || strcmp(tag, "plist") != 0))
+		{
+			parse_error(&ps, "expected </plist>");
+			plist_free(root);
+			root = NULL;
+		}
+	}
+	else
+	{
+		parse_error(&ps, "expected <plist>");
+	}
+
+	free(buffer);
+	return root;
+}
+
+static void write_escaped(FILE *f, const char *s)
+{
+	for (; *s; s++)
+	{
+		if (*s == '&')
+			fputs("&amp;", f);
+		else if (*s == '<')
+			fputs("&lt;", f);
+		else if (*s == '>')
+			fputs("&gt;", f);
+		else
+			fputc(*s, f);
+	}
+}
+
+static void write_indent(FILE *f, int depth)
+{
+	for (int i = 0; i < depth; i++)
+		fputc('\t', f);
+}
+
+static void write_value(FILE *f, const plist_t *node, int depth)
+{
+	switch (node->type)
+	{
+		case PLIST_DICT:
+		case PLIST_ARRAY:
+		{
+			const char *name = node->type == PLIST_DICT ? "dict" : "array";
+			if (node->count == 0)
+			{
+				fprintf(f, "<%s/>\n", name);
+				break;
+			}
+			fprintf(f, "<%s>\n", name);
+			for (size_t i = 0; i < node->count; i++)
+			{
+				write_indent(f, depth + 1);
+				if (node->type == PLIST_DICT)
+				{
+					fputs("<key>", f);
+					write_escaped(f, node->keys[i]);
+					fputs("</key>\n", f);
+					write_indent(f, depth + 1);
+				}
+				write_value(f, node->items[i], depth + 1);
+			}
+			write_indent(f, depth);
+			fprintf(f, "</%s>\n", name);
+			break;
+		}
+		case PLIST_STRING:
+			fputs("<string>", f);
+			write_escaped(f, node->text);
+			fputs("</string>\n", f);
+			break;
+		case PLIST_INTEGER:
+			fprintf(f, "<integer>%lld</integer>\n", node->integer);
+			break;
+		case PLIST_REAL:
+			fprintf(f, "<real>%s</real>\n", node->text);
+			break;
+		case PLIST_DATE:
+			fprintf(f, "<date>%s</date>\n", node->text);
+			break;
+		case PLIST_BOOL:
+			fputs(node->boolean ? "<true/>\n" : "<false/>\n", f);
+			break;
+		case PLIST_DATA:
+		{
+			char *text = plist_base64_encode(node->data, node->size);
+			fprintf(f, "<data>%s</data>\n", text != NULL ? text : "");
+			free(text);
+			break;
+		}
+	}
+}
+
+int plist_write(const plist_t *root, const char *path)
+{
+	size_t length = strlen(path) + 5;
+	char *tmp = malloc(length);
+	if (tmp == NULL)
+		return -1;
+	snprintf(tmp, length, "%s.tmp", path);
+
+	FILE *f = fopen(tmp, "wb");
+	if (f == NULL)
+	{
+		free(tmp);
+		return -1;
+	}
+
+	fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", f);
+	fputs("<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n", f);
+	fputs("<plist version=\"1.0\">\n", f);
+	write_value(f, root, 0);
+	fputs("</plist>\n", f);
+
+	int ret = ferror(f) ? -1 : 0;
+	if (fclose(f) != 0)
+		ret = -1;
+	if (ret == 0)
+		ret = rename(tmp, path);
+	if (ret != 0)
+		remove(tmp);
+	free(tmp);
+	return ret;
+}
+
+plist_t *plist_new(plist_type_t type)
+{
+	plist_t *node = calloc(1, sizeof(*node));
+	if (node != NULL)
+		node->type = type;
+	return node;
+}
+
+plist_t *plist_new_data(const uint8_t *data, size_t size)
+{
+	plist_t *node = plist_new(PLIST_DATA);
+	if (node == NULL)
+		return NULL;
+
+	node->data = malloc(size ? size : 1);
+	if (node->data == NULL)
+	{
+		free(node);
+		return NULL;
+	}
+
+	if (size > 0)
+		memcpy(node->data, data, size);
+	node->size = size;
+	return node;
+}
+
+plist_t *plist_copy(const plist_t *node)
+{
+	plist_t *copy = plist_new(node->type);
+	if (copy == NULL)
+		return NULL;
+
+	copy->integer = node->integer;
+	copy->boolean = node->boolean;
+	bool failed = false;
+	if (node->text != NULL)
+		failed |= (copy->text = dup_range(node->text, strlen(node->text))) == NULL;
+	if (node->type == PLIST_DATA)
+	{
+		copy->data = malloc(node->size ? node->size : 1);
+		failed |= copy->data == NULL;
+		if (copy->data != NULL && node->size > 0)
+			memcpy(copy->data, node->data, node->size);
+		copy->size = node->size;
+	}
+
+	for (size_t i = 0; i < node->count && !failed; i++)
+	{
+		plist_t *item = plist_copy(node->items[i]);
+		if (item == NULL)
+			failed = true;
+		else if (node->type == PLIST_DICT)
+			failed = plist_dict_set(copy, node->keys[i], item) != 0;
+		else
+			failed = plist_array_append(copy, item) != 0;
+	}
+
+	if (failed)
+	{
+		plist_free(copy);
+		return NULL;
+	}
+
+	return copy;
+}
+
+bool plist_equal(const plist_t *a, const plist_t *b)
+{
+	if (a->type != b->type || a->count != b->count)
+		return false;
+
+	switch (a->type)
+	{
+		case PLIST_STRING:
+		case PLIST_REAL:
+		case PLIST_DATE:
+			return strcmp(a->text, b->text) == 0;
+		case PLIST_INTEGER:
+			return a->integer == b->integer;
+		case PLIST_BOOL:
+			return a->boolean == b->boolean;
+		case PLIST_DATA:
+			return a->size == b->size && (a->size == 0 || memcmp(a->data, b->data, a->size) == 0);
+		case PLIST_ARRAY:
+			for (size_t i = 0; i < a->count; i++)
+				if (!plist_equal(a->items[i], b->items[i]))
+					return false;
+			return true;
+		case PLIST_DICT:
+			/* key order does not matter */
+			for (size_t i = 0; i < a->count; i++)
+			{
+				const plist_t *other = plist_dict_get(b, a->keys[i]);
+				if (other == NULL || !plist_equal(a->items[i], other))
+					return false;
+			}
+			return true;
+	}
+
+	return false;
+}
+
+void plist_free(plist_t *node)
+{
+	if (node == NULL)
+		return;
+
+	for (size_t i = 0; i < node->count; i++)
+	{
+		if (node->keys != NULL)
+			free(node->keys[i]);
+		plist_free(node->items[i]);
+	}
+
+	free(node->keys);
+	free(node->items);
+	free(node->text);
+	free(node->data);
+	free(node);
+}
+
+static int reserve(plist_t *node)
+{
+	if (node->count < node->capacity)
+		return 0;
+
+	size_t capacity = node->capacity ? node->capacity * 2 : 8;
+	plist_t **items = realloc(node->items, capacity * sizeof(items[0]));
+	if (items == NULL)
+		return -1;
+	node->items = items;
+
+	if (node->type == PLIST_DICT)
+	{
+		char **keys = realloc(node->keys, capacity * sizeof(keys[0]));
+		if (keys == NULL)
+			return -1;
+		node->keys = keys;
+	}
+
+	node->capacity = capacity;
+	return 0;
+}
+
+plist_t *plist_dict_get(const plist_t *dict, const char *key)
+{
+	if (dict == NULL || dict->type != PLIST_DICT)
+		return NULL;
+
+	for (size_t i = 0; i < dict->count; i++)
+		if (strcmp(dict->keys[i], key) == 0)
+			return dict->items[i];
+	return NULL;
+}
+
+int plist_dict_set(plist_t *dict, const char *key, plist_t *value)
+{
+	for (size_t i = 0; i < dict->count; i++)
+	{
+		if (strcmp(dict->keys[i], key) == 0)
+		{
+			plist_free(dict->items[i]);
+			dict->items[i] = value;
+			return 0;
+		}
+	}
+
+	char *copy = dup_range(key, strlen(key));
+	if (copy == NULL || reserve(dict) != 0)
+	{
+		free(copy);
+		plist_free(value);
+		return -1;
+	}
+
+	dict->keys[dict->count] = copy;
+	dict->items[dict->count++] = value;
+	return 0;
+}
+
+void plist_dict_remove(plist_t *dict, const char *key)
+{
+	for (size_t i = 0; i < dict->count; i++)
+	{
+		if (strcmp(dict->keys[i], key) == 0)
+		{
+			free(dict->keys[i]);
+			plist_free(dict->items[i]);
+			memmove(&dict->keys[i], &dict->keys[i + 1], (dict->count - i - 1) * sizeof(dict->keys[0]));
+			memmove(&dict->items[i], &dict->items[i + 1], (dict->count - i - 1) * sizeof(dict->items[0]));
+			dict->count--;
+			return;
+		}
+	}
+}
+
+int plist_array_append(plist_t *array, plist_t *item)
+{
+	if (reserve(array) != 0)
+	{
+		plist_free(item);
+		return -1;
+	}
+
+	array->items[array->count++] = item;
+	return 0;
+}
+
+plist_t *plist_get_path(const plist_t *root, ...)
+{
+	va_list args;
+	va_start(args, root);
+	const plist_t *node = root;
+	const char *key;
+	while (node != NULL && (key = va_arg(args, const char *)) != NULL)
+		node = plist_dict_get(node, key);
+	va_end(args);
+	return (plist_t *)node;
+}
@@ -0,0 +1,87 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef plist_h
+#define plist_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal XML property list reader and writer, enough for kext Info.plist files.
+ * Dictionaries keep their key order, so unchanged files are written back as read.
+ */
+
+typedef enum
+{
+	PLIST_DICT,
+	PLIST_ARRAY,
+	PLIST_STRING,
+	PLIST_INTEGER,
+	PLIST_REAL,
+	PLIST_DATE,
+	PLIST_BOOL,
+	PLIST_DATA
+} plist_type_t;
+
+typedef struct plist
+{
+	plist_type_t type;
+	char *text;				/* string, real and date values */
+	long long integer;
+	bool boolean;
+	uint8_t *data;
+	size_t size;			/* data length */
+	size_t count;			/* dict and array items */
+	size_t capacity;
+	char **keys;			/* dict keys */
+	struct plist **items;	/* dict values and array items */
+} plist_t;
+
+/* read an XML plist, returns NULL and fills error on failure */
+plist_t *plist_read(const char *path, char *error, size_t error_size);
+
+/* write an XML plist atomically, returns 0 on success */
+int plist_write(const plist_t *root, const char *path);
+
+plist_t *plist_new(plist_type_t type);
+plist_t *plist_new_data(const uint8_t *data, size_t size);
+plist_t *plist_copy(const plist_t *node);
+void plist_free(plist_t *node);
+
+/* deep comparison, dictionary key order is ignored */
+bool plist_equal(const plist_t *a, const plist_t *b);
+
+plist_t *plist_dict_get(const plist_t *dict, const char *key);
+/* takes ownership of value, replacing an existing one */
+int plist_dict_set(plist_t *dict, const char *key, plist_t *value);
+void plist_dict_remove(plist_t *dict, const char *key);
+
+/* takes ownership of item */
+int plist_array_append(plist_t *array, plist_t *item);
+
+/* follow a path of dict keys, NULL terminated */
+plist_t *plist_get_path(const plist_t *root, ...);
+
+/* base64 helpers used for <data>, the results must be freed */
+uint8_t *plist_base64_decode(const char *text, size_t length, size_t *size);
+char *plist_base64_encode(const uint8_t *data, size_t size);
+
+#endif /* plist_h */
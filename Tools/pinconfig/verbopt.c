@@ -0,0 +1,536 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "verbopt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define VERB_SET_CONVERTER_FORMAT	0x2
+#define VERB_SET_AMP_GAIN_MUTE		0x3
+#define VERB_SET_PROC_COEF			0x4
+#define VERB_SET_COEF_INDEX			0x5
+
+#define VERB_GET_PARAMETER			0xf00
+#define VERB_SET_CONNECT_SEL		0x701
+#define VERB_SET_PROC_STATE			0x703
+#define VERB_SET_POWER_STATE		0x705
+#define VERB_SET_CHANNEL_STREAMID	0x706
+#define VERB_SET_PIN_WIDGET_CONTROL	0x707
+#define VERB_SET_UNSOLICITED_ENABLE	0x708
+#define VERB_SET_EAPD_BTLENABLE		0x70c
+#define VERB_SET_GPIO_DATA			0x715
+#define VERB_SET_GPIO_DIRECTION		0x717
+#define VERB_SET_CONFIG_DEFAULT_0	0x71c
+#define VERB_SET_CONFIG_DEFAULT_3	0x71f
+
+#define PARAM_VENDOR_ID				0x00
+#define PARAM_AUDIO_WIDGET_CAP		0x09
+#define PARAM_PIN_CAP				0x0c
+#define PARAM_CONNLIST_LEN			0x0e
+
+#define WCAP_IN_AMP					(1u << 1)
+#define WCAP_OUT_AMP				(1u << 2)
+#define WCAP_TYPE(caps)				(((caps) >> 20) & 0xf)
+#define WID_TYPE_PIN				0x4
+#define PINCAP_EAPD					(1u << 16)
+
+#define AMP_SET_OUTPUT				(1u << 15)
+#define AMP_SET_INPUT				(1u << 14)
+#define AMP_SET_LEFT				(1u << 13)
+#define AMP_SET_RIGHT				(1u << 12)
+
+enum verb_class
+{
+	VERB_STATE,		/* register write, only the last one matters */
+	VERB_AMP,		/* amp write, each channel only matters by its last write */
+	VERB_ORDERED,	/* kept in place relative to other ordered verbs */
+	VERB_BARRIER	/* nothing is dropped or moved across it */
+};
+
+struct verb
+{
+	unsigned cad;
+	unsigned nid;
+	unsigned id;		/* 12-bit verb id, or the 4-bit id for long payload verbs */
+	unsigned payload;
+	bool long_payload;
+};
+
+static struct verb verb_parse(uint32_t value)
+{
+	struct verb v;
+	v.cad = value >> 28;
+	v.nid = (value >> 20) & 0xff;
+	unsigned high = (value >> 16) & 0xf;
+	v.long_payload = high != 0x7 && high != 0xf;
+	if (v.long_payload)
+	{
+		v.id = high;
+		v.payload = value & 0xffff;
+	}
+	else
+	{
+		v.id = (value >> 8) & 0xfff;
+		v.payload = value & 0xff;
+	}
+	return v;
+}
+
+static enum verb_class verb_classify(const struct verb *v)
+{
+	if (v->long_payload)
+	{
+		switch (v->id)
+		{
+			case VERB_SET_AMP_GAIN_MUTE:
+				return VERB_AMP;
+			case VERB_SET_CONVERTER_FORMAT:
+			case VERB_SET_COEF_INDEX:
+			case VERB_SET_PROC_COEF:
+				return VERB_ORDERED;
+			default:
+				return VERB_BARRIER;
+		}
+	}
+
+	/* a node entering a low power state may lose its settings, nothing is dropped or moved across it */
+	if (v->id == VERB_SET_POWER_STATE && (v->payload & 0xf) != 0)
+		return VERB_BARRIER;
+
+	switch (v->id)
+	{
+		case VERB_SET_CONNECT_SEL:
+		case VERB_SET_PROC_STATE:
+		case VERB_SET_POWER_STATE:
+		case VERB_SET_CHANNEL_STREAMID:
+		case VERB_SET_PIN_WIDGET_CONTROL:
+		case VERB_SET_UNSOLICITED_ENABLE:
+		case VERB_SET_EAPD_BTLENABLE:
+			return VERB_STATE;
+		default:
+			if (v->id >= VERB_SET_CONFIG_DEFAULT_0 && v->id <= VERB_SET_CONFIG_DEFAULT_3)
+				return VERB_STATE;
+			/* GPIO writes are often pulses, keep every one of them */
+			if (v->id >= VERB_SET_GPIO_DATA && v->id <= VERB_SET_GPIO_DIRECTION)
+				return VERB_ORDERED;
+			return VERB_BARRIER;
+	}
+}
+
+/* register key, the amp channel bits select one of the amps an amp write may update */
+static uint32_t verb_key(const struct verb *v, unsigned amp_channel)
+{
+	return (v->cad << 26) | (v->nid << 18) | (v->id << 6) | amp_channel;
+}
+
+/* amp channels updated by an amp write as out/in << 5 | left/right << 4 | index */
+static size_t amp_channels(unsigned payload, unsigned channels[4])
+{
+	size_t count = 0;
+	unsigned index = (payload >> 8) & 0xf;
+	for (unsigned dir = 0; dir < 2; dir++)
+	{
+		if (!(payload & (dir ? AMP_SET_INPUT : AMP_SET_OUTPUT)))
+			continue;
+		for (unsigned side = 0; side < 2; side++)
+			if (payload & (side ? AMP_SET_RIGHT : AMP_SET_LEFT))
+				channels[count++] = (dir << 5) | (side << 4) | index;
+	}
+	return count;
+}
+
+static bool key_find(const uint32_t *keys, size_t count, uint32_t key)
+{
+	for (size_t i = 0; i < count; i++)
+		if (keys[i] == key)
+			return true;
+	return false;
+}
+
+size_t verbopt_decode(const uint8_t *data, size_t size, uint32_t *out)
+{
+	size_t count = size / 4;
+	for (size_t i = 0; i < count; i++)
+		out[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) | ((uint32_t)data[i * 4 + 2] << 8) | data[i * 4 + 3];
+	return count;
+}
+
+void verbopt_encode(const uint32_t *verbs, size_t count, uint8_t *out)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		out[i * 4] = verbs[i] >> 24;
+		out[i * 4 + 1] = (verbs[i] >> 16) & 0xff;
+		out[i * 4 + 2] = (verbs[i] >> 8) & 0xff;
+		out[i * 4 + 3] = verbs[i] & 0xff;
+	}
+}
+
+/* optimize verbs [start, end) which contain no barrier */
+static size_t optimize_segment(const uint32_t *verbs, size_t start, size_t end, uint32_t *out, uint32_t *keys, bool *live, struct verbopt_stats *stats)
+{
+	size_t key_count = 0;
+
+	/* walk backwards, a write is dead when every register it touches is written again later */
+	for (size_t i = end; i-- > start;)
+	{
+		struct verb v = verb_parse(verbs[i]);
+		enum verb_class cls = verb_classify(&v);
+		live[i - start] = true;
+
+		if (cls == VERB_STATE)
+		{
+			uint32_t key = verb_key(&v, 0);
+			if (key_find(keys, key_count, key))
+				live[i - start] = false;
+			else
+				keys[key_count++] = key;
+		}
+		else if (cls == VERB_AMP)
+		{
+			unsigned channels[4];
+			size_t num = amp_channels(v.payload, channels);
+			bool covered = num > 0;
+			for (size_t c = 0; c < num; c++)
+			{
+				uint32_t key = verb_key(&v, channels[c]);
+				if (!key_find(keys, key_count, key))
+				{
+					covered = false;
+					keys[key_count++] = key;
+				}
+			}
+			live[i - start] = !covered;
+		}
+
+		if (!live[i - start])
+			stats->overwritten++;
+	}
+
+	/* D0 writes go first so that the other writes reach powered widgets, function groups first */
+	size_t count = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		bool seen_other = false;
+		for (size_t i = start; i < end; i++)
+		{
+			if (!live[i - start])
+				continue;
+			struct verb v = verb_parse(verbs[i]);
+			bool power = !v.long_payload && v.id == VERB_SET_POWER_STATE;
+			if (power && (v.nid == 1) == (pass == 0))
+			{
+				out[count++] = verbs[i];
+				if (seen_other)
+					stats->hoisted++;
+			}
+			else if (!power || pass == 0)
+			{
+				seen_other = true;
+			}
+		}
+	}
+
+	for (size_t i = start; i < end; i++)
+	{
+		if (!live[i - start])
+			continue;
+		struct verb v = verb_parse(verbs[i]);
+		if (v.long_payload || v.id != VERB_SET_POWER_STATE)
+			out[count++] = verbs[i];
+	}
+
+	return count;
+}
+
+size_t verbopt_optimize(const uint32_t *verbs, size_t count, uint32_t *out, struct verbopt_stats *stats)
+{
+	struct verbopt_stats unused;
+	if (stats == NULL)
+		stats = &unused;
+	memset(stats, 0, sizeof(*stats));
+	stats->input = count;
+
+	/* an amp write may add up to four keys */
+	uint32_t *keys = malloc(count * 4 * sizeof(uint32_t) + 1);
+	bool *live = malloc(count + 1);
+	if (keys == NULL || live == NULL)
+	{
+		free(keys);
+		free(live);
+		memcpy(out, verbs, count * sizeof(uint32_t));
+		stats->output = count;
+		return count;
+	}
+
+	size_t written = 0, start = 0;
+	for (size_t i = 0; i <= count; i++)
+	{
+		if (i < count)
+		{
+			struct verb v = verb_parse(verbs[i]);
+			if (verb_classify(&v) != VERB_BARRIER)
+				continue;
+		}
+
+		written += optimize_segment(verbs, start, i, out + written, keys, live, stats);
+		if (i < count)
+			out[written++] = verbs[i];
+		start = i + 1;
+	}
+
+	free(keys);
+	free(live);
+	stats->output = written;
+	return written;
+}
+
+/* per segment summary compared by verbopt_equivalent */
+struct sim_entry
+{
+	uint32_t key;
+	uint32_t value;
+};
+
+static int sim_compare(const void *a, const void *b)
+{
+	const struct sim_entry *x = a, *y = b;
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return 0;
+}
+
+struct sim
+{
+	struct sim_entry *state;	/* final register values */
+	size_t state_count;
+	uint32_t *ordered;			/* ordered verbs in order, closed by the barrier */
+	size_t ordered_count;
+};
+
+static void sim_set(struct sim *s, uint32_t key, uint32_t value)
+{
+	for (size_t i = 0; i < s->state_count; i++)
+	{
+		if (s->state[i].key == key)
+		{
+			s->state[i].value = value;
+			return;
+		}
+	}
+	s->state[s->state_count].key = key;
+	s->state[s->state_count].value = value;
+	s->state_count++;
+}
+
+/* simulate verbs up to and including the next barrier, returns the index after it */
+static size_t sim_segment(const uint32_t *verbs, size_t count, size_t start, struct sim *s)
+{
+	s->state_count = 0;
+	s->ordered_count = 0;
+
+	size_t i = start;
+	for (; i < count; i++)
+	{
+		struct verb v = verb_parse(verbs[i]);
+		enum verb_class cls = verb_classify(&v);
+		if (cls == VERB_STATE)
+		{
+			sim_set(s, verb_key(&v, 0), v.payload);
+		}
+		else if (cls == VERB_AMP)
+		{
+			unsigned channels[4];
+			size_t num = amp_channels(v.payload, channels);
+			for (size_t c = 0; c < num; c++)
+				sim_set(s, verb_key(&v, channels[c]), v.payload & 0xff);
+		}
+		else
+		{
+			s->ordered[s->ordered_count++] = verbs[i];
+			if (cls == VERB_BARRIER)
+				return i + 1;
+		}
+	}
+
+	return i;
+}
+
+bool verbopt_equivalent(const uint32_t *a, size_t a_count, const uint32_t *b, size_t b_count)
+{
+	size_t max = a_count > b_count ? a_count : b_count;
+	struct sim sa, sb;
+	sa.state = malloc(max * 4 * sizeof(struct sim_entry) + 1);
+	sb.state = malloc(max * 4 * sizeof(struct sim_entry) + 1);
+	sa.ordered = malloc(max * sizeof(uint32_t) + 1);
+	sb.ordered = malloc(max * sizeof(uint32_t) + 1);
+
+	bool equal = sa.state && sb.state && sa.ordered && sb.ordered;
+	size_t ia = 0, ib = 0;
+	while (equal && (ia < a_count || ib < b_count))
+	{
+		ia = sim_segment(a, a_count, ia, &sa);
+		ib = sim_segment(b, b_count, ib, &sb);
+
+		qsort(sa.state, sa.state_count, sizeof(struct sim_entry), sim_compare);
+		qsort(sb.state, sb.state_count, sizeof(struct sim_entry), sim_compare);
+
+		equal = sa.state_count == sb.state_count && sa.ordered_count == sb.ordered_count &&
+			memcmp(sa.state, sb.state, sa.state_count * sizeof(struct sim_entry)) == 0 &&
+			memcmp(sa.ordered, sb.ordered, sa.ordered_count * sizeof(uint32_t)) == 0;
+	}
+
+	free(sa.state);
+	free(sb.state);
+	free(sa.ordered);
+	free(sb.ordered);
+	return equal;
+}
+
+struct codec_node
+{
+	bool present;
+	bool has_caps;
+	uint32_t caps;
+	bool has_pin_caps;
+	uint32_t pin_caps;
+	bool has_conn_len;
+	uint32_t conn_len;
+};
+
+struct verbopt_codec
+{
+	uint32_t vendor_id;
+	struct codec_node nodes[256];
+};
+
+struct verbopt_codec *verbopt_codec_load(FILE *dump, char *error, size_t error_size)
+{
+	struct verbopt_codec *codec = calloc(1, sizeof(*codec));
+	if (codec == NULL)
+	{
+		snprintf(error, error_size, "out of memory");
+		return NULL;
+	}
+
+	char line[512];
+	size_t lineno = 0, values = 0;
+	while (fgets(line, sizeof(line), dump))
+	{
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\0')
+			continue;
+
+		unsigned nid, verb, param;
+		char response[32];
+		if (sscanf(line, "%x %x %x %31s", &nid, &verb, &param, response) != 4 || nid > 0xff)
+		{
+			snprintf(error, error_size, "line %zu is not in alc-verb --dump format", lineno);
+			free(codec);
+			return NULL;
+		}
+
+		struct codec_node *node = &codec->nodes[nid];
+		node->present = true;
+		values++;
+
+		/* reads the codec rejected tell that the node exists and nothing else */
+		unsigned long value;
+		char *end;
+		value = strtoul(response, &end, 16);
+		if (strncmp(response, "error:", 6) == 0 || *end != '\0' || verb != VERB_GET_PARAMETER)
+			continue;
+
+		if (nid == 0 && param == PARAM_VENDOR_ID)
+		{
+			codec->vendor_id = (uint32_t)value;
+		}
+		else if (param == PARAM_AUDIO_WIDGET_CAP)
+		{
+			node->has_caps = true;
+			node->caps = (uint32_t)value;
+		}
+		else if (param == PARAM_PIN_CAP)
+		{
+			node->has_pin_caps = true;
+			node->pin_caps = (uint32_t)value;
+		}
+		else if (param == PARAM_CONNLIST_LEN)
+		{
+			node->has_conn_len = true;
+			node->conn_len = (uint32_t)value & 0x7f;
+		}
+	}
+
+	if (values == 0)
+	{
+		snprintf(error, error_size, "codec dump is empty");
+		free(codec);
+		return NULL;
+	}
+
+	return codec;
+}
+
+uint32_t verbopt_codec_id(const struct verbopt_codec *codec)
+{
+	return codec->vendor_id;
+}
+
+void verbopt_codec_free(struct verbopt_codec *codec)
+{
+	free(codec);
+}
+
+size_t verbopt_validate(const struct verbopt_codec *codec, const uint32_t *verbs, size_t count, FILE *report, const char *name)
+{
+	size_t errors = 0;
+	unsigned first_cad = count > 0 ? verbs[0] >> 28 : 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		struct verb v = verb_parse(verbs[i]);
+		const struct codec_node *node = &codec->nodes[v.nid];
+		const char *problem = NULL;
+
+		if (v.cad != first_cad)
+			problem = "codec address differs from the rest of the stream";
+		else if (!node->present)
+			problem = "node does not exist";
+		else if (!v.long_payload && (v.id == VERB_SET_PIN_WIDGET_CONTROL || (v.id >= VERB_SET_CONFIG_DEFAULT_0 && v.id <= VERB_SET_CONFIG_DEFAULT_3)) &&
+			node->has_caps && WCAP_TYPE(node->caps) != WID_TYPE_PIN)
+			problem = "node is not a pin";
+		else if (!v.long_payload && v.id == VERB_SET_EAPD_BTLENABLE && node->has_pin_caps && !(node->pin_caps & PINCAP_EAPD))
+			problem = "pin has no EAPD";
+		else if (!v.long_payload && v.id == VERB_SET_CONNECT_SEL && node->has_conn_len && v.payload >= node->conn_len)
+			problem = "connection index is out of range";
+		else if (v.long_payload && v.id == VERB_SET_AMP_GAIN_MUTE && node->has_caps &&
+			(((v.payload & AMP_SET_OUTPUT) && !(node->caps & WCAP_OUT_AMP)) || ((v.payload & AMP_SET_INPUT) && !(node->caps & WCAP_IN_AMP))))
+			problem = "node has no such amplifier";
+
+		if (problem)
+		{
+			errors++;
+			fprintf(report, "%s: verb %zu (0x%08x): %s\n", name, i, verbs[i], problem);
+		}
+	}
+
+	return errors;
+}
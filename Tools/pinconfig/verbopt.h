@@ -0,0 +1,80 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef verbopt_h
+#define verbopt_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ConfigData / WakeConfigData verb stream optimizer.
+ *
+ * Streams are packed big-endian 32-bit HDA commands. Writes to plain state registers
+ * (pin controls, EAPD, connection selects, power states, GPIO, amps and config default
+ * bytes) only matter by their last value, so earlier writes to the same register are
+ * dropped and D0 power state writes are moved ahead of the rest of their segment. Other
+ * verbs keep their relative order, codec resets and writes of any other power state
+ * split the stream into segments nothing is moved across. The optimizer is
+ * deterministic, running it twice gives the same stream.
+ */
+
+struct verbopt_stats
+{
+	size_t input;			/* verbs read */
+	size_t output;			/* verbs written */
+	size_t overwritten;		/* writes dropped because the register is written again */
+	size_t hoisted;			/* D0 power state writes moved ahead */
+};
+
+/* decode a packed big-endian stream, out must hold size / 4 verbs */
+size_t verbopt_decode(const uint8_t *data, size_t size, uint32_t *out);
+
+/* encode verbs into a packed big-endian stream of count * 4 bytes */
+void verbopt_encode(const uint32_t *verbs, size_t count, uint8_t *out);
+
+/* optimize count verbs into out, which must hold count verbs, returns the new count */
+size_t verbopt_optimize(const uint32_t *verbs, size_t count, uint32_t *out, struct verbopt_stats *stats);
+
+/* check that two streams leave the codec in the same state, returns true if they do */
+bool verbopt_equivalent(const uint32_t *a, size_t a_count, const uint32_t *b, size_t b_count);
+
+/* codec capabilities loaded from an alc-verb --dump file */
+struct verbopt_codec;
+
+struct verbopt_codec *verbopt_codec_load(FILE *dump, char *error, size_t error_size);
+void verbopt_codec_free(struct verbopt_codec *codec);
+
+/* vendor and device id of the dumped codec, the CodecID of matching entries */
+uint32_t verbopt_codec_id(const struct verbopt_codec *codec);
+
+/* report verbs the codec cannot accept, returns the number of errors */
+size_t verbopt_validate(const struct verbopt_codec *codec, const uint32_t *verbs, size_t count, FILE *report, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* verbopt_h */
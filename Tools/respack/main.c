@@ -0,0 +1,188 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "respack.h"
+
+struct mapping
+{
+	void *data;
+	size_t size;
+};
+
+static bool map_pack(const char *path, struct mapping *map, struct respack *pack)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Failed to open %s.\n", path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		fprintf(stderr, "Failed to stat %s.\n", path);
+		close(fd);
+		return false;
+	}
+
+	map->size = (size_t)st.st_size;
+	map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->data == MAP_FAILED)
+	{
+		fprintf(stderr, "Failed to map %s.\n", path);
+		return false;
+	}
+
+	enum respack_status status = respack_open(pack, map->data, map->size);
+	if (status != RESPACK_OK)
+	{
+		fprintf(stderr, "Invalid pack %s: %s.\n", path, respack_status_name(status));
+		munmap(map->data, map->size);
+		return false;
+	}
+	return true;
+}
+
+static const char *kind_name(uint32_t kind)
+{
+	switch (kind)
+	{
+		case RESPACK_LAYOUT:		return "layout";
+		case RESPACK_PLATFORM:		return "platform";
+		case RESPACK_CONTROLLER:	return "controller";
+	}
+	return "unknown";
+}
+
+static bool parse_kind(const char *name, uint32_t *kind)
+{
+	for (uint32_t k = RESPACK_LAYOUT; k <= RESPACK_CONTROLLER; k++)
+	{
+		if (strcmp(name, kind_name(k)) == 0)
+		{
+			*kind = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void print_entry(const struct respack *pack, const struct respack_entry *entry)
+{
+	printf("%-10s %04x:%04x %3u kernel %2u-%-2u %7u bytes at 0x%08x crc %08x\n", kind_name(entry->kind),
+		entry->id >> 16, entry->id & 0xffff, entry->sub, entry->min_kernel, entry->max_kernel, entry->size,
+		pack->header->blob_offset + entry->offset, entry->crc);
+
+	struct respack_controller_view ctrl;
+	if (!respack_controller(pack, entry, &ctrl))
+		return;
+
+	const uint8_t *cursor = ctrl.patches;
+	struct respack_patch_view patch;
+	while (respack_next_patch(&ctrl, &cursor, &patch))
+		printf("           patch kext %u, %u bytes, count %u, kernel %u-%u\n", patch.kext, patch.size, patch.count, patch.min_kernel, patch.max_kernel);
+}
+
+static int info_command(int argc, char **argv)
+{
+	if (argc != 2)
+		return -1;
+
+	struct mapping map;
+	struct respack pack;
+	if (!map_pack(argv[1], &map, &pack))
+		return 1;
+
+	const struct respack_header *header = pack.header;
+	printf("version %u.%u, %u bytes, %u entries, %u blob bytes, %u kexts, build %08x\n", header->major, header->minor,
+		header->total_size, header->entry_count, header->blob_size, header->kext_count, header->build_hash);
+	for (uint32_t i = 0; i < header->entry_count; i++)
+		print_entry(&pack, &pack.entries[i]);
+
+	munmap(map.data, map.size);
+	return 0;
+}
+
+static int find_command(int argc, char **argv)
+{
+	uint32_t kind;
+	unsigned vendor, device;
+	if (argc < 4 || argc > 5 || !parse_kind(argv[2], &kind) || sscanf(argv[3], "%x:%x", &vendor, &device) != 2)
+		return -1;
+
+	uint32_t sub = argc == 5 ? (uint32_t)strtoul(argv[4], NULL, 0) : 0;
+	uint32_t kernel = 0;
+	const char *env = getenv("RESPACK_KERNEL");
+	if (env != NULL)
+		kernel = (uint32_t)strtoul(env, NULL, 0);
+
+	struct mapping map;
+	struct respack pack;
+	if (!map_pack(argv[1], &map, &pack))
+		return 1;
+
+	const struct respack_entry *entry = respack_find(&pack, kind, (vendor << 16) | (device & 0xffff), sub, kernel);
+	if (entry != NULL)
+		print_entry(&pack, entry);
+	else
+		printf("not found\n");
+
+	munmap(map.data, map.size);
+	return entry != NULL ? 0 : 1;
+}
+
+static void usage(void)
+{
+	printf("alc-respack for AppleALC\n");
+	printf("usage: alc-respack info pack\n");
+	printf("       alc-respack find pack layout|platform|controller vendor:id [layout|ordinal]\n");
+	printf("   info   Verify a pack and list its entries\n");
+	printf("   find   Look up an entry, RESPACK_KERNEL selects the darwin major\n");
+}
+
+int main(int argc, char **argv)
+{
+	int ret = -1;
+	if (argc >= 2)
+	{
+		if (strcmp(argv[1], "info") == 0)
+			ret = info_command(argc - 1, argv + 1);
+		else if (strcmp(argv[1], "find") == 0)
+			ret = find_command(argc - 1, argv + 1);
+	}
+
+	if (ret < 0)
+	{
+		usage();
+		return 1;
+	}
+	return ret;
+}
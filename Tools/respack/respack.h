@@ -0,0 +1,197 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef respack_h
+#define respack_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "resource packs are little-endian"
+#endif
+
+/*
+ * External resource pack, a versioned image of layout, platform and controller resources
+ * the kext looks up in place instead of its compiled-in tables.
+ *
+ * The image starts with a header, followed by an index of fixed-size entries sorted by
+ * kind, id, sub-id and kernel range, and a blob area where every blob is aligned to
+ * RESPACK_ALIGN. The header, the index and every blob carry a CRC-32, all of which are
+ * verified once by respack_open, so lookups afterwards are plain binary searches that
+ * return pointers into the image. Everything is little-endian and 32-bit.
+ *
+ * A pack belongs to the kext build generated with it. The build hash covers the compiled-in
+ * tables and every pack entry, the kext ignores packs with a different one.
+ *
+ * The reader does not allocate and only depends on the compiler, it is built into the kext.
+ */
+
+#define RESPACK_MAGIC			0x4b504c41	/* "ALPK" */
+#define RESPACK_VERSION_MAJOR	1
+#define RESPACK_VERSION_MINOR	0
+#define RESPACK_ALIGN			16
+
+enum respack_kind
+{
+	RESPACK_LAYOUT = 1,		/* id (vendor << 16) | codec, sub layout-id, blob layout file */
+	RESPACK_PLATFORM = 2,	/* id (vendor << 16) | codec, sub layout-id, blob platform file */
+	RESPACK_CONTROLLER = 3	/* id (vendor << 16) | device, sub ordinal of entries with the id, blob struct respack_controller */
+};
+
+enum respack_status
+{
+	RESPACK_OK,
+	RESPACK_TRUNCATED,		/* image smaller than it claims */
+	RESPACK_MISALIGNED,		/* image not 4-byte aligned in memory */
+	RESPACK_BAD_MAGIC,
+	RESPACK_BAD_VERSION,	/* unsupported major version */
+	RESPACK_BAD_LAYOUT,		/* index or blob area out of bounds or misaligned */
+	RESPACK_BAD_CHECKSUM,
+	RESPACK_BAD_ENTRY,		/* unknown kind, blob out of bounds or malformed controller */
+	RESPACK_UNSORTED		/* index not strictly sorted */
+};
+
+struct respack_header
+{
+	uint32_t magic;
+	uint16_t major;
+	uint16_t minor;
+	uint32_t header_size;
+	uint32_t total_size;
+	uint32_t entry_count;
+	uint32_t index_offset;
+	uint32_t blob_offset;
+	uint32_t blob_size;
+	uint32_t kext_count;	/* patched kexts controller patches refer to by index */
+	uint32_t build_hash;	/* ADDPR(resourceBuildHash) of the kext build the pack was generated with */
+	uint32_t index_crc;
+	uint32_t header_crc;	/* of the header with header_crc set to 0 */
+};
+
+struct respack_entry
+{
+	uint32_t kind;
+	uint32_t id;
+	uint32_t sub;
+	uint32_t min_kernel;	/* darwin major, 0 for any */
+	uint32_t max_kernel;	/* darwin major, 0 for any */
+	uint32_t offset;		/* from the blob area */
+	uint32_t size;
+	uint32_t crc;
+};
+
+/* controller blob, followed by revisions and patch_count patches */
+struct respack_controller
+{
+	uint32_t platform;		/* AAPL,ig-platform-id, 0 for any */
+	int32_t model;			/* WIOKit::ComputerModel mask */
+	uint32_t revision_count;
+	uint32_t patch_count;
+};
+
+/* controller patch, followed by size find bytes, size replace bytes and padding to 4 */
+struct respack_patch
+{
+	uint32_t kext;			/* index in the patched kext list */
+	uint32_t count;			/* replacements, 0 for all */
+	uint32_t min_kernel;
+	uint32_t max_kernel;
+	uint32_t size;
+};
+
+struct respack
+{
+	const uint8_t *data;
+	const struct respack_header *header;
+	const struct respack_entry *entries;
+	const uint8_t *blobs;
+};
+
+struct respack_controller_view
+{
+	uint32_t platform;
+	int32_t model;
+	const uint32_t *revisions;
+	uint32_t revision_count;
+	uint32_t patch_count;
+	const uint8_t *patches;
+	const uint8_t *end;
+};
+
+struct respack_patch_view
+{
+	uint32_t kext;
+	uint32_t count;
+	uint32_t min_kernel;
+	uint32_t max_kernel;
+	uint32_t size;
+	const uint8_t *find;
+	const uint8_t *replace;
+};
+
+/* CRC-32 (IEEE), pass 0 to start */
+uint32_t respack_crc32(uint32_t crc, const void *data, size_t size);
+
+/* validate an image and every blob in it, data must stay valid while pack is used */
+enum respack_status respack_open(struct respack *pack, const void *data, size_t size);
+
+const char *respack_status_name(enum respack_status status);
+
+/* find the entry matching kind, id and sub whose kernel range has kernel with the highest min_kernel, kernel 0 matches any */
+const struct respack_entry *respack_find(const struct respack *pack, uint32_t kind, uint32_t id, uint32_t sub, uint32_t kernel);
+
+const uint8_t *respack_blob(const struct respack *pack, const struct respack_entry *entry);
+
+/* decode a controller entry of an opened pack */
+bool respack_controller(const struct respack *pack, const struct respack_entry *entry, struct respack_controller_view *out);
+
+/* read the patch at cursor, which starts at ctrl->patches, returns false after the last one */
+bool respack_next_patch(const struct respack_controller_view *ctrl, const uint8_t **cursor, struct respack_patch_view *out);
+
+/* pack writer, not built into the kext */
+struct respack_writer;
+
+struct respack_writer *respack_writer_create(uint32_t kext_count);
+void respack_writer_free(struct respack_writer *writer);
+
+/* add a layout or platform file, returns false on allocation failure or a duplicate key */
+bool respack_writer_add(struct respack_writer *writer, uint32_t kind, uint32_t id, uint32_t sub,
+	uint32_t min_kernel, uint32_t max_kernel, const void *data, size_t size);
+
+/* add a controller with its patches, find and replace of each patch are read from the views */
+bool respack_writer_add_controller(struct respack_writer *writer, uint32_t id, uint32_t platform, int32_t model,
+	const uint32_t *revisions, uint32_t revision_count, const struct respack_patch_view *patches, uint32_t patch_count);
+
+/* continue a CRC-32 over the keys and checksums of all added entries, independent of the order of addition */
+uint32_t respack_writer_digest(struct respack_writer *writer, uint32_t crc);
+
+/* build the image with the given build hash, returns a malloc'd buffer or NULL */
+uint8_t *respack_writer_finish(struct respack_writer *writer, uint32_t build_hash, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* respack_h */
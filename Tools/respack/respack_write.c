@@ -0,0 +1,249 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "respack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct pending
+{
+	struct respack_entry entry;
+	uint8_t *data;
+};
+
+struct respack_writer
+{
+	struct pending *items;
+	size_t count;
+	size_t capacity;
+	uint32_t kext_count;
+};
+
+struct respack_writer *respack_writer_create(uint32_t kext_count)
+{
+	struct respack_writer *writer = calloc(1, sizeof(*writer));
+	if (writer != NULL)
+		writer->kext_count = kext_count;
+	return writer;
+}
+
+void respack_writer_free(struct respack_writer *writer)
+{
+	if (writer == NULL)
+		return;
+	for (size_t i = 0; i < writer->count; i++)
+		free(writer->items[i].data);
+	free(writer->items);
+	free(writer);
+}
+
+static bool push(struct respack_writer *writer, const struct respack_entry *entry, uint8_t *data)
+{
+	for (size_t i = 0; i < writer->count; i++)
+	{
+		const struct respack_entry *other = &writer->items[i].entry;
+		if (other->kind == entry->kind && other->id == entry->id && other->sub == entry->sub &&
+			other->min_kernel == entry->min_kernel && other->max_kernel == entry->max_kernel)
+			return false;
+	}
+
+	if (writer->count == writer->capacity)
+	{
+		size_t capacity = writer->capacity ? writer->capacity * 2 : 64;
+		struct pending *items = realloc(writer->items, capacity * sizeof(*items));
+		if (items == NULL)
+			return false;
+		writer->items = items;
+		writer->capacity = capacity;
+	}
+
+	writer->items[writer->count].entry = *entry;
+	writer->items[writer->count].data = data;
+	writer->count++;
+	return true;
+}
+
+bool respack_writer_add(struct respack_writer *writer, uint32_t kind, uint32_t id, uint32_t sub,
+	uint32_t min_kernel, uint32_t max_kernel, const void *data, size_t size)
+{
+	if ((kind != RESPACK_LAYOUT && kind != RESPACK_PLATFORM) || size > UINT32_MAX)
+		return false;
+
+	uint8_t *copy = malloc(size ? size : 1);
+	if (copy == NULL)
+		return false;
+	memcpy(copy, data, size);
+
+	struct respack_entry entry = { kind, id, sub, min_kernel, max_kernel, 0, (uint32_t)size, respack_crc32(0, copy, size) };
+	if (!push(writer, &entry, copy))
+	{
+		free(copy);
+		return false;
+	}
+	return true;
+}
+
+bool respack_writer_add_controller(struct respack_writer *writer, uint32_t id, uint32_t platform, int32_t model,
+	const uint32_t *revisions, uint32_t revision_count, const struct respack_patch_view *patches, uint32_t patch_count)
+{
+	uint64_t size = sizeof(struct respack_controller) + (uint64_t)revision_count * sizeof(uint32_t);
+	for (uint32_t i = 0; i < patch_count; i++)
+	{
+		if (patches[i].kext >= writer->kext_count || patches[i].size == 0)
+			return false;
+		size += sizeof(struct respack_patch) + (((uint64_t)patches[i].size * 2 + 3) & ~(uint64_t)3);
+	}
+	if (size > UINT32_MAX)
+		return false;
+
+	uint8_t *blob = calloc(1, (size_t)size);
+	if (blob == NULL)
+		return false;
+
+	struct respack_controller ctrl = { platform, model, revision_count, patch_count };
+	memcpy(blob, &ctrl, sizeof(ctrl));
+	uint8_t *pos = blob + sizeof(ctrl);
+	if (revision_count > 0)
+		memcpy(pos, revisions, revision_count * sizeof(uint32_t));
+	pos += revision_count * sizeof(uint32_t);
+	for (uint32_t i = 0; i < patch_count; i++)
+	{
+		struct respack_patch patch = { patches[i].kext, patches[i].count, patches[i].min_kernel, patches[i].max_kernel, patches[i].size };
+		memcpy(pos, &patch, sizeof(patch));
+		pos += sizeof(patch);
+		memcpy(pos, patches[i].find, patches[i].size);
+		memcpy(pos + patches[i].size, patches[i].replace, patches[i].size);
+		pos += ((size_t)patches[i].size * 2 + 3) & ~(size_t)3;
+	}
+
+	/* entries sharing a controller id are told apart by their order of addition */
+	uint32_t sub = 0;
+	for (size_t i = 0; i < writer->count; i++)
+		if (writer->items[i].entry.kind == RESPACK_CONTROLLER && writer->items[i].entry.id == id)
+			sub++;
+
+	struct respack_entry entry = { RESPACK_CONTROLLER, id, sub, 0, 0, 0, (uint32_t)size, respack_crc32(0, blob, (size_t)size) };
+	if (!push(writer, &entry, blob))
+	{
+		free(blob);
+		return false;
+	}
+	return true;
+}
+
+static int compare_pending(const void *a, const void *b)
+{
+	const struct respack_entry *x = &((const struct pending *)a)->entry;
+	const struct respack_entry *y = &((const struct pending *)b)->entry;
+	const uint32_t xk[] = { x->kind, x->id, x->sub, x->min_kernel, x->max_kernel };
+	const uint32_t yk[] = { y->kind, y->id, y->sub, y->min_kernel, y->max_kernel };
+	for (size_t i = 0; i < sizeof(xk) / sizeof(xk[0]); i++)
+		if (xk[i] != yk[i])
+			return xk[i] < yk[i] ? -1 : 1;
+	return 0;
+}
+
+static size_t align_up(size_t value)
+{
+	return (value + RESPACK_ALIGN - 1) & ~(size_t)(RESPACK_ALIGN - 1);
+}
+
+static void sort_pending(struct respack_writer *writer)
+{
+	if (writer->count > 0)
+		qsort(writer->items, writer->count, sizeof(*writer->items), compare_pending);
+}
+
+uint32_t respack_writer_digest(struct respack_writer *writer, uint32_t crc)
+{
+	sort_pending(writer);
+	for (size_t i = 0; i < writer->count; i++)
+	{
+		const struct respack_entry *entry = &writer->items[i].entry;
+		const uint32_t key[] = { entry->kind, entry->id, entry->sub, entry->min_kernel, entry->max_kernel, entry->size, entry->crc };
+		crc = respack_crc32(crc, key, sizeof(key));
+	}
+	return crc;
+}
+
+uint8_t *respack_writer_finish(struct respack_writer *writer, uint32_t build_hash, size_t *size)
+{
+	sort_pending(writer);
+
+	/* identical blobs, like a layout shared by two kernel ranges, are stored once */
+	size_t index_offset = sizeof(struct respack_header);
+	size_t blob_offset = align_up(index_offset + writer->count * sizeof(struct respack_entry));
+	size_t blob_size = 0;
+	for (size_t i = 0; i < writer->count; i++)
+	{
+		struct respack_entry *entry = &writer->items[i].entry;
+		size_t j = 0;
+		for (; j < i; j++)
+		{
+			const struct respack_entry *other = &writer->items[j].entry;
+			if (other->size == entry->size && other->crc == entry->crc &&
+				memcmp(writer->items[j].data, writer->items[i].data, entry->size) == 0)
+				break;
+		}
+
+		if (j < i)
+		{
+			entry->offset = writer->items[j].entry.offset;
+		}
+		else
+		{
+			entry->offset = (uint32_t)blob_size;
+			blob_size = align_up(blob_size + entry->size);
+		}
+	}
+
+	size_t total = blob_offset + blob_size;
+	if (total > UINT32_MAX)
+		return NULL;
+
+	uint8_t *image = calloc(1, total ? total : 1);
+	if (image == NULL)
+		return NULL;
+
+	struct respack_entry *entries = (struct respack_entry *)(image + index_offset);
+	for (size_t i = 0; i < writer->count; i++)
+	{
+		entries[i] = writer->items[i].entry;
+		memcpy(image + blob_offset + entries[i].offset, writer->items[i].data, entries[i].size);
+	}
+
+	struct respack_header *header = (struct respack_header *)image;
+	header->magic = RESPACK_MAGIC;
+	header->major = RESPACK_VERSION_MAJOR;
+	header->minor = RESPACK_VERSION_MINOR;
+	header->header_size = sizeof(struct respack_header);
+	header->total_size = (uint32_t)total;
+	header->entry_count = (uint32_t)writer->count;
+	header->index_offset = (uint32_t)index_offset;
+	header->blob_offset = (uint32_t)blob_offset;
+	header->blob_size = (uint32_t)blob_size;
+	header->kext_count = writer->kext_count;
+	header->build_hash = build_hash;
+	header->index_crc = respack_crc32(0, entries, writer->count * sizeof(struct respack_entry));
+	header->header_crc = respack_crc32(0, header, sizeof(*header));
+
+	*size = total;
+	return image;
+}
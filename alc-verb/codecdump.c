@@ -0,0 +1,506 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* the walker only talks to the codec through codec_dump_exec_t and builds anywhere */
+#ifdef __APPLE__
+#include <IOKit/IOReturn.h>
+#else
+#define kIOReturnSuccess	0
+#define kIOReturnAborted	0xe00002eb
+#endif
+
+#include "codecdump.h"
+#include "hdaverb.h"
+
+#define DUMP_HASH_SIZE		4096	/* power of two, well above a full codec */
+#define DUMP_MAX_NODES		256
+#define DUMP_DEFAULT_COEFS	0x80	/* vendor widgets commonly report no coefficient count */
+
+#define AC_WCAP_STEREO		(1 << 0)
+#define AC_WCAP_IN_AMP		(1 << 1)
+#define AC_WCAP_OUT_AMP		(1 << 2)
+#define AC_WCAP_AMP_OVRD	(1 << 3)
+#define AC_WCAP_FORMAT_OVRD	(1 << 4)
+#define AC_WCAP_PROC_WID	(1 << 6)
+#define AC_WCAP_CONN_LIST	(1 << 8)
+#define AC_WCAP_DIGITAL		(1 << 9)
+#define AC_WCAP_POWER		(1 << 10)
+
+#define AC_WID_AUD_OUT		0x0
+#define AC_WID_AUD_IN		0x1
+#define AC_WID_AUD_MIX		0x2
+#define AC_WID_AUD_SEL		0x3
+#define AC_WID_PIN			0x4
+
+#define AC_PINCAP_PRES_DETECT	(1 << 2)
+#define AC_PINCAP_EAPD			(1 << 16)
+
+#define AC_AMP_GET_OUTPUT	0x8000
+#define AC_AMP_GET_LEFT		0x2000
+
+enum
+{
+	READ_DONE		= 1 << 0,
+	READ_PENDING	= 1 << 1,
+	READ_CHAINED	= 1 << 2,	/* must run right after the previous read in the same transaction */
+	READ_HIDDEN		= 1 << 3,	/* helper verb, not printed */
+	READ_NOCACHE	= 1 << 4	/* result depends on codec state, never deduplicated */
+};
+
+struct dump_read
+{
+	uint16_t nid;
+	uint16_t verb;
+	uint16_t param;
+	uint16_t flags;
+	uint16_t sendVerb;	/* verb actually sent, differs for coefficient reads */
+	uint16_t sendParam;
+	uint32_t response;
+	uint32_t status;
+};
+
+struct dump_state
+{
+	codec_dump_exec_t exec;
+	void *ctx;
+	struct codec_dump_stats *stats;
+
+	struct dump_read *reads;
+	size_t count, capacity;
+
+	long hash[DUMP_HASH_SIZE];
+
+	size_t *pending;
+	size_t pendingCount;
+};
+
+static size_t dump_hash(uint16_t nid, uint16_t verb, uint16_t param)
+{
+	uint64_t key = ((uint64_t)nid << 32) | ((uint64_t)verb << 16) | param;
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(key >> 32) & (DUMP_HASH_SIZE - 1);
+}
+
+static long dump_add(struct dump_state *d, uint16_t nid, uint16_t verb, uint16_t param, uint16_t flags)
+{
+	if (d->count == d->capacity)
+	{
+		size_t capacity = d->capacity ? d->capacity * 2 : 1024;
+		struct dump_read *reads = realloc(d->reads, capacity * sizeof(reads[0]));
+		size_t *pending = realloc(d->pending, capacity * sizeof(pending[0]));
+		if (reads == NULL || pending == NULL)
+		{
+			if (reads != NULL)
+				d->reads = reads;
+			if (pending != NULL)
+				d->pending = pending;
+			fprintf(stderr, "Failed to allocate memory.\n");
+			return -1;
+		}
+		d->reads = reads;
+		d->pending = pending;
+		d->capacity = capacity;
+	}
+
+	struct dump_read *r = &d->reads[d->count];
+	memset(r, 0, sizeof(*r));
+	r->nid = nid;
+	r->verb = verb;
+	r->param = param;
+	r->sendVerb = verb;
+	r->sendParam = param;
+	r->flags = flags | READ_PENDING;
+	d->pending[d->pendingCount++] = d->count;
+	return (long)d->count++;
+}
+
+/* queue a read unless the same value was already requested */
+static long dump_read(struct dump_state *d, uint16_t nid, uint16_t verb, uint16_t param)
+{
+	size_t slot = dump_hash(nid, verb, param);
+	while (d->hash[slot] >= 0)
+	{
+		struct dump_read *r = &d->reads[d->hash[slot]];
+		if (r->nid == nid && r->verb == verb && r->param == param)
+		{
+			d->stats->duplicates++;
+			return d->hash[slot];
+		}
+		slot = (slot + 1) & (DUMP_HASH_SIZE - 1);
+	}
+
+	if (d->count >= DUMP_HASH_SIZE / 2)
+	{
+		fprintf(stderr, "Codec has too many values to dump.\n");
+		return -1;
+	}
+
+	long index = dump_add(d, nid, verb, param, 0);
+	if (index >= 0)
+		d->hash[slot] = index;
+	return index;
+}
+
+static long dump_param(struct dump_state *d, uint16_t nid, uint16_t param)
+{
+	return dump_read(d, nid, AC_VERB_PARAMETERS, param);
+}
+
+/* queue an indexed coefficient read, shown as GET_PROC_COEF with the index as param */
+static long dump_coef(struct dump_state *d, uint16_t nid, uint16_t index)
+{
+	if (dump_add(d, nid, AC_VERB_SET_COEF_INDEX, index, READ_HIDDEN | READ_NOCACHE) < 0)
+		return -1;
+
+	long coef = dump_add(d, nid, AC_VERB_GET_PROC_COEF, index, READ_CHAINED | READ_NOCACHE);
+	if (coef >= 0)
+		d->reads[coef].sendParam = 0;
+	return coef;
+}
+
+static bool dump_value(struct dump_state *d, long index, uint32_t *value)
+{
+	if (index < 0 || !(d->reads[index].flags & READ_DONE) || d->reads[index].status != kIOReturnSuccess)
+		return false;
+	*value = d->reads[index].response;
+	return true;
+}
+
+/* execute all queued reads in as few transactions as possible */
+static int dump_flush(struct dump_state *d)
+{
+	ALCVerbCommand commands[kMaxTransactionVerbs];
+	ALCVerbResult results[kMaxTransactionVerbs];
+	size_t batch[kMaxTransactionVerbs];
+
+	size_t head = 0;
+	while (head < d->pendingCount)
+	{
+		size_t count = 0;
+		while (head + count < d->pendingCount && count < kMaxTransactionVerbs)
+		{
+			/* never split a chained pair between transactions */
+			size_t next = head + count + 1;
+			if (count + 1 == kMaxTransactionVerbs && next < d->pendingCount &&
+				(d->reads[d->pending[next]].flags & READ_CHAINED))
+				break;
+
+			struct dump_read *r = &d->reads[d->pending[head + count]];
+			batch[count] = d->pending[head + count];
+			commands[count].nid = r->nid;
+			commands[count].verb = r->sendVerb;
+			commands[count].param = r->sendParam;
+			commands[count].flags = kVerbFlagNoWait;
+			count++;
+		}
+
+		if (d->exec(d->ctx, commands, results, count) != 0)
+			return 1;
+
+		d->stats->transactions++;
+
+		/* aborted reads go to the next transaction, a failed read fails its chained successor */
+		size_t done = 0;
+		bool failed = false;
+		for (size_t i = 0; i < count; i++)
+		{
+			struct dump_read *r = &d->reads[batch[i]];
+			bool aborted = results[i].status == kIOReturnAborted;
+			if (aborted && i > 0 && !(failed && (r->flags & READ_CHAINED)))
+				break;
+
+			r->response = results[i].response;
+			r->status = aborted && failed ? d->reads[batch[i - 1]].status : results[i].status;
+			r->flags = (r->flags & ~READ_PENDING) | READ_DONE;
+			failed = r->status != kIOReturnSuccess;
+			if (failed)
+				d->stats->failures++;
+			if (!(r->flags & READ_HIDDEN))
+				d->stats->reads++;
+			done = i + 1;
+		}
+
+		head += done;
+	}
+
+	d->pendingCount = 0;
+	return 0;
+}
+
+static const char *dump_name(struct strtbl *tbl, int val)
+{
+	for (; tbl->str; tbl++)
+		if (tbl->val == val)
+			return tbl->str;
+	return NULL;
+}
+
+static int dump_compare(const void *a, const void *b)
+{
+	const struct dump_read *x = a, *y = b;
+	if (x->nid != y->nid)
+		return x->nid < y->nid ? -1 : 1;
+	if (x->verb != y->verb)
+		return x->verb < y->verb ? -1 : 1;
+	if (x->param != y->param)
+		return x->param < y->param ? -1 : 1;
+	return 0;
+}
+
+static void dump_print(struct dump_state *d, FILE *out)
+{
+	size_t visible = 0;
+	for (size_t i = 0; i < d->count; i++)
+		if (!(d->reads[i].flags & READ_HIDDEN))
+			d->reads[visible++] = d->reads[i];
+	d->count = visible;
+
+	qsort(d->reads, d->count, sizeof(d->reads[0]), dump_compare);
+
+	fprintf(out, "# alc-verb codec dump: nid verb param response\n");
+	for (size_t i = 0; i < d->count; i++)
+	{
+		struct dump_read *r = &d->reads[i];
+		const char *verb = dump_name(hda_verbs, r->verb);
+		const char *param = r->verb == AC_VERB_PARAMETERS ? dump_name(hda_params, r->param) : NULL;
+
+		fprintf(out, "0x%02x 0x%03x 0x%04x ", r->nid, r->verb, r->param);
+		if (r->status != kIOReturnSuccess)
+			fprintf(out, "error:%08x", r->status);
+		else
+			fprintf(out, "0x%08x", r->response);
+		if (verb)
+			fprintf(out, " %s", verb);
+		if (param)
+			fprintf(out, " %s", param);
+		fprintf(out, "\n");
+	}
+}
+
+/* values every widget exposes depending on its capabilities */
+static void dump_widget_caps(struct dump_state *d, uint16_t nid, uint32_t wcaps, long *pincap, long *connlen, long *proccap)
+{
+	uint32_t type = (wcaps >> 20) & 0xf;
+
+	*pincap = *connlen = *proccap = -1;
+
+	if ((wcaps & AC_WCAP_AMP_OVRD) && (wcaps & AC_WCAP_IN_AMP))
+		dump_param(d, nid, AC_PAR_AMP_IN_CAP);
+	if ((wcaps & AC_WCAP_AMP_OVRD) && (wcaps & AC_WCAP_OUT_AMP))
+		dump_param(d, nid, AC_PAR_AMP_OUT_CAP);
+	if (wcaps & AC_WCAP_CONN_LIST)
+		*connlen = dump_param(d, nid, AC_PAR_CONNLIST_LEN);
+	if (wcaps & AC_WCAP_POWER)
+	{
+		dump_param(d, nid, AC_PAR_POWER_STATE);
+		dump_read(d, nid, AC_VERB_GET_POWER_STATE, 0);
+	}
+	if (wcaps & AC_WCAP_PROC_WID)
+	{
+		*proccap = dump_param(d, nid, AC_PAR_PROC_CAP);
+		dump_read(d, nid, AC_VERB_GET_PROC_STATE, 0);
+		dump_read(d, nid, AC_VERB_GET_COEF_INDEX, 0);
+	}
+
+	if ((wcaps & AC_WCAP_CONN_LIST) && type != AC_WID_AUD_MIX)
+		dump_read(d, nid, AC_VERB_GET_CONNECT_SEL, 0);
+
+	if (type == AC_WID_AUD_OUT || type == AC_WID_AUD_IN)
+	{
+		if (wcaps & AC_WCAP_FORMAT_OVRD)
+		{
+			dump_param(d, nid, AC_PAR_PCM);
+			dump_param(d, nid, AC_PAR_STREAM);
+		}
+		dump_read(d, nid, AC_VERB_GET_CONV, 0);
+		dump_read(d, nid, AC_VERB_GET_STREAM_FORMAT, 0);
+		if (type == AC_WID_AUD_IN)
+			dump_read(d, nid, AC_VERB_GET_SDI_SELECT, 0);
+	}
+
+	if ((type == AC_WID_AUD_OUT || type == AC_WID_AUD_IN || type == AC_WID_PIN) && (wcaps & AC_WCAP_DIGITAL))
+		dump_read(d, nid, AC_VERB_GET_DIGI_CONVERT_1, 0);
+
+	if (type == AC_WID_PIN)
+	{
+		*pincap = dump_param(d, nid, AC_PAR_PIN_CAP);
+		dump_read(d, nid, AC_VERB_GET_CONFIG_DEFAULT, 0);
+		dump_read(d, nid, AC_VERB_GET_PIN_WIDGET_CONTROL, 0);
+		dump_read(d, nid, AC_VERB_GET_UNSOLICITED_RESPONSE, 0);
+	}
+}
+
+/* values that need widget parameters read first */
+static void dump_widget_state(struct dump_state *d, uint16_t nid, uint32_t wcaps, long pincap, long connlen)
+{
+	uint32_t type = (wcaps >> 20) & 0xf;
+	uint32_t value = 0;
+	uint32_t conns = 0;
+
+	if (dump_value(d, connlen, &value))
+	{
+		bool longForm = (value & 0x80) != 0;
+		conns = value & 0x7f;
+		for (uint32_t i = 0; i < conns; i += longForm ? 2 : 4)
+			dump_read(d, nid, AC_VERB_GET_CONNECT_LIST, (uint16_t)i);
+	}
+
+	if (dump_value(d, pincap, &value))
+	{
+		if (value & AC_PINCAP_EAPD)
+			dump_read(d, nid, AC_VERB_GET_EAPD_BTLENABLE, 0);
+		if (value & AC_PINCAP_PRES_DETECT)
+			dump_read(d, nid, AC_VERB_GET_PIN_SENSE, 0);
+	}
+
+	if (wcaps & AC_WCAP_IN_AMP)
+	{
+		uint32_t inputs = type == AC_WID_PIN || conns == 0 ? 1 : conns;
+		for (uint32_t i = 0; i < inputs; i++)
+		{
+			dump_read(d, nid, AC_VERB_GET_AMP_GAIN_MUTE, (uint16_t)(AC_AMP_GET_LEFT | i));
+			if (wcaps & AC_WCAP_STEREO)
+				dump_read(d, nid, AC_VERB_GET_AMP_GAIN_MUTE, (uint16_t)i);
+		}
+	}
+
+	if (wcaps & AC_WCAP_OUT_AMP)
+	{
+		dump_read(d, nid, AC_VERB_GET_AMP_GAIN_MUTE, AC_AMP_GET_OUTPUT | AC_AMP_GET_LEFT);
+		if (wcaps & AC_WCAP_STEREO)
+			dump_read(d, nid, AC_VERB_GET_AMP_GAIN_MUTE, AC_AMP_GET_OUTPUT);
+	}
+}
+
+int codec_dump(FILE *out, codec_dump_exec_t exec, void *ctx, struct codec_dump_stats *stats)
+{
+	struct dump_state d = { .exec = exec, .ctx = ctx, .stats = stats };
+	uint16_t nodes[DUMP_MAX_NODES];
+	long wcaps[DUMP_MAX_NODES], pincap[DUMP_MAX_NODES], connlen[DUMP_MAX_NODES], proccap[DUMP_MAX_NODES];
+	size_t nodeCount = 0;
+	uint32_t value = 0;
+	int ret = 1;
+
+	memset(stats, 0, sizeof(*stats));
+	memset(d.hash, 0xff, sizeof(d.hash));
+
+	/* root node */
+	dump_param(&d, 0, AC_PAR_VENDOR_ID);
+	dump_param(&d, 0, AC_PAR_SUBSYSTEM_ID);
+	dump_param(&d, 0, AC_PAR_REV_ID);
+	long rootCount = dump_param(&d, 0, AC_PAR_NODE_COUNT);
+	if (dump_flush(&d) != 0)
+		goto done;
+
+	if (!dump_value(&d, rootCount, &value))
+	{
+		fprintf(stderr, "Failed to read codec node count.\n");
+		goto done;
+	}
+
+	/* function groups */
+	uint16_t fgStart = (value >> 16) & 0xff, fgCount = value & 0xff;
+	long fgNodes[DUMP_MAX_NODES];
+	for (uint16_t i = 0; i < fgCount && i < DUMP_MAX_NODES; i++)
+	{
+		uint16_t fg = fgStart + i;
+		dump_param(&d, fg, AC_PAR_FUNCTION_TYPE);
+		dump_param(&d, fg, AC_PAR_AUDIO_FG_CAP);
+		dump_param(&d, fg, AC_PAR_PCM);
+		dump_param(&d, fg, AC_PAR_STREAM);
+		dump_param(&d, fg, AC_PAR_AMP_IN_CAP);
+		dump_param(&d, fg, AC_PAR_AMP_OUT_CAP);
+		dump_param(&d, fg, AC_PAR_POWER_STATE);
+		dump_param(&d, fg, AC_PAR_GPIO_CAP);
+		dump_read(&d, fg, AC_VERB_GET_POWER_STATE, 0);
+		dump_read(&d, fg, AC_VERB_GET_SUBSYSTEM_ID, 0);
+		dump_read(&d, fg, AC_VERB_GET_GPIO_DATA, 0);
+		dump_read(&d, fg, AC_VERB_GET_GPIO_MASK, 0);
+		dump_read(&d, fg, AC_VERB_GET_GPIO_DIRECTION, 0);
+		fgNodes[i] = dump_param(&d, fg, AC_PAR_NODE_COUNT);
+		stats->nodes++;
+	}
+	if (dump_flush(&d) != 0)
+		goto done;
+
+	/* widget capabilities */
+	for (uint16_t i = 0; i < fgCount && i < DUMP_MAX_NODES; i++)
+	{
+		if (!dump_value(&d, fgNodes[i], &value))
+			continue;
+
+		uint16_t start = (value >> 16) & 0xff, count = value & 0xff;
+		for (uint16_t nid = start; nid < start + count && nodeCount < DUMP_MAX_NODES; nid++)
+		{
+			nodes[nodeCount] = nid;
+			wcaps[nodeCount] = dump_param(&d, nid, AC_PAR_AUDIO_WIDGET_CAP);
+			nodeCount++;
+		}
+	}
+	stats->nodes += nodeCount;
+	if (dump_flush(&d) != 0)
+		goto done;
+
+	/* widget parameters and plain state */
+	for (size_t i = 0; i < nodeCount; i++)
+	{
+		pincap[i] = connlen[i] = proccap[i] = -1;
+		if (dump_value(&d, wcaps[i], &value))
+			dump_widget_caps(&d, nodes[i], value, &pincap[i], &connlen[i], &proccap[i]);
+	}
+	if (dump_flush(&d) != 0)
+		goto done;
+
+	/* connection lists, amplifiers and pin state */
+	for (size_t i = 0; i < nodeCount; i++)
+		if (dump_value(&d, wcaps[i], &value))
+			dump_widget_state(&d, nodes[i], value, pincap[i], connlen[i]);
+	if (dump_flush(&d) != 0)
+		goto done;
+
+	/* processing coefficients, restoring the coefficient index afterwards */
+	for (size_t i = 0; i < nodeCount; i++)
+	{
+		uint32_t index = 0;
+		if (!dump_value(&d, proccap[i], &value) || !dump_value(&d, dump_read(&d, nodes[i], AC_VERB_GET_COEF_INDEX, 0), &index))
+			continue;
+
+		uint32_t coefs = (value >> 8) & 0xff;
+		if (coefs == 0)
+			coefs = DUMP_DEFAULT_COEFS;
+		for (uint32_t c = 0; c < coefs; c++)
+			dump_coef(&d, nodes[i], (uint16_t)c);
+		dump_add(&d, nodes[i], AC_VERB_SET_COEF_INDEX, (uint16_t)index, READ_HIDDEN | READ_NOCACHE);
+	}
+	if (dump_flush(&d) != 0)
+		goto done;
+
+	dump_print(&d, out);
+	ret = 0;
+
+done:
+	free(d.reads);
+	free(d.pending);
+	return ret;
+}
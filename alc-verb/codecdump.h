@@ -0,0 +1,53 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef codecdump_h
+#define codecdump_h
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "UserKernelShared.h"
+
+/**
+ *  Execute a batch of verbs atomically, the same way kMethodExecuteVerbs does.
+ *  Must fill every result, verbs after a failing one are reported as kIOReturnAborted.
+ *
+ *  @return 0 on success, non-zero if the batch could not be submitted at all
+ */
+typedef int (*codec_dump_exec_t)(void *ctx, const ALCVerbCommand *commands, ALCVerbResult *results, size_t count);
+
+struct codec_dump_stats
+{
+	size_t nodes;			/* function groups and widgets walked */
+	size_t reads;			/* values read from the codec */
+	size_t duplicates;		/* reads answered from the cache */
+	size_t failures;		/* reads the codec rejected */
+	size_t transactions;	/* batches submitted */
+};
+
+/**
+ *  Walk the root node, function groups and widgets of a codec and print every
+ *  read value sorted by nid, verb and param, one per line.
+ *
+ *  @return 0 on success
+ */
+int codec_dump(FILE *out, codec_dump_exec_t exec, void *ctx, struct codec_dump_stats *stats);
+
+#endif /* codecdump_h */
@@ -0,0 +1,191 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "logdecode.h"
+
+/* longest conversion specification copied from the format: %, flags, width, precision and length */
+#define LOG_SPEC_LENGTH 32
+
+struct log_output
+{
+	char *out;
+	size_t size;
+	size_t length;
+};
+
+static void log_append(struct log_output *o, const char *str, size_t len)
+{
+	if (o->length + 1 < o->size)
+	{
+		size_t room = o->size - 1 - o->length;
+		memcpy(o->out + o->length, str, len < room ? len : room);
+	}
+	o->length += len;
+}
+
+static void log_printf(struct log_output *o, const char *spec, unsigned long long value, bool is_signed, bool is_string, const char *str)
+{
+	char buf[128];
+	int len;
+	if (is_string)
+		len = snprintf(buf, sizeof(buf), spec, str);
+	else if (is_signed)
+		len = snprintf(buf, sizeof(buf), spec, (long long)value);
+	else
+		len = snprintf(buf, sizeof(buf), spec, value);
+	if (len > 0)
+		log_append(o, buf, (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+}
+
+/* take the next argument slot, strings take the slots up to their terminator */
+static bool log_next(const ALCLogRecord *record, size_t *slot, unsigned long long *value, const char **str)
+{
+	if (*slot >= record->count || *slot >= kALCLogArgs)
+		return false;
+
+	*value = record->args[*slot];
+	*str = NULL;
+	if (record->strings & (1U << *slot))
+	{
+		const char *start = (const char *)&record->args[*slot];
+		size_t room = (kALCLogArgs - *slot) * sizeof(uint64_t);
+		const char *end = memchr(start, '\0', room);
+		if (end == NULL)
+			return false;
+		*str = start;
+		*slot += ((size_t)(end - start) + sizeof(uint64_t)) / sizeof(uint64_t);
+	}
+	else
+	{
+		(*slot)++;
+	}
+
+	return true;
+}
+
+size_t log_decode(char *out, size_t size, const char *format, const ALCLogRecord *record)
+{
+	struct log_output o = { out, size, 0 };
+	size_t slot = 0;
+
+	while (*format != '\0')
+	{
+		const char *percent = strchr(format, '%');
+		if (percent == NULL)
+		{
+			log_append(&o, format, strlen(format));
+			break;
+		}
+
+		log_append(&o, format, (size_t)(percent - format));
+		format = percent + 1;
+		if (*format == '%')
+		{
+			log_append(&o, "%", 1);
+			format++;
+			continue;
+		}
+
+		/* copy flags, width and precision, then drop the length modifiers and apply our own */
+		char spec[LOG_SPEC_LENGTH + 4];
+		size_t n = 0;
+		spec[n++] = '%';
+		while (*format != '\0' && strchr("-+ #0123456789.", *format) != NULL && n < LOG_SPEC_LENGTH)
+			spec[n++] = *format++;
+
+		int length = 0;
+		while (*format != '\0' && strchr("hlqjzt", *format) != NULL)
+		{
+			length = *format == 'h' ? length - 1 : 2;
+			format++;
+		}
+
+		char conv = *format;
+		if (conv == '\0')
+			break;
+		format++;
+
+		unsigned long long value;
+		const char *str;
+		if (!log_next(record, &slot, &value, &str))
+		{
+			log_append(&o, "?", 1);
+			continue;
+		}
+
+		switch (conv)
+		{
+			case 'd':
+			case 'i':
+				if (length == -1)
+					value = (unsigned long long)(long long)(short)value;
+				else if (length < -1)
+					value = (unsigned long long)(long long)(signed char)value;
+				else if (length == 0)
+					value = (unsigned long long)(long long)(int)value;
+				memcpy(spec + n, "lld", 4);
+				log_printf(&o, spec, value, true, false, NULL);
+				break;
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+				if (length == -1)
+					value = (unsigned short)value;
+				else if (length < -1)
+					value = (unsigned char)value;
+				else if (length == 0)
+					value = (unsigned int)value;
+				spec[n] = 'l';
+				spec[n + 1] = 'l';
+				spec[n + 2] = conv;
+				spec[n + 3] = '\0';
+				log_printf(&o, spec, value, false, false, NULL);
+				break;
+			case 'c':
+			{
+				char c = (char)value;
+				log_append(&o, &c, 1);
+				break;
+			}
+			case 's':
+				memcpy(spec + n, "s", 2);
+				if (str != NULL)
+					log_printf(&o, spec, 0, false, true, str);
+				else
+					log_printf(&o, "<0x%llx>", value, false, false, NULL);
+				break;
+			case 'p':
+				log_printf(&o, "0x%llx", value, false, false, NULL);
+				break;
+			default:
+				/* unknown conversion, keep the raw value */
+				log_printf(&o, "<0x%llx>", value, false, false, NULL);
+				break;
+		}
+	}
+
+	if (size > 0)
+		out[o.length < size ? o.length : size - 1] = '\0';
+	return o.length < size ? o.length : (size > 0 ? size - 1 : 0);
+}
@@ -0,0 +1,36 @@
+/*
+ *  Released under "The GNU General Public License (GPL-2.0)"
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef logdecode_h
+#define logdecode_h
+
+#include <stddef.h>
+
+#include "UserKernelShared.h"
+
+/**
+ *  Format a binary log record with the printf format of its call site.
+ *  Arguments are narrowed by the length modifiers of the format, missing
+ *  arguments are printed as '?' and the output is always terminated.
+ *
+ *  @return length of the formatted text, truncated to size - 1
+ */
+size_t log_decode(char *out, size_t size, const char *format, const ALCLogRecord *record);
+
+#endif /* logdecode_h */
@@ -23,12 +23,17 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <time.h>
 #include <IOKit/IOKitLib.h>
+#include <zlib.h>
 
 #include <CoreFoundation/CoreFoundation.h>
 
 #include "UserKernelShared.h"
 #include "hdaverb.h"
+#include "codecdump.h"
+#include "logdecode.h"
 
 static int compare_path(const void *a, const void *b)
 {
@@ -125,21 +130,21 @@ static io_service_t get_service(const char *name)
 	return 0;
 }
 
-static unsigned execute_command(unsigned dev, uint16_t nid, uint16_t verb, uint16_t param)
+static io_connect_t open_device(unsigned dev)
 {
 	size_t nameCount = 0;
 	io_string_t *names = find_services(&nameCount);
 
 	if (names == NULL)
 	{
-		return kIOReturnError;
+		return 0;
 	}
 
 	if (nameCount <= dev)
 	{
 		fprintf(stderr, "Failed to open ALCUserClientProvider service with specified id %u.\n", dev);
 		free(names);
-		return kIOReturnBadArgument;
+		return 0;
 	}
 
 	io_service_t service = get_service(names[dev]);
@@ -150,24 +155,41 @@ static unsigned execute_command(unsigned dev, uint16_t nid, uint16_t verb, uint1
 	if (kr != kIOReturnSuccess)
 	{
 		fprintf(stderr, "Failed to open ALCUserClientProvider service: %08x.\n", kr);
+		return 0;
+	}
+
+	return dataPort;
+}
+
+static unsigned execute_command(unsigned dev, uint16_t nid, uint16_t verb, uint16_t param, bool wait, unsigned *retries)
+{
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+	{
 		return kIOReturnError;
 	}
 
-	uint32_t inputCount = 3;	// Must match the declaration in ALCUserClient::sMethods
+	uint32_t inputCount = 4;	// Must match the declaration in ALCUserClient::sMethods
 	uint64_t input[inputCount];
 	input[0]	= nid;
 	input[1]	= verb;
 	input[2]	= param;
+	input[3]	= wait ? 0 : kVerbFlagNoWait;
 	
-	uint64_t output;
-	uint32_t outputCount = 1;
+	uint64_t output[3];
+	uint32_t outputCount = 3;
 
-	kr = IOConnectCallScalarMethod(dataPort, kMethodExecuteVerb, input, inputCount, &output, &outputCount);
+	kern_return_t kr = IOConnectCallScalarMethod(dataPort, kMethodExecuteVerbEx, input, inputCount, output, &outputCount);
 	
 	if (kr != kIOReturnSuccess)
 		return -1;
+
+	*retries = (unsigned)output[2];
+
+	if ((kern_return_t)output[1] != kIOReturnSuccess)
+		fprintf(stderr, "Codec reported failure: %08x.\n", (unsigned)output[1]);
 	
-	return (unsigned)output;
+	return (unsigned)output[0];
 }
 
 static void list_keys(struct strtbl *tbl, int one_per_line)
@@ -236,13 +258,850 @@ static void strtoupper(char *str)
 		*str = toupper(*str);
 }
 
+/* parse a node id, returns -1 on failure */
+static long parse_nid(const char *str)
+{
+	long nid = strtol(str, NULL, 0);
+	if (nid < 0 || nid > 0xff)
+	{
+		fprintf(stderr, "invalid nid %s\n", str);
+		return -1;
+	}
+	return nid;
+}
+
+/* parse a verb name or number, returns -1 on failure */
+static long parse_verb(char *str)
+{
+	long verb;
+
+	if (!isdigit(*str))
+	{
+		strtoupper(str);
+		return lookup_str(hda_verbs, str);
+	}
+
+	verb = strtol(str, NULL, 0);
+	if (verb < 0 || verb > 0xfff)
+	{
+		fprintf(stderr, "invalid verb %s\n", str);
+		return -1;
+	}
+	return verb;
+}
+
+/* parse a parameter name or number, returns -1 on failure */
+static long parse_param(char *str)
+{
+	long param;
+
+	if (!isdigit(*str))
+	{
+		strtoupper(str);
+		return lookup_str(hda_params, str);
+	}
+
+	param = strtol(str, NULL, 0);
+	if (param < 0 || param > 0xffff)
+	{
+		fprintf(stderr, "invalid param %s\n", str);
+		return -1;
+	}
+	return param;
+}
+
+/* execute "nid verb param" triples from the command line as one atomic transaction */
+static int execute_transaction(unsigned dev, char **args, int argCount, bool wait, bool quiet)
+{
+	ALCVerbCommand commands[kMaxTransactionVerbs];
+	ALCVerbResult results[kMaxTransactionVerbs];
+	size_t count = (size_t)argCount / 3;
+
+	if (count == 0 || argCount % 3 != 0 || count > kMaxTransactionVerbs)
+	{
+		fprintf(stderr, "transaction needs 1 to %d nid verb param triples\n", kMaxTransactionVerbs);
+		return 1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		long nid = parse_nid(args[i * 3]);
+		long verb = parse_verb(args[i * 3 + 1]);
+		long param = parse_param(args[i * 3 + 2]);
+		if (nid < 0 || verb < 0 || param < 0)
+			return 1;
+
+		commands[i].nid = (uint16_t)nid;
+		commands[i].verb = (uint16_t)verb;
+		commands[i].param = (uint16_t)param;
+		commands[i].flags = wait ? 0 : kVerbFlagNoWait;
+	}
+
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+		return 1;
+
+	uint64_t status = 0;
+	uint32_t outputCount = 1;
+	size_t resultsSize = count * sizeof(results[0]);
+	kern_return_t kr = IOConnectCallMethod(dataPort, kMethodExecuteVerbs, NULL, 0, commands, count * sizeof(commands[0]),
+										   &status, &outputCount, results, &resultsSize);
+	IOServiceClose(dataPort);
+
+	if (kr != kIOReturnSuccess)
+	{
+		fprintf(stderr, "Failed to execute transaction: %08x.\n", kr);
+		return 1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (results[i].status != kIOReturnSuccess)
+			fprintf(stderr, "0x%02x 0x%03x 0x%04x failed: %08x\n", commands[i].nid, commands[i].verb, commands[i].param, results[i].status);
+		else if (quiet)
+			printf("0x%08x\n", results[i].response);
+		else
+			printf("0x%02x 0x%03x 0x%04x 0x%08x\n", commands[i].nid, commands[i].verb, commands[i].param, results[i].response);
+	}
+
+	return (IOReturn)status == kIOReturnSuccess ? 0 : 1;
+}
+
+#define MAX_ASYNC_DEVICES 16
+
+struct async_verb
+{
+	unsigned dev;
+	long nid, verb, param;
+	IOReturn status;
+	unsigned result;
+	unsigned retries;
+};
+
+static size_t async_pending;
+
+static void async_callback(void *refcon, IOReturn result, void **args, UInt32 numArgs)
+{
+	struct async_verb *v = refcon;
+
+	v->status = result;
+	if (numArgs >= kVerbAsyncArgCount)
+	{
+		v->result = (unsigned)(uintptr_t)args[kVerbAsyncResponse];
+		v->retries = (unsigned)(uintptr_t)args[kVerbAsyncRetries];
+	}
+	async_pending--;
+}
+
+/* read "[dev] nid verb param" lines from stdin and keep them all in flight */
+static int execute_async(unsigned dev, bool wait, bool quiet)
+{
+	io_connect_t ports[MAX_ASYNC_DEVICES] = { 0 };
+	bool unavailable[MAX_ASYNC_DEVICES] = { false };
+	struct async_verb *verbs = NULL;
+	size_t count = 0, devices = 0;
+	char line[256];
+	int ret = 1;
+
+	while (fgets(line, sizeof(line), stdin))
+	{
+		char *tok[4];
+		size_t n = 0;
+
+		for (char *t = strtok(line, " \t\r\n"); t && n < 4; t = strtok(NULL, " \t\r\n"))
+			tok[n++] = t;
+
+		if (n == 0 || tok[0][0] == '#')
+			continue;
+
+		if (n < 3)
+		{
+			fprintf(stderr, "invalid verb line %zu\n", count + 1);
+			goto done;
+		}
+
+		struct async_verb *newVerbs = realloc(verbs, (count + 1) * sizeof(verbs[0]));
+		if (newVerbs == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory.\n");
+			goto done;
+		}
+		verbs = newVerbs;
+
+		struct async_verb *v = &verbs[count];
+		memset(v, 0, sizeof(*v));
+		v->dev = n == 4 ? (unsigned)atoi(tok[0]) : dev;
+		v->nid = parse_nid(tok[n - 3]);
+		v->verb = parse_verb(tok[n - 2]);
+		v->param = parse_param(tok[n - 1]);
+		if (v->nid < 0 || v->verb < 0 || v->param < 0)
+			goto done;
+
+		if (v->dev >= MAX_ASYNC_DEVICES)
+		{
+			fprintf(stderr, "device index %u is out of range\n", v->dev);
+			goto done;
+		}
+
+		count++;
+	}
+
+	IONotificationPortRef notify = IONotificationPortCreate(kIOMasterPortDefault);
+	if (notify == NULL)
+	{
+		fprintf(stderr, "Failed to create notification port.\n");
+		goto done;
+	}
+	CFRunLoopAddSource(CFRunLoopGetCurrent(), IONotificationPortGetRunLoopSource(notify), kCFRunLoopDefaultMode);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		struct async_verb *v = &verbs[i];
+
+		/* open every device once, a device that failed to open fails the rest of its verbs */
+		if (ports[v->dev] == 0 && !unavailable[v->dev])
+		{
+			ports[v->dev] = open_device(v->dev);
+			if (ports[v->dev] == 0)
+				unavailable[v->dev] = true;
+			else
+				devices++;
+		}
+
+		if (unavailable[v->dev])
+		{
+			v->status = kIOReturnNotFound;
+			continue;
+		}
+
+		uint64_t input[4] = { v->nid, v->verb, v->param, wait ? 0 : kVerbFlagNoWait };
+		uint64_t ref[kOSAsyncRef64Count] = { 0 };
+		ref[kIOAsyncCalloutFuncIndex] = (uint64_t)(uintptr_t)async_callback;
+		ref[kIOAsyncCalloutRefconIndex] = (uint64_t)(uintptr_t)v;
+
+		kern_return_t kr;
+		while ((kr = IOConnectCallAsyncScalarMethod(ports[v->dev], kMethodExecuteVerbAsync, IONotificationPortGetMachPort(notify),
+													ref, kOSAsyncRef64Count, input, 4, NULL, NULL)) == kIOReturnNoResources)
+		{
+			/* codec work queue is full, let some of the verbs complete */
+			CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.01, true);
+		}
+
+		if (kr != kIOReturnSuccess)
+			v->status = kr;
+		else
+			async_pending++;
+	}
+
+	while (async_pending > 0)
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0, true);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ret = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		struct async_verb *v = &verbs[i];
+		if (v->status != kIOReturnSuccess)
+		{
+			fprintf(stderr, "%u 0x%02lx 0x%03lx 0x%04lx failed: %08x\n", v->dev, v->nid, v->verb, v->param, v->status);
+			ret = 1;
+		}
+		else if (quiet)
+			printf("0x%08x\n", v->result);
+		else
+			printf("%u 0x%02lx 0x%03lx 0x%04lx 0x%08x retries %u\n", v->dev, v->nid, v->verb, v->param, v->result, v->retries);
+	}
+
+	if (!quiet)
+	{
+		double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+		fprintf(stderr, "%zu verbs on %zu devices in %.3f ms\n", count, devices, ms);
+	}
+
+	IONotificationPortDestroy(notify);
+
+done:
+	for (size_t i = 0; i < MAX_ASYNC_DEVICES; i++)
+		if (ports[i] != 0)
+			IOServiceClose(ports[i]);
+	free(verbs);
+	return ret;
+}
+
+static int dump_exec(void *ctx, const ALCVerbCommand *commands, ALCVerbResult *results, size_t count)
+{
+	io_connect_t dataPort = *(io_connect_t *)ctx;
+	uint64_t status = 0;
+	uint32_t outputCount = 1;
+	size_t resultsSize = count * sizeof(results[0]);
+
+	kern_return_t kr = IOConnectCallMethod(dataPort, kMethodExecuteVerbs, NULL, 0, commands, count * sizeof(commands[0]),
+										   &status, &outputCount, results, &resultsSize);
+	if (kr != kIOReturnSuccess || resultsSize != count * sizeof(results[0]))
+	{
+		fprintf(stderr, "Failed to execute transaction: %08x.\n", kr);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* dump the whole codec graph to stdout and the timing summary to stderr */
+static int dump_codec(unsigned dev, bool quiet)
+{
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+		return 1;
+
+	struct codec_dump_stats stats;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int ret = codec_dump(stdout, dump_exec, &dataPort, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	IOServiceClose(dataPort);
+
+	if (ret == 0 && !quiet)
+	{
+		double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+		fprintf(stderr, "%zu nodes, %zu reads (%zu failed, %zu deduplicated) in %zu transactions, %.3f ms\n",
+				stats.nodes, stats.reads, stats.failures, stats.duplicates, stats.transactions, ms);
+	}
+
+	return ret;
+}
+
+static const char *trace_classes[kALCTraceClassCount] =
+{
+	"parameter",
+	"get",
+	"set",
+	"coefficient",
+	"stream-format"
+};
+
+/* print the kernel verb trace and latency histograms, optionally changing the tracing state */
+static int read_trace(unsigned dev, const char *mode, bool quiet)
+{
+	uint64_t flags = 0;
+	if (mode == NULL)
+		flags = 0;
+	else if (strcmp(mode, "on") == 0)
+		flags = kTraceFlagEnable;
+	else if (strcmp(mode, "off") == 0)
+		flags = kTraceFlagDisable;
+	else if (strcmp(mode, "reset") == 0)
+		flags = kTraceFlagReset;
+	else
+	{
+		fprintf(stderr, "invalid trace mode %s\n", mode);
+		return 1;
+	}
+
+	ALCTraceDump *dump = malloc(sizeof(*dump));
+	if (dump == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return 1;
+	}
+
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+	{
+		free(dump);
+		return 1;
+	}
+
+	size_t size = sizeof(*dump);
+	kern_return_t kr = IOConnectCallMethod(dataPort, kMethodReadTrace, &flags, 1, NULL, 0, NULL, NULL, dump, &size);
+	IOServiceClose(dataPort);
+
+	if (kr != kIOReturnSuccess || size < sizeof(*dump) || dump->version != kALCTraceVersion || dump->capacity > kALCTraceCapacity)
+	{
+		fprintf(stderr, "Failed to read verb trace: %08x.\n", kr);
+		free(dump);
+		return 1;
+	}
+
+	printf("# seq time nid verb param response status duration_us\n");
+	uint64_t first = dump->head > dump->capacity ? dump->head - dump->capacity + 1 : 1;
+	for (uint64_t seq = first; seq <= dump->head; seq++)
+	{
+		const ALCTraceEntry *e = &dump->entries[(seq - 1) % dump->capacity];
+		if (e->sequence != seq)
+			continue;
+
+		printf("%llu %llu.%06llu 0x%02x 0x%03x 0x%04x 0x%08x %08x %.3f\n", (unsigned long long)seq,
+			   (unsigned long long)(e->timestamp / 1000000000ULL), (unsigned long long)((e->timestamp / 1000ULL) % 1000000ULL),
+			   e->nid, e->verb, e->param, e->response, e->status, e->duration / 1000.0);
+	}
+
+	printf("# class count avg_us max_us buckets\n");
+	for (size_t i = 0; i < kALCTraceClassCount; i++)
+	{
+		const ALCTraceHistogram *h = &dump->histograms[i];
+		if (h->count == 0)
+			continue;
+
+		printf("%s %llu %.3f %.3f", trace_classes[i], (unsigned long long)h->count,
+			   h->totalTime / 1000.0 / h->count, h->maxTime / 1000.0);
+		for (size_t b = 0; b < kALCTraceBuckets; b++)
+			if (h->buckets[b] != 0)
+				printf(" <%lluus:%llu", 1ULL << b, (unsigned long long)h->buckets[b]);
+		printf("\n");
+	}
+
+	if (!quiet)
+		fprintf(stderr, "verb tracing is %s\n", dump->enabled ? "enabled" : "disabled (use --trace=on or -alctrace)");
+
+	free(dump);
+	return 0;
+}
+
+static uint64_t cf_number(CFDictionaryRef dict, CFStringRef key)
+{
+	int64_t value = 0;
+	CFNumberRef number = CFDictionaryGetValue(dict, key);
+	if (number != NULL && CFGetTypeID(number) == CFNumberGetTypeID())
+		CFNumberGetValue(number, kCFNumberSInt64Type, &value);
+	return (uint64_t)value;
+}
+
+static const char *cf_string(CFDictionaryRef dict, CFStringRef key, char *buffer, size_t size)
+{
+	CFStringRef string = CFDictionaryGetValue(dict, key);
+	if (string == NULL || CFGetTypeID(string) != CFStringGetTypeID() || !CFStringGetCString(string, buffer, size, kCFStringEncodingUTF8))
+		return "-";
+	return buffer;
+}
+
+/* print the boot stage timings AppleALC publishes on HDEF */
+static int print_timings(void)
+{
+	io_service_t hdef = IOServiceGetMatchingService(kIOMasterPortDefault, IOServiceNameMatching("HDEF"));
+	if (hdef == 0)
+	{
+		fprintf(stderr, "Failed to find HDEF device.\n");
+		return 1;
+	}
+
+	CFTypeRef report = IORegistryEntryCreateCFProperty(hdef, CFSTR("alc-boot-timings"), kCFAllocatorDefault, 0);
+	IOObjectRelease(hdef);
+
+	CFArrayRef stages = NULL;
+	if (report != NULL && CFGetTypeID(report) == CFDictionaryGetTypeID())
+		stages = CFDictionaryGetValue(report, CFSTR("Stages"));
+
+	if (stages == NULL || CFGetTypeID(stages) != CFArrayGetTypeID())
+	{
+		fprintf(stderr, "HDEF has no AppleALC boot timings.\n");
+		if (report != NULL)
+			CFRelease(report);
+		return 1;
+	}
+
+	CFIndex count = CFArrayGetCount(stages);
+	uint64_t first = UINT64_MAX, last = 0;
+	for (CFIndex i = 0; i < count; i++)
+	{
+		CFDictionaryRef stage = CFArrayGetValueAtIndex(stages, i);
+		uint64_t start = cf_number(stage, CFSTR("Start"));
+		uint64_t end = start + cf_number(stage, CFSTR("Duration"));
+		if (start < first)
+			first = start;
+		if (end > last)
+			last = end;
+	}
+
+	printf("# start_ms duration_ms stage target detail\n");
+	for (CFIndex i = 0; i < count; i++)
+	{
+		CFDictionaryRef stage = CFArrayGetValueAtIndex(stages, i);
+		char name[64], target[128];
+		printf("%.3f %.3f %s %s %llu\n", (cf_number(stage, CFSTR("Start")) - first) / 1000000.0,
+			   cf_number(stage, CFSTR("Duration")) / 1000000.0, cf_string(stage, CFSTR("Name"), name, sizeof(name)),
+			   cf_string(stage, CFSTR("Target"), target, sizeof(target)), (unsigned long long)cf_number(stage, CFSTR("Detail")));
+	}
+
+	if (count > 0)
+		printf("# %ld stages over %.3f ms, %llu dropped\n", (long)count, (last - first) / 1000000.0,
+			   (unsigned long long)cf_number(report, CFSTR("Dropped")));
+
+	CFRelease(report);
+	return 0;
+}
+
+/* print the lookup patches AppleALC applied during boot and flag those that never matched */
+static int print_patches(unsigned dev)
+{
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+		return 1;
+
+	/* ask for the total first, then read every record */
+	uint64_t total = 0;
+	uint32_t outputCount = 1;
+	size_t size = 0;
+	kern_return_t kr = IOConnectCallMethod(dataPort, kMethodReadPatchReport, NULL, 0, NULL, 0, &total, &outputCount, NULL, &size);
+
+	ALCPatchRecord *records = NULL;
+	if (kr == kIOReturnSuccess && total > 0)
+	{
+		records = calloc((size_t)total, sizeof(*records));
+		if (records == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory.\n");
+			IOServiceClose(dataPort);
+			return 1;
+		}
+
+		size = (size_t)total * sizeof(*records);
+		outputCount = 1;
+		kr = IOConnectCallMethod(dataPort, kMethodReadPatchReport, NULL, 0, NULL, 0, &total, &outputCount, records, &size);
+	}
+	IOServiceClose(dataPort);
+
+	if (kr != kIOReturnSuccess)
+	{
+		fprintf(stderr, "Failed to read patch report: %08x.\n", kr);
+		free(records);
+		return 1;
+	}
+
+	size_t count = records != NULL ? size / sizeof(*records) : 0;
+	size_t unmatched = 0;
+	uint64_t duration = 0, scanned = 0;
+	printf("# kext source count found status duration_us scanned_kb\n");
+	for (size_t i = 0; i < count; i++)
+	{
+		const ALCPatchRecord *r = &records[i];
+		bool missed = r->status != 0 || r->found == 0;
+		if (missed)
+			unmatched++;
+		duration += r->duration;
+		scanned += r->scanned;
+
+		char found[16] = "-", kb[32] = "-";
+		if (r->found != kALCPatchFoundUnknown)
+		{
+			snprintf(found, sizeof(found), "%u", r->found);
+			snprintf(kb, sizeof(kb), "%llu", (unsigned long long)(r->scanned / 1024));
+		}
+
+		printf("%.*s %.*s %u %s %u %.3f %s%s\n", (int)sizeof(r->kext), r->kext, (int)sizeof(r->source), r->source,
+			   r->count, found, r->status, r->duration / 1000.0, kb, missed ? " unmatched" : "");
+	}
+
+	printf("# %zu patches, %zu unmatched, %.3f ms applying, %llu KB counted\n", count, unmatched, duration / 1000000.0,
+		   (unsigned long long)(scanned / 1024));
+	if (count > 0 && records[0].found == kALCPatchFoundUnknown)
+		printf("# boot with -alcpatchstats to count exact matches\n");
+
+	free(records);
+	return 0;
+}
+
+static const ALCEventQueue *watch_queue;
+static uint64_t watch_seen;
+
+static void print_event(const ALCEvent *e)
+{
+	if (e->type == kALCEventPinSense)
+		printf("%llu.%06llu 0x%02x pin-sense 0x%08x %s\n", e->timestamp / 1000000000ULL, (e->timestamp / 1000ULL) % 1000000ULL,
+			   e->nid, e->value, (e->value & 0x80000000U) ? "present" : "absent");
+	else if (e->type == kALCEventGpio)
+		printf("%llu.%06llu 0x%02x gpio 0x%08x\n", e->timestamp / 1000000000ULL, (e->timestamp / 1000ULL) % 1000000ULL,
+			   e->nid, e->value);
+	else
+		printf("%llu.%06llu 0x%02x type %u 0x%08x\n", e->timestamp / 1000000000ULL, (e->timestamp / 1000ULL) % 1000000ULL,
+			   e->nid, e->type, e->value);
+}
+
+/* consume every event published since the last call straight from the shared queue */
+static void drain_events(void)
+{
+	uint64_t head = __atomic_load_n(&watch_queue->head, __ATOMIC_ACQUIRE);
+	uint32_t capacity = watch_queue->capacity;
+
+	if (head - watch_seen > capacity)
+	{
+		fprintf(stderr, "lost %llu events\n", (unsigned long long)(head - watch_seen - capacity));
+		watch_seen = head - capacity;
+	}
+
+	while (watch_seen < head)
+	{
+		uint64_t seq = watch_seen + 1;
+		const ALCEvent *slot = &watch_queue->events[(seq - 1) % capacity];
+		ALCEvent e;
+
+		uint64_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		memcpy(&e, slot, sizeof(e));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint64_t after = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+		/* the kernel has already reused the entry */
+		if (before != seq || after != seq)
+			fprintf(stderr, "lost event %llu\n", (unsigned long long)seq);
+		else
+			print_event(&e);
+
+		watch_seen = seq;
+	}
+
+	fflush(stdout);
+}
+
+static void watch_callback(void *refcon, IOReturn result, void **args, UInt32 numArgs)
+{
+	drain_events();
+}
+
+/* print jack sense and GPIO events until interrupted */
+static int watch_events(unsigned dev)
+{
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+	{
+		return 1;
+	}
+
+	mach_vm_address_t address = 0;
+	mach_vm_size_t size = 0;
+	kern_return_t kr = IOConnectMapMemory64(dataPort, kALCMemoryEventQueue, mach_task_self(), &address, &size, kIOMapAnywhere | kIOMapReadOnly);
+	if (kr != kIOReturnSuccess || size < sizeof(ALCEventQueue))
+	{
+		fprintf(stderr, "Failed to map event queue: %08x.\n", kr);
+		IOServiceClose(dataPort);
+		return 1;
+	}
+
+	watch_queue = (const ALCEventQueue *)(uintptr_t)address;
+	if (watch_queue->version != kALCEventQueueVersion || watch_queue->capacity == 0 || watch_queue->capacity > kALCEventQueueCapacity)
+	{
+		fprintf(stderr, "Unsupported event queue version %u.\n", watch_queue->version);
+		IOServiceClose(dataPort);
+		return 1;
+	}
+	watch_seen = __atomic_load_n(&watch_queue->head, __ATOMIC_ACQUIRE);
+
+	IONotificationPortRef notify = IONotificationPortCreate(kIOMasterPortDefault);
+	if (notify == NULL)
+	{
+		fprintf(stderr, "Failed to create notification port.\n");
+		IOServiceClose(dataPort);
+		return 1;
+	}
+	CFRunLoopAddSource(CFRunLoopGetCurrent(), IONotificationPortGetRunLoopSource(notify), kCFRunLoopDefaultMode);
+
+	uint64_t ref[kOSAsyncRef64Count] = { 0 };
+	ref[kIOAsyncCalloutFuncIndex] = (uint64_t)(uintptr_t)watch_callback;
+	ref[kIOAsyncCalloutRefconIndex] = 0;
+
+	kr = IOConnectCallAsyncScalarMethod(dataPort, kMethodWatchEvents, IONotificationPortGetMachPort(notify),
+										ref, kOSAsyncRef64Count, NULL, 0, NULL, NULL);
+	if (kr != kIOReturnSuccess)
+	{
+		fprintf(stderr, "Failed to watch events: %08x.\n", kr);
+		IONotificationPortDestroy(notify);
+		IOServiceClose(dataPort);
+		return 1;
+	}
+
+	CFRunLoopRun();
+
+	IONotificationPortDestroy(notify);
+	IOServiceClose(dataPort);
+	return 0;
+}
+
+/* print the binary debug log of -alcbinlog boots, formatting it here instead of in the kernel */
+static int read_log(unsigned dev, const char *mode)
+{
+	uint64_t flags = 0;
+	if (mode != NULL && strcmp(mode, "reset") == 0)
+		flags = kLogFlagReset;
+	else if (mode != NULL)
+	{
+		fprintf(stderr, "invalid log mode %s\n", mode);
+		return 1;
+	}
+
+	ALCLogDump *dump = malloc(sizeof(*dump));
+	if (dump == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return 1;
+	}
+
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+	{
+		free(dump);
+		return 1;
+	}
+
+	size_t size = sizeof(*dump);
+	kern_return_t kr = IOConnectCallMethod(dataPort, kMethodReadLog, &flags, 1, NULL, 0, NULL, NULL, dump, &size);
+	IOServiceClose(dataPort);
+
+	if (kr == kIOReturnNotReady)
+	{
+		fprintf(stderr, "Binary log is not recorded, boot a DEBUG AppleALC with -alcbinlog.\n");
+		free(dump);
+		return 1;
+	}
+
+	if (kr != kIOReturnSuccess || size < sizeof(*dump) || dump->version != kALCLogVersion || dump->capacity > kALCLogCapacity ||
+		dump->formatCount > kALCLogFormats)
+	{
+		fprintf(stderr, "Failed to read binary log: %08x.\n", kr);
+		free(dump);
+		return 1;
+	}
+
+	char line[1024];
+	uint64_t first = dump->head > dump->capacity ? dump->head - dump->capacity + 1 : 1;
+	for (uint64_t seq = first; seq <= dump->head; seq++)
+	{
+		const ALCLogRecord *r = &dump->records[(seq - 1) % dump->capacity];
+		if (r->sequence != seq)
+			continue;
+
+		const ALCLogFormat *f = r->format > 0 && r->format <= dump->formatCount ? &dump->formats[r->format - 1] : NULL;
+		if (f == NULL || f->format[0] == '\0')
+			snprintf(line, sizeof(line), "<unknown format %u>", r->format);
+		else
+			log_decode(line, sizeof(line), f->format, r);
+
+		printf("%llu.%06llu %10.*s: %s\n", (unsigned long long)(r->timestamp / 1000000000ULL),
+			   (unsigned long long)((r->timestamp / 1000ULL) % 1000000ULL), (int)sizeof(f->module), f ? f->module : "?", line);
+	}
+
+	if (dump->dropped > 0)
+		fprintf(stderr, "%llu records dropped without a free format slot\n", (unsigned long long)dump->dropped);
+
+	free(dump);
+	return 0;
+}
+
+/* compress a layout or platform plist and replace the one of the codec until reboot, or drop the replacement */
+static int upload_resource(unsigned dev, const char *kind, const char *path, uint32_t layout, bool reload)
+{
+	uint32_t type;
+	if (strcmp(kind, "layout") == 0)
+		type = kALCResourceLayout;
+	else if (strcmp(kind, "platform") == 0)
+		type = kALCResourcePlatform;
+	else
+	{
+		fprintf(stderr, "Unknown resource type %s, expected layout or platform.\n", kind);
+		return 1;
+	}
+
+	uint8_t *packed = NULL;
+	uLongf packedSize = 0;
+	long unpackedSize = 0;
+	if (path != NULL)
+	{
+		FILE *file = fopen(path, "rb");
+		if (file == NULL)
+		{
+			fprintf(stderr, "Failed to open %s.\n", path);
+			return 1;
+		}
+
+		uint8_t *text = NULL;
+		if (fseek(file, 0, SEEK_END) == 0 && (unpackedSize = ftell(file)) > 0 && unpackedSize <= kALCResourceMaxUnpackedSize &&
+			fseek(file, 0, SEEK_SET) == 0 && (text = malloc((size_t)unpackedSize)) != NULL &&
+			fread(text, 1, (size_t)unpackedSize, file) != (size_t)unpackedSize)
+		{
+			free(text);
+			text = NULL;
+		}
+		fclose(file);
+
+		if (text == NULL)
+		{
+			fprintf(stderr, "Failed to read %s, it must be 1 to %d bytes.\n", path, kALCResourceMaxUnpackedSize);
+			return 1;
+		}
+
+		/* AppleHDA loads zlib compressed resources, same as generated by ResourceConverter */
+		packedSize = compressBound((uLong)unpackedSize);
+		packed = malloc(packedSize);
+		int zr = packed != NULL ? compress2(packed, &packedSize, text, (uLong)unpackedSize, Z_BEST_COMPRESSION) : Z_MEM_ERROR;
+		free(text);
+		if (zr != Z_OK || packedSize > kALCResourceMaxSize)
+		{
+			fprintf(stderr, "Failed to compress %s to at most %d bytes.\n", path, kALCResourceMaxSize);
+			free(packed);
+			return 1;
+		}
+	}
+
+	io_connect_t dataPort = open_device(dev);
+	if (dataPort == 0)
+	{
+		free(packed);
+		return 1;
+	}
+
+	/* large inputs are passed as a single memory descriptor by IOKitLib */
+	uint64_t input[4] = { type, layout, (uint64_t)unpackedSize, (path == NULL ? kResourceFlagRemove : 0) | (reload ? kResourceFlagReload : 0) };
+	kern_return_t kr = IOConnectCallMethod(dataPort, kMethodUploadResource, input, 4, packed, packedSize, NULL, NULL, NULL, NULL);
+	IOServiceClose(dataPort);
+	free(packed);
+
+	if (kr != kIOReturnSuccess)
+	{
+		fprintf(stderr, "Failed to %s %s: %08x.\n", path != NULL ? "upload" : "remove", kind, kr);
+		return 1;
+	}
+
+	printf("%s %s (%ld bytes, %lu compressed)%s\n", path != NULL ? "Uploaded" : "Removed", kind, unpackedSize,
+		   (unsigned long)packedSize, reload ? ", AppleHDA reload queued" : "");
+	return 0;
+}
+
 static void usage(void)
 {
 	printf("alc-verb for AppleALC (based on alsa-tools hda-verb)\n");
 	printf("usage: alc-verb [option] nid verb param\n");
+	printf("       alc-verb [option] -a < verbs\n");
+	printf("       alc-verb [option] -t nid verb param [nid verb param ...]\n");
+	printf("       alc-verb [option] -w\n");
+	printf("       alc-verb [option] --dump > codec.txt\n");
+	printf("       alc-verb [option] --trace[=on|off|reset]\n");
+	printf("       alc-verb --timings\n");
+	printf("       alc-verb [option] --log[=reset]\n");
+	printf("       alc-verb [option] --patches\n");
+	printf("       alc-verb [option] --upload layout|platform [--layout-id id] [--reload] file.xml\n");
+	printf("       alc-verb [option] --remove layout|platform [--layout-id id] [--reload]\n");
+	printf("   -a        Execute \"[device] nid verb param\" lines from stdin asynchronously\n");
 	printf("   -d <int>  Specify device index\n");
+	printf("   --dump    Dump all codec widgets, amplifiers, pins and coefficients\n");
+	printf("   --trace[=on|off|reset]\n");
+	printf("             Print traced verbs and latency histograms, changing tracing state\n");
+	printf("   --timings Print AppleALC boot stage timings\n");
+	printf("   --log[=reset]\n");
+	printf("             Print the binary debug log of DEBUG builds booted with -alcbinlog\n");
+	printf("   --patches Print applied kext patches with match counts and cost\n");
+	printf("   --upload layout|platform\n");
+	printf("             Replace the layout or platform plist of the codec until reboot (root only)\n");
+	printf("   --remove layout|platform\n");
+	printf("             Drop the replacement and use the built-in resource again (root only)\n");
+	printf("   --layout-id <int>\n");
+	printf("             Replace the resource of this layout id instead of the current one\n");
+	printf("   --reload  Restart AppleHDA of the codec to apply the change immediately\n");
 	printf("   -l        List known verbs and parameters\n");
+	printf("   -n        Do not retry SET_STREAM_FORMAT until the codec accepts it\n");
 	printf("   -q        Only print errors when executing verbs\n");
+	printf("   -t        Execute all verbs atomically with no other verbs in between\n");
+	printf("   -w        Watch jack sense and GPIO events\n");
 	printf("   -L        List known verbs and parameters (one per line)\n");
 }
 
@@ -274,12 +1133,72 @@ int main(int argc, char **argv)
 	int c;
 	char **p;
 	bool quiet = false;
+	bool async = false;
+	bool transaction = false;
+	bool watch = false;
+	bool dump = false;
+	bool trace = false;
+	bool patches = false;
+	const char *traceMode = NULL;
+	bool log = false;
+	const char *logMode = NULL;
+	const char *upload = NULL;
+	const char *removal = NULL;
+	uint32_t layout = 0;
+	bool reload = false;
+	bool wait = true;
+	unsigned retries = 0;
 	int dev = 0;
 	
-	while ((c = getopt(argc, argv, "d:qlL")) >= 0)
+	static const struct option longOptions[] =
+	{
+		{ "dump", no_argument, NULL, 'D' },
+		{ "trace", optional_argument, NULL, 'T' },
+		{ "timings", no_argument, NULL, 'B' },
+		{ "log", optional_argument, NULL, 'G' },
+		{ "patches", no_argument, NULL, 'P' },
+		{ "upload", required_argument, NULL, 'U' },
+		{ "remove", required_argument, NULL, 'R' },
+		{ "layout-id", required_argument, NULL, 'I' },
+		{ "reload", no_argument, NULL, 'O' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "ad:nqtwlL", longOptions, NULL)) >= 0)
 	{
 		switch (c)
 		{
+			case 'D':
+				dump = true;
+				break;
+			case 'T':
+				trace = true;
+				traceMode = optarg;
+				break;
+			case 'B':
+				return print_timings();
+			case 'G':
+				log = true;
+				logMode = optarg;
+				break;
+			case 'P':
+				patches = true;
+				break;
+			case 'U':
+				upload = optarg;
+				break;
+			case 'R':
+				removal = optarg;
+				break;
+			case 'I':
+				layout = (uint32_t)strtoul(optarg, NULL, 0);
+				break;
+			case 'O':
+				reload = true;
+				break;
+			case 'a':
+				async = true;
+				break;
 			case 'd':
 				dev = (unsigned)atoi(optarg);
 				break;
@@ -289,76 +1208,84 @@ int main(int argc, char **argv)
 			case 'L':
 				list_verbs(1);
 				return 0;
+			case 'n':
+				wait = false;
+				break;
 			case 'q':
 				quiet = true;
 				break;
+			case 't':
+				transaction = true;
+				break;
+			case 'w':
+				watch = true;
+				break;
 			default:
 				usage();
 				return 1;
 		}
 	}
 	
-	if (argc - optind < 3)
-	{
-		usage();
-		return 1;
-	}
-	
-	p = argv + optind;
-	nid = strtol(*p, NULL, 0);
-	if (nid < 0 || nid > 0xff) {
-		fprintf(stderr, "invalid nid %s\n", *p);
-		return 1;
-	}
-	
-	p++;
-	if (!isdigit(**p))
-	{
-		strtoupper(*p);
-		verb = lookup_str(hda_verbs, *p);
-		
-		if (verb < 0)
-			return 1;
-	}
-	else
+	if (dump)
+		return dump_codec(dev, quiet);
+
+	if (trace)
+		return read_trace(dev, traceMode, quiet);
+
+	if (patches)
+		return print_patches(dev);
+
+	if (log)
+		return read_log(dev, logMode);
+
+	if (upload)
 	{
-		verb = strtol(*p, NULL, 0);
-		
-		if (verb < 0 || verb > 0xfff)
+		if (argc - optind < 1)
 		{
-			fprintf(stderr, "invalid verb %s\n", *p);
+			usage();
 			return 1;
 		}
+		return upload_resource(dev, upload, argv[optind], layout, reload);
 	}
+
+	if (removal)
+		return upload_resource(dev, removal, NULL, layout, reload);
+
+	if (watch)
+		return watch_events(dev);
+
+	if (async)
+		return execute_async(dev, wait, quiet);
+
+	if (transaction)
+		return execute_transaction(dev, argv + optind, argc - optind, wait, quiet);
 	
-	p++;
-	if (!isdigit(**p))
-	{
-		strtoupper(*p);
-		params = lookup_str(hda_params, *p);
-		if (params < 0)
-			return 1;
-	}
-	else
+	if (argc - optind < 3)
 	{
-		params = strtol(*p, NULL, 0);
-		
-		if (params < 0 || params > 0xffff)
-		{
-			fprintf(stderr, "invalid param %s\n", *p);
-			return 1;
-		}
+		usage();
+		return 1;
 	}
+	
+	p = argv + optind;
+	nid = parse_nid(p[0]);
+	verb = parse_verb(p[1]);
+	params = parse_param(p[2]);
+
+	if (nid < 0 || verb < 0 || params < 0)
+		return 1;
 
 	if (!quiet)
 		printf("nid = 0x%lx, verb = 0x%lx, param = 0x%lx\n", nid, verb, params);
 	
 	// Execute command
-	uint32_t result = execute_command(dev, nid, verb, params);
+	uint32_t result = execute_command(dev, nid, verb, params, wait, &retries);
 
 	// Print result
 	printf("0x%08x\n", result);
 
+	if (!quiet && retries > 0)
+		printf("retries = %u\n", retries);
+
 	return 0;
 }
 